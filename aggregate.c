@@ -0,0 +1,520 @@
+/** @file aggregate.c
+ * @brief Summarizes matches instead of printing them, for --count, --du, and --extensions.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "aggregate.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The key for files without an extension in the --extensions histogram. */
+#define NO_EXTENSION "(none)"
+
+struct agg_slot{
+	char* key;         /* NULL if the slot is empty */
+	size_t len;
+	uint64_t hash;
+	uint64_t a;        /* bytes for --du, files for --extensions */
+	uint64_t b;        /* bytes for --extensions */
+	size_t parent_len; /* for --du, the length of the parent directory's key */
+	int level;         /* for --du, the number of components below the base directory */
+};
+
+/* FNV-1a, which is plenty for directory names and extensions. */
+static uint64_t hash_key(const char* key, size_t len){
+	uint64_t h = UINT64_C(0xCBF29CE484222325);
+
+	for (size_t i = 0; i < len; ++i){
+		h ^= (unsigned char)key[i];
+		h *= UINT64_C(0x100000001B3);
+	}
+	return h;
+}
+
+static struct agg_slot* map_probe(struct agg_slot* slots, size_t cap, const char* key, size_t len, uint64_t hash){
+	size_t i = hash & (cap - 1);
+
+	while (slots[i].key && (slots[i].hash != hash || slots[i].len != len || memcmp(slots[i].key, key, len) != 0)){
+		i = (i + 1) & (cap - 1);
+	}
+	return &(slots[i]);
+}
+
+/* Doubles a map's capacity, keeping it at most 3/4 full.
+ * Returns 0 on success, negative on failure. */
+static int map_grow(struct agg_map* m){
+	size_t cap = m->cap ? m->cap * 2 : 64;
+	struct agg_slot* slots = calloc(cap, sizeof(*slots));
+
+	if (!slots){
+		log_enomem();
+		return -1;
+	}
+	for (size_t i = 0; i < m->cap; ++i){
+		if (m->slots[i].key){
+			*map_probe(slots, cap, m->slots[i].key, m->slots[i].len, m->slots[i].hash) = m->slots[i];
+		}
+	}
+	free(m->slots);
+	m->slots = slots;
+	m->cap = cap;
+	return 0;
+}
+
+/* Finds the totals for a key, creating them if needed.
+ * Sets *created if they were just created.
+ * Returns NULL on failure. The slot stays valid until the next key is added. */
+static struct agg_slot* map_get(struct agg_map* m, const char* key, size_t len, int* created){
+	uint64_t hash = hash_key(key, len);
+	struct agg_slot* slot;
+
+	*created = 0;
+	if ((m->len + 1) * 4 > m->cap * 3 && map_grow(m) != 0){
+		return NULL;
+	}
+	slot = map_probe(m->slots, m->cap, key, len, hash);
+	if (!slot->key){
+		slot->key = malloc(len + 1);
+		if (!slot->key){
+			log_enomem();
+			return NULL;
+		}
+		memcpy(slot->key, key, len);
+		slot->key[len] = '\0';
+		slot->len = len;
+		slot->hash = hash;
+		slot->a = 0;
+		slot->b = 0;
+		slot->parent_len = 0;
+		slot->level = 0;
+		m->len++;
+		*created = 1;
+	}
+	return slot;
+}
+
+/* Adds to the totals for a key, creating them if needed.
+ * Returns 0 on success, negative on failure. */
+static int map_add(struct agg_map* m, const char* key, size_t len, uint64_t a, uint64_t b){
+	int created;
+	struct agg_slot* slot = map_get(m, key, len, &created);
+
+	if (!slot){
+		return -1;
+	}
+	slot->a += a;
+	slot->b += b;
+	return 0;
+}
+
+static void map_free(struct agg_map* m){
+	for (size_t i = 0; i < m->cap; ++i){
+		free(m->slots[i].key);
+	}
+	free(m->slots);
+	m->slots = NULL;
+	m->cap = 0;
+	m->len = 0;
+}
+
+void agg_init(struct agg* a, unsigned modes, int du_depth){
+	a->modes = modes;
+	a->du_depth = du_depth;
+	a->sets = NULL;
+	pthread_mutex_init(&(a->mutex), NULL);
+}
+
+struct agg_set* agg_set_new(struct agg* a){
+	struct agg_set* set = calloc(1, sizeof(*set));
+
+	if (!set){
+		log_enomem();
+		return NULL;
+	}
+	pthread_mutex_lock(&(a->mutex));
+	set->next = a->sets;
+	a->sets = set;
+	pthread_mutex_unlock(&(a->mutex));
+	return set;
+}
+
+/* Finds the end of the directory containing the path that ends at end, which is base_len for a child of the base directory. */
+static size_t parent_end(const char* path, size_t base_len, size_t end){
+	while (end > base_len && path[end - 1] != '/'){
+		end--;
+	}
+	while (end > base_len && path[end - 1] == '/'){
+		end--;
+	}
+	return end;
+}
+
+/* Adds bytes to the directory at the first key_len bytes of path, which is level components below the base directory.
+ * Only that directory's own total is updated. Each directory is added to its parent's total by du_rollup(), so the cost of an entry does not grow with its depth.
+ * Every directory between it and the base directory is created the first time it is seen, so du_rollup() never has to add any. */
+static int du_add_at(struct agg_map* m, const char* path, size_t base_len, size_t key_len, int level, uint64_t bytes){
+	struct agg_slot* slot;
+	int created;
+
+	slot = map_get(m, path, key_len, &created);
+	if (!slot){
+		return -1;
+	}
+	slot->a += bytes;
+
+	while (created && level > 0){
+		slot->level = level;
+		slot->parent_len = parent_end(path, base_len, key_len);
+		key_len = slot->parent_len;
+		level--;
+		slot = map_get(m, path, key_len, &created);
+		if (!slot){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Adds an entry's disk usage to its directory, or to its ancestor du_depth levels below the base directory if it is deeper than that.
+ * A directory's own blocks count toward itself, like du(1). */
+static int du_add(struct agg_map* m, int du_depth, const char* path, size_t path_len, size_t base_len, int is_dir, int depth, uint64_t bytes){
+	int level = is_dir ? depth : depth - 1;
+	size_t end;
+
+	if (du_depth >= 0 && level > du_depth){
+		/* deep entries are rare with a small --du=DEPTH, so finding the cut-off from the front is cheap enough */
+		end = base_len;
+		for (int k = 0; k < du_depth; ++k){
+			while (end < path_len && path[end] == '/'){
+				end++;
+			}
+			while (end < path_len && path[end] != '/'){
+				end++;
+			}
+		}
+		level = du_depth;
+	}
+	else{
+		end = is_dir ? path_len : parent_end(path, base_len, path_len);
+	}
+	return du_add_at(m, path, base_len, end, level, bytes);
+}
+
+static int level_cmp(const void* a, const void* b){
+	const struct agg_slot* s1 = *(struct agg_slot* const*)a;
+	const struct agg_slot* s2 = *(struct agg_slot* const*)b;
+
+	return s1->level > s2->level ? -1 : s1->level < s2->level;
+}
+
+/* Adds each directory's total to its parent's, deepest first, so every directory ends up with the total of everything under it.
+ * This only happens once the threads' totals are merged, which is why it does not matter in which order the subtrees were finished. */
+static int du_rollup(struct agg_map* m){
+	struct agg_slot** sorted = malloc((m->len ? m->len : 1) * sizeof(*sorted));
+	size_t n = 0;
+
+	if (!sorted){
+		log_enomem();
+		return -1;
+	}
+	for (size_t i = 0; i < m->cap; ++i){
+		if (m->slots[i].key){
+			sorted[n++] = &(m->slots[i]);
+		}
+	}
+	qsort(sorted, n, sizeof(*sorted), level_cmp);
+
+	for (size_t i = 0; i < n && sorted[i]->level > 0; ++i){
+		struct agg_slot* parent = map_probe(m->slots, m->cap, sorted[i]->key, sorted[i]->parent_len, hash_key(sorted[i]->key, sorted[i]->parent_len));
+		parent->a += sorted[i]->a;
+	}
+	free(sorted);
+	return 0;
+}
+
+/* Finds the extension of the last component of a path, including its '.'.
+ * A leading '.' marks a hidden file, not an extension. */
+static const char* find_extension(const char* path, size_t path_len, size_t* len){
+	const char* name = path + path_len;
+	const char* dot = NULL;
+
+	while (name > path && name[-1] != '/'){
+		name--;
+		if (*name == '.' && !dot){
+			dot = name;
+		}
+	}
+	if (!dot || dot == name || dot + 1 == path + path_len){
+		*len = strlen(NO_EXTENSION);
+		return NO_EXTENSION;
+	}
+	*len = path + path_len - dot;
+	return dot;
+}
+
+int agg_add(const struct agg* a, struct agg_set* set, const char* path, size_t path_len, size_t base_len, const struct stat* st, int depth){
+	set->count++;
+
+	if (a->modes & AGG_DU){
+		uint64_t bytes = (uint64_t)st->st_blocks * 512;
+
+		if (!S_ISDIR(st->st_mode) && st->st_nlink > 1){
+			struct agg_link* l;
+
+			if (set->links_len >= set->links_cap){
+				size_t cap = set->links_cap ? set->links_cap * 2 : 64;
+				void* tmp = realloc(set->links, cap * sizeof(*(set->links)));
+				if (!tmp){
+					log_enomem();
+					return -1;
+				}
+				set->links = tmp;
+				set->links_cap = cap;
+			}
+			l = &(set->links[set->links_len]);
+			l->path = malloc(path_len + 1);
+			if (!l->path){
+				log_enomem();
+				return -1;
+			}
+			memcpy(l->path, path, path_len + 1);
+			l->path_len = path_len;
+			l->base_len = base_len;
+			l->depth = depth;
+			l->dev = st->st_dev;
+			l->ino = st->st_ino;
+			l->bytes = bytes;
+			set->links_len++;
+		}
+		else if (du_add(&(set->du), a->du_depth, path, path_len, base_len, S_ISDIR(st->st_mode), depth, bytes) != 0){
+			return -1;
+		}
+	}
+
+	if ((a->modes & AGG_EXTENSIONS) && !S_ISDIR(st->st_mode)){
+		size_t ext_len;
+		const char* ext = find_extension(path, path_len, &ext_len);
+
+		if (map_add(&(set->ext), ext, ext_len, 1, st->st_size) != 0){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int agg_add_base(const struct agg* a, struct agg_set* set, const char* path, const struct stat* st){
+	size_t len = strlen(path);
+
+	if (!(a->modes & AGG_DU)){
+		return 0;
+	}
+	return du_add_at(&(set->du), path, len, len, 0, (uint64_t)st->st_blocks * 512);
+}
+
+static int link_cmp(const void* a, const void* b){
+	const struct agg_link* l1 = a;
+	const struct agg_link* l2 = b;
+
+	if (l1->dev != l2->dev){
+		return l1->dev < l2->dev ? -1 : 1;
+	}
+	if (l1->ino != l2->ino){
+		return l1->ino < l2->ino ? -1 : 1;
+	}
+	return strcmp(l1->path, l2->path);
+}
+
+/* Orders directories the way du(1) prints them, with each directory after everything inside it. */
+static int du_cmp(const void* a, const void* b){
+	const struct agg_slot* s1 = *(struct agg_slot* const*)a;
+	const struct agg_slot* s2 = *(struct agg_slot* const*)b;
+	size_t len = s1->len < s2->len ? s1->len : s2->len;
+	size_t i = 0;
+
+	while (i < len && s1->key[i] == s2->key[i]){
+		i++;
+	}
+	if (i == len){
+		/* one is a prefix of the other, and it is a parent if the other continues with a new component */
+		if (s1->len == s2->len){
+			return 0;
+		}
+		if (i == s1->len){
+			return s2->key[i] == '/' || (i > 0 && s1->key[i - 1] == '/') ? 1 : -1;
+		}
+		return s1->key[i] == '/' || (i > 0 && s2->key[i - 1] == '/') ? -1 : 1;
+	}
+	/* siblings sort by name, so '/' comes before anything else */
+	if (s1->key[i] == '/'){
+		return -1;
+	}
+	if (s2->key[i] == '/'){
+		return 1;
+	}
+	return (unsigned char)s1->key[i] < (unsigned char)s2->key[i] ? -1 : 1;
+}
+
+static int ext_cmp(const void* a, const void* b){
+	const struct agg_slot* s1 = *(struct agg_slot* const*)a;
+	const struct agg_slot* s2 = *(struct agg_slot* const*)b;
+
+	if (s1->a != s2->a){
+		return s1->a > s2->a ? -1 : 1;
+	}
+	if (s1->b != s2->b){
+		return s1->b > s2->b ? -1 : 1;
+	}
+	return strcmp(s1->key, s2->key);
+}
+
+/* Merges every thread's map of one kind into a single map. */
+static int merge_maps(struct agg* a, struct agg_map* out, size_t map_off){
+	for (struct agg_set* set = a->sets; set; set = set->next){
+		struct agg_map* m = (struct agg_map*)((char*)set + map_off);
+
+		for (size_t i = 0; i < m->cap; ++i){
+			struct agg_slot* slot;
+			int created;
+
+			if (!m->slots[i].key){
+				continue;
+			}
+			slot = map_get(out, m->slots[i].key, m->slots[i].len, &created);
+			if (!slot){
+				return -1;
+			}
+			slot->a += m->slots[i].a;
+			slot->b += m->slots[i].b;
+			slot->parent_len = m->slots[i].parent_len;
+			slot->level = m->slots[i].level;
+		}
+	}
+	return 0;
+}
+
+/* Prints every key in a map in the given order, with one or both of its totals. */
+static int print_map(const struct agg_map* m, int (*cmp)(const void*, const void*), int both, char sep){
+	const struct agg_slot** sorted = malloc((m->len ? m->len : 1) * sizeof(*sorted));
+	size_t n = 0;
+
+	if (!sorted){
+		log_enomem();
+		return -1;
+	}
+	for (size_t i = 0; i < m->cap; ++i){
+		if (m->slots[i].key){
+			sorted[n++] = &(m->slots[i]);
+		}
+	}
+	qsort(sorted, n, sizeof(*sorted), cmp);
+
+	for (size_t i = 0; i < n; ++i){
+		if (both){
+			printf("%llu\t%llu\t%s%c", (unsigned long long)sorted[i]->a, (unsigned long long)sorted[i]->b, sorted[i]->key, sep);
+		}
+		else{
+			/* du(1) rounds up to whole KiB */
+			printf("%llu\t%s%c", (unsigned long long)((sorted[i]->a + 1023) / 1024), sorted[i]->key, sep);
+		}
+	}
+	free(sorted);
+	return 0;
+}
+
+/* Counts each file with several hard links once, under the name that sorts first. */
+static int du_add_links(struct agg* a, struct agg_map* du){
+	struct agg_link* all;
+	size_t total = 0;
+	size_t n = 0;
+	int ret = 0;
+
+	for (struct agg_set* set = a->sets; set; set = set->next){
+		total += set->links_len;
+	}
+	if (total == 0){
+		return 0;
+	}
+
+	all = malloc(total * sizeof(*all));
+	if (!all){
+		log_enomem();
+		return -1;
+	}
+	for (struct agg_set* set = a->sets; set; set = set->next){
+		if (set->links_len){
+			memcpy(all + n, set->links, set->links_len * sizeof(*all));
+			n += set->links_len;
+		}
+	}
+	qsort(all, total, sizeof(*all), link_cmp);
+
+	for (size_t i = 0; i < total; ++i){
+		if (i > 0 && all[i].dev == all[i - 1].dev && all[i].ino == all[i - 1].ino){
+			continue;
+		}
+		if (du_add(du, a->du_depth, all[i].path, all[i].path_len, all[i].base_len, 0, all[i].depth, all[i].bytes) != 0){
+			ret = -1;
+			break;
+		}
+	}
+	free(all);
+	return ret;
+}
+
+int agg_print(struct agg* a, char sep){
+	struct agg_map merged = { NULL, 0, 0 };
+	uint64_t count = 0;
+	int ret = 0;
+
+	if (a->modes & AGG_DU){
+		if (merge_maps(a, &merged, offsetof(struct agg_set, du)) != 0 ||
+				du_add_links(a, &merged) != 0 ||
+				du_rollup(&merged) != 0 ||
+				print_map(&merged, du_cmp, 0, sep) != 0){
+			ret = -1;
+			goto cleanup;
+		}
+		map_free(&merged);
+	}
+
+	if (a->modes & AGG_EXTENSIONS){
+		if (merge_maps(a, &merged, offsetof(struct agg_set, ext)) != 0 ||
+				print_map(&merged, ext_cmp, 1, sep) != 0){
+			ret = -1;
+			goto cleanup;
+		}
+		map_free(&merged);
+	}
+
+	if (a->modes & AGG_COUNT){
+		for (struct agg_set* set = a->sets; set; set = set->next){
+			count += set->count;
+		}
+		printf("%llu%c", (unsigned long long)count, sep);
+	}
+
+cleanup:
+	map_free(&merged);
+	return ret;
+}
+
+void agg_free(struct agg* a){
+	while (a->sets){
+		struct agg_set* next = a->sets->next;
+
+		map_free(&(a->sets->du));
+		map_free(&(a->sets->ext));
+		for (size_t i = 0; i < a->sets->links_len; ++i){
+			free(a->sets->links[i].path);
+		}
+		free(a->sets->links);
+		free(a->sets);
+		a->sets = next;
+	}
+	pthread_mutex_destroy(&(a->mutex));
+}
@@ -0,0 +1,162 @@
+/** @file aggregate.h
+ * @brief Summarizes matches instead of printing them, for --count, --du, and --extensions.<br>
+ * Each thread adds its matches to its own accumulators, and the accumulators are merged once every search is finished.
+ * Totals are plain sums, so they come out the same no matter which thread finished which subtree first.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __AGGREGATE_H
+#define __AGGREGATE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/**
+ * @brief Count the matches.
+ */
+#define AGG_COUNT      (1 << 0)
+/**
+ * @brief Total the disk usage of the matches under each directory.
+ */
+#define AGG_DU         (1 << 1)
+/**
+ * @brief Count the matches and their sizes by file extension.
+ */
+#define AGG_EXTENSIONS (1 << 2)
+
+/**
+ * @brief A hash table from strings to a pair of totals.
+ */
+struct agg_map{
+	struct agg_slot* slots; /**< The table, with open addressing. */
+	size_t cap;             /**< The number of slots. This is 0 or a power of 2. */
+	size_t len;             /**< The number of slots in use. */
+};
+
+/**
+ * @brief A match that is one of several hard links to its file.<br>
+ * du(1) counts a file's blocks once no matter how many names it has, so these are set aside and counted once every thread is done.
+ */
+struct agg_link{
+	char* path;      /**< A copy of the match's path. */
+	size_t path_len; /**< strlen(path) */
+	size_t base_len; /**< The length of the base directory at the front of path. */
+	int depth;       /**< The match's depth. */
+	dev_t dev;       /**< The device the file is on. */
+	ino_t ino;       /**< The file's inode. */
+	uint64_t bytes;  /**< The disk space the file uses. */
+};
+
+/**
+ * @brief One thread's accumulators.
+ */
+struct agg_set{
+	uint64_t count;           /**< The number of matches. */
+	struct agg_map du;        /**< Directory path -> bytes used under it. */
+	struct agg_map ext;       /**< Extension -> number of files and their total size. */
+	struct agg_link* links;   /**< Hard links set aside for --du. */
+	size_t links_len;         /**< The number of links. */
+	size_t links_cap;         /**< The allocated size of links. */
+	struct agg_set* next;     /**< The next set of the same agg structure. */
+};
+
+/**
+ * @brief Everything needed to summarize the matches from a set of searches.
+ */
+struct agg{
+	unsigned modes;          /**< A combination of AGG_COUNT, AGG_DU, and AGG_EXTENSIONS. */
+	int du_depth;            /**< The deepest directories --du reports, relative to the base directory, or -1 for all of them. */
+	struct agg_set* sets;    /**< Every thread's set. */
+	pthread_mutex_t mutex;   /**< Protects sets. */
+};
+
+/**
+ * @brief Initializes an agg structure.
+ *
+ * @param a The structure to initialize.<br>
+ * This must be freed with agg_free() when no longer in use.
+ * @see agg_free()
+ *
+ * @param modes A combination of AGG_COUNT, AGG_DU, and AGG_EXTENSIONS.
+ *
+ * @param du_depth The deepest directories --du reports, or -1 for all of them.
+ */
+void agg_init(struct agg* a, unsigned modes, int du_depth);
+
+/**
+ * @brief Creates a set for a thread to add matches to.<br>
+ * This function is thread-safe.
+ *
+ * @param a The agg structure the set belongs to.
+ *
+ * @return A new set, or NULL if memory could not be allocated.<br>
+ * The set is freed with the agg structure.
+ */
+struct agg_set* agg_set_new(struct agg* a);
+
+/**
+ * @brief Adds a match to a thread's accumulators.
+ *
+ * @param a The agg structure.
+ *
+ * @param set The calling thread's set.
+ *
+ * @param path The match's path.
+ *
+ * @param path_len strlen(path)
+ *
+ * @param base_len The length of the base directory at the front of path.
+ *
+ * @param st The match's metadata.
+ *
+ * @param depth The match's depth. Entries directly inside the base directory have a depth of 1.
+ *
+ * @return 0 on success, negative if memory could not be allocated.
+ */
+int agg_add(const struct agg* a, struct agg_set* set, const char* path, size_t path_len, size_t base_len, const struct stat* st, int depth);
+
+/**
+ * @brief Adds a base directory's own disk usage for --du.<br>
+ * Searches do not return their base directory as a match, so it is added separately when it would have matched.
+ *
+ * @param a The agg structure.
+ *
+ * @param set The calling thread's set.
+ *
+ * @param path The base directory.
+ *
+ * @param st The base directory's metadata.
+ *
+ * @return 0 on success, negative if memory could not be allocated.
+ */
+int agg_add_base(const struct agg* a, struct agg_set* set, const char* path, const struct stat* st);
+
+/**
+ * @brief Merges every thread's accumulators and prints the summary to stdout.<br>
+ * --du prints the KiB used under each directory, with subdirectories before their parents like du(1).<br>
+ * --extensions prints the number of files and bytes for each extension, most common first.<br>
+ * --count prints the number of matches.
+ *
+ * @param a The agg structure.<br>
+ * No more matches can be added once this is called.
+ *
+ * @param sep The character that ends each line.
+ *
+ * @return 0 on success, negative if memory could not be allocated.
+ */
+int agg_print(struct agg* a, char sep);
+
+/**
+ * @brief Releases the memory held by an agg structure.
+ *
+ * @param a The agg structure.
+ */
+void agg_free(struct agg* a);
+
+#endif
@@ -59,6 +59,17 @@
  */
 #define FF_PURE __attribute__((const))
 
+/**
+ * @brief Tells the compiler that a condition is almost always false, so the code it guards is moved out of the hot path.
+ *
+ * @param x The condition.
+ */
+#ifdef __GNUC__
+#define FF_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define FF_UNLIKELY(x) (x)
+#endif
+
 /**
  * @brief A function marked with this attribute is potentially unused.<br>
  * An "unused function" warning will not be generated for this function.
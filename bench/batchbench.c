@@ -0,0 +1,228 @@
+/** @file batchbench.c
+ * @brief Compares matching the names of large directories one at a time with match() against matching them together with match_batch().
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "match.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+/* A pattern to run, with the text it is compiled from. */
+struct bench_pattern{
+	enum pattern_type type;
+	const char* type_name;
+	const char* text;
+	unsigned flags;
+};
+
+/* Patterns ffind is commonly run with. The last ones have no filter, so they show what batching costs when it cannot help. */
+static const struct bench_pattern patterns[] = {
+	{ TYPE_FNMATCH,          "fnmatch",         "*.c",                   PFLAG_NORMAL },
+	{ TYPE_FNMATCH,          "fnmatch",         "*test*",                PFLAG_NORMAL },
+	{ TYPE_FNMATCH,          "fnmatch",         "*_test*.[ch]",          PFLAG_NORMAL },
+	{ TYPE_FNMATCH,          "fnmatch",         "*/src/*.json",          PFLAG_NORMAL },
+	{ TYPE_FNMATCH_LITERAL,  "literal",         "parser",                PFLAG_NORMAL },
+	{ TYPE_REGEX_POSIX,      "posix-basic",     "\\.c$",                 PFLAG_NORMAL },
+	{ TYPE_REGEX_POSIX,      "posix-basic",     "util[0-9]*\\.h$",       PFLAG_NORMAL },
+	{ TYPE_REGEX_POSIX_EX,   "posix-extended",  "string_test[0-9]+\\.c$", PFLAG_NORMAL },
+	{ TYPE_REGEX_POSIX_EX,   "posix-extended",  "\\.(c|h)$",             PFLAG_NORMAL },
+	{ TYPE_REGEX_POSIX_EX,   "posix-extended",  "readme",                PFLAG_ICASE },
+};
+
+/* Pieces for generated names, roughly in the proportions of a source tree. */
+static const char* const file_names[] = { "main", "util", "parser", "test_io", "README", "Makefile", "index", "config", "string_test", "hash", "server", "client" };
+static const char* const extensions[] = { ".c", ".h", ".cpp", ".py", ".js", ".json", ".md", ".txt", ".o", ".png", "" };
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof(*(a)))
+
+/* xorshift64 with a fixed seed, so every run generates the same directories. */
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t rng_next(void){
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+static uint64_t now_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* A directory's names, packed the way ffind reads them. */
+struct bench_dir{
+	const char* path;
+	char* names;
+	size_t* offs;
+	size_t len;
+};
+
+static int dir_generate(struct bench_dir* d, const char* path, size_t n){
+	size_t cap = n * 32;
+	size_t len = 0;
+
+	d->path = path;
+	d->len = n;
+	d->names = malloc(cap);
+	d->offs = malloc((n + 1) * sizeof(*(d->offs)));
+	if (!d->names || !d->offs){
+		return -1;
+	}
+	for (size_t i = 0; i < n; ++i){
+		d->offs[i] = len;
+		len += sprintf(d->names + len, "%s%u%s",
+				file_names[rng_next() % ARRAY_LEN(file_names)],
+				(unsigned)(i % 100000),
+				extensions[rng_next() % ARRAY_LEN(extensions)]) + 1;
+	}
+	d->offs[n] = len;
+	return 0;
+}
+
+/* Matches every name in a directory one at a time, building each path like ffind does. */
+static size_t run_single(const struct bench_dir* d, const struct pattern* pat, char* path, size_t dir_len, unsigned char* hits){
+	size_t n_hits = 0;
+
+	for (size_t i = 0; i < d->len; ++i){
+		memcpy(path + dir_len, d->names + d->offs[i], d->offs[i + 1] - d->offs[i]);
+		hits[i] = match(path, pat) == 1;
+		n_hits += hits[i];
+	}
+	return n_hits;
+}
+
+/* Matches a directory MATCH_BATCH_MAX names at a time. */
+static size_t run_batch(const struct bench_dir* d, const struct pattern* pat, char* path, size_t dir_len, unsigned char* hits){
+	size_t n_hits = 0;
+
+	for (size_t i = 0; i < d->len; i += MATCH_BATCH_MAX){
+		size_t n = d->len - i < MATCH_BATCH_MAX ? d->len - i : MATCH_BATCH_MAX;
+		n_hits += match_batch(pat, path, dir_len, d->names, d->offs + i, n, hits + i);
+	}
+	return n_hits;
+}
+
+/* Runs one way of matching passes times, keeping the fastest.
+ * Returns the time per name in nanoseconds. */
+static double time_run(size_t (*run)(const struct bench_dir*, const struct pattern*, char*, size_t, unsigned char*),
+		const struct bench_dir* d, const struct pattern* pat, char* path, size_t dir_len, unsigned char* hits, size_t passes, size_t* n_hits){
+	uint64_t best = UINT64_MAX;
+
+	for (size_t p = 0; p < passes; ++p){
+		uint64_t start = now_ns();
+		uint64_t ns;
+
+		*n_hits = run(d, pat, path, dir_len, hits);
+		ns = now_ns() - start;
+		if (ns < best){
+			best = ns;
+		}
+	}
+	return (double)best / d->len;
+}
+
+static void usage(const char* prog){
+	fprintf(stderr, "Usage: %s [-n NAMES] [-r REPEATS]\n", prog);
+	fprintf(stderr, "\t-n NAMES: The number of names in each directory (default 20000).\n");
+	fprintf(stderr, "\t-r REPEATS: Timed runs for each pattern, of which the fastest is kept (default 15).\n");
+}
+
+/* Prints one CSV row per pattern and directory:
+ *   type,pattern,icase,filtered,dir,names,hits,ns_per_name_single,ns_per_name_batch,speedup
+ * filtered is whether match_batch() could work out a filter for the pattern. */
+int main(int argc, char** argv){
+	/* a short path and a long one, since the full matchers read the whole path */
+	static const char* const dir_paths[] = { "./src/", "/home/user/projects/ffind/build/generated/objects/cache/" };
+	struct bench_dir dirs[ARRAY_LEN(dir_paths)];
+	size_t n_names = 20000;
+	size_t repeats = 15;
+	unsigned char* single_hits = NULL;
+	unsigned char* batch_hits = NULL;
+	char* path = NULL;
+	int opt;
+	int ret = 0;
+
+	while ((opt = getopt(argc, argv, "n:r:h")) != -1){
+		switch (opt){
+		case 'n':
+			n_names = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			repeats = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (n_names == 0 || repeats == 0){
+		usage(argv[0]);
+		return 1;
+	}
+
+	memset(dirs, 0, sizeof(dirs));
+	single_hits = malloc(n_names);
+	batch_hits = malloc(n_names);
+	path = malloc(4096);
+	for (size_t i = 0; i < ARRAY_LEN(dirs) && ret == 0; ++i){
+		ret = dir_generate(&(dirs[i]), dir_paths[i], n_names) != 0;
+	}
+	if (!single_hits || !batch_hits || !path || ret != 0){
+		fprintf(stderr, "batchbench: out of memory\n");
+		ret = 1;
+		goto cleanup;
+	}
+
+	printf("type,pattern,icase,filtered,dir,names,hits,ns_per_name_single,ns_per_name_batch,speedup\n");
+	for (size_t p = 0; p < ARRAY_LEN(patterns); ++p){
+		struct pattern pat;
+
+		pat.p_type = patterns[p].type;
+		if (pat_init(patterns[p].text, &pat, patterns[p].flags) != 0){
+			ret = 1;
+			continue;
+		}
+
+		for (size_t i = 0; i < ARRAY_LEN(dirs); ++i){
+			size_t dir_len = strlen(dirs[i].path);
+			size_t single_n;
+			size_t batch_n;
+			double single_ns;
+			double batch_ns;
+
+			memcpy(path, dirs[i].path, dir_len);
+			single_ns = time_run(run_single, &(dirs[i]), &pat, path, dir_len, single_hits, repeats, &single_n);
+			batch_ns = time_run(run_batch, &(dirs[i]), &pat, path, dir_len, batch_hits, repeats, &batch_n);
+
+			/* a faster answer is no good if it is a different one */
+			if (single_n != batch_n || memcmp(single_hits, batch_hits, n_names) != 0){
+				fprintf(stderr, "batchbench: match_batch() disagrees with match() for \"%s\" in %s\n", patterns[p].text, dirs[i].path);
+				ret = 1;
+			}
+
+			printf("%s,\"%s\",%d,%d,\"%s\",%zu,%zu,%.2f,%.2f,%.2f\n",
+					patterns[p].type_name, patterns[p].text, (patterns[p].flags & PFLAG_ICASE) != 0, pat_has_filter(&pat) != 0,
+					dirs[i].path, n_names, single_n, single_ns, batch_ns, batch_ns > 0 ? single_ns / batch_ns : 0.0);
+		}
+		pat_free(&pat);
+	}
+
+cleanup:
+	for (size_t i = 0; i < ARRAY_LEN(dirs); ++i){
+		free(dirs[i].names);
+		free(dirs[i].offs);
+	}
+	free(path);
+	free(batch_hits);
+	free(single_hits);
+	return ret;
+}
@@ -0,0 +1,111 @@
+#!/bin/sh
+# Copyright (c) 2018 Jonathan Lemos
+#
+# This software may be modified and distributed under the terms
+# of the MIT license.  See the LICENSE file for details.
+#
+# End-to-end benchmark of ffind against find(1).
+#
+# Usage: bench/bench.sh [path/to/ffind]
+#
+# Results are written as CSV to $BENCH_OUT, one row per run:
+#   tree,tool,threads,pattern,cache,run,entries,wall_s,user_s,sys_s,maxrss_kb,entries_per_s
+#
+# Environment:
+#   BENCH_DIR      Where the synthetic trees are generated (default /tmp/ffind-bench).
+#   BENCH_SCALE    Size multiplier for the trees (default 1).
+#   BENCH_TREES    Tree shapes to run (default "wide deep monorepo symlinks flat").
+#   BENCH_THREADS  -j values to run ffind with (default "1 2 4 8 auto").
+#   BENCH_CACHE    "warm", "cold", or both (default "warm").
+#                  Cold runs drop the page cache before every run and need root.
+#   BENCH_RUNS     Timed runs per configuration (default 3).
+#   BENCH_LATENCY_US  If set, every opendir(), stat(), and lstat() is delayed by this many
+#                  microseconds through bench/latency.so to imitate a network filesystem.
+#   BENCH_OUT      The output file (default bench_output.txt).
+
+set -u
+
+FFIND=${1:-./ffind}
+BENCHBIN=$(dirname "$0")
+BENCH_DIR=${BENCH_DIR:-/tmp/ffind-bench}
+BENCH_SCALE=${BENCH_SCALE:-1}
+BENCH_TREES=${BENCH_TREES:-"wide deep monorepo symlinks flat"}
+BENCH_THREADS=${BENCH_THREADS:-"1 2 4 8 auto"}
+BENCH_CACHE=${BENCH_CACHE:-warm}
+BENCH_RUNS=${BENCH_RUNS:-3}
+BENCH_OUT=${BENCH_OUT:-bench_output.txt}
+
+if [ -n "${BENCH_LATENCY_US:-}" ]; then
+	export BENCH_LATENCY_US
+	export LD_PRELOAD="$(cd "$BENCHBIN" && pwd)/latency.so"
+fi
+
+# Each pattern is "name|ffind arguments|find arguments".
+# find(1) has no fuzzy matching, so its "fuzzy" row lists every entry, which is what an external fuzzy matcher would have to read.
+PATTERNS='all||
+name|-name *.c|-name *.c
+literal|-l -name module_1|-path *module_1*
+regex|-regex file_[0-9]*1\.h$|-regex .*file_[0-9]*1\.h
+pcre|-regextype pcre -regex file_[0-9]+1\.h$|-regextype posix-extended -regex .*file_[0-9]+1\.h
+quit|-quit -name *.h|-name *.h -quit
+fuzzy|--fuzzy fil1h --top 20|'
+
+drop_caches(){
+	sync
+	if ! (echo 3 > /proc/sys/vm/drop_caches) 2>/dev/null; then
+		echo "bench: cannot drop the page cache (not root?); skipping cold runs" >&2
+		return 1
+	fi
+	return 0
+}
+
+# run TREE TOOL THREADS PATTERN CACHE COMMAND...
+run(){
+	tree=$1 tool=$2 threads=$3 pattern=$4 cache=$5
+	shift 5
+
+	if [ "$cache" = warm ]; then
+		"$@" > /dev/null 2>&1
+	fi
+
+	i=1
+	while [ "$i" -le "$BENCH_RUNS" ]; do
+		if [ "$cache" = cold ]; then
+			drop_caches || return
+		fi
+		result=$("$BENCHBIN/benchexec" "$@" 2>/dev/null)
+		echo "$result" | awk -v prefix="$tree,$tool,$threads,$pattern,$cache,$i" '{
+			eps = $2 > 0 ? $1 / $2 : 0
+			printf "%s,%s,%s,%s,%s,%s,%.0f\n", prefix, $1, $2, $3, $4, $5, eps
+		}' >> "$BENCH_OUT"
+		i=$((i + 1))
+	done
+}
+
+echo "tree,tool,threads,pattern,cache,run,entries,wall_s,user_s,sys_s,maxrss_kb,entries_per_s" > "$BENCH_OUT"
+
+mkdir -p "$BENCH_DIR"
+for tree in $BENCH_TREES; do
+	root="$BENCH_DIR/$tree-$BENCH_SCALE"
+	if [ ! -d "$root" ]; then
+		echo "bench: generating $root" >&2
+		"$BENCHBIN/gentree" "$tree" "$root" "$BENCH_SCALE" >&2 || exit 1
+	fi
+
+	for cache in $BENCH_CACHE; do
+		echo "$PATTERNS" | while IFS='|' read -r pname fargs findargs; do
+			[ -n "$pname" ] || continue
+			for j in $BENCH_THREADS; do
+				# word splitting of the argument lists is intended; globbing is not
+				set -f
+				run "$tree" ffind "$j" "$pname" "$cache" "$FFIND" "-j$j" "$root" $fargs
+				set +f
+			done
+			set -f
+			run "$tree" find 1 "$pname" "$cache" find "$root" $findargs
+			set +f
+		done
+	done
+done
+
+echo "bench: results written to $BENCH_OUT" >&2
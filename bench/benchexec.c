@@ -0,0 +1,91 @@
+/** @file benchexec.c
+ * @brief Runs a command once and reports its output count, timings, and peak memory.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+/* wait4() is not part of POSIX */
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+static double tv_seconds(const struct timeval* tv){
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/* Prints "entries wall_s user_s sys_s maxrss_kb" for the command in argv[1..].
+ * Entries are counted as the number of '\n' or '\0' bytes the command writes to stdout. */
+int main(int argc, char** argv){
+	int fds[2];
+	pid_t pid;
+	int status;
+	struct rusage ru;
+	struct timespec start, end;
+	char buf[65536];
+	ssize_t len;
+	unsigned long long entries = 0;
+
+	if (argc < 2){
+		fprintf(stderr, "Usage: %s COMMAND [ARGS...]\n", argv[0]);
+		return 1;
+	}
+
+	if (pipe(fds) != 0){
+		fprintf(stderr, "benchexec: pipe failed (%s)\n", strerror(errno));
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pid = fork();
+	if (pid < 0){
+		fprintf(stderr, "benchexec: fork failed (%s)\n", strerror(errno));
+		return 1;
+	}
+	if (pid == 0){
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		execvp(argv[1], argv + 1);
+		fprintf(stderr, "benchexec: failed to execute %s (%s)\n", argv[1], strerror(errno));
+		_exit(127);
+	}
+	close(fds[1]);
+
+	while ((len = read(fds[0], buf, sizeof(buf))) != 0){
+		if (len < 0){
+			if (errno == EINTR){
+				continue;
+			}
+			break;
+		}
+		for (ssize_t i = 0; i < len; ++i){
+			entries += buf[i] == '\n' || buf[i] == '\0';
+		}
+	}
+	close(fds[0]);
+
+	if (wait4(pid, &status, 0, &ru) < 0){
+		fprintf(stderr, "benchexec: wait failed (%s)\n", strerror(errno));
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("%llu %.6f %.6f %.6f %ld\n",
+			entries,
+			(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9,
+			tv_seconds(&ru.ru_utime),
+			tv_seconds(&ru.ru_stime),
+			ru.ru_maxrss);
+
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
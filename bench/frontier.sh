@@ -0,0 +1,65 @@
+#!/bin/sh
+# Copyright (c) 2018 Jonathan Lemos
+#
+# This software may be modified and distributed under the terms
+# of the MIT license.  See the LICENSE file for details.
+#
+# Measures the memory used by the queue of directories waiting to be searched.
+#
+# Usage: bench/frontier.sh [path/to/ffind]
+#
+# Results are written as CSV to $BENCH_OUT, one row per run:
+#   tree,threads,run,entries,wall_s,maxrss_kb,pending_peak,node_kib,path_kib
+# pending_peak, node_kib, and path_kib come from the "pending dirs peak" line of --stats:
+# the most directories queued at once, the memory their nodes took,
+# and the memory their full paths would have taken as separate strings.
+#
+# Environment:
+#   BENCH_DIR      Where the synthetic trees are generated (default /tmp/ffind-bench).
+#   BENCH_SCALE    Size multiplier for the trees (default 10).
+#   BENCH_TREES    Tree shapes to run (default "comb deep wide").
+#   BENCH_THREADS  -j values to run ffind with (default "1 8").
+#   BENCH_RUNS     Timed runs per configuration (default 3).
+#   BENCH_OUT      The output file (default bench_frontier_output.txt).
+
+set -u
+
+FFIND=${1:-./ffind}
+BENCHBIN=$(dirname "$0")
+BENCH_DIR=${BENCH_DIR:-/tmp/ffind-bench}
+BENCH_SCALE=${BENCH_SCALE:-10}
+BENCH_TREES=${BENCH_TREES:-"comb deep wide"}
+BENCH_THREADS=${BENCH_THREADS:-"1 8"}
+BENCH_RUNS=${BENCH_RUNS:-3}
+BENCH_OUT=${BENCH_OUT:-bench_frontier_output.txt}
+STATS_FILE=$(mktemp)
+
+trap 'rm -f "$STATS_FILE"' EXIT INT TERM
+
+mkdir -p "$BENCH_DIR"
+for tree in $BENCH_TREES; do
+	dir="$BENCH_DIR/$tree-$BENCH_SCALE"
+	if [ ! -d "$dir" ]; then
+		echo "bench: generating $dir" >&2
+		"$BENCHBIN/gentree" "$tree" "$dir" "$BENCH_SCALE" >&2 || exit 1
+	fi
+done
+
+echo "tree,threads,run,entries,wall_s,maxrss_kb,pending_peak,node_kib,path_kib" > "$BENCH_OUT"
+
+for tree in $BENCH_TREES; do
+	dir="$BENCH_DIR/$tree-$BENCH_SCALE"
+	for threads in $BENCH_THREADS; do
+		i=1
+		while [ "$i" -le "$BENCH_RUNS" ]; do
+			result=$("$BENCHBIN/benchexec" "$FFIND" --stats "-j$threads" "$dir" 2>"$STATS_FILE")
+			pending=$(sed -n 's/^pending dirs peak: *\([0-9]*\) (\([0-9.]*\) KiB as nodes, \([0-9.]*\) KiB as full paths)$/\1 \2 \3/p' "$STATS_FILE")
+			echo "$result $pending" | awk -v prefix="$tree,$threads,$i" '{
+				printf "%s,%s,%s,%s,%s,%s,%s\n", prefix, $1, $2, $5, $6, $7, $8
+			}' >> "$BENCH_OUT"
+			i=$((i + 1))
+		done
+	done
+done
+
+echo "bench: results written to $BENCH_OUT" >&2
@@ -0,0 +1,221 @@
+/** @file gentree.c
+ * @brief Generates deterministic synthetic directory trees for benchmarking.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const char* const extensions[] = { ".c", ".h", ".txt", ".md", ".o", ".json", ".py", "" };
+
+/* xorshift64 with a fixed seed, so every run produces the same tree. */
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t rng_next(void){
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+static size_t n_files = 0;
+static size_t n_dirs = 0;
+static size_t n_links = 0;
+
+static void die(const char* what, const char* path){
+	fprintf(stderr, "gentree: %s %s (%s)\n", what, path, strerror(errno));
+	exit(1);
+}
+
+static void make_dir(const char* path){
+	if (mkdir(path, 0755) != 0 && errno != EEXIST){
+		die("failed to create directory", path);
+	}
+	n_dirs++;
+}
+
+static void make_file(const char* dir, size_t index){
+	char path[4096];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/file_%zu%s", dir, index, extensions[rng_next() % (sizeof(extensions) / sizeof(*extensions))]);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0){
+		die("failed to create file", path);
+	}
+	/* a few bytes of content so -contains has something to look at */
+	if (rng_next() % 4 == 0){
+		char buf[64];
+		int len = snprintf(buf, sizeof(buf), "line %zu\nneedle %llu\n", index, (unsigned long long)(rng_next() % 1000));
+		if (write(fd, buf, len) != len){
+			die("failed to write", path);
+		}
+	}
+	close(fd);
+	n_files++;
+}
+
+static void make_files(const char* dir, size_t count){
+	for (size_t i = 0; i < count; ++i){
+		make_file(dir, i);
+	}
+}
+
+/* One directory with many subdirectories, each holding many files. */
+static void gen_wide(const char* root, size_t scale){
+	char path[4096];
+
+	make_dir(root);
+	for (size_t i = 0; i < 200 * scale; ++i){
+		snprintf(path, sizeof(path), "%s/dir_%zu", root, i);
+		make_dir(path);
+		make_files(path, 250);
+	}
+}
+
+/* A long chain of directories with a handful of files at every level. */
+static void gen_deep(const char* root, size_t scale){
+	char path[4096];
+	size_t len;
+
+	make_dir(root);
+	for (size_t chain = 0; chain < 4 * scale; ++chain){
+		len = snprintf(path, sizeof(path), "%s/chain_%zu", root, chain);
+		make_dir(path);
+		for (size_t depth = 0; depth < 200 && len + 8 < sizeof(path); ++depth){
+			make_files(path, 8);
+			len += snprintf(path + len, sizeof(path) - len, "/d%zu", depth % 10);
+			make_dir(path);
+		}
+	}
+}
+
+/* A deep spine of directories with a row of leaf directories hanging off every level,
+ * so a depth-first search queues many long paths at once. */
+static void gen_comb(const char* root, size_t scale){
+	char path[4096];
+	char leaf[4096 + 64];
+	size_t len;
+
+	make_dir(root);
+	len = snprintf(path, sizeof(path), "%s", root);
+	for (size_t depth = 0; depth < 150 && len + 16 < sizeof(path); ++depth){
+		for (size_t i = 0; i < 20 * scale; ++i){
+			snprintf(leaf, sizeof(leaf), "%s/component_%zu", path, i);
+			make_dir(leaf);
+			make_files(leaf, 2);
+		}
+		len += snprintf(path + len, sizeof(path) - len, "/level_%zu", depth);
+		make_dir(path);
+	}
+}
+
+/* Projects whose sizes follow a Zipf-like distribution, so a few subtrees hold most of the entries. */
+static void gen_monorepo(const char* root, size_t scale){
+	char project[4096];
+	char module[4096 + 64];
+	size_t total = 100000 * scale;
+
+	make_dir(root);
+	for (size_t p = 0; p < 64; ++p){
+		size_t files = total / (p + 1) / 5;
+		size_t modules = files / 200 + 1;
+
+		snprintf(project, sizeof(project), "%s/project_%zu", root, p);
+		make_dir(project);
+		make_files(project, 4);
+		for (size_t m = 0; m < modules; ++m){
+			snprintf(module, sizeof(module), "%s/module_%zu", project, m);
+			make_dir(module);
+			snprintf(module, sizeof(module), "%s/module_%zu/src", project, m);
+			make_dir(module);
+			make_files(module, files / modules);
+		}
+	}
+}
+
+/* A single directory holding every file, like a mail spool or an object store mirror.
+ * A scale of 25 gives 5 million entries. */
+static void gen_flat(const char* root, size_t scale){
+	make_dir(root);
+	make_files(root, 200000 * scale);
+}
+
+/* Files, symlinks to files, symlinks to directories, and dangling symlinks. */
+static void gen_symlinks(const char* root, size_t scale){
+	char dir[4096];
+	char link[4096 + 64];
+	char target[4096];
+
+	make_dir(root);
+	for (size_t i = 0; i < 100 * scale; ++i){
+		snprintf(dir, sizeof(dir), "%s/dir_%zu", root, i);
+		make_dir(dir);
+		make_files(dir, 50);
+		for (size_t j = 0; j < 100; ++j){
+			switch (rng_next() % 3){
+			case 0:
+				snprintf(target, sizeof(target), "file_%zu%s", j % 50, extensions[j % (sizeof(extensions) / sizeof(*extensions))]);
+				break;
+			case 1:
+				snprintf(target, sizeof(target), "../dir_%zu", (size_t)(rng_next() % (i + 1)));
+				break;
+			default:
+				snprintf(target, sizeof(target), "missing_%zu", j);
+			}
+			snprintf(link, sizeof(link), "%s/link_%zu", dir, j);
+			if (symlink(target, link) != 0 && errno != EEXIST){
+				die("failed to create symlink", link);
+			}
+			n_links++;
+		}
+	}
+}
+
+int main(int argc, char** argv){
+	size_t scale = 1;
+
+	if (argc < 3){
+		fprintf(stderr, "Usage: %s wide|deep|monorepo|symlinks|flat|comb DIRECTORY [SCALE]\n", argv[0]);
+		return 1;
+	}
+	if (argc >= 4 && sscanf(argv[3], "%zu", &scale) != 1){
+		fprintf(stderr, "gentree: SCALE must be a number\n");
+		return 1;
+	}
+
+	if (!strcmp(argv[1], "wide")){
+		gen_wide(argv[2], scale);
+	}
+	else if (!strcmp(argv[1], "deep")){
+		gen_deep(argv[2], scale);
+	}
+	else if (!strcmp(argv[1], "monorepo")){
+		gen_monorepo(argv[2], scale);
+	}
+	else if (!strcmp(argv[1], "symlinks")){
+		gen_symlinks(argv[2], scale);
+	}
+	else if (!strcmp(argv[1], "flat")){
+		gen_flat(argv[2], scale);
+	}
+	else if (!strcmp(argv[1], "comb")){
+		gen_comb(argv[2], scale);
+	}
+	else{
+		fprintf(stderr, "gentree: unknown tree shape %s\n", argv[1]);
+		return 1;
+	}
+
+	printf("%s dirs=%zu files=%zu links=%zu\n", argv[1], n_dirs, n_files, n_links);
+	return 0;
+}
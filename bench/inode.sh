@@ -0,0 +1,89 @@
+#!/bin/sh
+# Copyright (c) 2018 Jonathan Lemos
+#
+# This software may be modified and distributed under the terms
+# of the MIT license.  See the LICENSE file for details.
+#
+# Cold-cache benchmark of --inode-order on a loopback ext4 image.
+# Needs root to mount the image and drop the page cache.
+#
+# Usage: bench/inode.sh [path/to/ffind]
+#
+# Results are written as CSV to $BENCH_OUT, one row per run:
+#   tree,order,run,entries,wall_s,user_s,sys_s,maxrss_kb,read_ios,read_sectors
+# read_ios and read_sectors come from the loop device's /sys/block/*/stat,
+# so they count the requests that reached the image during the run.
+#
+# Environment:
+#   BENCH_IMAGE    The image file (default /tmp/ffind-inode.img). It is rebuilt on every run.
+#   BENCH_MNT      Where the image is mounted (default /tmp/ffind-inode-mnt).
+#   BENCH_SCALE    Size multiplier for the trees (default 1).
+#   BENCH_TREES    Tree shapes to run (default "flat wide").
+#   BENCH_THREADS  -j value to run ffind with (default 1).
+#   BENCH_RUNS     Timed runs per configuration (default 3).
+#   BENCH_OUT      The output file (default bench_inode_output.txt).
+
+set -u
+
+FFIND=${1:-./ffind}
+BENCHBIN=$(dirname "$0")
+BENCH_IMAGE=${BENCH_IMAGE:-/tmp/ffind-inode.img}
+BENCH_MNT=${BENCH_MNT:-/tmp/ffind-inode-mnt}
+BENCH_SCALE=${BENCH_SCALE:-1}
+BENCH_TREES=${BENCH_TREES:-"flat wide"}
+BENCH_THREADS=${BENCH_THREADS:-1}
+BENCH_RUNS=${BENCH_RUNS:-3}
+BENCH_OUT=${BENCH_OUT:-bench_inode_output.txt}
+
+cleanup(){
+	umount "$BENCH_MNT" 2>/dev/null
+	rm -f "$BENCH_IMAGE"
+}
+
+drop_caches(){
+	sync
+	if ! (echo 3 > /proc/sys/vm/drop_caches) 2>/dev/null; then
+		echo "bench: cannot drop the page cache (not root?)" >&2
+		exit 1
+	fi
+}
+
+# Prints "read_ios read_sectors" for the loop device backing the image.
+read_counts(){
+	awk '{ print $1, $3 }' "/sys/block/$LOOPDEV/stat"
+}
+
+trap cleanup EXIT INT TERM
+
+truncate -s $((512 * BENCH_SCALE))M "$BENCH_IMAGE" || exit 1
+mkfs.ext4 -q -F -N $((400000 * BENCH_SCALE)) "$BENCH_IMAGE" || exit 1
+mkdir -p "$BENCH_MNT"
+mount -o loop "$BENCH_IMAGE" "$BENCH_MNT" || exit 1
+LOOPDEV=$(basename "$(losetup -j "$BENCH_IMAGE" | cut -d: -f1)")
+
+for tree in $BENCH_TREES; do
+	echo "bench: generating $tree" >&2
+	"$BENCHBIN/gentree" "$tree" "$BENCH_MNT/$tree" "$BENCH_SCALE" >&2 || exit 1
+done
+
+echo "tree,order,run,entries,wall_s,user_s,sys_s,maxrss_kb,read_ios,read_sectors" > "$BENCH_OUT"
+
+for tree in $BENCH_TREES; do
+	for order in readdir inode; do
+		flag=
+		[ "$order" = inode ] && flag=--inode-order
+		i=1
+		while [ "$i" -le "$BENCH_RUNS" ]; do
+			drop_caches
+			before=$(read_counts)
+			result=$("$BENCHBIN/benchexec" "$FFIND" "-j$BENCH_THREADS" $flag "$BENCH_MNT/$tree" 2>/dev/null)
+			after=$(read_counts)
+			echo "$result $before $after" | awk -v prefix="$tree,$order,$i" '{
+				printf "%s,%s,%s,%s,%s,%s,%d,%d\n", prefix, $1, $2, $3, $4, $5, $8 - $6, $9 - $7
+			}' >> "$BENCH_OUT"
+			i=$((i + 1))
+		done
+	done
+done
+
+echo "bench: results written to $BENCH_OUT" >&2
@@ -0,0 +1,67 @@
+/** @file latency.c
+ * @brief An LD_PRELOAD shim that adds a fixed delay to opendir(), stat(), and lstat().<br>
+ * This imitates a high-latency filesystem such as NFS without needing one.
+ *
+ * Usage: BENCH_LATENCY_US=200 LD_PRELOAD=bench/latency.so ffind ...
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+/* RTLD_NEXT is a GNU extension */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+static void delay(void){
+	static long latency_us = -1;
+	struct timespec ts;
+
+	/* racing threads all compute the same value */
+	if (latency_us < 0){
+		const char* env = getenv("BENCH_LATENCY_US");
+		latency_us = env ? atol(env) : 0;
+	}
+	if (latency_us <= 0){
+		return;
+	}
+
+	ts.tv_sec = latency_us / 1000000;
+	ts.tv_nsec = (latency_us % 1000000) * 1000;
+	nanosleep(&ts, NULL);
+}
+
+DIR* opendir(const char* name){
+	static DIR* (*real)(const char*) = NULL;
+
+	if (!real){
+		*(void**)&real = dlsym(RTLD_NEXT, "opendir");
+	}
+	delay();
+	return real(name);
+}
+
+int stat(const char* path, struct stat* st){
+	static int (*real)(const char*, struct stat*) = NULL;
+
+	if (!real){
+		*(void**)&real = dlsym(RTLD_NEXT, "stat");
+	}
+	delay();
+	return real(path, st);
+}
+
+int lstat(const char* path, struct stat* st){
+	static int (*real)(const char*, struct stat*) = NULL;
+
+	if (!real){
+		*(void**)&real = dlsym(RTLD_NEXT, "lstat");
+	}
+	delay();
+	return real(path, st);
+}
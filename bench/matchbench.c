@@ -0,0 +1,417 @@
+/** @file matchbench.c
+ * @brief Measures match() on its own, over a corpus of paths held in memory, so changes to the matching engine can be judged without the noise of a disk.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "match.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* A pattern to run, with the text it is compiled from. */
+struct bench_pattern{
+	enum pattern_type type;
+	const char* type_name;
+	const char* text;
+	unsigned flags;
+};
+
+/* Representative patterns for every pattern type: a common suffix, something more selective, and a case-insensitive search where the type supports it.
+ * The regular expressions stay within what POSIX extended and PCRE agree on, so the same text means the same thing to every engine. */
+static const struct bench_pattern patterns[] = {
+	{ TYPE_FNMATCH,          "fnmatch",         "*.c",                           PFLAG_NORMAL },
+	{ TYPE_FNMATCH,          "fnmatch",         "*/src/*test*.[ch]",             PFLAG_NORMAL },
+	{ TYPE_FNMATCH,          "fnmatch",         "*",                             PFLAG_NORMAL },
+	{ TYPE_FNMATCH_ESCAPE,   "fnmatch-escape",  "*.c",                           PFLAG_NORMAL },
+	{ TYPE_FNMATCH_ESCAPE,   "fnmatch-escape",  "*test*",                        PFLAG_NORMAL },
+	{ TYPE_FNMATCH_LITERAL,  "literal",         "test",                          PFLAG_NORMAL },
+	{ TYPE_FNMATCH_LITERAL,  "literal",         "node_modules/",                 PFLAG_NORMAL },
+	{ TYPE_REGEX_POSIX,      "posix-basic",     "\\.c$",                         PFLAG_NORMAL },
+	{ TYPE_REGEX_POSIX,      "posix-basic",     "/src/.*test",                   PFLAG_NORMAL },
+	{ TYPE_REGEX_POSIX,      "posix-basic",     "readme",                        PFLAG_ICASE },
+	{ TYPE_REGEX_POSIX_EX,   "posix-extended",  "\\.(c|h)$",                     PFLAG_NORMAL },
+	{ TYPE_REGEX_POSIX_EX,   "posix-extended",  "/(src|lib)/[a-z_]+[0-9]+\\.c$", PFLAG_NORMAL },
+	{ TYPE_REGEX_POSIX_EX,   "posix-extended",  "readme",                        PFLAG_ICASE },
+	{ TYPE_REGEX_PCRE,       "pcre",            "\\.(c|h)$",                     PFLAG_NORMAL },
+	{ TYPE_REGEX_PCRE,       "pcre",            "/(src|lib)/[a-z_]+[0-9]+\\.c$", PFLAG_NORMAL },
+	{ TYPE_REGEX_PCRE,       "pcre",            "readme",                        PFLAG_ICASE },
+	{ TYPE_REGEX_JAVASCRIPT, "javascript",      "\\.(c|h)$",                     PFLAG_NORMAL },
+	{ TYPE_REGEX_JAVASCRIPT, "javascript",      "readme",                        PFLAG_ICASE },
+};
+
+/* Pieces for generated paths, roughly in the proportions of a source tree. */
+static const char* const dir_names[] = { "src", "lib", "include", "test", "tests", "docs", "build", "node_modules", ".git", "vendor", "assets", "scripts", "tools", "utils", "cmake", "objects" };
+static const char* const file_names[] = { "main", "util", "parser", "test_io", "README", "Makefile", "index", "config", "string_test", "hash", "server", "client" };
+static const char* const extensions[] = { ".c", ".h", ".cpp", ".py", ".js", ".json", ".md", ".txt", ".o", ".png", "" };
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof(*(a)))
+
+/* xorshift64 with a fixed seed, so every run generates the same corpus. */
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t rng_next(void){
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+static uint64_t now_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* The paths to match against. */
+struct corpus{
+	char** paths;
+	size_t len;
+	size_t cap;
+	char* data;
+};
+
+static int corpus_push(struct corpus* c, char* path){
+	if (c->len >= c->cap){
+		size_t cap = c->cap ? c->cap * 2 : 1024;
+		char** tmp = realloc(c->paths, cap * sizeof(*tmp));
+		if (!tmp){
+			return -1;
+		}
+		c->paths = tmp;
+		c->cap = cap;
+	}
+	c->paths[c->len++] = path;
+	return 0;
+}
+
+/* Reads a corpus from a file with one path per line, or one per NUL, as ffind -print0 writes. "-" reads stdin. */
+static int corpus_load(struct corpus* c, const char* file){
+	FILE* fp = strcmp(file, "-") ? fopen(file, "rb") : stdin;
+	size_t len = 0;
+	size_t cap = 1 << 20;
+	size_t start = 0;
+	size_t res;
+
+	if (!fp){
+		fprintf(stderr, "matchbench: failed to open %s (%s)\n", file, strerror(errno));
+		return -1;
+	}
+	c->data = malloc(cap + 1);
+	while (c->data && (res = fread(c->data + len, 1, cap - len, fp)) > 0){
+		len += res;
+		if (len == cap){
+			char* tmp = realloc(c->data, cap * 2 + 1);
+			if (!tmp){
+				free(c->data);
+				c->data = NULL;
+				break;
+			}
+			c->data = tmp;
+			cap *= 2;
+		}
+	}
+	if (fp != stdin){
+		fclose(fp);
+	}
+	if (!c->data){
+		fprintf(stderr, "matchbench: out of memory\n");
+		return -1;
+	}
+
+	c->data[len] = '\n';
+	for (size_t i = 0; i <= len; ++i){
+		if (c->data[i] != '\n' && c->data[i] != '\0'){
+			continue;
+		}
+		c->data[i] = '\0';
+		if (i > start && corpus_push(c, c->data + start) != 0){
+			fprintf(stderr, "matchbench: out of memory\n");
+			return -1;
+		}
+		start = i + 1;
+	}
+	return 0;
+}
+
+/* Generates n paths under /home/user/project, 1 to 10 directories deep. */
+static int corpus_generate(struct corpus* c, size_t n){
+	for (size_t i = 0; i < n; ++i){
+		char buf[512];
+		int len = snprintf(buf, sizeof(buf), "/home/user/project");
+		int depth = 1 + rng_next() % 10;
+		char* path;
+
+		for (int j = 0; j < depth - 1; ++j){
+			if (rng_next() % 4 == 0){
+				len += snprintf(buf + len, sizeof(buf) - len, "/dir%04u", (unsigned)(rng_next() % 10000));
+			}
+			else{
+				len += snprintf(buf + len, sizeof(buf) - len, "/%s", dir_names[rng_next() % ARRAY_LEN(dir_names)]);
+			}
+		}
+		len += snprintf(buf + len, sizeof(buf) - len, "/%s%u%s",
+				file_names[rng_next() % ARRAY_LEN(file_names)],
+				(unsigned)(rng_next() % 100),
+				extensions[rng_next() % ARRAY_LEN(extensions)]);
+
+		path = malloc(len + 1);
+		if (!path || corpus_push(c, path) != 0){
+			free(path);
+			fprintf(stderr, "matchbench: out of memory\n");
+			return -1;
+		}
+		memcpy(path, buf, len + 1);
+	}
+	return 0;
+}
+
+static void corpus_free(struct corpus* c){
+	if (!c->data){
+		for (size_t i = 0; i < c->len; ++i){
+			free(c->paths[i]);
+		}
+	}
+	free(c->paths);
+	free(c->data);
+}
+
+/* One thread's share of a timed run. */
+struct worker{
+	pthread_t thread;
+	const struct pattern* pat;
+	char* const* paths;
+	size_t len;
+	size_t passes;
+	size_t hits;
+	struct gate* gate;
+};
+
+/* Holds the threads back until all of them are created, so thread creation is not timed. */
+struct gate{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int open;
+};
+
+static void* worker_run(void* arg){
+	struct worker* w = arg;
+	size_t hits = 0;
+
+	pthread_mutex_lock(&(w->gate->mutex));
+	while (!w->gate->open){
+		pthread_cond_wait(&(w->gate->cond), &(w->gate->mutex));
+	}
+	pthread_mutex_unlock(&(w->gate->mutex));
+
+	for (size_t p = 0; p < w->passes; ++p){
+		for (size_t i = 0; i < w->len; ++i){
+			hits += match(w->paths[i], w->pat) == 1;
+		}
+	}
+	w->hits = hits;
+	return NULL;
+}
+
+/* Matches every path passes times, split evenly over n_threads threads.
+ * Returns the wall time in nanoseconds, or 0 on failure. */
+static uint64_t timed_run(const struct corpus* c, const struct pattern* pat, size_t n_threads, size_t passes, size_t* hits){
+	struct worker* workers = calloc(n_threads, sizeof(*workers));
+	struct gate gate;
+	uint64_t start;
+	uint64_t end;
+	size_t created = 0;
+
+	if (!workers){
+		fprintf(stderr, "matchbench: out of memory\n");
+		return 0;
+	}
+	pthread_mutex_init(&(gate.mutex), NULL);
+	pthread_cond_init(&(gate.cond), NULL);
+	gate.open = 0;
+
+	for (; created < n_threads; ++created){
+		struct worker* w = &(workers[created]);
+		size_t lo = c->len * created / n_threads;
+		size_t hi = c->len * (created + 1) / n_threads;
+
+		w->pat = pat;
+		w->paths = c->paths + lo;
+		w->len = hi - lo;
+		w->passes = passes;
+		w->gate = &gate;
+		if (pthread_create(&(w->thread), NULL, worker_run, w) != 0){
+			fprintf(stderr, "matchbench: failed to start thread (%s)\n", strerror(errno));
+			break;
+		}
+	}
+
+	pthread_mutex_lock(&(gate.mutex));
+	gate.open = 1;
+	start = now_ns();
+	pthread_cond_broadcast(&(gate.cond));
+	pthread_mutex_unlock(&(gate.mutex));
+
+	*hits = 0;
+	for (size_t i = 0; i < created; ++i){
+		pthread_join(workers[i].thread, NULL);
+		*hits += workers[i].hits;
+	}
+	end = now_ns();
+
+	pthread_cond_destroy(&(gate.cond));
+	pthread_mutex_destroy(&(gate.mutex));
+	free(workers);
+	return created == n_threads ? (end - start ? end - start : 1) : 0;
+}
+
+static int double_cmp(const void* a, const void* b){
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static void usage(const char* prog){
+	fprintf(stderr, "Usage: %s [-c CORPUS] [-n PATHS] [-t THREADS] [-r REPEATS] [-m MIN_MS]\n", prog);
+	fprintf(stderr, "\t-c CORPUS: Read paths from CORPUS, one per line or NUL-separated (\"-\" for stdin). Otherwise a corpus is generated.\n");
+	fprintf(stderr, "\t-n PATHS: The number of paths to generate (default 200000).\n");
+	fprintf(stderr, "\t-t THREADS: Run at 1, 2, 4, ... up to THREADS threads (default: the number of CPUs).\n");
+	fprintf(stderr, "\t-r REPEATS: Timed runs for each pattern and thread count (default 7).\n");
+	fprintf(stderr, "\t-m MIN_MS: Repeat the corpus until each run takes at least this long on one thread (default 200).\n");
+}
+
+/* Prints one CSV row per pattern and thread count:
+ *   type,pattern,icase,threads,paths,hits,repeats,ns_per_match_median,ns_per_match_mean,ns_per_match_stddev,matches_per_sec_median
+ * ns_per_match is the time each thread spends on one match, so it stays flat while matching scales with threads. */
+int main(int argc, char** argv){
+	struct corpus c = { NULL, 0, 0, NULL };
+	const char* corpus_file = NULL;
+	size_t n_paths = 200000;
+	size_t max_threads;
+	size_t repeats = 7;
+	double min_ms = 200;
+	double* samples;
+	long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int opt;
+	int ret = 0;
+
+	max_threads = n_cpus > 0 ? (size_t)n_cpus : 1;
+	while ((opt = getopt(argc, argv, "c:n:t:r:m:h")) != -1){
+		switch (opt){
+		case 'c':
+			corpus_file = optarg;
+			break;
+		case 'n':
+			n_paths = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			max_threads = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			repeats = strtoul(optarg, NULL, 10);
+			break;
+		case 'm':
+			min_ms = strtod(optarg, NULL);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (max_threads == 0 || repeats == 0 || (!corpus_file && n_paths == 0)){
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (corpus_file ? corpus_load(&c, corpus_file) : corpus_generate(&c, n_paths)){
+		corpus_free(&c);
+		return 1;
+	}
+	if (c.len == 0){
+		fprintf(stderr, "matchbench: the corpus is empty\n");
+		corpus_free(&c);
+		return 1;
+	}
+
+	samples = malloc(repeats * sizeof(*samples));
+	if (!samples){
+		fprintf(stderr, "matchbench: out of memory\n");
+		corpus_free(&c);
+		return 1;
+	}
+
+	printf("type,pattern,icase,threads,paths,hits,repeats,ns_per_match_median,ns_per_match_mean,ns_per_match_stddev,matches_per_sec_median\n");
+	for (size_t p = 0; p < ARRAY_LEN(patterns); ++p){
+		struct pattern pat;
+		size_t passes;
+		size_t hits;
+		uint64_t pass_ns;
+
+		pat.p_type = patterns[p].type;
+		if (pat_init(patterns[p].text, &pat, patterns[p].flags) != 0){
+			ret = 1;
+			continue;
+		}
+
+		/* one untimed pass warms the caches and tells how many passes fill min_ms */
+		pass_ns = timed_run(&c, &pat, 1, 1, &hits);
+		if (!pass_ns){
+			pat_free(&pat);
+			ret = 1;
+			break;
+		}
+		passes = (size_t)ceil(min_ms * 1e6 / pass_ns);
+		passes = passes ? passes : 1;
+
+		for (size_t threads = 1;; threads = threads * 2 < max_threads ? threads * 2 : max_threads){
+			double sum = 0;
+			double var = 0;
+			double mean;
+			double median;
+			size_t run_hits = 0;
+
+			for (size_t r = 0; r < repeats; ++r){
+				uint64_t ns = timed_run(&c, &pat, threads, passes, &run_hits);
+				if (!ns){
+					ret = 1;
+					goto done;
+				}
+				samples[r] = (double)ns * threads / ((double)passes * c.len);
+				sum += samples[r];
+			}
+			mean = sum / repeats;
+			for (size_t r = 0; r < repeats; ++r){
+				var += (samples[r] - mean) * (samples[r] - mean);
+			}
+			qsort(samples, repeats, sizeof(*samples), double_cmp);
+			median = repeats % 2 ? samples[repeats / 2] : (samples[repeats / 2 - 1] + samples[repeats / 2]) / 2;
+
+			printf("%s,\"%s\",%d,%zu,%zu,%zu,%zu,%.2f,%.2f,%.2f,%.0f\n",
+					patterns[p].type_name, patterns[p].text, (patterns[p].flags & PFLAG_ICASE) != 0,
+					threads, c.len, run_hits / passes, repeats,
+					median, mean, repeats > 1 ? sqrt(var / (repeats - 1)) : 0.0,
+					threads * 1e9 / median);
+			fflush(stdout);
+			if (threads == max_threads){
+				break;
+			}
+		}
+done:
+		pat_free(&pat);
+		if (ret){
+			break;
+		}
+	}
+
+	free(samples);
+	corpus_free(&c);
+	return ret;
+}
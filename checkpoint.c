@@ -0,0 +1,361 @@
+/** @file checkpoint.c
+ * @brief Saving and resuming long searches for --checkpoint and --resume.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "checkpoint.h"
+#include "stats.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+/* The file starts with this, then every field is followed by a NUL:
+ *   the base directory, its index, the results printed so far, and the number of pending directories,
+ *   then for each pending directory its depth, whether it is flat, its path, the length of its names, and the names themselves,
+ *   and finally "end". */
+#define CHECKPOINT_MAGIC "ffind-checkpoint-2"
+
+/* Writes a frontier to a stream.
+ * Returns 0 on success, negative on failure. */
+static int write_frontier(FILE* fp, const char* dir, size_t index, size_t found, const struct ffind_frontier* f){
+	fprintf(fp, "%s%c%s%c%zu%c%zu%c%zu%c", CHECKPOINT_MAGIC, '\0', dir, '\0', index, '\0', found, '\0', f->len, '\0');
+	for (size_t i = 0; i < f->len; ++i){
+		const struct ffind_pending* p = &(f->dirs[i]);
+
+		fprintf(fp, "%d%c%d%c", p->depth, '\0', p->flat ? 1 : 0, '\0');
+		fwrite(p->path, 1, p->path_len + 1, fp);
+		fprintf(fp, "%zu%c", p->names ? p->names_len : 0, '\0');
+		if (p->names){
+			fwrite(p->names, 1, p->names_len, fp);
+		}
+	}
+	fprintf(fp, "end%c", '\0');
+	return ferror(fp) ? -1 : 0;
+}
+
+/* Writes a checkpoint to the temporary file, flushes it to disk, and renames it over the checkpoint file.
+ * Returns 0 on success, negative on failure. */
+static int save_file(struct checkpoint* cp, size_t found, const struct ffind_frontier* f){
+	FILE* fp;
+	int ret = 0;
+
+	/* everything the checkpoint says was printed has to be out before the checkpoint is */
+	fflush(stdout);
+
+	fp = fopen(cp->tmp_file, "wb");
+	if (!fp){
+		log_eopen(cp->tmp_file);
+		return -1;
+	}
+	if (write_frontier(fp, cp->directories[cp->index], cp->index, found, f) != 0 || fflush(fp) != 0 || fsync(fileno(fp)) != 0){
+		log_ewrite(cp->tmp_file);
+		ret = -1;
+	}
+	if (fclose(fp) != 0 && ret == 0){
+		log_ewrite(cp->tmp_file);
+		ret = -1;
+	}
+	if (ret == 0 && rename(cp->tmp_file, cp->file) != 0){
+		eprintf_mt("ffind: failed to rename %s to %s (%s)\n", cp->tmp_file, cp->file, strerror(errno));
+		ret = -1;
+	}
+	if (ret != 0){
+		remove(cp->tmp_file);
+	}
+	return ret;
+}
+
+/* Saves a checkpoint of the running search, stopping it afterwards if stop is set.
+ * cp->mutex must be held, and a search must be running. */
+static void save_locked(struct checkpoint* cp, int stop){
+	struct ffind_frontier f;
+	int res;
+
+	res = ffind_search_checkpoint(cp->search, stop, &f);
+	/* a search that was cancelled some other way has nothing left that a checkpoint could describe, so the last one is kept */
+	if (res == 0){
+		save_file(cp, cp->found + f.results, &f);
+	}
+	ffind_frontier_free(&f);
+}
+
+/* Saves a checkpoint every interval_ns, and stops the search on SIGINT or SIGTERM.
+ * The signals are blocked in every thread, so they stay pending until this picks them up. */
+static void* checkpoint_thread(void* param){
+	struct checkpoint* cp = param;
+	uint64_t next = stats_now() + cp->interval_ns;
+	sigset_t set;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+
+	while (!__atomic_load_n(&(cp->stop), __ATOMIC_ACQUIRE)){
+		uint64_t now = stats_now();
+		struct timespec ts;
+		int sig;
+
+		if (now >= next){
+			pthread_mutex_lock(&(cp->mutex));
+			if (cp->search && !cp->signal){
+				save_locked(cp, 0);
+			}
+			pthread_mutex_unlock(&(cp->mutex));
+			next = stats_now() + cp->interval_ns;
+			continue;
+		}
+
+		ts.tv_sec = (next - now) / 1000000000;
+		ts.tv_nsec = (next - now) % 1000000000;
+		sig = sigtimedwait(&set, NULL, &ts);
+		if (sig > 0 && !__atomic_load_n(&(cp->stop), __ATOMIC_ACQUIRE)){
+			pthread_mutex_lock(&(cp->mutex));
+			/* a second signal means the first is not stopping things fast enough */
+			if (cp->signal){
+				_exit(128 + sig);
+			}
+			cp->signal = sig;
+			/* with no search running, the next one is stopped as soon as checkpoint_set() is given it */
+			if (cp->search){
+				save_locked(cp, 1);
+			}
+			pthread_mutex_unlock(&(cp->mutex));
+		}
+	}
+	return NULL;
+}
+
+int checkpoint_block_signals(void){
+	sigset_t set;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	if ((errno = pthread_sigmask(SIG_BLOCK, &set, NULL)) != 0){
+		eprintf_mt("ffind: failed to block SIGINT and SIGTERM (%s)\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+int checkpoint_start(struct checkpoint* cp, const char* file, uint64_t interval_ns, char* const* directories, size_t directories_len){
+	cp->file = file;
+	cp->interval_ns = interval_ns;
+	cp->directories = directories;
+	cp->directories_len = directories_len;
+	cp->search = NULL;
+	cp->index = 0;
+	cp->found = 0;
+	cp->signal = 0;
+	cp->stop = 0;
+
+	cp->tmp_file = malloc(strlen(file) + sizeof(".tmp"));
+	if (!cp->tmp_file){
+		log_enomem();
+		return -1;
+	}
+	strcpy(cp->tmp_file, file);
+	strcat(cp->tmp_file, ".tmp");
+
+	pthread_mutex_init(&(cp->mutex), NULL);
+	if ((errno = pthread_create(&(cp->thread), NULL, checkpoint_thread, cp)) != 0){
+		log_ethread();
+		pthread_mutex_destroy(&(cp->mutex));
+		free(cp->tmp_file);
+		return -1;
+	}
+	return 0;
+}
+
+void checkpoint_set(struct checkpoint* cp, struct ffind_search* search, size_t index, size_t found){
+	pthread_mutex_lock(&(cp->mutex));
+	cp->search = search;
+	cp->index = index;
+	cp->found = found;
+	if (search && cp->signal){
+		save_locked(cp, 1);
+	}
+	pthread_mutex_unlock(&(cp->mutex));
+}
+
+int checkpoint_signal(struct checkpoint* cp){
+	int sig;
+
+	pthread_mutex_lock(&(cp->mutex));
+	sig = cp->signal;
+	pthread_mutex_unlock(&(cp->mutex));
+	return sig;
+}
+
+void checkpoint_stop(struct checkpoint* cp, int finished){
+	__atomic_store_n(&(cp->stop), 1, __ATOMIC_RELEASE);
+	/* wakes the thread up, and since it checks stop first, it does not take this for a real SIGTERM */
+	if (pthread_kill(cp->thread, SIGTERM) != 0 || pthread_join(cp->thread, NULL) != 0){
+		log_ejoin();
+	}
+	if (finished && remove(cp->file) != 0 && errno != ENOENT){
+		eprintf_mt("ffind: failed to remove %s (%s)\n", cp->file, strerror(errno));
+	}
+	pthread_mutex_destroy(&(cp->mutex));
+	free(cp->tmp_file);
+}
+
+/* A position in a checkpoint being read. */
+struct reader{
+	const char* pos;
+	const char* end;
+};
+
+/* Reads a NUL-terminated field.
+ * Returns the field, or NULL if the file ends first. */
+static const char* read_field(struct reader* r, size_t* len){
+	const char* field = r->pos;
+	const char* nul = memchr(r->pos, '\0', r->end - r->pos);
+
+	if (!nul){
+		return NULL;
+	}
+	*len = nul - field;
+	r->pos = nul + 1;
+	return field;
+}
+
+/* Reads a field holding a number.
+ * Returns 0 on success, negative if the field is missing or not a number. */
+static int read_number(struct reader* r, size_t* out){
+	size_t len;
+	const char* field = read_field(r, &len);
+	char* end;
+
+	if (!field || len == 0){
+		return -1;
+	}
+	errno = 0;
+	*out = strtoul(field, &end, 10);
+	return errno == 0 && *end == '\0' ? 0 : -1;
+}
+
+/* Reads the pending directories of a checkpoint.
+ * Returns 0 on success, negative if the file is malformed or memory runs out. */
+static int read_frontier(struct reader* r, struct ffind_frontier* f, size_t len){
+	/* every directory takes at least 7 bytes, so a count larger than that is damage and not worth allocating for */
+	if (len > (size_t)(r->end - r->pos) / 7){
+		return -1;
+	}
+	f->dirs = calloc(len ? len : 1, sizeof(*(f->dirs)));
+	if (!f->dirs){
+		log_enomem();
+		return -1;
+	}
+
+	for (; f->len < len; ++(f->len)){
+		struct ffind_pending* p = &(f->dirs[f->len]);
+		const char* path;
+		size_t depth;
+		size_t flat;
+
+		if (read_number(r, &depth) != 0 || read_number(r, &flat) != 0 || flat > 1 || !(path = read_field(r, &(p->path_len))) || read_number(r, &(p->names_len)) != 0 ||
+				p->names_len > (size_t)(r->end - r->pos)){
+			return -1;
+		}
+		p->depth = (int)depth;
+		p->flat = (int)flat;
+		p->path = malloc(p->path_len + 1);
+		p->names = p->names_len ? malloc(p->names_len) : NULL;
+		if (!p->path || (p->names_len && !p->names)){
+			log_enomem();
+			free(p->path);
+			free(p->names);
+			return -1;
+		}
+		memcpy(p->path, path, p->path_len + 1);
+		if (p->names){
+			memcpy(p->names, r->pos, p->names_len);
+			r->pos += p->names_len;
+		}
+	}
+	return 0;
+}
+
+int checkpoint_load(const char* file, char* const* directories, size_t directories_len, struct checkpoint_state* out){
+	FILE* fp;
+	char* data = NULL;
+	size_t len = 0;
+	size_t cap = 0;
+	size_t res;
+	struct reader r;
+	const char* field;
+	size_t field_len;
+	size_t n_dirs;
+	int ret = 0;
+
+	out->index = 0;
+	out->found = 0;
+	out->frontier.dirs = NULL;
+	out->frontier.len = 0;
+	out->frontier.results = 0;
+
+	fp = fopen(file, "rb");
+	if (!fp){
+		log_eopen(file);
+		return -1;
+	}
+	do{
+		if (len == cap){
+			char* tmp;
+			cap = cap ? cap * 2 : 65536;
+			tmp = realloc(data, cap);
+			if (!tmp){
+				log_enomem();
+				ret = -1;
+				goto cleanup;
+			}
+			data = tmp;
+		}
+		res = fread(data + len, 1, cap - len, fp);
+		len += res;
+	}while (res > 0);
+	if (ferror(fp)){
+		log_eread(file);
+		ret = -1;
+		goto cleanup;
+	}
+
+	r.pos = data;
+	r.end = data + len;
+	if (!(field = read_field(&r, &field_len)) || strcmp(field, CHECKPOINT_MAGIC) ||
+			!(field = read_field(&r, &field_len)) || read_number(&r, &(out->index)) != 0 ||
+			read_number(&r, &(out->found)) != 0 || read_number(&r, &n_dirs) != 0){
+		eprintf_mt("ffind: %s is not an ffind checkpoint.\n", file);
+		ret = -1;
+		goto cleanup;
+	}
+	/* the frontier's paths are only meaningful for the same list of directories */
+	if (out->index >= directories_len || strcmp(field, directories[out->index])){
+		eprintf_mt("ffind: %s was saved while searching %s. Resume with the same directories in the same order.\n", file, field);
+		ret = -1;
+		goto cleanup;
+	}
+	if (read_frontier(&r, &(out->frontier), n_dirs) != 0 || !(field = read_field(&r, &field_len)) || strcmp(field, "end")){
+		eprintf_mt("ffind: %s is damaged.\n", file);
+		ret = -1;
+		goto cleanup;
+	}
+
+cleanup:
+	fclose(fp);
+	free(data);
+	return ret;
+}
+
+void checkpoint_state_free(struct checkpoint_state* state){
+	ffind_frontier_free(&(state->frontier));
+}
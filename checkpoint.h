@@ -0,0 +1,134 @@
+/** @file checkpoint.h
+ * @brief Saving and resuming long searches for --checkpoint and --resume.<br>
+ * A checkpoint thread saves what the running search has left to do every so often, and once more when SIGINT or SIGTERM arrives before stopping it.
+ * Each save is taken between directories, so a resumed search neither repeats nor skips anything that was printed before the save.
+ * The file is written to a temporary name and renamed over the old one, so it is never left half written.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __CHECKPOINT_H
+#define __CHECKPOINT_H
+
+#include "ffind.h"
+#include <pthread.h>
+#include <stdint.h>
+
+/**
+ * @brief The default time between checkpoints, in nanoseconds.
+ */
+#define CHECKPOINT_DEFAULT_INTERVAL 60000000000ULL
+
+/**
+ * @brief A running checkpoint thread.
+ */
+struct checkpoint{
+	const char* file;               /**< Where checkpoints are saved. */
+	char* tmp_file;                 /**< Where each checkpoint is written before it is renamed to file. */
+	uint64_t interval_ns;           /**< The time between checkpoints. */
+	char* const* directories;       /**< The base directories being searched, one after another. */
+	size_t directories_len;         /**< The number of base directories. */
+	pthread_mutex_t mutex;          /**< Held while a checkpoint is taken, so the search cannot be swapped out in the middle. */
+	struct ffind_search* search;    /**< The running search, or NULL between searches. */
+	size_t index;                   /**< The index of the running search's base directory. */
+	size_t found;                   /**< Results printed by the searches before it. */
+	int signal;                     /**< The signal that stopped the search, or 0. */
+	pthread_t thread;               /**< The checkpoint thread. */
+	int stop;                       /**< Set when the thread should exit. */
+};
+
+/**
+ * @brief A checkpoint read back by checkpoint_load().
+ */
+struct checkpoint_state{
+	size_t index;                   /**< The index of the base directory to carry on with. */
+	size_t found;                   /**< Results printed before the checkpoint, counting every earlier base directory. */
+	struct ffind_frontier frontier; /**< What the search of that base directory had left. */
+};
+
+/**
+ * @brief Blocks SIGINT and SIGTERM in the calling thread, so that it and every thread it creates afterwards leave them to the checkpoint thread.<br>
+ * This must be called before the pool is created.
+ *
+ * @return 0 on success, negative on failure.
+ */
+int checkpoint_block_signals(void);
+
+/**
+ * @brief Starts the checkpoint thread.
+ *
+ * @param cp The checkpoint thread.<br>
+ * This must be stopped with checkpoint_stop().
+ * @see checkpoint_stop()
+ *
+ * @param file Where to save checkpoints.
+ *
+ * @param interval_ns The time between checkpoints.
+ *
+ * @param directories The base directories that will be searched, one after another.
+ *
+ * @param directories_len The number of base directories.
+ *
+ * @return 0 on success, negative on failure.
+ */
+int checkpoint_start(struct checkpoint* cp, const char* file, uint64_t interval_ns, char* const* directories, size_t directories_len);
+
+/**
+ * @brief Tells the checkpoint thread which search is running.<br>
+ * If a signal arrived while no search was running, the search is stopped right away with a final checkpoint.
+ *
+ * @param cp The checkpoint thread.
+ *
+ * @param search The search, which must have been started with a callback, or NULL before freeing it.
+ *
+ * @param index The index of the search's base directory.
+ *
+ * @param found Results printed by the searches before it.
+ */
+void checkpoint_set(struct checkpoint* cp, struct ffind_search* search, size_t index, size_t found);
+
+/**
+ * @brief Gets the signal that stopped the search.
+ *
+ * @param cp The checkpoint thread.
+ *
+ * @return The signal, or 0 if none arrived.
+ */
+int checkpoint_signal(struct checkpoint* cp);
+
+/**
+ * @brief Stops the checkpoint thread and waits for it to exit.
+ *
+ * @param cp The checkpoint thread.
+ *
+ * @param finished If true, every search ran to the end, so the checkpoint file is removed.
+ */
+void checkpoint_stop(struct checkpoint* cp, int finished);
+
+/**
+ * @brief Reads a checkpoint to resume from.
+ *
+ * @param file The checkpoint file.
+ *
+ * @param directories The base directories to search, which must be the same as when the checkpoint was saved.
+ *
+ * @param directories_len The number of base directories.
+ *
+ * @param out Filled with the checkpoint.<br>
+ * This must be freed with checkpoint_state_free(), even if this function fails.
+ * @see checkpoint_state_free()
+ *
+ * @return 0 on success, negative on failure.
+ */
+int checkpoint_load(const char* file, char* const* directories, size_t directories_len, struct checkpoint_state* out);
+
+/**
+ * @brief Frees a checkpoint read by checkpoint_load().
+ *
+ * @param state The checkpoint.
+ */
+void checkpoint_state_free(struct checkpoint_state* state);
+
+#endif
@@ -0,0 +1,182 @@
+/** @file contents.c
+ * @brief File content searching.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "contents.h"
+#include "log.h"
+#include "match.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+void contents_buf_init(struct contents_buf* cb){
+	cb->data = NULL;
+	cb->data_cap = 0;
+	cb->line = NULL;
+	cb->line_cap = 0;
+}
+
+void contents_buf_free(struct contents_buf* cb){
+	free(cb->data);
+	free(cb->line);
+	contents_buf_init(cb);
+}
+
+/* Grows a buffer to at least len bytes.
+ * The old contents are not preserved. */
+static int buf_reserve(char** buf, size_t* cap, size_t len){
+	char* tmp;
+
+	if (*cap >= len){
+		return 0;
+	}
+
+	tmp = malloc(len);
+	if (!tmp){
+		return -1;
+	}
+	free(*buf);
+	*buf = tmp;
+	*cap = len;
+	return 0;
+}
+
+/* Finds the needle within the haystack.
+ * memchr() is vectorized by the C library, so it is used to skip ahead to candidate first characters
+ * before the rest of the needle is compared. */
+FF_HOT static const char* mem_find(const char* haystack, size_t haystack_len, const char* needle, size_t needle_len){
+	const char* ptr = haystack;
+	const char* end = haystack + haystack_len;
+
+	if (needle_len == 0){
+		return haystack;
+	}
+
+	while ((size_t)(end - ptr) >= needle_len){
+		ptr = memchr(ptr, needle[0], (end - ptr) - needle_len + 1);
+		if (!ptr){
+			return NULL;
+		}
+		if (!memcmp(ptr + 1, needle + 1, needle_len - 1)){
+			return ptr;
+		}
+		ptr++;
+	}
+	return NULL;
+}
+
+/* Matches a pattern against each line of a buffer.
+ * Each line is copied to cb->line so it can be NUL-terminated for match(). */
+static int match_lines(const char* data, size_t len, const struct pattern* needle, struct contents_buf* cb){
+	const char* ptr = data;
+	const char* end = data + len;
+
+	while (ptr < end){
+		const char* eol = memchr(ptr, '\n', end - ptr);
+		size_t line_len;
+
+		if (!eol){
+			eol = end;
+		}
+		line_len = eol - ptr;
+
+		if (buf_reserve(&(cb->line), &(cb->line_cap), line_len + 1) != 0){
+			log_enomem();
+			return -1;
+		}
+		memcpy(cb->line, ptr, line_len);
+		cb->line[line_len] = '\0';
+
+		if (match(cb->line, needle) == 1){
+			return 1;
+		}
+		ptr = eol + 1;
+	}
+	return 0;
+}
+
+static int search_buffer(const char* data, size_t len, const struct pattern* needle, struct contents_buf* cb){
+	size_t probe = len < CONTENTS_BINARY_PROBE ? len : CONTENTS_BINARY_PROBE;
+
+	if (memchr(data, '\0', probe)){
+		return 0;
+	}
+
+	if (needle->p_type == TYPE_FNMATCH_LITERAL){
+		return mem_find(data, len, needle->p.fnmatch, strlen(needle->p.fnmatch)) != NULL;
+	}
+	return match_lines(data, len, needle, cb);
+}
+
+int file_contains(const char* path, off_t size, const struct pattern* needle, off_t max_size, struct contents_buf* cb){
+	struct stat st;
+	int fd;
+	int ret;
+
+	if (size > max_size){
+		return 0;
+	}
+
+	/* O_NONBLOCK keeps a file that was replaced by a FIFO from blocking the thread */
+	fd = open(path, O_RDONLY | O_NONBLOCK);
+	if (fd < 0){
+		log_eopen(path);
+		return -1;
+	}
+	if (fstat(fd, &st) != 0){
+		log_eread(path);
+		close(fd);
+		return -1;
+	}
+	if (!S_ISREG(st.st_mode)){
+		close(fd);
+		return 0;
+	}
+
+	/* mapping past the end of a file that shrank would fault on the missing pages, so only a file that kept its size is mapped */
+	if (size >= CONTENTS_MMAP_THRESHOLD && st.st_size == size){
+		void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED){
+			log_eread(path);
+			close(fd);
+			return -1;
+		}
+		ret = search_buffer(map, size, needle, cb);
+		munmap(map, size);
+	}
+	else{
+		size_t len = 0;
+		ssize_t res;
+
+		if (buf_reserve(&(cb->data), &(cb->data_cap), size + 1) != 0){
+			log_enomem();
+			close(fd);
+			return -1;
+		}
+
+		/* the file may have changed size since it was stat()'d, so only read what fits */
+		while (len < (size_t)size && (res = read(fd, cb->data + len, size - len)) != 0){
+			if (res < 0){
+				if (errno == EINTR){
+					continue;
+				}
+				log_eread(path);
+				close(fd);
+				return -1;
+			}
+			len += res;
+		}
+		ret = search_buffer(cb->data, len, needle, cb);
+	}
+
+	close(fd);
+	return ret;
+}
@@ -0,0 +1,79 @@
+/** @file contents.h
+ * @brief File content searching.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __CONTENTS_H
+#define __CONTENTS_H
+
+#include "match.h"
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * @brief Files at least this large are mmap()'d instead of read into a buffer.
+ */
+#define CONTENTS_MMAP_THRESHOLD (256 * 1024)
+
+/**
+ * @brief The number of bytes at the start of a file that are checked for NUL characters.<br>
+ * A file containing a NUL character in this range is considered binary and is skipped.
+ */
+#define CONTENTS_BINARY_PROBE (8 * 1024)
+
+/**
+ * @brief The default maximum size of a file whose contents will be searched.
+ */
+#define CONTENTS_DEFAULT_MAX_SIZE ((off_t)64 * 1024 * 1024)
+
+/**
+ * @brief A reusable buffer for reading file contents.<br>
+ * Each thread should own one of these so small files can be read without allocating every time.
+ */
+struct contents_buf{
+	char*  data;     /**< Holds the contents of files below CONTENTS_MMAP_THRESHOLD. */
+	size_t data_cap; /**< The allocated size of data. */
+	char*  line;     /**< Holds a single NUL-terminated line for regex matching. */
+	size_t line_cap; /**< The allocated size of line. */
+};
+
+/**
+ * @brief Initializes a content buffer.
+ *
+ * @param cb The buffer to initialize.<br>
+ * This must be freed with contents_buf_free() when no longer in use.
+ * @see contents_buf_free()
+ */
+void contents_buf_init(struct contents_buf* cb);
+
+/**
+ * @brief Releases the memory held by a content buffer.
+ *
+ * @param cb The buffer to free.
+ */
+void contents_buf_free(struct contents_buf* cb);
+
+/**
+ * @brief Checks if a regular file's contents match a pattern.<br>
+ * TYPE_FNMATCH_LITERAL patterns are matched anywhere in the file.
+ * All other pattern types are matched against each line of the file.<br>
+ * The search stops at the first match.
+ *
+ * @param path The path of the file to search.
+ *
+ * @param size The size of the file as reported by stat().
+ *
+ * @param needle The pattern to search for.
+ *
+ * @param max_size Files larger than this are not searched.
+ *
+ * @param cb A content buffer created with contents_buf_init().
+ *
+ * @return 1 if the file matches, 0 if it does not match or was skipped because it was binary, too large, or no longer a regular file, negative on failure.
+ */
+int file_contains(const char* path, off_t size, const struct pattern* needle, off_t max_size, struct contents_buf* cb) FF_HOT;
+
+#endif
@@ -0,0 +1,176 @@
+/** @file dirnode.c
+ * @brief Compact storage for directories waiting to be searched.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "dirnode.h"
+#include "log.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* The size of a node with a name of name_len bytes. */
+static size_t node_size(size_t name_len){
+	return (offsetof(struct dir_node, name) + name_len + DIRNODE_ALIGN - 1) / DIRNODE_ALIGN * DIRNODE_ALIGN;
+}
+
+void dir_arena_init(struct dir_arena* arena){
+	arena->slabs = NULL;
+	arena->bump = NULL;
+	arena->bump_left = 0;
+	for (size_t i = 0; i < DIRNODE_CLASSES; ++i){
+		arena->free_lists[i] = NULL;
+	}
+	arena->big = NULL;
+	arena->slab_bytes = 0;
+	arena->live_bytes = 0;
+	arena->peak_live_bytes = 0;
+}
+
+void dir_arena_free(struct dir_arena* arena){
+	void* slab = arena->slabs;
+
+	while (slab){
+		void* next = *(void**)slab;
+		free(slab);
+		slab = next;
+	}
+	while (arena->big){
+		struct dir_big* next = arena->big->next;
+		free(arena->big);
+		arena->big = next;
+	}
+	dir_arena_init(arena);
+}
+
+/* Carves size bytes out of the newest slab, starting a new slab if needed. */
+static void* arena_bump(struct dir_arena* arena, size_t size){
+	void* ret;
+
+	if (arena->bump_left < size){
+		void* slab = malloc(DIRNODE_SLAB_SIZE);
+		if (!slab){
+			log_enomem();
+			return NULL;
+		}
+		*(void**)slab = arena->slabs;
+		arena->slabs = slab;
+		/* the first word links the slabs together */
+		arena->bump = (char*)slab + DIRNODE_ALIGN;
+		arena->bump_left = DIRNODE_SLAB_SIZE - DIRNODE_ALIGN;
+		arena->slab_bytes += DIRNODE_SLAB_SIZE;
+	}
+
+	ret = arena->bump;
+	arena->bump += size;
+	arena->bump_left -= size;
+	return ret;
+}
+
+struct dir_node* dir_node_new(struct dir_arena* arena, struct dir_node* parent, const char* name, size_t name_len){
+	size_t size = node_size(name_len);
+	unsigned size_class = size / DIRNODE_ALIGN - 1;
+	struct dir_node* node;
+
+	if (size_class >= DIRNODE_CLASSES){
+		struct dir_big* big = malloc(sizeof(*big) + size);
+
+		if (!big){
+			log_enomem();
+			return NULL;
+		}
+		big->prev = NULL;
+		big->next = arena->big;
+		if (arena->big){
+			arena->big->prev = big;
+		}
+		arena->big = big;
+		size_class = DIRNODE_CLASSES;
+		node = (struct dir_node*)(big + 1);
+		arena->slab_bytes += size;
+	}
+	else if (arena->free_lists[size_class]){
+		node = arena->free_lists[size_class];
+		arena->free_lists[size_class] = *(void**)node;
+	}
+	else{
+		node = arena_bump(arena, size);
+		if (!node){
+			return NULL;
+		}
+	}
+
+	arena->live_bytes += size;
+	if (arena->live_bytes > arena->peak_live_bytes){
+		arena->peak_live_bytes = arena->live_bytes;
+	}
+
+	node->parent = parent;
+	node->name_len = name_len;
+	node->refs = 1;
+	node->size_class = size_class;
+	memcpy(node->name, name, name_len);
+
+	if (!parent){
+		node->path_len = name_len;
+		node->depth = 0;
+		return node;
+	}
+
+	parent->refs++;
+	node->depth = parent->depth + 1;
+	/* no slash is added after a base directory that already ends in one */
+	node->path_len = parent->path_len + name_len;
+	if (parent->path_len == 0 || !(parent->parent == NULL && parent->name[parent->name_len - 1] == '/')){
+		node->path_len++;
+	}
+	return node;
+}
+
+void dir_node_ref(struct dir_node* node){
+	node->refs++;
+}
+
+void dir_node_release(struct dir_arena* arena, struct dir_node* node){
+	while (node && --(node->refs) == 0){
+		struct dir_node* parent = node->parent;
+		size_t size = node_size(node->name_len);
+
+		arena->live_bytes -= size;
+		if (node->size_class == DIRNODE_CLASSES){
+			struct dir_big* big = (struct dir_big*)node - 1;
+
+			if (big->prev){
+				big->prev->next = big->next;
+			}
+			else{
+				arena->big = big->next;
+			}
+			if (big->next){
+				big->next->prev = big->prev;
+			}
+			arena->slab_bytes -= size;
+			free(big);
+		}
+		else{
+			*(void**)node = arena->free_lists[node->size_class];
+			arena->free_lists[node->size_class] = node;
+		}
+		node = parent;
+	}
+}
+
+void dir_node_path(const struct dir_node* node, char* buf){
+	size_t pos = node->path_len;
+
+	buf[pos] = '\0';
+	for (; node; node = node->parent){
+		pos -= node->name_len;
+		memcpy(buf + pos, node->name, node->name_len);
+		if (node->parent && pos > node->parent->path_len){
+			buf[--pos] = '/';
+		}
+	}
+}
@@ -0,0 +1,127 @@
+/** @file dirnode.h
+ * @brief Compact storage for directories waiting to be searched.<br>
+ * Each queued directory is a node holding only its own name and a pointer to its parent,
+ * so the common prefixes of a deep tree are stored once instead of once per queued path.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __DIRNODE_H
+#define __DIRNODE_H
+
+#include <stddef.h>
+
+/**
+ * @brief The size of each slab nodes are carved out of.
+ */
+#define DIRNODE_SLAB_SIZE (64 * 1024)
+
+/**
+ * @brief Node sizes are rounded up to a multiple of this.
+ */
+#define DIRNODE_ALIGN 8
+
+/**
+ * @brief The number of node size classes.<br>
+ * Nodes larger than DIRNODE_CLASSES * DIRNODE_ALIGN bytes are allocated with malloc() instead, and kept on a list so the arena can still free them.
+ */
+#define DIRNODE_CLASSES 40
+
+/**
+ * @brief A directory in a tree of queued directories.
+ */
+struct dir_node{
+	struct dir_node* parent;  /**< The parent directory, or NULL for a search's base directory. */
+	unsigned path_len;        /**< The length of the full path. */
+	unsigned name_len;        /**< The length of name. */
+	unsigned refs;            /**< References from queued work and from child nodes. */
+	int depth;                /**< The depth of the directory. The base directory has a depth of 0. */
+	unsigned char size_class; /**< The free list the node returns to, or DIRNODE_CLASSES if it came from malloc(). */
+	char name[];              /**< The last component of the path, or the whole path for the base directory. Not NUL-terminated. */
+};
+
+/**
+ * @brief The header in front of a node allocated with malloc(), linking it into its arena's list of oversized nodes.
+ */
+struct dir_big{
+	struct dir_big* prev; /**< The previous oversized node, or NULL for the first. */
+	struct dir_big* next; /**< The next oversized node, or NULL for the last. */
+};
+
+/**
+ * @brief An allocator for nodes.<br>
+ * An arena is not thread-safe, so every call using the same arena must hold the same lock.
+ */
+struct dir_arena{
+	void* slabs;                          /**< Every slab, linked through their first word. */
+	char* bump;                           /**< The unused part of the newest slab. */
+	size_t bump_left;                     /**< The number of bytes left at bump. */
+	void* free_lists[DIRNODE_CLASSES];    /**< Released nodes of each size class, linked through their first word. */
+	struct dir_big* big;                  /**< Oversized nodes that have not been released. */
+	size_t slab_bytes;                    /**< Bytes allocated for slabs and oversized nodes. */
+	size_t live_bytes;                    /**< Bytes in nodes that have not been released. */
+	size_t peak_live_bytes;               /**< The largest value of live_bytes. */
+};
+
+/**
+ * @brief Initializes an arena.
+ *
+ * @param arena The arena to initialize.<br>
+ * This must be freed with dir_arena_free() when no longer in use.
+ * @see dir_arena_free()
+ */
+void dir_arena_init(struct dir_arena* arena);
+
+/**
+ * @brief Releases every slab and oversized node of an arena, including any nodes that were not released.
+ *
+ * @param arena The arena to free.
+ */
+void dir_arena_free(struct dir_arena* arena);
+
+/**
+ * @brief Creates a node with a single reference.
+ *
+ * @param arena The arena to allocate from.
+ *
+ * @param parent The parent node, which gains a reference, or NULL to create a base directory.
+ *
+ * @param name The directory's name, or its whole path if parent is NULL.
+ *
+ * @param name_len The length of name.
+ *
+ * @return A new node, or NULL if memory could not be allocated.
+ */
+struct dir_node* dir_node_new(struct dir_arena* arena, struct dir_node* parent, const char* name, size_t name_len);
+
+/**
+ * @brief Adds a reference to a node.
+ *
+ * @param node The node.
+ */
+void dir_node_ref(struct dir_node* node);
+
+/**
+ * @brief Drops a reference to a node.<br>
+ * Once a node has no references left it is released, along with any parents that only it referenced.
+ *
+ * @param arena The arena the node was allocated from.
+ *
+ * @param node The node.
+ */
+void dir_node_release(struct dir_arena* arena, struct dir_node* node);
+
+/**
+ * @brief Writes a node's full path.<br>
+ * Since nodes never change once created, this needs no lock as long as the caller holds a reference to the node.
+ *
+ * @param node The node.
+ *
+ * @param buf Where to write the path.<br>
+ * This must have room for node->path_len + 1 bytes.
+ */
+void dir_node_path(const struct dir_node* node, char* buf);
+
+#endif
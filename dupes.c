@@ -0,0 +1,606 @@
+/** @file dupes.c
+ * @brief Finds files with identical contents.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "dupes.h"
+#include "log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* A 64-bit non-cryptographic hash in the style of xxHash.
+ * It only has to tell different files apart, and it is fast enough that the disk stays the bottleneck. */
+#define P1 UINT64_C(0x9E3779B185EBCA87)
+#define P2 UINT64_C(0xC2B2AE3D27D4EB4F)
+#define P3 UINT64_C(0x165667B19E3779F9)
+#define P4 UINT64_C(0x85EBCA77C2B2AE63)
+#define P5 UINT64_C(0x27D4EB2F165667C5)
+
+struct hash_state{
+	uint64_t v[4];
+	uint64_t total;
+	unsigned char buf[32];
+	size_t buf_len;
+};
+
+static uint64_t rotl(uint64_t x, int r){
+	return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t read64(const unsigned char* p){
+	uint64_t x;
+	memcpy(&x, p, sizeof(x));
+	return x;
+}
+
+static uint32_t read32(const unsigned char* p){
+	uint32_t x;
+	memcpy(&x, p, sizeof(x));
+	return x;
+}
+
+static uint64_t hash_round(uint64_t acc, uint64_t input){
+	acc += input * P2;
+	acc = rotl(acc, 31);
+	return acc * P1;
+}
+
+static uint64_t hash_merge(uint64_t acc, uint64_t v){
+	acc ^= hash_round(0, v);
+	return acc * P1 + P4;
+}
+
+static void hash_init(struct hash_state* h){
+	h->v[0] = P1 + P2;
+	h->v[1] = P2;
+	h->v[2] = 0;
+	h->v[3] = -P1;
+	h->total = 0;
+	h->buf_len = 0;
+}
+
+static void hash_stripe(struct hash_state* h, const unsigned char* p){
+	h->v[0] = hash_round(h->v[0], read64(p));
+	h->v[1] = hash_round(h->v[1], read64(p + 8));
+	h->v[2] = hash_round(h->v[2], read64(p + 16));
+	h->v[3] = hash_round(h->v[3], read64(p + 24));
+}
+
+static void hash_update(struct hash_state* h, const void* data, size_t len){
+	const unsigned char* p = data;
+	const unsigned char* end = p + len;
+
+	h->total += len;
+
+	if (h->buf_len + len < sizeof(h->buf)){
+		memcpy(h->buf + h->buf_len, p, len);
+		h->buf_len += len;
+		return;
+	}
+	if (h->buf_len){
+		size_t fill = sizeof(h->buf) - h->buf_len;
+		memcpy(h->buf + h->buf_len, p, fill);
+		hash_stripe(h, h->buf);
+		p += fill;
+		h->buf_len = 0;
+	}
+	while (end - p >= 32){
+		hash_stripe(h, p);
+		p += 32;
+	}
+	memcpy(h->buf, p, end - p);
+	h->buf_len = end - p;
+}
+
+static uint64_t hash_final(const struct hash_state* h){
+	const unsigned char* p = h->buf;
+	const unsigned char* end = p + h->buf_len;
+	uint64_t acc;
+
+	if (h->total >= 32){
+		acc = rotl(h->v[0], 1) + rotl(h->v[1], 7) + rotl(h->v[2], 12) + rotl(h->v[3], 18);
+		for (int i = 0; i < 4; ++i){
+			acc = hash_merge(acc, h->v[i]);
+		}
+	}
+	else{
+		acc = h->v[2] + P5;
+	}
+	acc += h->total;
+
+	for (; end - p >= 8; p += 8){
+		acc ^= hash_round(0, read64(p));
+		acc = rotl(acc, 27) * P1 + P4;
+	}
+	if (end - p >= 4){
+		acc ^= (uint64_t)read32(p) * P1;
+		acc = rotl(acc, 23) * P2 + P3;
+		p += 4;
+	}
+	for (; p < end; ++p){
+		acc ^= *p * P5;
+		acc = rotl(acc, 11) * P1;
+	}
+
+	acc ^= acc >> 33;
+	acc *= P2;
+	acc ^= acc >> 29;
+	acc *= P3;
+	acc ^= acc >> 32;
+	return acc;
+}
+
+void dupes_init(struct dupes* d){
+	d->sets = NULL;
+	pthread_mutex_init(&(d->mutex), NULL);
+	memset(&(d->stats), 0, sizeof(d->stats));
+}
+
+struct dupes_set* dupes_set_new(struct dupes* d){
+	struct dupes_set* set = calloc(1, sizeof(*set));
+
+	if (!set){
+		log_enomem();
+		return NULL;
+	}
+	pthread_mutex_lock(&(d->mutex));
+	set->next = d->sets;
+	d->sets = set;
+	pthread_mutex_unlock(&(d->mutex));
+	return set;
+}
+
+int dupes_add(struct dupes_set* set, const char* path, size_t path_len, const struct stat* st){
+	struct dupes_file* f;
+
+	if (!S_ISREG(st->st_mode) || st->st_size == 0){
+		return 0;
+	}
+
+	if (set->len >= set->cap){
+		size_t cap = set->cap ? set->cap * 2 : 256;
+		void* tmp = realloc(set->files, cap * sizeof(*(set->files)));
+		if (!tmp){
+			log_enomem();
+			return -1;
+		}
+		set->files = tmp;
+		set->cap = cap;
+	}
+	if (set->strings_len + path_len + 1 > set->strings_cap){
+		size_t cap = set->strings_cap ? set->strings_cap * 2 : 16384;
+		char* tmp;
+
+		while (cap < set->strings_len + path_len + 1){
+			cap *= 2;
+		}
+		tmp = realloc(set->strings, cap);
+		if (!tmp){
+			log_enomem();
+			return -1;
+		}
+		set->strings = tmp;
+		set->strings_cap = cap;
+	}
+
+	/* the strings move as they grow, so the path is found by its offset until dupes_find() */
+	memcpy(set->strings + set->strings_len, path, path_len + 1);
+	f = &(set->files[set->len++]);
+	f->path = NULL;
+	f->path_off = set->strings_len;
+	f->size = st->st_size;
+	f->dev = st->st_dev;
+	f->ino = st->st_ino;
+	f->hash = 0;
+	f->n_links = 0;
+	f->complete = 0;
+	f->failed = 0;
+	set->strings_len += path_len + 1;
+	return 0;
+}
+
+/* Reads exactly len bytes at off, unless the file is shorter.
+ * Returns the number of bytes read, or negative on failure. */
+static ssize_t read_at(int fd, void* buf, size_t len, off_t off){
+	size_t done = 0;
+	ssize_t res;
+
+	while (done < len && (res = pread(fd, (char*)buf + done, len - done, off + done)) != 0){
+		if (res < 0){
+			if (errno == EINTR){
+				continue;
+			}
+			return -1;
+		}
+		done += res;
+	}
+	return done;
+}
+
+/* What the hashing tasks share. */
+struct hash_job{
+	struct dupes_file** files;
+	unsigned char** bufs;    /* one DUPES_READ_SIZE buffer for each pool thread */
+	uint64_t bytes_read;
+};
+
+/* Hashes the first and last DUPES_BLOCK_SIZE bytes of a file.
+ * A file that fits in those two blocks is hashed whole instead, which settles it. */
+static void hash_partial(size_t index, size_t thread, void* data){
+	struct hash_job* job = data;
+	struct dupes_file* f = job->files[index];
+	unsigned char* buf = job->bufs[thread];
+	struct hash_state h;
+	size_t len;
+	ssize_t res;
+	int fd;
+
+	fd = open(f->path, O_RDONLY);
+	if (fd < 0){
+		log_eopen(f->path);
+		f->failed = 1;
+		return;
+	}
+
+	hash_init(&h);
+	if (f->size <= 2 * DUPES_BLOCK_SIZE){
+		len = f->size;
+		res = read_at(fd, buf, len, 0);
+		f->complete = 1;
+	}
+	else{
+		len = 2 * DUPES_BLOCK_SIZE;
+		res = read_at(fd, buf, DUPES_BLOCK_SIZE, 0);
+		if (res == DUPES_BLOCK_SIZE){
+			res = read_at(fd, buf + DUPES_BLOCK_SIZE, DUPES_BLOCK_SIZE, f->size - DUPES_BLOCK_SIZE);
+			if (res == DUPES_BLOCK_SIZE){
+				res = len;
+			}
+		}
+	}
+	if (res < 0){
+		log_eread(f->path);
+		f->failed = 1;
+	}
+	/* a file that shrank since it was found cannot match anything reliably */
+	else if ((size_t)res != len){
+		f->failed = 1;
+	}
+	else{
+		hash_update(&h, buf, len);
+		f->hash = hash_final(&h);
+		__atomic_fetch_add(&(job->bytes_read), len, __ATOMIC_RELAXED);
+	}
+	close(fd);
+}
+
+/* Hashes the whole of a file. */
+static void hash_full(size_t index, size_t thread, void* data){
+	struct hash_job* job = data;
+	struct dupes_file* f = job->files[index];
+	unsigned char* buf = job->bufs[thread];
+	struct hash_state h;
+	off_t off = 0;
+	int fd;
+
+	fd = open(f->path, O_RDONLY);
+	if (fd < 0){
+		log_eopen(f->path);
+		f->failed = 1;
+		return;
+	}
+
+	hash_init(&h);
+	while (off < f->size){
+		size_t len = f->size - off < DUPES_READ_SIZE ? (size_t)(f->size - off) : DUPES_READ_SIZE;
+		ssize_t res = read_at(fd, buf, len, off);
+
+		if (res < 0){
+			log_eread(f->path);
+			f->failed = 1;
+			break;
+		}
+		if ((size_t)res != len){
+			f->failed = 1;
+			break;
+		}
+		hash_update(&h, buf, len);
+		off += len;
+	}
+	close(fd);
+
+	__atomic_fetch_add(&(job->bytes_read), off, __ATOMIC_RELAXED);
+	if (!f->failed){
+		f->hash = hash_final(&h);
+		f->complete = 1;
+	}
+}
+
+static int file_cmp_inode(const void* a, const void* b){
+	const struct dupes_file* f1 = a;
+	const struct dupes_file* f2 = b;
+
+	if (f1->size != f2->size){
+		return f1->size < f2->size ? -1 : 1;
+	}
+	if (f1->dev != f2->dev){
+		return f1->dev < f2->dev ? -1 : 1;
+	}
+	if (f1->ino != f2->ino){
+		return f1->ino < f2->ino ? -1 : 1;
+	}
+	return strcmp(f1->path, f2->path);
+}
+
+static int file_cmp_hash(const void* a, const void* b){
+	const struct dupes_file* f1 = *(struct dupes_file* const*)a;
+	const struct dupes_file* f2 = *(struct dupes_file* const*)b;
+
+	/* files that could not be read go last, so they never split a group */
+	if (f1->failed != f2->failed){
+		return f1->failed ? 1 : -1;
+	}
+	if (f1->size != f2->size){
+		return f1->size < f2->size ? -1 : 1;
+	}
+	if (f1->hash != f2->hash){
+		return f1->hash < f2->hash ? -1 : 1;
+	}
+	return strcmp(f1->path, f2->path);
+}
+
+static int path_cmp(const void* a, const void* b){
+	return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+/* A run of files found to be identical, as a range of the final list. */
+struct group{
+	struct dupes_file* head;
+	size_t start;
+	size_t len;
+};
+
+/* Everything that dupes_find() builds up. */
+struct finder{
+	struct dupes_file* all;       /* every file, sorted by inode so that links follow the path they were merged into */
+	struct dupes_file** pending;  /* the files that still need to be read */
+	size_t pending_len;
+	struct dupes_file** done;     /* the files known to have a duplicate, with each group contiguous */
+	size_t done_len;
+	struct group* groups;
+	size_t groups_len;
+};
+
+static void finder_group(struct finder* fi, struct dupes_file** files, size_t len){
+	fi->groups[fi->groups_len].head = files[0];
+	fi->groups[fi->groups_len].start = fi->done_len;
+	fi->groups[fi->groups_len].len = len;
+	fi->groups_len++;
+	memcpy(fi->done + fi->done_len, files, len * sizeof(*files));
+	fi->done_len += len;
+}
+
+/* Sorts the files that were just hashed and keeps only those that share their size and hash with another.
+ * Groups that were hashed whole are finished, and the rest stay pending for the next stage.
+ * A lone file with hard links is a group of its own, since its names are duplicates of each other.
+ * Returns the number of files ruled out. */
+static uint64_t finder_sift(struct finder* fi){
+	struct dupes_file** files = fi->pending;
+	size_t len = fi->pending_len;
+	uint64_t ruled_out = 0;
+	size_t kept = 0;
+	size_t i = 0;
+
+	qsort(files, len, sizeof(*files), file_cmp_hash);
+	while (i < len){
+		size_t j = i + 1;
+
+		if (files[i]->failed){
+			break;
+		}
+		while (j < len && !files[j]->failed && files[j]->size == files[i]->size && files[j]->hash == files[i]->hash){
+			j++;
+		}
+
+		if (j - i == 1){
+			if (files[i]->n_links){
+				finder_group(fi, files + i, 1);
+			}
+			else{
+				ruled_out++;
+			}
+		}
+		else if (files[i]->complete){
+			finder_group(fi, files + i, j - i);
+		}
+		else{
+			memmove(files + kept, files + i, (j - i) * sizeof(*files));
+			kept += j - i;
+		}
+		i = j;
+	}
+	fi->pending_len = kept;
+	return ruled_out;
+}
+
+static int group_cmp(const void* a, const void* b){
+	const struct group* g1 = a;
+	const struct group* g2 = b;
+
+	return file_cmp_hash(&(g1->head), &(g2->head));
+}
+
+/* Runs a hashing stage over every pending file. */
+static void finder_hash(struct finder* fi, struct ffind_pool* pool, ffind_task fn, struct hash_job* job){
+	job->files = fi->pending;
+	job->bytes_read = 0;
+	ffind_pool_run(pool, fi->pending_len, fn, job);
+}
+
+int dupes_find(struct dupes* d, struct ffind_pool* pool, dupes_callback cb, void* data){
+	struct finder fi = { NULL, NULL, 0, NULL, 0, NULL, 0 };
+	struct hash_job job = { NULL, NULL, 0 };
+	const char** paths = NULL;
+	size_t n_threads = ffind_pool_threads(pool);
+	size_t total = 0;
+	size_t n = 0;
+	int ret = 0;
+
+	for (struct dupes_set* set = d->sets; set; set = set->next){
+		total += set->len;
+	}
+	d->stats.files = total;
+	if (total < 2){
+		return 0;
+	}
+
+	fi.all = malloc(total * sizeof(*(fi.all)));
+	fi.pending = malloc(total * sizeof(*(fi.pending)));
+	fi.done = malloc(total * sizeof(*(fi.done)));
+	fi.groups = malloc(total * sizeof(*(fi.groups)));
+	paths = malloc(total * sizeof(*paths));
+	job.bufs = calloc(n_threads, sizeof(*(job.bufs)));
+	if (!fi.all || !fi.pending || !fi.done || !fi.groups || !paths || !job.bufs){
+		log_enomem();
+		ret = -1;
+		goto cleanup;
+	}
+	for (size_t i = 0; i < n_threads; ++i){
+		job.bufs[i] = malloc(DUPES_READ_SIZE);
+		if (!job.bufs[i]){
+			log_enomem();
+			ret = -1;
+			goto cleanup;
+		}
+	}
+
+	for (struct dupes_set* set = d->sets; set; set = set->next){
+		for (size_t i = 0; i < set->len; ++i){
+			fi.all[n] = set->files[i];
+			fi.all[n].path = set->strings + set->files[i].path_off;
+			n++;
+		}
+	}
+
+	/* overlapping directories find the same path more than once, and it is only a duplicate of itself */
+	qsort(fi.all, total, sizeof(*(fi.all)), file_cmp_inode);
+	n = 1;
+	for (size_t i = 1; i < total; ++i){
+		if (fi.all[i].dev != fi.all[n - 1].dev || fi.all[i].ino != fi.all[n - 1].ino || strcmp(fi.all[i].path, fi.all[n - 1].path) != 0){
+			fi.all[n++] = fi.all[i];
+		}
+	}
+	total = n;
+	d->stats.files = total;
+
+	/* stage 0: sizes, which cost nothing to compare since they came with the search
+	 * only the first path to each inode is read, and the rest ride along with it */
+	for (size_t i = 0; i < total;){
+		size_t j = i + 1;
+		size_t group_start = fi.pending_len;
+
+		while (j < total && fi.all[j].size == fi.all[i].size){
+			j++;
+		}
+		for (size_t k = i; k < j;){
+			size_t l = k + 1;
+
+			while (l < j && fi.all[l].dev == fi.all[k].dev && fi.all[l].ino == fi.all[k].ino){
+				l++;
+			}
+			fi.all[k].n_links = l - k - 1;
+			d->stats.links += l - k - 1;
+			fi.pending[fi.pending_len++] = &(fi.all[k]);
+			k = l;
+		}
+
+		if (fi.pending_len - group_start == 1){
+			fi.pending_len--;
+			if (fi.all[i].n_links){
+				finder_group(&fi, fi.pending + group_start, 1);
+			}
+			else{
+				d->stats.unique_size++;
+			}
+		}
+		i = j;
+	}
+
+	/* stage 1: the first and last blocks, which tell apart most files of the same size */
+	d->stats.partial = fi.pending_len;
+	finder_hash(&fi, pool, hash_partial, &job);
+	d->stats.bytes_read += job.bytes_read;
+	d->stats.unique_partial = finder_sift(&fi);
+
+	/* stage 2: everything, but only for the files that are still left */
+	d->stats.full = fi.pending_len;
+	finder_hash(&fi, pool, hash_full, &job);
+	d->stats.bytes_read += job.bytes_read;
+	finder_sift(&fi);
+
+	d->stats.groups = fi.groups_len;
+	qsort(fi.groups, fi.groups_len, sizeof(*(fi.groups)), group_cmp);
+
+	for (size_t i = 0; i < fi.groups_len; ++i){
+		const struct group* g = &(fi.groups[i]);
+		size_t len = 0;
+
+		for (size_t j = g->start; j < g->start + g->len; ++j){
+			const struct dupes_file* f = fi.done[j];
+
+			for (size_t k = 0; k <= f->n_links; ++k){
+				paths[len++] = f[k].path;
+			}
+		}
+		qsort(paths, len, sizeof(*paths), path_cmp);
+		if (cb(paths, len, fi.done[g->start]->size, data) != 0){
+			ret = 1;
+			break;
+		}
+	}
+
+cleanup:
+	if (job.bufs){
+		for (size_t i = 0; i < n_threads; ++i){
+			free(job.bufs[i]);
+		}
+	}
+	free(job.bufs);
+	free(paths);
+	free(fi.groups);
+	free(fi.done);
+	free(fi.pending);
+	free(fi.all);
+	return ret;
+}
+
+void dupes_print_stats(const struct dupes* d){
+	const struct dupes_stats* s = &(d->stats);
+
+	eprintf_mt("ffind: duplicate search\n");
+	eprintf_mt("files considered:     %llu\n", (unsigned long long)s->files);
+	eprintf_mt("extra hard links:     %llu\n", (unsigned long long)s->links);
+	eprintf_mt("unique size:          %llu\n", (unsigned long long)s->unique_size);
+	eprintf_mt("partially hashed:     %llu\n", (unsigned long long)s->partial);
+	eprintf_mt("unique partial hash:  %llu\n", (unsigned long long)s->unique_partial);
+	eprintf_mt("fully hashed:         %llu\n", (unsigned long long)s->full);
+	eprintf_mt("bytes read:           %llu\n", (unsigned long long)s->bytes_read);
+	eprintf_mt("duplicate groups:     %llu\n", (unsigned long long)s->groups);
+}
+
+void dupes_free(struct dupes* d){
+	while (d->sets){
+		struct dupes_set* next = d->sets->next;
+		free(d->sets->files);
+		free(d->sets->strings);
+		free(d->sets);
+		d->sets = next;
+	}
+	pthread_mutex_destroy(&(d->mutex));
+}
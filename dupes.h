@@ -0,0 +1,167 @@
+/** @file dupes.h
+ * @brief Finds files with identical contents.<br>
+ * Files are grouped by size as they are found, and only files that share a size are read.
+ * Those are narrowed down by a hash of their first and last blocks, and only the files that still match are hashed in full.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __DUPES_H
+#define __DUPES_H
+
+#include "ffind.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/**
+ * @brief The size of the blocks read from the start and the end of a file for its partial hash.<br>
+ * Files up to twice this size are hashed in full by the first stage.
+ */
+#define DUPES_BLOCK_SIZE 4096
+
+/**
+ * @brief The size of each read when hashing a whole file.
+ */
+#define DUPES_READ_SIZE (256 * 1024)
+
+/**
+ * @brief A file that might have duplicates.
+ */
+struct dupes_file{
+	const char* path;         /**< The file's path. This is only set once dupes_find() starts. */
+	size_t path_off;          /**< The offset of the path within its set's strings. */
+	off_t size;               /**< The file's size. */
+	dev_t dev;                /**< The device the file is on. */
+	ino_t ino;                /**< The file's inode. */
+	uint64_t hash;            /**< The file's partial or full hash. */
+	size_t n_links;           /**< For the first path of an inode, the number of paths to it that follow in order. */
+	unsigned complete:1;      /**< True if hash covers the whole file. */
+	unsigned failed:1;        /**< True if the file could not be read. */
+};
+
+/**
+ * @brief The files found by a single thread.<br>
+ * Each thread adds to its own set, so no locking is needed.
+ */
+struct dupes_set{
+	struct dupes_file* files;  /**< The files. */
+	size_t len;                /**< The number of files. */
+	size_t cap;                /**< The allocated size of files. */
+	char* strings;             /**< The files' paths, packed as NUL-terminated strings. */
+	size_t strings_len;        /**< The number of bytes used in strings. */
+	size_t strings_cap;        /**< The allocated size of strings. */
+	struct dupes_set* next;    /**< The next set of the same dupes structure. */
+};
+
+/**
+ * @brief Counters showing how many files each stage ruled out.
+ */
+struct dupes_stats{
+	uint64_t files;          /**< Non-empty regular files found. */
+	uint64_t links;          /**< Paths that were hard links to an inode already found, which are never read twice. */
+	uint64_t unique_size;    /**< Files ruled out because no other file has their size. */
+	uint64_t partial;        /**< Files whose first and last blocks were hashed. */
+	uint64_t unique_partial; /**< Files ruled out by the partial hash. */
+	uint64_t full;           /**< Files that were hashed in full. */
+	uint64_t bytes_read;     /**< Bytes read by both stages. */
+	uint64_t groups;         /**< Groups of duplicates found. */
+};
+
+/**
+ * @brief Everything needed to find duplicates among the files from a set of searches.
+ */
+struct dupes{
+	struct dupes_set* sets;  /**< Every thread's set. */
+	pthread_mutex_t mutex;   /**< Protects sets. */
+	struct dupes_stats stats; /**< Filled in by dupes_find(). */
+};
+
+/**
+ * @brief Receives a group of duplicate files.
+ *
+ * @param paths The paths of the files, in sorted order.<br>
+ * Hard links to the same file are all listed.
+ *
+ * @param n The number of paths. This is at least 2.
+ *
+ * @param size The size of each file.
+ *
+ * @param data The data passed to dupes_find().
+ *
+ * @return 0 to continue, or nonzero to stop.
+ */
+typedef int (*dupes_callback)(const char* const* paths, size_t n, off_t size, void* data);
+
+/**
+ * @brief Initializes a dupes structure.
+ *
+ * @param d The structure to initialize.<br>
+ * This must be freed with dupes_free() when no longer in use.
+ * @see dupes_free()
+ */
+void dupes_init(struct dupes* d);
+
+/**
+ * @brief Creates a set for a thread to add files to.<br>
+ * This function is thread-safe.
+ *
+ * @param d The dupes structure the set belongs to.
+ *
+ * @return A new set, or NULL if memory could not be allocated.<br>
+ * The set is freed with the dupes structure.
+ */
+struct dupes_set* dupes_set_new(struct dupes* d);
+
+/**
+ * @brief Adds a file as a candidate.<br>
+ * Anything that is not a non-empty regular file is ignored.
+ *
+ * @param set The calling thread's set.
+ *
+ * @param path The file's path.
+ *
+ * @param path_len strlen(path)
+ *
+ * @param st The file's metadata.
+ *
+ * @return 0 on success, negative if memory could not be allocated.
+ */
+int dupes_add(struct dupes_set* set, const char* path, size_t path_len, const struct stat* st);
+
+/**
+ * @brief Finds every group of files with identical contents.<br>
+ * Files are compared by size, then by a hash of their first and last DUPES_BLOCK_SIZE bytes, then by a hash of their whole contents.<br>
+ * Each stage is spread over the pool's threads.<br>
+ * No more files can be added once this is called.
+ *
+ * @param d The dupes structure.
+ *
+ * @param pool The pool to read files with.
+ *
+ * @param cb Called with each group, in order of file size.
+ *
+ * @param data Passed to cb.
+ *
+ * @return 0 on success, positive if cb stopped early, negative if memory could not be allocated.
+ */
+int dupes_find(struct dupes* d, struct ffind_pool* pool, dupes_callback cb, void* data);
+
+/**
+ * @brief Prints the counters of a dupes structure to stderr.
+ *
+ * @param d The dupes structure.
+ */
+void dupes_print_stats(const struct dupes* d);
+
+/**
+ * @brief Releases the memory held by a dupes structure.
+ *
+ * @param d The dupes structure.
+ */
+void dupes_free(struct dupes* d);
+
+#endif
@@ -0,0 +1,615 @@
+/** @file extsort.c
+ * @brief Sorts any number of results by a key, spilling to temporary files.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "extsort.h"
+#include "log.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* A result, followed by its NUL-terminated path and padding up to REC_ALIGN.
+ * Runs are written exactly as they are buffered, so they can be read back in place. */
+struct rec{
+	int64_t key;
+	struct stat st;
+	size_t path_len;
+	int depth;
+};
+
+struct rec_align{
+	char c;
+	struct rec r;
+};
+#define REC_ALIGN offsetof(struct rec_align, r)
+
+/* The next run, or the rest of a run, that a merge reads from.
+ * A set's buffered results are merged straight from memory through recs instead. */
+struct source{
+	const struct rec* cur;
+	const struct rec** recs;
+	size_t i;
+	size_t n;
+	int fd;
+	off_t off;
+	off_t end;
+	char* buf;
+	size_t pos;
+	size_t len;
+	size_t cap;
+};
+
+/* Buffers what a merge pass writes. */
+struct writer{
+	int fd;
+	off_t len;
+	char* buf;
+	size_t buf_len;
+};
+
+static size_t rec_size(size_t path_len){
+	size_t size = sizeof(struct rec) + path_len + 1;
+	return (size + REC_ALIGN - 1) / REC_ALIGN * REC_ALIGN;
+}
+
+static const char* rec_path(const struct rec* r){
+	return (const char*)(r + 1);
+}
+
+/* Returns negative if a ranks below b, positive if it ranks above, and 0 if they are the same, breaking ties like topk. */
+static int rec_cmp(const struct rec* a, const struct rec* b){
+	if (a->key != b->key){
+		return a->key < b->key ? -1 : 1;
+	}
+	if (a->path_len != b->path_len){
+		return a->path_len > b->path_len ? -1 : 1;
+	}
+	return -memcmp(rec_path(a), rec_path(b), a->path_len);
+}
+
+static int sort_cmp(const void* a, const void* b){
+	return rec_cmp(*(const struct rec* const*)b, *(const struct rec* const*)a);
+}
+
+/* Creates an unlinked file in $TMPDIR, or /tmp if it is not set.
+ * Returns the file, or -1 on failure. */
+static int open_temp(void){
+	const char* dir = getenv("TMPDIR");
+	char* path;
+	int fd;
+
+	if (!dir || !dir[0]){
+		dir = "/tmp";
+	}
+	path = malloc(strlen(dir) + sizeof("/ffind-sort-XXXXXX"));
+	if (!path){
+		log_enomem();
+		return -1;
+	}
+	sprintf(path, "%s/ffind-sort-XXXXXX", dir);
+	fd = mkstemp(path);
+	if (fd < 0){
+		eprintf_mt("ffind: failed to create a temporary file in %s (%s)\n", dir, strerror(errno));
+	}
+	else{
+		/* the file is gone as soon as it is closed, even if ffind is killed */
+		unlink(path);
+	}
+	free(path);
+	return fd;
+}
+
+/* Returns 0 on success, negative on failure. */
+static int write_all(int fd, const char* data, size_t len){
+	while (len > 0){
+		ssize_t res = write(fd, data, len);
+		if (res < 0){
+			if (errno == EINTR){
+				continue;
+			}
+			eprintf_mt("ffind: failed to write a temporary file (%s)\n", strerror(errno));
+			return -1;
+		}
+		data += res;
+		len -= (size_t)res;
+	}
+	return 0;
+}
+
+static int writer_flush(struct writer* w){
+	if (write_all(w->fd, w->buf, w->buf_len) != 0){
+		return -1;
+	}
+	w->len += (off_t)w->buf_len;
+	w->buf_len = 0;
+	return 0;
+}
+
+static int writer_put(struct writer* w, const struct rec* r){
+	size_t size = rec_size(r->path_len);
+
+	if (w->buf_len + size > EXTSORT_READ_SIZE && writer_flush(w) != 0){
+		return -1;
+	}
+	if (size > EXTSORT_READ_SIZE){
+		if (write_all(w->fd, (const char*)r, size) != 0){
+			return -1;
+		}
+		w->len += (off_t)size;
+		return 0;
+	}
+	memcpy(w->buf + w->buf_len, r, size);
+	w->buf_len += size;
+	return 0;
+}
+
+/* Makes sure the next need bytes of a run are in its buffer.
+ * Returns 0 on success, negative on failure. */
+static int source_fill(struct source* src, size_t need){
+	if (src->len - src->pos >= need){
+		return 0;
+	}
+	memmove(src->buf, src->buf + src->pos, src->len - src->pos);
+	src->len -= src->pos;
+	src->pos = 0;
+	if (need > src->cap){
+		char* tmp = realloc(src->buf, need);
+		if (!tmp){
+			log_enomem();
+			return -1;
+		}
+		src->buf = tmp;
+		src->cap = need;
+	}
+
+	while (src->len < need){
+		size_t want = src->cap - src->len;
+		ssize_t res;
+
+		if ((off_t)want > src->end - src->off){
+			want = (size_t)(src->end - src->off);
+		}
+		if (want == 0){
+			eprintf_mt("ffind: a temporary file ended early\n");
+			return -1;
+		}
+		res = pread(src->fd, src->buf + src->len, want, src->off);
+		if (res < 0 && errno == EINTR){
+			continue;
+		}
+		if (res <= 0){
+			eprintf_mt("ffind: failed to read a temporary file (%s)\n", res < 0 ? strerror(errno) : "unexpected end of file");
+			return -1;
+		}
+		src->off += res;
+		src->len += (size_t)res;
+	}
+	return 0;
+}
+
+/* Moves a source to its next result, setting cur to NULL once it has none left.
+ * Returns 0 on success, negative on failure. */
+static int source_next(struct source* src){
+	if (src->recs){
+		src->cur = src->i < src->n ? src->recs[src->i++] : NULL;
+		return 0;
+	}
+
+	if (src->cur){
+		src->pos += rec_size(src->cur->path_len);
+		src->cur = NULL;
+	}
+	if (src->pos == src->len && src->off == src->end){
+		return 0;
+	}
+	if (source_fill(src, sizeof(struct rec)) != 0 || source_fill(src, rec_size(((const struct rec*)(src->buf + src->pos))->path_len)) != 0){
+		return -1;
+	}
+	src->cur = (const struct rec*)(src->buf + src->pos);
+	return 0;
+}
+
+/* Restores the heap of sources after the one at i got worse, keeping the source with the best result at the root. */
+static void heap_down(struct source** heap, size_t len, size_t i){
+	for (;;){
+		size_t best = i;
+		size_t l = 2 * i + 1;
+		size_t r = l + 1;
+
+		if (l < len && rec_cmp(heap[l]->cur, heap[best]->cur) > 0){
+			best = l;
+		}
+		if (r < len && rec_cmp(heap[r]->cur, heap[best]->cur) > 0){
+			best = r;
+		}
+		if (best == i){
+			break;
+		}
+		struct source* tmp = heap[i];
+		heap[i] = heap[best];
+		heap[best] = tmp;
+		i = best;
+	}
+}
+
+/* Merges sources that are each already sorted, passing every result to emit in order.
+ * Returns 0 on success, negative on failure or if emit returned nonzero. */
+static int merge(struct source* srcs, size_t n, int (*emit)(const struct rec*, void*), void* data){
+	struct source** heap = malloc((n ? n : 1) * sizeof(*heap));
+	size_t len = 0;
+	int ret = 0;
+
+	if (!heap){
+		log_enomem();
+		return -1;
+	}
+	for (size_t i = 0; i < n; ++i){
+		if (source_next(&(srcs[i])) != 0){
+			ret = -1;
+			goto cleanup;
+		}
+		if (srcs[i].cur){
+			heap[len++] = &(srcs[i]);
+		}
+	}
+	for (size_t i = len / 2; i > 0; --i){
+		heap_down(heap, len, i - 1);
+	}
+
+	while (len > 0){
+		if (emit(heap[0]->cur, data) != 0 || source_next(heap[0]) != 0){
+			ret = -1;
+			goto cleanup;
+		}
+		if (!heap[0]->cur){
+			heap[0] = heap[--len];
+		}
+		heap_down(heap, len, 0);
+	}
+
+cleanup:
+	free(heap);
+	return ret;
+}
+
+/* Points a source at a run, with a buffer to read it through.
+ * Returns 0 on success, negative on failure. */
+static int source_run(struct source* src, const struct extsort_run* run){
+	memset(src, 0, sizeof(*src));
+	src->fd = run->fd;
+	src->off = run->off;
+	src->end = run->off + run->len;
+	src->buf = malloc(EXTSORT_READ_SIZE);
+	if (!src->buf){
+		log_enomem();
+		return -1;
+	}
+	src->cap = EXTSORT_READ_SIZE;
+	return 0;
+}
+
+/* Sorts a set's buffered results.
+ * Returns an array of them from best to worst, or NULL on failure. */
+static const struct rec** set_sort(struct extsort_set* set){
+	const struct rec** recs = malloc((set->n ? set->n : 1) * sizeof(*recs));
+	size_t off = 0;
+
+	if (!recs){
+		log_enomem();
+		return NULL;
+	}
+	for (size_t i = 0; i < set->n; ++i){
+		recs[i] = (const struct rec*)(set->data + off);
+		off += rec_size(recs[i]->path_len);
+	}
+	qsort(recs, set->n, sizeof(*recs), sort_cmp);
+	return recs;
+}
+
+/* Sorts a set's buffered results and writes them to its temporary file as a run.
+ * Returns 0 on success, negative on failure. */
+static int set_spill(struct extsort_set* set){
+	struct extsort* es = set->es;
+	const struct rec** recs;
+	struct writer w;
+	int ret = 0;
+
+	if (set->fd < 0){
+		set->fd = open_temp();
+		if (set->fd < 0){
+			return -1;
+		}
+	}
+	recs = set_sort(set);
+	w.buf = malloc(EXTSORT_READ_SIZE);
+	if (!recs || !w.buf){
+		if (recs){
+			log_enomem();
+		}
+		free(recs);
+		free(w.buf);
+		return -1;
+	}
+	w.fd = set->fd;
+	w.len = 0;
+	w.buf_len = 0;
+	for (size_t i = 0; i < set->n && ret == 0; ++i){
+		ret = writer_put(&w, recs[i]);
+	}
+	if (ret == 0){
+		ret = writer_flush(&w);
+	}
+	free(recs);
+	free(w.buf);
+	if (ret != 0){
+		return -1;
+	}
+
+	pthread_mutex_lock(&(es->mutex));
+	if (es->runs_len == es->runs_cap){
+		size_t cap = es->runs_cap ? es->runs_cap * 2 : 16;
+		struct extsort_run* tmp = realloc(es->runs, cap * sizeof(*tmp));
+		if (!tmp){
+			pthread_mutex_unlock(&(es->mutex));
+			log_enomem();
+			return -1;
+		}
+		es->runs = tmp;
+		es->runs_cap = cap;
+	}
+	es->runs[es->runs_len].fd = set->fd;
+	es->runs[es->runs_len].off = set->file_len;
+	es->runs[es->runs_len].len = w.len;
+	es->runs_len++;
+	pthread_mutex_unlock(&(es->mutex));
+
+	set->file_len += w.len;
+	set->len = 0;
+	set->n = 0;
+	return 0;
+}
+
+void extsort_init(struct extsort* es, size_t n_threads){
+	es->sets = NULL;
+	es->runs = NULL;
+	es->runs_len = 0;
+	es->runs_cap = 0;
+	es->fd = -1;
+	es->run_size = EXTSORT_MEMORY / (n_threads ? n_threads : 1);
+	if (es->run_size < EXTSORT_MIN_RUN_SIZE){
+		es->run_size = EXTSORT_MIN_RUN_SIZE;
+	}
+	pthread_mutex_init(&(es->mutex), NULL);
+}
+
+struct extsort_set* extsort_set_new(struct extsort* es){
+	struct extsort_set* set = calloc(1, sizeof(*set));
+
+	if (!set){
+		log_enomem();
+		return NULL;
+	}
+	set->es = es;
+	set->fd = -1;
+
+	pthread_mutex_lock(&(es->mutex));
+	set->next = es->sets;
+	es->sets = set;
+	pthread_mutex_unlock(&(es->mutex));
+	return set;
+}
+
+int extsort_add(struct extsort_set* set, int64_t key, const char* path, size_t path_len, const struct stat* st, int depth){
+	size_t run_size = set->es->run_size;
+	size_t size = rec_size(path_len);
+	struct rec* r;
+
+	if (set->n > 0 && set->len + size > run_size && set_spill(set) != 0){
+		return -1;
+	}
+	if (set->len + size > set->cap){
+		size_t cap = set->cap ? set->cap * 2 : 65536;
+		char* tmp;
+
+		while (cap < set->len + size){
+			cap *= 2;
+		}
+		/* the buffer only outgrows the run size for a single oversized result */
+		if (cap > run_size && set->len + size <= run_size){
+			cap = run_size;
+		}
+		tmp = realloc(set->data, cap);
+		if (!tmp){
+			log_enomem();
+			return -1;
+		}
+		set->data = tmp;
+		set->cap = cap;
+	}
+
+	r = (struct rec*)(set->data + set->len);
+	r->key = key;
+	r->st = *st;
+	r->path_len = path_len;
+	r->depth = depth;
+	memcpy(r + 1, path, path_len);
+	((char*)(r + 1))[path_len] = '\0';
+	set->len += size;
+	set->n++;
+	return 0;
+}
+
+static int emit_writer(const struct rec* r, void* data){
+	return writer_put(data, r);
+}
+
+/* Merges the runs EXTSORT_FAN_IN at a time into a new temporary file, and closes the files they were in.
+ * Returns 0 on success, negative on failure. */
+static int merge_pass(struct extsort* es){
+	size_t n_runs = (es->runs_len + EXTSORT_FAN_IN - 1) / EXTSORT_FAN_IN;
+	struct extsort_run* runs = malloc(n_runs * sizeof(*runs));
+	struct source* srcs = calloc(EXTSORT_FAN_IN, sizeof(*srcs));
+	struct writer w;
+	int ret = 0;
+
+	w.fd = -1;
+	w.len = 0;
+	w.buf_len = 0;
+	w.buf = malloc(EXTSORT_READ_SIZE);
+	if (!runs || !srcs || !w.buf){
+		log_enomem();
+		ret = -1;
+		goto cleanup;
+	}
+	w.fd = open_temp();
+	if (w.fd < 0){
+		ret = -1;
+		goto cleanup;
+	}
+
+	for (size_t i = 0; i < n_runs; ++i){
+		size_t first = i * EXTSORT_FAN_IN;
+		size_t n = es->runs_len - first < EXTSORT_FAN_IN ? es->runs_len - first : EXTSORT_FAN_IN;
+		off_t start = w.len;
+
+		for (size_t j = 0; j < n; ++j){
+			if (source_run(&(srcs[j]), &(es->runs[first + j])) != 0){
+				ret = -1;
+			}
+		}
+		if (ret == 0 && (merge(srcs, n, emit_writer, &w) != 0 || writer_flush(&w) != 0)){
+			ret = -1;
+		}
+		for (size_t j = 0; j < n; ++j){
+			free(srcs[j].buf);
+			srcs[j].buf = NULL;
+		}
+		if (ret != 0){
+			goto cleanup;
+		}
+		runs[i].fd = w.fd;
+		runs[i].off = start;
+		runs[i].len = w.len - start;
+	}
+
+	/* every run is in the new file now */
+	for (struct extsort_set* set = es->sets; set; set = set->next){
+		if (set->fd >= 0){
+			close(set->fd);
+			set->fd = -1;
+		}
+	}
+	if (es->fd >= 0){
+		close(es->fd);
+	}
+	es->fd = w.fd;
+	w.fd = -1;
+	free(es->runs);
+	es->runs = runs;
+	es->runs_len = n_runs;
+	es->runs_cap = n_runs;
+	runs = NULL;
+
+cleanup:
+	if (w.fd >= 0){
+		close(w.fd);
+	}
+	free(w.buf);
+	free(srcs);
+	free(runs);
+	return ret;
+}
+
+struct emit_data{
+	extsort_callback cb;
+	void* data;
+};
+
+static int emit_callback(const struct rec* r, void* data){
+	struct emit_data* ed = data;
+	return ed->cb(rec_path(r), r->path_len, &(r->st), r->depth, ed->data);
+}
+
+int extsort_finish(struct extsort* es, extsort_callback cb, void* data){
+	struct source* srcs = NULL;
+	size_t n_srcs = 0;
+	size_t n_buffered = 0;
+	struct emit_data ed;
+	int ret = 0;
+
+	for (struct extsort_set* set = es->sets; set; set = set->next){
+		n_buffered += set->n > 0;
+	}
+	/* what is still buffered is merged straight from memory, unless there are too many sources for one merge */
+	if (es->runs_len + n_buffered > EXTSORT_FAN_IN){
+		for (struct extsort_set* set = es->sets; set; set = set->next){
+			if (set->n > 0 && set_spill(set) != 0){
+				return -1;
+			}
+		}
+		n_buffered = 0;
+	}
+	while (es->runs_len > EXTSORT_FAN_IN){
+		if (merge_pass(es) != 0){
+			return -1;
+		}
+	}
+
+	srcs = calloc(es->runs_len + n_buffered + 1, sizeof(*srcs));
+	if (!srcs){
+		log_enomem();
+		return -1;
+	}
+	for (size_t i = 0; i < es->runs_len; ++i){
+		if (source_run(&(srcs[n_srcs++]), &(es->runs[i])) != 0){
+			ret = -1;
+			goto cleanup;
+		}
+	}
+	for (struct extsort_set* set = es->sets; set; set = set->next){
+		if (set->n > 0){
+			srcs[n_srcs].recs = set_sort(set);
+			srcs[n_srcs].n = set->n;
+			if (!srcs[n_srcs++].recs){
+				ret = -1;
+				goto cleanup;
+			}
+		}
+	}
+
+	ed.cb = cb;
+	ed.data = data;
+	ret = merge(srcs, n_srcs, emit_callback, &ed);
+
+cleanup:
+	for (size_t i = 0; i < n_srcs; ++i){
+		free(srcs[i].buf);
+		free(srcs[i].recs);
+	}
+	free(srcs);
+	return ret;
+}
+
+void extsort_free(struct extsort* es){
+	while (es->sets){
+		struct extsort_set* next = es->sets->next;
+
+		if (es->sets->fd >= 0){
+			close(es->sets->fd);
+		}
+		free(es->sets->data);
+		free(es->sets);
+		es->sets = next;
+	}
+	if (es->fd >= 0){
+		close(es->fd);
+	}
+	free(es->runs);
+	pthread_mutex_destroy(&(es->mutex));
+}
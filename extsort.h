@@ -0,0 +1,159 @@
+/** @file extsort.h
+ * @brief Sorts any number of results by a key for --sort, spilling to temporary files instead of holding them all in memory.<br>
+ * Each thread buffers its results in its own set, and once a set's buffer is full, it is sorted and written to the thread's temporary file as a run.
+ * When the search is finished, the runs and whatever is still buffered are merged, EXTSORT_FAN_IN at a time, until a single pass can produce the output.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __EXTSORT_H
+#define __EXTSORT_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/**
+ * @brief The most memory the buffered results of every thread take together, before they are written out as runs.
+ */
+#define EXTSORT_MEMORY (64 << 20)
+
+/**
+ * @brief The least memory each thread's buffered results may take, however many threads there are.
+ */
+#define EXTSORT_MIN_RUN_SIZE (256 << 10)
+
+/**
+ * @brief The most runs merged at once.<br>
+ * Each of them needs an EXTSORT_READ_SIZE buffer while it is merged.
+ */
+#define EXTSORT_FAN_IN 64
+
+/**
+ * @brief The size of the buffers runs are read and written through.
+ */
+#define EXTSORT_READ_SIZE 65536
+
+/**
+ * @brief A sorted run in a temporary file.
+ */
+struct extsort_run{
+	int fd;     /**< The file it is in. This belongs to the set or merge pass that wrote it. */
+	off_t off;  /**< Where it starts. */
+	off_t len;  /**< Its length in bytes. */
+};
+
+/**
+ * @brief The results found by a single thread.<br>
+ * Each thread adds to its own set, so no locking is needed until a run is written.
+ */
+struct extsort_set{
+	struct extsort* es;         /**< The sort the set belongs to. */
+	char* data;                 /**< The buffered results, packed one after another. */
+	size_t len;                 /**< The number of bytes used in data. */
+	size_t cap;                 /**< The allocated size of data. */
+	size_t n;                   /**< The number of buffered results. */
+	int fd;                     /**< The thread's temporary file, or -1 until the first run is written. */
+	off_t file_len;             /**< The length of the temporary file. */
+	struct extsort_set* next;   /**< The next set of the same sort. */
+};
+
+/**
+ * @brief Everything needed to sort the results from a set of searches.
+ */
+struct extsort{
+	struct extsort_set* sets;   /**< Every thread's set. */
+	struct extsort_run* runs;   /**< The runs written so far. */
+	size_t runs_len;            /**< The number of runs. */
+	size_t runs_cap;            /**< The allocated size of runs. */
+	int fd;                     /**< The temporary file of the latest merge pass, or -1. */
+	size_t run_size;            /**< The most memory each set's buffered results take. */
+	pthread_mutex_t mutex;      /**< Protects sets and runs. */
+};
+
+/**
+ * @brief Receives the sorted results one at a time.
+ *
+ * @param path The result's path.
+ *
+ * @param path_len strlen(path)
+ *
+ * @param st The result's metadata.
+ *
+ * @param depth The result's depth.
+ *
+ * @param data The data passed to extsort_finish().
+ *
+ * @return 0 to continue, or nonzero to stop.
+ */
+typedef int (*extsort_callback)(const char* path, size_t path_len, const struct stat* st, int depth, void* data);
+
+/**
+ * @brief Initializes a sort.
+ *
+ * @param es The sort to initialize.<br>
+ * This must be freed with extsort_free() when no longer in use.
+ * @see extsort_free()
+ *
+ * @param n_threads The number of threads that will add results, which share EXTSORT_MEMORY between them.
+ */
+void extsort_init(struct extsort* es, size_t n_threads);
+
+/**
+ * @brief Creates a set for a thread to add results to.<br>
+ * This function is thread-safe.
+ *
+ * @param es The sort the set belongs to.
+ *
+ * @return A new set, or NULL if memory could not be allocated.<br>
+ * The set is freed with the sort.
+ */
+struct extsort_set* extsort_set_new(struct extsort* es);
+
+/**
+ * @brief Adds a result.<br>
+ * If the set's buffer is full, its results are sorted and written to a temporary file first.
+ *
+ * @param set The calling thread's set.
+ *
+ * @param key The result's sort key. Results are sorted from the highest key to the lowest, like the ranks of a topk heap.
+ *
+ * @param path The result's path.
+ *
+ * @param path_len strlen(path)
+ *
+ * @param st The result's metadata.
+ *
+ * @param depth The result's depth.
+ *
+ * @return 0 on success, negative on failure.
+ */
+int extsort_add(struct extsort_set* set, int64_t key, const char* path, size_t path_len, const struct stat* st, int depth);
+
+/**
+ * @brief Merges every set's results and passes them to a callback in sorted order.<br>
+ * Ties are broken like topk_offer() does, so the first N results are the ones a topk heap of size N would keep.<br>
+ * Nothing may be added to the sets while this runs.
+ *
+ * @param es The sort.
+ *
+ * @param cb Receives the results.
+ *
+ * @param data Passed to cb.
+ *
+ * @return 0 on success, negative on failure or if cb stopped the merge.
+ */
+int extsort_finish(struct extsort* es, extsort_callback cb, void* data);
+
+/**
+ * @brief Releases the memory and temporary files held by a sort.
+ *
+ * @param es The sort to free.
+ */
+void extsort_free(struct extsort* es);
+
+#endif
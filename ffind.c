@@ -6,9 +6,18 @@
  * of the MIT license.  See the LICENSE file for details.
  */
 
+/* d_type */
+#define _DEFAULT_SOURCE
+
 #include "ffind.h"
+#include "contents.h"
+#include "dirnode.h"
+#include "fuzzy.h"
 #include "match.h"
 #include "options.h"
+#include "stats.h"
+#include "throttle.h"
+#include "trace.h"
 #include "log.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,297 +26,2219 @@
 #include <dirent.h>
 #include <stdint.h>
 #include <errno.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/stat.h>
-#include <stdarg.h>
+#ifdef __linux__
+#include <sys/vfs.h>
+#endif
+
+/* A directory waiting to be searched, or part of one.
+ * If names is not NULL, the item is a chunk of a large directory's entries that were already read, packed as NUL-terminated names that each start with the entry's d_type.
+ * If flat is set, the subdirectories among its entries are matched but not searched, since they are queued separately or belong to another shard.
+ * Each item holds a reference to its node. */
+struct dir_item{
+	struct dir_node* node;
+	char* names;
+	size_t names_len;
+	int flat;
+};
+
+/* An entry read from a directory, waiting to be stat'd in inode order. */
+struct inode_entry{
+	ino_t ino;
+	/* the offset of the name in ffind_thread_data::split, which is also readdir order */
+	size_t off;
+	size_t index;
+};
+
+/* Results waiting to be delivered.
+ * The paths are packed into strings; the path pointers are only filled in by batch_finish(),
+ * since strings can move while the batch is being filled. */
+struct ffind_batch{
+	struct ffind_result* results;
+	size_t len;
+	size_t cap;
+	char* strings;
+	size_t strings_len;
+	size_t strings_cap;
+	struct ffind_batch* next;
+};
+
+/* State owned by a single pool thread. */
+struct ffind_thread_data{
+	struct contents_buf cb;
+	struct ffind_stats* stats;
+	struct trace_buf* trace;
+	unsigned sample;
+	size_t index;
+	struct ffind_batch* batch;
+	char* path;
+	size_t path_cap;
+	/* names of subdirectories to queue once the current directory is finished, packed as NUL-terminated strings */
+	char* children;
+	size_t children_len;
+	size_t children_cap;
+	size_t n_children;
+	/* names read from a large directory that have not been handed out yet */
+	char* split;
+	size_t split_len;
+	size_t split_cap;
+	size_t split_count;
+	/* with a pattern match_batch() can filter, the names read from the current directory that have not been matched yet.
+	 * the offsets and d_types are per name, and names_max is the length of the longest one. */
+	char* names;
+	size_t names_len;
+	size_t names_cap;
+	size_t names_max;
+	size_t n_names;
+	size_t name_offs[MATCH_BATCH_MAX + 1];
+	unsigned char name_types[MATCH_BATCH_MAX];
+	unsigned char hits[MATCH_BATCH_MAX];
+	/* whether the entry being handled by a MATCHER_BATCH variant matched */
+	int hit;
+	/* with --inode-order, the entries of the current window and, to restore readdir order, their metadata */
+	struct inode_entry* ents;
+	size_t ents_cap;
+	struct stat* ent_stats;
+	size_t ent_stats_cap;
+	/* time spent working on directories, read by the adaptive controller */
+	uint64_t busy_ns;
+	/* time spent waiting on the search's throttles while working on the current directory */
+	uint64_t throttled_ns;
+	/* progress counters, written only by this thread and read by ffind_pool_progress() without the lock */
+	uint64_t n_dirs;
+	uint64_t n_entries;
+	uint64_t n_matches;
+	/* the end of the path of the directory being worked on, and the full length of the path, or 0 while idle.
+	 * dir_seq is odd while they are being written, so a reader that sees it change knows its copy is torn. */
+	unsigned dir_seq;
+	size_t dir_len;
+	uint64_t dir_words[FFIND_PROGRESS_PATH / sizeof(uint64_t)];
+};
+
+struct ffind_pool_thread{
+	struct ffind_pool* pool;
+	pthread_t thread;
+	struct ffind_thread_data td;
+};
+
+struct ffind_pool{
+	/* protects everything in the pool and in its searches that is not owned by a single thread */
+	pthread_mutex_t mutex;
+	/* signalled when a directory is pushed or the pool shuts down */
+	pthread_cond_t cond;
+	struct ffind_pool_thread* threads;
+	size_t n_threads;
+	struct ffind_search* searches;
+	/* threads with an index at or above this wait on park_cond instead of taking work */
+	size_t active_limit;
+	size_t min_threads;
+	pthread_cond_t park_cond;
+	pthread_t controller;
+	/* set before the threads start and never changed, since workers read it without the lock */
+	unsigned adaptive:1;
+	unsigned shutdown:1;
+	/* set before any search starts and never changed, for the same reason */
+	ffind_dir_hook dir_hook;
+	/* whether the controller thread needs to be joined */
+	int has_controller;
+	/* the ffind_pool_run() in progress, if job_len is nonzero */
+	ffind_task job_fn;
+	void* job_data;
+	size_t job_len;
+	size_t job_next;
+	size_t job_done;
+	/* signalled when every run of a job is done */
+	pthread_cond_t job_cond;
+	/* the number of directories on every search's stack.
+	 * this is only changed with the lock held, but ffind_pool_progress() reads it without. */
+	size_t queued;
+};
+
+/* The pattern engines the per-entry code is specialized for. */
+enum entry_matcher{
+	MATCHER_ALL = 0,  /* the pattern matches everything, like the default "*" */
+	MATCHER_FNMATCH,
+	MATCHER_LITERAL,
+	MATCHER_REGEX,    /* POSIX basic or extended */
+	MATCHER_BATCH,    /* already matched by match_batch(), with the result in ffind_thread_data::hit */
+	MATCHER_ANY       /* anything else, left to match() */
+};
 
-static pthread_mutex_t mutex_dir_stack = PTHREAD_MUTEX_INITIALIZER;
+struct ffind_search;
+struct ffind_thread_data;
 
-char** dir_stack = NULL;
-size_t dir_stack_len = 0;
+/* Stats and matches a single entry. See search_entry_spec(). */
+typedef int (*search_entry_fn)(struct ffind_search* s, struct ffind_thread_data* td, size_t base_len, size_t name_len, int depth, int descend);
 
-struct ffind_param{
+struct ffind_search{
+	struct ffind_pool* pool;
 	const struct pattern* p;
+	const struct pattern* contains;
 	const struct ffind_flags* flags;
+	off_t contains_maxsize;
+	/* the variant of the per-entry code for the search's options */
+	search_entry_fn search_entry;
+	/* the MATCHER_BATCH variant, or NULL if names are matched one at a time */
+	search_entry_fn search_entry_batch;
+	/* NULL without --fuzzy */
+	const struct fuzzy_query* fuzzy;
+	/* the length of the base directory and the slash after it */
+	size_t root_len;
 	int maxdepth;
+	size_t max_results;
+	/* the stats_now() time the search stops at, or 0 for none */
+	uint64_t deadline;
+	/* --max-iops and --max-dirs-per-sec, shared by every thread working on the search */
+	struct throttle iops;
+	struct throttle dirs;
+
+	struct dir_item* stack;
+	size_t stack_len;
+	size_t stack_cap;
+	/* the nodes of every queued directory and their parents */
+	struct dir_arena arena;
+	/* to compare with the nodes, the memory the queued paths would take as separate strings */
+	size_t path_bytes;
+	size_t peak_path_bytes;
+	size_t peak_stack_len;
+	/* the number of pool threads working on this search's directories */
+	size_t active;
+	int cancelled;
+	uint64_t cancel_time;
+	/* results handed to the consumer, plus those reserved by batches still being delivered */
+	size_t n_results;
+	int status;
+	unsigned done:1;
+	/* set by ffind_search_checkpoint() while it waits for the directories in progress, so no thread starts another */
+	unsigned paused:1;
+	/* signalled when a batch is queued or dequeued, or the search finishes */
+	pthread_cond_t cond;
+
+	ffind_callback cb;
+	void* cb_data;
+	struct ffind_batch* queue_head;
+	struct ffind_batch* queue_tail;
+	size_t queue_len;
+	struct ffind_batch* current;
+	struct ffind_batch* free_batches;
+
+	struct stats_set* stats;
+	struct ffind_search* next;
 };
 
-/* Pushes a directory on to the stack.
- * This string must be allocated with malloc().
- * This function is thread-safe. */
-static int dir_stack_push(char* entry){
-	void* tmp;
-	pthread_mutex_lock(&mutex_dir_stack);
+static struct ffind_batch* batch_new(void){
+	struct ffind_batch* b = calloc(1, sizeof(*b));
+	if (!b){
+		log_enomem();
+	}
+	return b;
+}
 
-	dir_stack_len++;
+static void batch_free(struct ffind_batch* b){
+	if (!b){
+		return;
+	}
+	free(b->results);
+	free(b->strings);
+	free(b);
+}
 
-	/* can't use dir_stack = realloc(dir_stack, ...).
-	 * if realloc fails in the above case, the pointer (which we lost though assignment) is still valid, causing a mem leak. */
-	tmp = realloc(dir_stack, dir_stack_len * sizeof(*dir_stack));
-	if (!tmp){
-		pthread_mutex_unlock(&mutex_dir_stack);
-		return -1;
+static void batch_free_list(struct ffind_batch* b){
+	while (b){
+		struct ffind_batch* next = b->next;
+		batch_free(b);
+		b = next;
+	}
+}
+
+/* Appends a result to a batch.
+ * Returns 0 on success, negative on failure. */
+FF_HOT static int batch_add(struct ffind_batch* b, const char* path, size_t path_len, const struct stat* st, int depth, int score){
+	struct ffind_result* r;
+
+	if (b->len == b->cap){
+		size_t cap = b->cap ? b->cap * 2 : 64;
+		void* tmp = realloc(b->results, cap * sizeof(*(b->results)));
+		if (!tmp){
+			log_enomem();
+			return -1;
+		}
+		b->results = tmp;
+		b->cap = cap;
+	}
+	if (b->strings_len + path_len + 1 > b->strings_cap){
+		size_t cap = b->strings_cap ? b->strings_cap * 2 : 4096;
+		void* tmp;
+		while (cap < b->strings_len + path_len + 1){
+			cap *= 2;
+		}
+		tmp = realloc(b->strings, cap);
+		if (!tmp){
+			log_enomem();
+			return -1;
+		}
+		b->strings = tmp;
+		b->strings_cap = cap;
 	}
-	dir_stack = tmp;
 
-	dir_stack[dir_stack_len - 1] = entry;
+	memcpy(b->strings + b->strings_len, path, path_len + 1);
+	b->strings_len += path_len + 1;
 
-	pthread_mutex_unlock(&mutex_dir_stack);
+	r = &(b->results[b->len]);
+	r->path = NULL;
+	r->path_len = path_len;
+	r->st = *st;
+	r->depth = depth;
+	r->score = score;
+	b->len++;
 	return 0;
 }
 
-/* Pops the top directory off the stack.
- * This string must be free()'d after use.
- * This function is thread-safe. */
-static char* dir_stack_pop(void){
-	char* ret;
-	void* tmp;
-	pthread_mutex_lock(&mutex_dir_stack);
+static int batch_full(const struct ffind_batch* b){
+	return b->len >= FFIND_BATCH_LEN || b->strings_len >= FFIND_BATCH_BYTES;
+}
 
-	if (dir_stack_len == 0){
-		pthread_mutex_unlock(&mutex_dir_stack);
-		return NULL;
+/* Points every result at its path. */
+static void batch_finish(struct ffind_batch* b){
+	const char* ptr = b->strings;
+	for (size_t i = 0; i < b->len; ++i){
+		b->results[i].path = ptr;
+		ptr += b->results[i].path_len + 1;
 	}
+}
 
-	ret = dir_stack[dir_stack_len - 1];
-	dir_stack_len--;
+static void batch_clear(struct ffind_batch* b){
+	b->len = 0;
+	b->strings_len = 0;
+}
+
+/* Locks the pool, recording how long it took if stats are enabled. */
+static void pool_lock(struct ffind_pool* pool, struct ffind_stats* stats){
+	uint64_t start;
 
-	tmp = realloc(dir_stack, dir_stack_len * sizeof(*dir_stack));
-	/* if dir_stack_len == 0, tmp is NULL */
-	if (tmp || dir_stack_len == 0){
-		dir_stack = tmp;
+	if (!stats){
+		pthread_mutex_lock(&(pool->mutex));
+		return;
 	}
 
-	/* don't care if realloc fails, since all that happens is a slight waste of memory */
-	pthread_mutex_unlock(&mutex_dir_stack);
-	return ret;
+	start = stats_now();
+	pthread_mutex_lock(&(pool->mutex));
+	stats->lock_wait_ns += stats_now() - start;
+}
+
+static void pool_unlock(struct ffind_pool* pool){
+	pthread_mutex_unlock(&(pool->mutex));
 }
 
-/* Frees every entry in a directory stack
- * This function is thread-safe. */
-FF_UNUSED static void dir_stack_free(void){
-	pthread_mutex_lock(&mutex_dir_stack);
+/* Pushes directories on to a search's stack.
+ * The pool must be locked. */
+static int search_push_locked(struct ffind_search* s, const struct dir_item* items, size_t len){
+	if (s->stack_len + len > s->stack_cap){
+		size_t cap = s->stack_cap ? s->stack_cap : 64;
+		void* tmp;
+		while (cap < s->stack_len + len){
+			cap *= 2;
+		}
+		/* can't use s->stack = realloc(s->stack, ...).
+		 * if realloc fails in the above case, the pointer (which we lost though assignment) is still valid, causing a mem leak. */
+		tmp = realloc(s->stack, cap * sizeof(*(s->stack)));
+		if (!tmp){
+			log_enomem();
+			return -1;
+		}
+		s->stack = tmp;
+		s->stack_cap = cap;
+	}
+	memcpy(s->stack + s->stack_len, items, len * sizeof(*items));
+	s->stack_len += len;
+	__atomic_store_n(&(s->pool->queued), s->pool->queued + len, __ATOMIC_RELAXED);
 
-	for (size_t i = 0; i < dir_stack_len; ++i){
-		free(dir_stack[i]);
+	for (size_t i = 0; i < len; ++i){
+		s->path_bytes += items[i].node->path_len + 1;
+	}
+	if (s->path_bytes > s->peak_path_bytes){
+		s->peak_path_bytes = s->path_bytes;
+	}
+	if (s->stack_len > s->peak_stack_len){
+		s->peak_stack_len = s->stack_len;
 	}
-	free(dir_stack);
-	dir_stack = NULL;
-	dir_stack_len = 0;
+	return 0;
+}
 
-	pthread_mutex_unlock(&mutex_dir_stack);
+/* Drops a work item's reference to its node.
+ * The pool must be locked. */
+static void search_release_locked(struct ffind_search* s, struct dir_item* item){
+	dir_node_release(&(s->arena), item->node);
+	free(item->names);
 }
 
-/* Creates a path out of a directory and dirent.d_name
- * This string must be free()'d after use.
- */
-FF_HOT FF_INLINE static char* make_path(const char* dir, const char* d_name){
-	char* path = malloc(strlen(dir) + strlen(d_name) + 2);
-	if (!path){
-		return NULL;
+/* Marks a search as finished.
+ * The pool must be locked, and no threads may be working on the search. */
+static void search_finish_locked(struct ffind_search* s){
+	struct ffind_search** pp;
+
+	if (s->done){
+		return;
 	}
 
-	strcpy(path, dir);
-	if (path[strlen(path) - 1] != '/'){
-		strcat(path, "/");
+	for (pp = &(s->pool->searches); *pp; pp = &((*pp)->next)){
+		if (*pp == s){
+			*pp = s->next;
+			break;
+		}
+	}
+	s->next = NULL;
+	s->done = 1;
+	stats_scan_end(s->stats);
+	stats_scan_pending(s->stats, s->peak_stack_len, s->arena.peak_live_bytes, s->peak_path_bytes);
+	if (s->cancelled){
+		stats_scan_stopped(s->stats, s->cancel_time);
 	}
-	strcat(path, d_name);
-	return path;
+	pthread_cond_broadcast(&(s->cond));
 }
 
-FF_INLINE static void print_match(const char* path, mode_t st_mode, const struct pattern* pat, char type, unsigned print0){
-	switch (type){
-	case 'f':
-		if (!S_ISREG(st_mode)){
-			return;
+/* The pool must be locked. */
+static void search_cancel_locked(struct ffind_search* s){
+	if (!s->cancelled){
+		s->cancel_time = stats_now();
+	}
+	__atomic_store_n(&(s->cancelled), 1, __ATOMIC_RELAXED);
+
+	for (size_t i = 0; i < s->stack_len; ++i){
+		search_release_locked(s, &(s->stack[i]));
+	}
+	__atomic_store_n(&(s->pool->queued), s->pool->queued - s->stack_len, __ATOMIC_RELAXED);
+	s->stack_len = 0;
+	s->path_bytes = 0;
+
+	pthread_cond_broadcast(&(s->cond));
+	if (s->active == 0){
+		search_finish_locked(s);
+	}
+}
+
+static int search_cancelled(const struct ffind_search* s){
+	return __atomic_load_n(&(s->cancelled), __ATOMIC_RELAXED);
+}
+
+/* Checks whether a worker should stop working on a search, cancelling it if its time is up. */
+static int search_should_stop(struct ffind_search* s, struct ffind_thread_data* td){
+	if (search_cancelled(s)){
+		return 1;
+	}
+	if (s->deadline && stats_now() >= s->deadline){
+		pool_lock(s->pool, td->stats);
+		if (s->status == 0){
+			s->status = FFIND_TIMED_OUT;
 		}
-		break;
-	case 'd':
-		if (!S_ISDIR(st_mode)){
+		search_cancel_locked(s);
+		pool_unlock(s->pool);
+		return 1;
+	}
+	return 0;
+}
+
+/* Waits for the next slot of one of the search's throttles.
+ * The wait is counted as throttled rather than busy time, so the adaptive controller does not mistake it for slow I/O.
+ * Returns 0 to go ahead, or positive if the search stopped while waiting. */
+static int search_throttle(struct ffind_search* s, struct ffind_thread_data* td, struct throttle* t){
+	uint64_t start = stats_now();
+	uint64_t at = throttle_take(t, start);
+	uint64_t now = start;
+	int ret = 0;
+
+	while (now < at){
+		uint64_t wait = at - now < THROTTLE_SLICE_NS ? at - now : THROTTLE_SLICE_NS;
+		struct timespec ts;
+
+		ts.tv_sec = wait / 1000000000;
+		ts.tv_nsec = wait % 1000000000;
+		nanosleep(&ts, NULL);
+		now = stats_now();
+		if (search_should_stop(s, td)){
+			ret = 1;
+			break;
+		}
+	}
+
+	td->throttled_ns += now - start;
+	if (td->stats){
+		td->stats->throttled_ns += now - start;
+	}
+	return ret;
+}
+
+/* Waits until the search's throttles allow another directory to be opened.
+ * Returns 0 to go ahead, or positive if the search stopped while waiting. */
+static int search_throttle_dir(struct ffind_search* s, struct ffind_thread_data* td){
+	if (s->dirs.interval_ns && search_throttle(s, td, &(s->dirs)) != 0){
+		return 1;
+	}
+	if (s->iops.interval_ns && search_throttle(s, td, &(s->iops)) != 0){
+		return 1;
+	}
+	return 0;
+}
+
+/* Records a failure that ffind_search_wait() should report, and stops the search. */
+static void search_fail(struct ffind_search* s, struct ffind_thread_data* td){
+	pool_lock(s->pool, td->stats);
+	s->status = -1;
+	search_cancel_locked(s);
+	pool_unlock(s->pool);
+}
+
+/* Checks whether the thread's batch should be delivered now.
+ * With a result limit, a batch is delivered as soon as it could reach the limit so the search stops promptly. */
+FF_INLINE static inline int search_batch_ready(const struct ffind_search* s, const struct ffind_batch* b){
+	return batch_full(b) ||
+		(s->max_results && b->len > 0 && b->len + __atomic_load_n(&(s->n_results), __ATOMIC_RELAXED) >= s->max_results);
+}
+
+/* Hands the thread's batch to the search's callback or iterator queue. */
+static void search_deliver(struct ffind_search* s, struct ffind_thread_data* td){
+	struct ffind_batch* b = td->batch;
+	uint64_t span;
+	size_t prev;
+	int limit_reached = 0;
+
+	if (!b || b->len == 0){
+		return;
+	}
+
+	/* reserve places for the results so that concurrent batches never go over the limit together.
+	 * whatever is not delivered is given back, which never takes the count below the limit once it is reached */
+	prev = __atomic_fetch_add(&(s->n_results), b->len, __ATOMIC_RELAXED);
+	if (s->max_results && prev + b->len >= s->max_results){
+		limit_reached = 1;
+		if (prev >= s->max_results){
+			__atomic_fetch_sub(&(s->n_results), b->len, __ATOMIC_RELAXED);
+			batch_clear(b);
+			ffind_search_cancel(s);
 			return;
 		}
+		__atomic_fetch_sub(&(s->n_results), b->len - (s->max_results - prev), __ATOMIC_RELAXED);
+		b->len = s->max_results - prev;
 	}
 
-	if (match(path, pat) == 1){
-		switch (print0){
-			case 0:
-				printf("%s\n", path);
-				break;
-			case 1:
-				fwrite(path, 1, strlen(path) + 1, stdout);
+	span = trace_begin(td->trace);
+	batch_finish(b);
+
+	if (s->cb){
+		if (s->cb(b->results, b->len, s->cb_data) != 0 || limit_reached){
+			ffind_search_cancel(s);
+		}
+		trace_end(td->trace, TRACE_OUTPUT, span, b->len);
+		batch_clear(b);
+		return;
+	}
+
+	pool_lock(s->pool, td->stats);
+	while (s->queue_len >= FFIND_QUEUE_MAX && !search_cancelled(s)){
+		pthread_cond_wait(&(s->cond), &(s->pool->mutex));
+	}
+	if (search_cancelled(s)){
+		pool_unlock(s->pool);
+		__atomic_fetch_sub(&(s->n_results), b->len, __ATOMIC_RELAXED);
+		batch_clear(b);
+		return;
+	}
+
+	if (s->queue_tail){
+		s->queue_tail->next = b;
+	}
+	else{
+		s->queue_head = b;
+	}
+	s->queue_tail = b;
+	b->next = NULL;
+	s->queue_len++;
+	pthread_cond_broadcast(&(s->cond));
+	/* batches already queued are still handed out after cancelling */
+	if (limit_reached){
+		search_cancel_locked(s);
+	}
+
+	td->batch = s->free_batches;
+	if (td->batch){
+		s->free_batches = td->batch->next;
+		batch_clear(td->batch);
+	}
+	pool_unlock(s->pool);
+
+	if (!td->batch){
+		td->batch = batch_new();
+		if (!td->batch){
+			search_fail(s, td);
 		}
 	}
+	trace_end(td->trace, TRACE_OUTPUT, span, 0);
 }
 
-/* The main finding function.
- * Finds all files in a directory that match ffp->find_me
- */
-FF_HOT int ffind_backend(const char* base_dir, const struct pattern* pattern, const struct ffind_flags* ffl, int max_depth){
-	DIR* dp;
-	struct dirent* dnt;
+/* Makes room for at least len bytes in the thread's path buffer. */
+static int path_reserve(struct ffind_thread_data* td, size_t len){
+	char* tmp;
+	size_t cap;
 
-	if (max_depth == 0){
+	if (len <= td->path_cap){
 		return 0;
 	}
-
-	dp = opendir(base_dir);
-	if (!dp){
-		log_eopendir(base_dir);
+	cap = td->path_cap ? td->path_cap : 256;
+	while (cap < len){
+		cap *= 2;
+	}
+	tmp = realloc(td->path, cap);
+	if (!tmp){
+		log_enomem();
 		return -1;
 	}
+	td->path = tmp;
+	td->path_cap = cap;
+	return 0;
+}
 
-	while ((dnt = readdir(dp)) != NULL){
-		char* path;
-		struct stat st;
-
-		/* "." and ".." are symlinks to the current directory/parent directory.
-		 * we do not want to search through these, as it would cause an infinite loop */
-		if (!strcmp(dnt->d_name, ".") || !strcmp(dnt->d_name, "..")){
-			continue;
+/* Remembers a subdirectory to push once the current directory is finished. */
+static int add_child(struct ffind_thread_data* td, const char* name, size_t name_len){
+	if (td->children_len + name_len + 1 > td->children_cap){
+		size_t cap = td->children_cap ? td->children_cap : 4096;
+		char* tmp;
+		while (cap < td->children_len + name_len + 1){
+			cap *= 2;
 		}
-
-		path = make_path(base_dir, dnt->d_name);
-		if (!path){
+		tmp = realloc(td->children, cap);
+		if (!tmp){
 			log_enomem();
-			closedir(dp);
 			return -1;
 		}
+		td->children = tmp;
+		td->children_cap = cap;
+	}
+	memcpy(td->children + td->children_len, name, name_len + 1);
+	td->children_len += name_len + 1;
+	td->n_children++;
+	return 0;
+}
 
-		switch (ffl->follow_symlink){
-		case 0:
-			lstat(path, &st);
-			break;
-		default:
-			stat(path, &st);
-			break;
+/* Queues the subdirectories found in a directory as nodes under the directory's node.
+ * The pool must be locked.
+ * Returns 0 on success, negative on failure. */
+static int push_children_locked(struct ffind_search* s, struct dir_node* parent, struct ffind_thread_data* td){
+	const char* name = td->children;
+	const char* end = td->children + td->children_len;
+
+	for (; name < end; name += strlen(name) + 1){
+		struct dir_item child;
+
+		child.node = dir_node_new(&(s->arena), parent, name, strlen(name));
+		child.names = NULL;
+		child.names_len = 0;
+		child.flat = 0;
+		if (!child.node){
+			return -1;
 		}
-		print_match(path, st.st_mode, pattern, ffl->type, ffl->print0);
-		if (S_ISDIR(st.st_mode)){
-			ffind_backend(path, pattern, ffl, max_depth - 1);
+		if (search_push_locked(s, &child, 1) != 0){
+			dir_node_release(&(s->arena), child.node);
+			return -1;
 		}
-		free(path);
 	}
-
-	closedir(dp);
 	return 0;
 }
 
-void* ffind_worker_thread(void* param){
-	const struct ffind_param* ffp = param;
-	char* current_dir;
+/* Hands the names gathered from a large directory to the other workers as a chunk.
+ * Returns 0 on success, negative on failure. */
+static int push_chunk(struct ffind_search* s, const struct dir_item* dir, struct ffind_thread_data* td){
+	struct dir_item chunk;
+	uint64_t span;
 
-	while ((current_dir = dir_stack_pop()) != NULL){
-		ffind_backend(current_dir, ffp->p, ffp->flags, ffp->maxdepth);
-		free(current_dir);
+	if (td->split_count == 0){
+		return 0;
 	}
 
-	return NULL;
-}
-
-/* Because only 1 thread can run in a directory, the initial search is always single threaded.
- * TODO: Make the initial search multi-threaded. */
-int ffind_init_stack(const char* base_dir, const struct pattern* pattern, const struct ffind_flags* ffl){
-	DIR* dp;
-	struct dirent* dnt;
+	span = trace_begin(td->trace);
+	chunk.node = dir->node;
+	chunk.names = malloc(td->split_len);
+	chunk.names_len = td->split_len;
+	chunk.flat = dir->flat;
+	if (!chunk.names){
+		log_enomem();
+		return -1;
+	}
+	memcpy(chunk.names, td->split, td->split_len);
 
-	dp = opendir(base_dir);
-	if (!dp){
-		log_eopendir(base_dir);
+	pool_lock(s->pool, td->stats);
+	/* a cancelled search has no use for the names, but losing them to a failed push would leave it incomplete */
+	if (search_cancelled(s)){
+		free(chunk.names);
+	}
+	else if (search_push_locked(s, &chunk, 1) != 0){
+		pool_unlock(s->pool);
+		free(chunk.names);
+		trace_end(td->trace, TRACE_PUSH, span, td->split_count);
 		return -1;
 	}
+	else{
+		dir_node_ref(chunk.node);
+		pthread_cond_signal(&(s->pool->cond));
+	}
+	pool_unlock(s->pool);
+	trace_end(td->trace, TRACE_PUSH, span, td->split_count);
 
-	while ((dnt = readdir(dp)) != NULL){
-		char* path;
-		struct stat st;
+	td->split_len = 0;
+	td->split_count = 0;
+	return 0;
+}
 
-		/* "." and ".." are symlinks to the current directory/parent directory.
-		 * we do not want to search through these, as it would cause an infinite loop */
-		if (!strcmp(dnt->d_name, ".") || !strcmp(dnt->d_name, "..")){
-			continue;
+/* Saves a name read from a large directory to be handed out in the next chunk.
+ * Returns 0 on success, negative on failure. */
+static int add_split(struct ffind_search* s, const struct dir_item* dir, struct ffind_thread_data* td, const char* name, size_t name_len, unsigned char type){
+	if (td->split_len + name_len + 2 > td->split_cap){
+		size_t cap = td->split_cap ? td->split_cap : 16384;
+		char* tmp;
+		while (cap < td->split_len + name_len + 2){
+			cap *= 2;
 		}
-
-		path = make_path(base_dir, dnt->d_name);
-		if (!path){
+		tmp = realloc(td->split, cap);
+		if (!tmp){
 			log_enomem();
-			closedir(dp);
 			return -1;
 		}
+		td->split = tmp;
+		td->split_cap = cap;
+	}
+	td->split[td->split_len] = type;
+	memcpy(td->split + td->split_len + 1, name, name_len + 1);
+	td->split_len += name_len + 2;
+	td->split_count++;
 
-		switch (ffl->follow_symlink){
-		case 0:
-			lstat(path, &st);
-			break;
-		default:
-			stat(path, &st);
-			break;
-		}
-		print_match(path, st.st_mode, pattern, ffl->type, ffl->print0);
-		if (S_ISDIR(st.st_mode)){
-			dir_stack_push(path);
+	if (td->split_count >= FFIND_SPLIT_CHUNK){
+		return push_chunk(s, dir, td);
+	}
+	return 0;
+}
+
+/* The type readdir() reports for an entry, or DT_UNKNOWN if the system does not report types. */
+#ifdef DT_UNKNOWN
+#define DIRENT_TYPE(dnt) ((dnt)->d_type)
+#else
+#define DT_UNKNOWN 0
+#define DIRENT_TYPE(dnt) DT_UNKNOWN
+#endif
+
+/* Checks whether an entry of a type reported by readdir() could be a directory to descend into, so it has to be stat'd even if its name does not match. */
+static int may_be_dir(unsigned char type, int follow_symlink){
+#ifdef DT_DIR
+	return type == DT_DIR || type == DT_UNKNOWN || (follow_symlink && type == DT_LNK);
+#else
+	(void)type;
+	(void)follow_symlink;
+	return 1;
+#endif
+}
+
+/* Adds a name to the thread's batch for search_names().
+ * Returns 0 on success, negative on failure. */
+static int names_add(struct ffind_thread_data* td, const char* name, size_t name_len, unsigned char type){
+	if (td->names_len + name_len + 1 > td->names_cap){
+		size_t cap = td->names_cap ? td->names_cap : 4096;
+		char* tmp;
+		while (cap < td->names_len + name_len + 1){
+			cap *= 2;
 		}
-		else{
-			free(path);
+		tmp = realloc(td->names, cap);
+		if (!tmp){
+			log_enomem();
+			return -1;
 		}
+		td->names = tmp;
+		td->names_cap = cap;
+	}
+	td->name_offs[td->n_names] = td->names_len;
+	td->name_types[td->n_names] = type;
+	td->n_names++;
+	memcpy(td->names + td->names_len, name, name_len + 1);
+	td->names_len += name_len + 1;
+	if (name_len > td->names_max){
+		td->names_max = name_len;
 	}
-
-	closedir(dp);
 	return 0;
 }
 
-int ffind_create_threads(const char* base_dir, const struct parsed_data* pd, pthread_t** out){
-	static struct ffind_param ffp;
-	pthread_t* threads = NULL;
-	int ret = 0;
+static void names_clear(struct ffind_thread_data* td){
+	td->names_len = 0;
+	td->names_max = 0;
+	td->n_names = 0;
+}
 
-	if (pd->n_threads == 0){
-		eprintf_mt("ffind: Cannot start with 0 threads.\n");
-		ret = -1;
-		goto cleanup;
-	}
+/* Stats a path, falling back to lstat() for dangling symlinks when following symlinks.
+ * Returns 0 on success, negative on failure. */
+FF_HOT static int stat_path(const char* path, struct stat* st, unsigned follow_symlink, struct ffind_stats* stats){
+	int res;
 
-	if (ffind_init_stack(base_dir, &(pd->pat), &(pd->flags)) != 0){
-		ret = -1;
-		goto cleanup;
+	stats_inc(stats, stat_calls);
+	res = follow_symlink ? stat(path, st) : lstat(path, st);
+	if (res != 0 && follow_symlink && errno == ENOENT){
+		stats_inc(stats, stat_calls);
+		res = lstat(path, st);
 	}
+	if (res != 0){
+		stats_error(stats, errno);
+	}
+	return res;
+}
 
-	threads = malloc(pd->n_threads * sizeof(*threads));
-	if (!threads){
-		log_enomem();
-		ret = -1;
-		goto cleanup;
+/* Matches a path against the search's pattern.
+ * matcher is a constant in every specialized variant, so the switch folds away and only the engine's own call is left. */
+FF_INLINE static inline int match_pattern(const char* path, const struct pattern* p, enum entry_matcher matcher){
+	switch (matcher){
+	case MATCHER_ALL:
+		return 1;
+	case MATCHER_FNMATCH:
+		return match_fnmatch(path, p->p.fnmatch);
+	case MATCHER_LITERAL:
+		return match_fnmatch_literal(path, p->p.fnmatch);
+	case MATCHER_REGEX:
+		return match_regex_posix(path, p->p.regex);
+	default:
+		return match(path, p);
 	}
+}
 
-	ffp.p = &(pd->pat);
-	ffp.flags = &(pd->flags);
-	ffp.maxdepth = pd->maxdepth;
+/* Adds a path to the thread's batch if it matches.
+ * type and matcher are the -type filter and the pattern engine to check for, and general enables --fuzzy and -contains.
+ * Returns 0 on success, negative on failure. */
+FF_INLINE static inline int check_match(const char* path, size_t path_len, size_t base_len, const struct stat* st, int depth, struct ffind_search* s, struct ffind_thread_data* td, int timed,
+		char type, enum entry_matcher matcher, int general){
+	uint64_t start = 0;
+	uint64_t span;
+	int score = 0;
+	int res;
 
-	for (size_t i = 0; i < pd->n_threads; ++i){
-		if (pthread_create(&(threads[i]), NULL, ffind_worker_thread, &ffp) != 0){
-			log_ethread();
-			free(threads);
-			ret = -1;
-			goto cleanup;
+	switch (type){
+	case 'f':
+		if (!S_ISREG(st->st_mode)){
+			return 0;
+		}
+		break;
+	case 'd':
+		if (!S_ISDIR(st->st_mode)){
+			return 0;
 		}
 	}
 
-cleanup:
-	if (ret != 0){
-		free(threads);
-		*out = NULL;
+	span = trace_begin(td->trace);
+	if (timed){
+		start = stats_now();
 	}
-	else{
-		*out = threads;
+	/* scoring is cheaper than most patterns and rejects most entries, so it goes first.
+	 * the base directory is the same for every path, so only what comes after it is scored */
+	res = 1;
+	if (general && s->fuzzy){
+		score = fuzzy_score(s->fuzzy, path + s->root_len, path_len - s->root_len, base_len - s->root_len);
+		res = score != FUZZY_NO_MATCH;
 	}
-	return ret;
+	if (res == 1){
+		res = matcher == MATCHER_BATCH ? td->hit : match_pattern(path, s->p, matcher);
+	}
+	if (timed){
+		stats_hist_add(td->stats->match_ns_hist, stats_now() - start);
+	}
+
+	/* the name is checked first since it is much cheaper than reading the file */
+	if (res == 1 && general && s->flags->contains &&
+			(!S_ISREG(st->st_mode) || (s->iops.interval_ns && search_throttle(s, td, &(s->iops)) != 0) || file_contains(path, st->st_size, s->contains, s->contains_maxsize, &(td->cb)) != 1)){
+		res = 0;
+	}
+	trace_end(td->trace, TRACE_MATCH, span, res == 1);
+
+	if (res != 1){
+		return 0;
+	}
+	stats_inc(td->stats, matches);
+	__atomic_store_n(&(td->n_matches), td->n_matches + 1, __ATOMIC_RELAXED);
+	return batch_add(td->batch, path, path_len, st, depth, score);
 }
 
-int ffind_join_threads(pthread_t* threads, size_t threads_len){
-	int ret = 0;
-	for (size_t i = 0; i < threads_len; ++i){
-		if (pthread_join(threads[i], NULL) != 0){
-			log_ejoin();
-			ret = -1;
-		}
+/* Opens a directory, counting it if stats are enabled. */
+static DIR* open_dir(const char* dir, struct ffind_thread_data* td){
+	struct ffind_stats* stats = td->stats;
+	DIR* dp;
+	uint64_t start = 0;
+	uint64_t span;
+
+	span = trace_begin(td->trace);
+	if (stats){
+		start = stats_now();
 	}
-	free(threads);
-	return ret;
+	dp = opendir(dir);
+	trace_end(td->trace, TRACE_OPENDIR, span, dp != NULL);
+	if (!dp){
+		stats_error(stats, errno);
+		log_eopendir(dir);
+		return NULL;
+	}
+	if (stats){
+		stats->blocked_ns += stats_now() - start;
+		stats->dirs_opened++;
+	}
+	__atomic_store_n(&(td->n_dirs), td->n_dirs + 1, __ATOMIC_RELAXED);
+	return dp;
+}
+
+/* Closes a directory, recording its size if stats are enabled.
+ * span is the start of the directory's TRACE_READDIR span. */
+static void close_dir(DIR* dp, uint64_t n_entries, uint64_t span, struct ffind_thread_data* td){
+	struct ffind_stats* stats = td->stats;
+
+	if (stats){
+		stats->entries_read += n_entries;
+		stats_hist_add(stats->dir_size_hist, n_entries);
+	}
+	__atomic_store_n(&(td->n_entries), td->n_entries + n_entries, __ATOMIC_RELAXED);
+	closedir(dp);
+	trace_end(td->trace, TRACE_READDIR, span, n_entries);
+}
+
+/* Publishes the directory a thread is working on for ffind_pool_progress_dir(), or clears it if len is 0.
+ * This is a sequence lock: the words are written between two increments of dir_seq, and readers retry if dir_seq changed under them.
+ * Every access is a relaxed atomic, so readers cannot slow the thread down. */
+static void progress_set_dir(struct ffind_thread_data* td, const char* path, size_t len){
+	unsigned seq = td->dir_seq;
+	size_t n = len;
+
+	if (n > FFIND_PROGRESS_PATH){
+		path += n - FFIND_PROGRESS_PATH;
+		n = FFIND_PROGRESS_PATH;
+	}
+
+	__atomic_store_n(&(td->dir_seq), seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	for (size_t i = 0; i < n; i += sizeof(uint64_t)){
+		uint64_t word = 0;
+		memcpy(&word, path + i, n - i < sizeof(word) ? n - i : sizeof(word));
+		__atomic_store_n(&(td->dir_words[i / sizeof(word)]), word, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&(td->dir_len), len, __ATOMIC_RELAXED);
+	__atomic_store_n(&(td->dir_seq), seq + 2, __ATOMIC_RELEASE);
+}
+
+/* Writes a directory's path into the thread's path buffer.
+ * Returns 0 on success, negative on failure. */
+static int path_set_dir(struct ffind_thread_data* td, const struct dir_node* node){
+	if (path_reserve(td, node->path_len + 2) != 0){
+		return -1;
+	}
+	dir_node_path(node, td->path);
+	progress_set_dir(td, td->path, node->path_len);
+	return 0;
+}
+
+/* The length of a directory's path with a slash after it. */
+static size_t path_end_dir_len(const struct dir_node* node){
+	if (node->path_len > 0 && node->parent == NULL && node->name[node->name_len - 1] == '/'){
+		return node->path_len;
+	}
+	return node->path_len + 1;
+}
+
+/* Adds a slash after the directory path written by path_set_dir(), and returns the length of the result. */
+static size_t path_end_dir(struct ffind_thread_data* td, const struct dir_node* node){
+	size_t len = path_end_dir_len(node);
+
+	td->path[len - 1] = '/';
+	return len;
+}
+
+/* Stats the path in the thread's path buffer.
+ * timed is set if the call was sampled for stats.
+ * Returns 0 on success, negative on failure. */
+FF_INLINE static inline int stat_entry(struct ffind_thread_data* td, struct stat* st, int* timed, int follow_symlink){
+	uint64_t start = 0;
+	uint64_t stat_span;
+
+	/* only one in STATS_SAMPLE_INTERVAL entries is timed, and the stat() time is scaled up to compensate */
+	*timed = td->stats && ++(td->sample) % STATS_SAMPLE_INTERVAL == 0;
+	stat_span = trace_begin(td->trace);
+	if (*timed){
+		start = stats_now();
+	}
+	if (stat_path(td->path, st, follow_symlink, td->stats) != 0){
+		trace_end(td->trace, TRACE_STAT, stat_span, 0);
+		return -1;
+	}
+	if (*timed){
+		td->stats->blocked_ns += (stats_now() - start) * STATS_SAMPLE_INTERVAL;
+	}
+	trace_end(td->trace, TRACE_STAT, stat_span, 1);
+	return 0;
+}
+
+/* Matches an entry whose path is in the thread's path buffer, and queues it if it is a directory to descend into.
+ * Returns 0 to continue, positive if the search was cancelled, negative on failure. */
+FF_INLINE static inline int match_entry_spec(struct ffind_search* s, struct ffind_thread_data* td, size_t base_len, size_t name_len, const struct stat* st, int depth, int descend, int timed,
+		char type, enum entry_matcher matcher, int general){
+	if (check_match(td->path, base_len + name_len, base_len, st, depth, s, td, timed, type, matcher, general) != 0 ||
+			(descend && S_ISDIR(st->st_mode) && add_child(td, td->path + base_len, name_len) != 0)){
+		return -1;
+	}
+
+	if (search_batch_ready(s, td->batch)){
+		search_deliver(s, td);
+		if (search_cancelled(s)){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int match_entry(struct ffind_search* s, struct ffind_thread_data* td, size_t base_len, size_t name_len, const struct stat* st, int depth, int descend, int timed){
+	return match_entry_spec(s, td, base_len, name_len, st, depth, descend, timed, s->flags->type, MATCHER_ANY, 1);
+}
+
+/* Stats and matches a single entry whose name was already copied to td->path + base_len.
+ * Returns 0 to continue, positive if the search was cancelled, negative on failure. */
+FF_INLINE static inline int search_entry_spec(struct ffind_search* s, struct ffind_thread_data* td, size_t base_len, size_t name_len, int depth, int descend,
+		int follow_symlink, char type, enum entry_matcher matcher, int general){
+	struct stat st;
+	int timed;
+
+	if (s->iops.interval_ns && search_throttle(s, td, &(s->iops)) != 0){
+		return 1;
+	}
+	if (stat_entry(td, &st, &timed, follow_symlink) != 0){
+		return 0;
+	}
+	return match_entry_spec(s, td, base_len, name_len, &st, depth, descend, timed, type, matcher, general);
+}
+
+/* The variant for options that have no specialization: anything with --fuzzy, -contains, or a PCRE pattern. */
+FF_HOT static int search_entry_any(struct ffind_search* s, struct ffind_thread_data* td, size_t base_len, size_t name_len, int depth, int descend){
+	return search_entry_spec(s, td, base_len, name_len, depth, descend, s->flags->follow_symlink, s->flags->type, MATCHER_ANY, 1);
+}
+
+/* Specialized variants of search_entry_spec() for every combination of symlink mode, -type filter, and pattern engine.
+ * The options are constants in each one, so every entry runs straight through without testing them. */
+#define SEARCH_ENTRY_VARIANT(name, follow_symlink, type, matcher) \
+	FF_HOT static int name(struct ffind_search* s, struct ffind_thread_data* td, size_t base_len, size_t name_len, int depth, int descend){ \
+		return search_entry_spec(s, td, base_len, name_len, depth, descend, follow_symlink, type, matcher, 0); \
+	}
+
+#define SEARCH_ENTRY_MATCHERS(prefix, follow_symlink, type) \
+	SEARCH_ENTRY_VARIANT(prefix##_all, follow_symlink, type, MATCHER_ALL) \
+	SEARCH_ENTRY_VARIANT(prefix##_fnmatch, follow_symlink, type, MATCHER_FNMATCH) \
+	SEARCH_ENTRY_VARIANT(prefix##_literal, follow_symlink, type, MATCHER_LITERAL) \
+	SEARCH_ENTRY_VARIANT(prefix##_regex, follow_symlink, type, MATCHER_REGEX) \
+	SEARCH_ENTRY_VARIANT(prefix##_batch, follow_symlink, type, MATCHER_BATCH)
+
+#define SEARCH_ENTRY_TYPES(prefix, follow_symlink) \
+	SEARCH_ENTRY_MATCHERS(prefix##_any, follow_symlink, 0) \
+	SEARCH_ENTRY_MATCHERS(prefix##_f, follow_symlink, 'f') \
+	SEARCH_ENTRY_MATCHERS(prefix##_d, follow_symlink, 'd')
+
+SEARCH_ENTRY_TYPES(search_entry_lstat, 0)
+SEARCH_ENTRY_TYPES(search_entry_stat, 1)
+
+#define SEARCH_ENTRY_ROW(prefix) { prefix##_all, prefix##_fnmatch, prefix##_literal, prefix##_regex, prefix##_batch }
+
+/* Indexed by [follow_symlink][no filter, 'f', 'd'][matcher]. */
+static const search_entry_fn search_entry_variants[2][3][MATCHER_ANY] = {
+	{ SEARCH_ENTRY_ROW(search_entry_lstat_any), SEARCH_ENTRY_ROW(search_entry_lstat_f), SEARCH_ENTRY_ROW(search_entry_lstat_d) },
+	{ SEARCH_ENTRY_ROW(search_entry_stat_any), SEARCH_ENTRY_ROW(search_entry_stat_f), SEARCH_ENTRY_ROW(search_entry_stat_d) }
+};
+
+/* The index of a -type filter in search_entry_variants. */
+static int search_entry_type(char type){
+	switch (type){
+	case 'f':
+		return 1;
+	case 'd':
+		return 2;
+	default:
+		return 0;
+	}
+}
+
+/* Picks the variant of the per-entry code for a search's options. */
+static search_entry_fn search_entry_select(const struct ffind_search* s){
+	int type = search_entry_type(s->flags->type);
+	enum entry_matcher matcher;
+
+	if (s->fuzzy || s->flags->contains){
+		return search_entry_any;
+	}
+
+	if (pat_matches_all(s->p)){
+		matcher = MATCHER_ALL;
+	}
+	else{
+		switch (s->p->p_type){
+		case TYPE_FNMATCH:
+			matcher = MATCHER_FNMATCH;
+			break;
+		case TYPE_FNMATCH_LITERAL:
+			matcher = MATCHER_LITERAL;
+			break;
+		case TYPE_REGEX_POSIX:
+		case TYPE_REGEX_POSIX_EX:
+			matcher = MATCHER_REGEX;
+			break;
+		default:
+			return search_entry_any;
+		}
+	}
+
+	return search_entry_variants[s->flags->follow_symlink ? 1 : 0][type][matcher];
+}
+
+/* Picks the MATCHER_BATCH variant for a search, or returns NULL if its names should be matched one at a time.
+ * Batching only pays off when match_batch() can rule names out without the full matcher, and --inode-order stats every name anyway. */
+static search_entry_fn search_entry_select_batch(const struct ffind_search* s){
+	if (s->fuzzy || s->flags->contains || s->flags->inode_order || pat_matches_all(s->p) || !pat_has_filter(s->p)){
+		return NULL;
+	}
+	return search_entry_variants[s->flags->follow_symlink ? 1 : 0][search_entry_type(s->flags->type)][MATCHER_BATCH];
+}
+
+static int inode_entry_cmp(const void* a, const void* b){
+	const struct inode_entry* x = a;
+	const struct inode_entry* y = b;
+
+	if (x->ino != y->ino){
+		return x->ino < y->ino ? -1 : 1;
+	}
+	return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/* Stats and matches a window of entries gathered by search_dir_sorted() in inode order.
+ * With restore_order, the entries are all stat'd first and then matched in the order they were read.
+ * Returns 0 to continue, positive if the search was cancelled, negative on failure. */
+static int search_window(struct ffind_search* s, struct ffind_thread_data* td, size_t len, size_t base_len, int depth, int descend){
+	int restore = s->flags->restore_order;
+	int res = 0;
+
+	if (restore && td->ent_stats_cap < len){
+		void* tmp = realloc(td->ent_stats, FFIND_INODE_WINDOW * sizeof(*(td->ent_stats)));
+		if (!tmp){
+			log_enomem();
+			return -1;
+		}
+		td->ent_stats = tmp;
+		td->ent_stats_cap = FFIND_INODE_WINDOW;
+	}
+
+	qsort(td->ents, len, sizeof(*(td->ents)), inode_entry_cmp);
+
+	for (size_t i = 0; i < len && res == 0; ++i){
+		const struct inode_entry* e = &(td->ents[i]);
+		const char* name = td->split + e->off;
+		size_t name_len = strlen(name);
+		struct stat st;
+		int timed;
+
+		if (i % FFIND_CHECK_INTERVAL == FFIND_CHECK_INTERVAL - 1 && search_should_stop(s, td)){
+			return 1;
+		}
+		if (path_reserve(td, base_len + name_len + 1) != 0){
+			return -1;
+		}
+		memcpy(td->path + base_len, name, name_len + 1);
+
+		if (!restore){
+			res = s->search_entry(s, td, base_len, name_len, depth, descend);
+		}
+		else if (s->iops.interval_ns && search_throttle(s, td, &(s->iops)) != 0){
+			return 1;
+		}
+		/* a mode of 0 marks an entry that could not be stat'd */
+		else if (stat_entry(td, &st, &timed, s->flags->follow_symlink) == 0){
+			td->ent_stats[e->index] = st;
+		}
+		else{
+			td->ent_stats[e->index].st_mode = 0;
+		}
+	}
+	if (!restore){
+		return res;
+	}
+
+	/* the names are packed in the order they were read */
+	for (size_t i = 0, off = 0; i < len && res == 0; ++i){
+		const char* name = td->split + off;
+		size_t name_len = strlen(name);
+
+		off += name_len + 1;
+		if (td->ent_stats[i].st_mode == 0){
+			continue;
+		}
+		if (path_reserve(td, base_len + name_len + 1) != 0){
+			return -1;
+		}
+		memcpy(td->path + base_len, name, name_len + 1);
+		res = match_entry(s, td, base_len, name_len, &(td->ent_stats[i]), depth, descend, 0);
+	}
+	return res;
+}
+
+/* Searches a directory with --inode-order.
+ * Entries are read in windows of up to FFIND_INODE_WINDOW, and each window is stat'd in inode order so a cold disk reads its inode table in one sweep instead of seeking back and forth.
+ * Large directories are not split between workers, since that would break up the sweep.
+ * Returns 0 on success, negative on failure. */
+static int search_dir_sorted(struct ffind_search* s, const struct dir_item* item, struct ffind_thread_data* td){
+	DIR* dp;
+	struct dirent* dnt;
+	uint64_t n_entries = 0;
+	uint64_t span;
+	size_t base_len;
+	size_t len = 0;
+	int depth = item->node->depth + 1;
+	int descend = !item->flat && (s->maxdepth < 0 || depth < s->maxdepth);
+	int ret = 0;
+
+	if (search_should_stop(s, td)){
+		return 0;
+	}
+
+	if (path_set_dir(td, item->node) != 0){
+		return -1;
+	}
+	if (search_throttle_dir(s, td) != 0){
+		return 0;
+	}
+	if (s->pool->dir_hook){
+		s->pool->dir_hook(td->path, item->node->path_len, item->node->depth, s->cb_data);
+	}
+	dp = open_dir(td->path, td);
+	if (!dp){
+		return item->node->depth == 0 ? -1 : 0;
+	}
+	span = trace_begin(td->trace);
+	base_len = path_end_dir(td, item->node);
+
+	td->split_len = 0;
+	for (;;){
+		size_t name_len;
+		int res;
+
+		dnt = readdir(dp);
+		if (dnt && (!strcmp(dnt->d_name, ".") || !strcmp(dnt->d_name, ".."))){
+			continue;
+		}
+
+		if (!dnt || len == FFIND_INODE_WINDOW){
+			res = search_window(s, td, len, base_len, depth, descend);
+			td->split_len = 0;
+			len = 0;
+			if (res != 0){
+				ret = res < 0 ? -1 : 0;
+				break;
+			}
+			if (!dnt){
+				break;
+			}
+		}
+
+		n_entries++;
+		if (n_entries % FFIND_CHECK_INTERVAL == 0 && search_should_stop(s, td)){
+			break;
+		}
+
+		if (len == td->ents_cap){
+			size_t cap = td->ents_cap ? td->ents_cap * 2 : 256;
+			void* tmp = realloc(td->ents, cap * sizeof(*(td->ents)));
+			if (!tmp){
+				log_enomem();
+				ret = -1;
+				break;
+			}
+			td->ents = tmp;
+			td->ents_cap = cap;
+		}
+
+		/* the names are kept in the buffer that large directories are normally split with */
+		name_len = strlen(dnt->d_name);
+		if (td->split_len + name_len + 1 > td->split_cap){
+			size_t cap = td->split_cap ? td->split_cap : 16384;
+			char* tmp;
+			while (cap < td->split_len + name_len + 1){
+				cap *= 2;
+			}
+			tmp = realloc(td->split, cap);
+			if (!tmp){
+				log_enomem();
+				ret = -1;
+				break;
+			}
+			td->split = tmp;
+			td->split_cap = cap;
+		}
+		td->ents[len].ino = dnt->d_ino;
+		td->ents[len].off = td->split_len;
+		td->ents[len].index = len;
+		memcpy(td->split + td->split_len, dnt->d_name, name_len + 1);
+		td->split_len += name_len + 1;
+		len++;
+	}
+
+	close_dir(dp, n_entries, span, td);
+	td->split_len = 0;
+	search_deliver(s, td);
+	return ret;
+}
+
+/* Matches the names in the thread's batch all at once, then stats and handles the ones that matched or could be subdirectories to descend into.
+ * Names that did not match and that readdir() says are not directories are never stat'd.
+ * Returns 0 to continue, positive if the search was cancelled, negative on failure. */
+FF_HOT static int search_names(struct ffind_search* s, struct ffind_thread_data* td, size_t base_len, int depth, int descend){
+	size_t n = td->n_names;
+	int follow_symlink = s->flags->follow_symlink;
+	int res = 0;
+
+	if (path_reserve(td, base_len + td->names_max + 1) != 0){
+		names_clear(td);
+		return -1;
+	}
+	td->name_offs[n] = td->names_len;
+	match_batch(s->p, td->path, base_len, td->names, td->name_offs, n, td->hits);
+
+	for (size_t i = 0; i < n && res == 0; ++i){
+		size_t name_len = td->name_offs[i + 1] - td->name_offs[i] - 1;
+
+		if (!td->hits[i] && !(descend && may_be_dir(td->name_types[i], follow_symlink))){
+			continue;
+		}
+		memcpy(td->path + base_len, td->names + td->name_offs[i], name_len + 1);
+		td->hit = td->hits[i];
+		res = s->search_entry_batch(s, td, base_len, name_len, depth, descend);
+	}
+	names_clear(td);
+	return res;
+}
+
+/* Hands an entry to the search's per-entry code, or to search_names() once the thread's batch is full when the search batches names.
+ * Returns 0 to continue, positive if the search was cancelled, negative on failure. */
+FF_INLINE static inline int search_name(struct ffind_search* s, struct ffind_thread_data* td, size_t base_len, const char* name, size_t name_len, unsigned char type, int depth, int descend){
+	if (s->search_entry_batch){
+		if (names_add(td, name, name_len, type) != 0){
+			return -1;
+		}
+		return td->n_names < MATCH_BATCH_MAX ? 0 : search_names(s, td, base_len, depth, descend);
+	}
+
+	if (path_reserve(td, base_len + name_len + 1) != 0){
+		return -1;
+	}
+	memcpy(td->path + base_len, name, name_len + 1);
+	return s->search_entry(s, td, base_len, name_len, depth, descend);
+}
+
+/* Handles the names left in the thread's batch once a directory or chunk is done, unless the search stopped before then.
+ * Returns 0 to continue, positive if the search was cancelled, negative on failure. */
+static int search_names_finish(struct ffind_search* s, struct ffind_thread_data* td, size_t base_len, int depth, int descend, int ret){
+	if (ret != 0 || td->n_names == 0 || search_cancelled(s)){
+		names_clear(td);
+		return ret;
+	}
+	return search_names(s, td, base_len, depth, descend) < 0 ? -1 : 0;
+}
+
+/* The main finding function.
+ * Matches every entry in a single directory and queues its subdirectories.
+ * Past FFIND_SPLIT_THRESHOLD entries, the rest of the names are handed to the other workers in chunks instead.
+ * Returns 0 on success, negative on failure. */
+FF_HOT static int search_dir(struct ffind_search* s, const struct dir_item* item, struct ffind_thread_data* td){
+	DIR* dp;
+	struct dirent* dnt;
+	uint64_t n_entries = 0;
+	uint64_t span;
+	size_t base_len;
+	int depth = item->node->depth + 1;
+	int descend = !item->flat && (s->maxdepth < 0 || depth < s->maxdepth);
+	/* with one thread there is nobody to share with */
+	uint64_t split_after = s->pool->n_threads > 1 ? FFIND_SPLIT_THRESHOLD : UINT64_MAX;
+	int ret = 0;
+
+	if (s->flags->inode_order){
+		return search_dir_sorted(s, item, td);
+	}
+	if (search_should_stop(s, td)){
+		return 0;
+	}
+
+	if (path_set_dir(td, item->node) != 0){
+		return -1;
+	}
+	if (search_throttle_dir(s, td) != 0){
+		return 0;
+	}
+	if (s->pool->dir_hook){
+		s->pool->dir_hook(td->path, item->node->path_len, item->node->depth, s->cb_data);
+	}
+	dp = open_dir(td->path, td);
+	if (!dp){
+		return item->node->depth == 0 ? -1 : 0;
+	}
+	span = trace_begin(td->trace);
+	base_len = path_end_dir(td, item->node);
+
+	while ((dnt = readdir(dp)) != NULL){
+		size_t name_len;
+		int res;
+
+		/* "." and ".." are symlinks to the current directory/parent directory.
+		 * we do not want to search through these, as it would cause an infinite loop */
+		if (!strcmp(dnt->d_name, ".") || !strcmp(dnt->d_name, "..")){
+			continue;
+		}
+		n_entries++;
+		if (n_entries % FFIND_CHECK_INTERVAL == 0 && search_should_stop(s, td)){
+			break;
+		}
+
+		name_len = strlen(dnt->d_name);
+		if (n_entries > split_after){
+			if (add_split(s, item, td, dnt->d_name, name_len, DIRENT_TYPE(dnt)) != 0){
+				ret = -1;
+				break;
+			}
+			continue;
+		}
+
+		res = search_name(s, td, base_len, dnt->d_name, name_len, DIRENT_TYPE(dnt), depth, descend);
+		if (res != 0){
+			ret = res < 0 ? -1 : 0;
+			break;
+		}
+	}
+	ret = search_names_finish(s, td, base_len, depth, descend, ret);
+
+	close_dir(dp, n_entries, span, td);
+	if (ret == 0 && push_chunk(s, item, td) != 0){
+		ret = -1;
+	}
+	td->split_len = 0;
+	td->split_count = 0;
+	search_deliver(s, td);
+	return ret;
+}
+
+/* Matches a chunk of a large directory's entries that another worker read.
+ * Returns 0 on success, negative on failure. */
+FF_HOT static int search_chunk(struct ffind_search* s, const struct dir_item* item, struct ffind_thread_data* td){
+	const char* name = item->names;
+	const char* end = item->names + item->names_len;
+	uint64_t n_entries = 0;
+	uint64_t span;
+	size_t base_len;
+	int depth = item->node->depth + 1;
+	int descend = !item->flat && (s->maxdepth < 0 || depth < s->maxdepth);
+	int ret = 0;
+
+	if (search_should_stop(s, td)){
+		return 0;
+	}
+	span = trace_begin(td->trace);
+
+	if (path_set_dir(td, item->node) != 0){
+		return -1;
+	}
+	base_len = path_end_dir(td, item->node);
+
+	/* each name starts with its d_type */
+	for (; name < end; name += strlen(name + 1) + 2){
+		size_t name_len = strlen(name + 1);
+		int res;
+
+		n_entries++;
+		if (n_entries % FFIND_CHECK_INTERVAL == 0 && search_should_stop(s, td)){
+			break;
+		}
+
+		res = search_name(s, td, base_len, name + 1, name_len, (unsigned char)name[0], depth, descend);
+		if (res != 0){
+			ret = res < 0 ? -1 : 0;
+			break;
+		}
+	}
+	ret = search_names_finish(s, td, base_len, depth, descend, ret);
+
+	search_deliver(s, td);
+	trace_end(td->trace, TRACE_CHUNK, span, n_entries);
+	return ret;
+}
+
+/* Picks the next directory to work on, preferring the search after the one last worked on so searches share the pool.
+ * The pool must be locked.
+ * Returns the search the directory belongs to, or NULL if there is no work. */
+static struct ffind_search* pool_pop_locked(struct ffind_pool* pool, struct dir_item* out){
+	struct ffind_search* s;
+
+	for (s = pool->searches; s; s = s->next){
+		if (s->stack_len > 0 && !s->paused){
+			break;
+		}
+	}
+	if (!s){
+		return NULL;
+	}
+
+	s->stack_len--;
+	__atomic_store_n(&(pool->queued), pool->queued - 1, __ATOMIC_RELAXED);
+	*out = s->stack[s->stack_len];
+	s->path_bytes -= out->node->path_len + 1;
+	s->active++;
+
+	/* rotate the search to the back of the list */
+	if (s->next){
+		struct ffind_search** pp = &(pool->searches);
+		while (*pp != s){
+			pp = &((*pp)->next);
+		}
+		*pp = s->next;
+		while (*pp){
+			pp = &((*pp)->next);
+		}
+		*pp = s;
+		s->next = NULL;
+	}
+	return s;
+}
+
+static void* ffind_worker_thread(void* param){
+	struct ffind_pool_thread* pt = param;
+	struct ffind_pool* pool = pt->pool;
+	struct ffind_thread_data* td = &(pt->td);
+
+	td->trace = trace_thread("worker");
+
+	pool_lock(pool, NULL);
+	for (;;){
+		struct ffind_search* s;
+		struct dir_item item;
+		uint64_t start = 0;
+		uint64_t span;
+
+		if (td->index >= pool->active_limit){
+			if (pool->shutdown){
+				break;
+			}
+			/* a wakeup meant for an active thread may have landed here */
+			pthread_cond_signal(&(pool->cond));
+			pthread_cond_wait(&(pool->park_cond), &(pool->mutex));
+			continue;
+		}
+
+		if (pool->job_next < pool->job_len){
+			size_t index = pool->job_next++;
+			ffind_task fn = pool->job_fn;
+			void* data = pool->job_data;
+
+			pool_unlock(pool);
+			fn(index, td->index, data);
+			pool_lock(pool, NULL);
+			if (++(pool->job_done) == pool->job_len){
+				pthread_cond_broadcast(&(pool->job_cond));
+			}
+			continue;
+		}
+
+		span = trace_begin(td->trace);
+		s = pool_pop_locked(pool, &item);
+		trace_end(td->trace, TRACE_POP, span, s != NULL);
+		if (!s){
+			if (pool->shutdown){
+				break;
+			}
+			pthread_cond_wait(&(pool->cond), &(pool->mutex));
+			continue;
+		}
+		pool_unlock(pool);
+
+		td->stats = stats_slot(s->stats, td->index);
+		td->throttled_ns = 0;
+		if (td->stats || pool->adaptive){
+			start = stats_now();
+		}
+
+		if (!td->batch){
+			td->batch = batch_new();
+		}
+		if (!td->batch || (item.names ? search_chunk(s, &item, td) : search_dir(s, &item, td)) != 0){
+			search_fail(s, td);
+		}
+		progress_set_dir(td, NULL, 0);
+
+		pool_lock(pool, td->stats);
+		if (td->n_children > 0){
+			span = trace_begin(td->trace);
+			if (!search_cancelled(s)){
+				if (push_children_locked(s, item.node, td) != 0){
+					s->status = -1;
+					search_cancel_locked(s);
+				}
+				else if (td->n_children > 1){
+					pthread_cond_broadcast(&(pool->cond));
+				}
+			}
+			trace_end(td->trace, TRACE_PUSH, span, td->n_children);
+			td->children_len = 0;
+			td->n_children = 0;
+		}
+		search_release_locked(s, &item);
+
+		s->active--;
+		if (s->active == 0 && s->stack_len == 0){
+			search_finish_locked(s);
+		}
+		else if (s->active == 0 && s->paused){
+			pthread_cond_broadcast(&(s->cond));
+		}
+		if (td->stats || pool->adaptive){
+			uint64_t elapsed = stats_now() - start;
+			if (td->stats){
+				td->stats->active_ns += elapsed;
+			}
+			/* waiting on a throttle is not work, and adding threads would not make it go faster */
+			__atomic_store_n(&(td->busy_ns), td->busy_ns + elapsed - td->throttled_ns, __ATOMIC_RELAXED);
+		}
+	}
+	pool_unlock(pool);
+
+	return NULL;
+}
+
+/* Resizes the active worker set of an adaptive pool.
+ *
+ * Every FFIND_ADAPT_PERIOD_MS, the time the active threads spent working on directories is compared to the CPU time the process used.
+ * Work time that did not turn into CPU time was spent blocked, usually on I/O.
+ * If most of it was blocked and directories are waiting, more threads are activated to hide the latency.
+ * If little of it was blocked and there are more threads than CPUs, threads are parked to cut contention. */
+static void* ffind_controller_thread(void* param){
+	struct ffind_pool* pool = param;
+	uint64_t* prev_busy;
+	uint64_t prev_cpu;
+	long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	struct timespec ts;
+
+	prev_busy = calloc(pool->n_threads, sizeof(*prev_busy));
+	if (!prev_busy){
+		log_enomem();
+		return NULL;
+	}
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	prev_cpu = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	if (n_cpus < 1){
+		n_cpus = 1;
+	}
+
+	pthread_mutex_lock(&(pool->mutex));
+	while (!pool->shutdown){
+		uint64_t busy = 0;
+		uint64_t cpu;
+		size_t queued = 0;
+		size_t limit = pool->active_limit;
+		double blocked;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += FFIND_ADAPT_PERIOD_MS * 1000000L;
+		ts.tv_sec += ts.tv_nsec / 1000000000L;
+		ts.tv_nsec %= 1000000000L;
+		pthread_cond_timedwait(&(pool->park_cond), &(pool->mutex), &ts);
+		if (pool->shutdown){
+			break;
+		}
+
+		for (const struct ffind_search* s = pool->searches; s; s = s->next){
+			queued += s->stack_len;
+		}
+		for (size_t i = 0; i < pool->n_threads; ++i){
+			uint64_t b = __atomic_load_n(&(pool->threads[i].td.busy_ns), __ATOMIC_RELAXED);
+			busy += b - prev_busy[i];
+			prev_busy[i] = b;
+		}
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+		cpu = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec - prev_cpu;
+		prev_cpu += cpu;
+
+		/* nothing worth measuring happened */
+		if (busy < FFIND_ADAPT_PERIOD_MS * 1000000ULL / 2){
+			continue;
+		}
+
+		blocked = busy > cpu ? (double)(busy - cpu) / busy : 0.0;
+		if (queued > limit && blocked > 0.5 && limit < pool->n_threads){
+			limit += limit / 4 > 0 ? limit / 4 : 1;
+			limit = limit < pool->n_threads ? limit : pool->n_threads;
+		}
+		else if (blocked < 0.25 && limit > (size_t)n_cpus && limit > pool->min_threads){
+			limit -= limit / 8 > 0 ? limit / 8 : 1;
+			limit = limit > (size_t)n_cpus ? limit : (size_t)n_cpus;
+			limit = limit > pool->min_threads ? limit : pool->min_threads;
+		}
+
+		if (limit > pool->active_limit){
+			pthread_cond_broadcast(&(pool->park_cond));
+		}
+		pool->active_limit = limit;
+	}
+	pthread_mutex_unlock(&(pool->mutex));
+
+	free(prev_busy);
+	return NULL;
+}
+
+static void thread_data_free(struct ffind_thread_data* td){
+	contents_buf_free(&(td->cb));
+	batch_free(td->batch);
+	free(td->path);
+	free(td->children);
+	free(td->split);
+	free(td->names);
+	free(td->ents);
+	free(td->ent_stats);
+}
+
+/* Creates a pool of n_threads threads, of which initial may take work at first. */
+static struct ffind_pool* pool_create(size_t n_threads, size_t min_threads, size_t initial, unsigned adaptive){
+	struct ffind_pool* pool;
+	size_t started;
+
+	if (n_threads == 0 || min_threads == 0){
+		eprintf_mt("ffind: Cannot start with 0 threads.\n");
+		return NULL;
+	}
+	if (min_threads > n_threads){
+		eprintf_mt("ffind: The minimum number of threads is larger than the maximum.\n");
+		return NULL;
+	}
+
+	pool = malloc(sizeof(*pool));
+	if (!pool){
+		log_enomem();
+		return NULL;
+	}
+	pool->threads = calloc(n_threads, sizeof(*(pool->threads)));
+	if (!pool->threads){
+		log_enomem();
+		free(pool);
+		return NULL;
+	}
+	pthread_mutex_init(&(pool->mutex), NULL);
+	pthread_cond_init(&(pool->cond), NULL);
+	pthread_cond_init(&(pool->park_cond), NULL);
+	pthread_cond_init(&(pool->job_cond), NULL);
+	pool->n_threads = n_threads;
+	pool->searches = NULL;
+	pool->min_threads = min_threads;
+	pool->active_limit = initial < min_threads ? min_threads : initial > n_threads ? n_threads : initial;
+	pool->adaptive = adaptive;
+	pool->shutdown = 0;
+	pool->has_controller = 0;
+	pool->dir_hook = NULL;
+	pool->job_fn = NULL;
+	pool->job_data = NULL;
+	pool->job_len = 0;
+	pool->job_next = 0;
+	pool->job_done = 0;
+	pool->queued = 0;
+
+	for (started = 0; started < n_threads; ++started){
+		struct ffind_pool_thread* pt = &(pool->threads[started]);
+
+		pt->pool = pool;
+		contents_buf_init(&(pt->td.cb));
+		pt->td.index = started;
+		pt->td.batch = batch_new();
+		if (!pt->td.batch){
+			break;
+		}
+		if (pthread_create(&(pt->thread), NULL, ffind_worker_thread, pt) != 0){
+			log_ethread();
+			batch_free(pt->td.batch);
+			break;
+		}
+	}
+
+	if (started != n_threads){
+		pool->n_threads = started;
+		ffind_pool_destroy(pool);
+		return NULL;
+	}
+
+	if (adaptive){
+		if (pthread_create(&(pool->controller), NULL, ffind_controller_thread, pool) != 0){
+			log_ethread();
+			ffind_pool_destroy(pool);
+			return NULL;
+		}
+		pool->has_controller = 1;
+	}
+	return pool;
+}
+
+struct ffind_pool* ffind_pool_create(size_t n_threads){
+	return pool_create(n_threads, n_threads == 0 ? 1 : n_threads, n_threads, 0);
+}
+
+struct ffind_pool* ffind_pool_create_adaptive(size_t min_threads, size_t max_threads, size_t initial){
+	return pool_create(max_threads, min_threads, initial, 1);
+}
+
+size_t ffind_default_threads(const char* path){
+	long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#ifdef __linux__
+	struct statfs sfs;
+#endif
+
+	if (n_cpus < 1){
+		n_cpus = 1;
+	}
+
+#ifdef __linux__
+	if (statfs(path, &sfs) == 0){
+		switch ((unsigned long)sfs.f_type){
+		case 0x6969UL:     /* NFS */
+		case 0x65735546UL: /* FUSE */
+		case 0x517BUL:     /* SMB */
+		case 0xFF534D42UL: /* CIFS */
+		case 0xFE534D42UL: /* SMB2 */
+		case 0x00C36400UL: /* Ceph */
+		case 0x47504653UL: /* GPFS */
+		case 0x0BD00BD0UL: /* Lustre */
+		case 0x6B414653UL: /* AFS */
+			/* remote filesystems spend most of their time waiting on the network */
+			return n_cpus * FFIND_REMOTE_THREADS_PER_CPU;
+		}
+	}
+#else
+	(void)path;
+#endif
+	return n_cpus;
+}
+
+void ffind_pool_destroy(struct ffind_pool* pool){
+	if (!pool){
+		return;
+	}
+
+	pthread_mutex_lock(&(pool->mutex));
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&(pool->cond));
+	pthread_cond_broadcast(&(pool->park_cond));
+	pthread_mutex_unlock(&(pool->mutex));
+
+	if (pool->has_controller && pthread_join(pool->controller, NULL) != 0){
+		log_ejoin();
+	}
+
+	for (size_t i = 0; i < pool->n_threads; ++i){
+		if (pthread_join(pool->threads[i].thread, NULL) != 0){
+			log_ejoin();
+		}
+		thread_data_free(&(pool->threads[i].td));
+	}
+
+	pthread_cond_destroy(&(pool->job_cond));
+	pthread_cond_destroy(&(pool->park_cond));
+	pthread_cond_destroy(&(pool->cond));
+	pthread_mutex_destroy(&(pool->mutex));
+	free(pool->threads);
+	free(pool);
+}
+
+size_t ffind_pool_threads(const struct ffind_pool* pool){
+	return pool->n_threads;
+}
+
+void ffind_pool_progress(const struct ffind_pool* pool, struct ffind_progress* out){
+	out->dirs = 0;
+	out->entries = 0;
+	out->matches = 0;
+	out->busy = 0;
+	for (size_t i = 0; i < pool->n_threads; ++i){
+		const struct ffind_thread_data* td = &(pool->threads[i].td);
+
+		out->dirs += __atomic_load_n(&(td->n_dirs), __ATOMIC_RELAXED);
+		out->entries += __atomic_load_n(&(td->n_entries), __ATOMIC_RELAXED);
+		out->matches += __atomic_load_n(&(td->n_matches), __ATOMIC_RELAXED);
+		if (__atomic_load_n(&(td->dir_len), __ATOMIC_RELAXED) != 0){
+			out->busy++;
+		}
+	}
+	out->queued = __atomic_load_n(&(pool->queued), __ATOMIC_RELAXED);
+}
+
+size_t ffind_pool_progress_dir(const struct ffind_pool* pool, size_t thread, char buf[FFIND_PROGRESS_PATH]){
+	const struct ffind_thread_data* td = &(pool->threads[thread].td);
+
+	/* a thread racing through tiny directories could keep this retrying forever, so give up after a few tries */
+	for (int tries = 0; tries < 8; ++tries){
+		unsigned seq = __atomic_load_n(&(td->dir_seq), __ATOMIC_ACQUIRE);
+		size_t len;
+		size_t n;
+
+		if (seq % 2 != 0){
+			continue;
+		}
+		len = __atomic_load_n(&(td->dir_len), __ATOMIC_RELAXED);
+		n = len < FFIND_PROGRESS_PATH ? len : FFIND_PROGRESS_PATH;
+		for (size_t i = 0; i < n; i += sizeof(uint64_t)){
+			uint64_t word = __atomic_load_n(&(td->dir_words[i / sizeof(word)]), __ATOMIC_RELAXED);
+			memcpy(buf + i, &word, n - i < sizeof(word) ? n - i : sizeof(word));
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&(td->dir_seq), __ATOMIC_RELAXED) == seq){
+			return len;
+		}
+	}
+	return 0;
+}
+
+void ffind_pool_set_dir_hook(struct ffind_pool* pool, ffind_dir_hook hook){
+	pool->dir_hook = hook;
+}
+
+void ffind_pool_run(struct ffind_pool* pool, size_t n, ffind_task fn, void* data){
+	if (n == 0){
+		return;
+	}
+
+	pthread_mutex_lock(&(pool->mutex));
+	while (pool->job_len != 0){
+		pthread_cond_wait(&(pool->job_cond), &(pool->mutex));
+	}
+	pool->job_fn = fn;
+	pool->job_data = data;
+	pool->job_len = n;
+	pool->job_next = 0;
+	pool->job_done = 0;
+	pthread_cond_broadcast(&(pool->cond));
+
+	while (pool->job_done < pool->job_len){
+		pthread_cond_wait(&(pool->job_cond), &(pool->mutex));
+	}
+	pool->job_len = 0;
+	pool->job_next = 0;
+	/* let the next caller in */
+	pthread_cond_broadcast(&(pool->job_cond));
+	pthread_mutex_unlock(&(pool->mutex));
+}
+
+/* The length of a base directory's path with a slash after it, like path_end_dir_len() for its node. */
+static size_t base_dir_len(const char* base_dir){
+	size_t len = strlen(base_dir);
+
+	return len > 0 && base_dir[len - 1] == '/' ? len : len + 1;
+}
+
+/* Creates the work items for a search resumed from a frontier.
+ * Returns 0 on success, negative on failure, in which case the items created so far are in *items and *len. */
+static int frontier_items(struct ffind_search* s, const struct ffind_frontier* f, struct dir_item* items, size_t* len){
+	for (*len = 0; *len < f->len; ++(*len)){
+		const struct ffind_pending* p = &(f->dirs[*len]);
+		struct dir_item* item = &(items[*len]);
+
+		/* every directory becomes a base node holding its whole path, since their parents are long gone */
+		item->node = dir_node_new(&(s->arena), NULL, p->path, p->path_len);
+		if (!item->node){
+			return -1;
+		}
+		item->node->depth = p->depth;
+		item->names = NULL;
+		item->names_len = 0;
+		item->flat = p->flat;
+		if (p->names){
+			item->names = malloc(p->names_len);
+			if (!item->names){
+				log_enomem();
+				dir_node_release(&(s->arena), item->node);
+				return -1;
+			}
+			memcpy(item->names, p->names, p->names_len);
+			item->names_len = p->names_len;
+		}
+	}
+	return 0;
+}
+
+/* Starts a search at its base directory, or from a frontier if f is not NULL. */
+static struct ffind_search* search_start(struct ffind_pool* pool, const char* base_dir, const struct parsed_data* pd, struct stats_set* stats, ffind_callback cb, void* data,
+		const struct ffind_frontier* f){
+	struct ffind_search* s;
+	struct dir_item root;
+	struct dir_item* items = &root;
+	size_t len = 0;
+
+	s = calloc(1, sizeof(*s));
+	if (!s){
+		log_enomem();
+		return NULL;
+	}
+
+	s->pool = pool;
+	s->p = &(pd->pat);
+	s->contains = &(pd->contains);
+	s->flags = &(pd->flags);
+	s->contains_maxsize = pd->contains_maxsize;
+	s->fuzzy = pd->flags.fuzzy ? &(pd->fuzzy) : NULL;
+	s->search_entry = search_entry_select(s);
+	s->search_entry_batch = search_entry_select_batch(s);
+	s->maxdepth = pd->maxdepth;
+	s->max_results = pd->max_results;
+	s->deadline = pd->timeout_ns ? stats_now() + pd->timeout_ns : 0;
+	throttle_init(&(s->iops), pd->max_iops);
+	throttle_init(&(s->dirs), pd->max_dirs_per_sec);
+	s->cb = cb;
+	s->cb_data = data;
+	s->stats = stats;
+	s->root_len = base_dir_len(base_dir);
+	pthread_cond_init(&(s->cond), NULL);
+
+	dir_arena_init(&(s->arena));
+
+	if (!f){
+		root.node = dir_node_new(&(s->arena), NULL, base_dir, strlen(base_dir));
+		root.names = NULL;
+		root.names_len = 0;
+		root.flat = 0;
+		len = root.node ? 1 : 0;
+	}
+	else if (f->len > 0){
+		items = malloc(f->len * sizeof(*items));
+		if (!items){
+			log_enomem();
+		}
+		else if (frontier_items(s, f, items, &len) != 0){
+			for (size_t i = 0; i < len; ++i){
+				search_release_locked(s, &(items[i]));
+			}
+			free(items);
+			items = NULL;
+		}
+	}
+	if ((!f && len == 0) || !items){
+		dir_arena_free(&(s->arena));
+		pthread_cond_destroy(&(s->cond));
+		free(s);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&(pool->mutex));
+	stats_scan_begin(stats);
+	if (len > 0 && search_push_locked(s, items, len) != 0){
+		pthread_mutex_unlock(&(pool->mutex));
+		for (size_t i = 0; i < len; ++i){
+			free(items[i].names);
+		}
+		if (items != &root){
+			free(items);
+		}
+		dir_arena_free(&(s->arena));
+		pthread_cond_destroy(&(s->cond));
+		free(s);
+		return NULL;
+	}
+	s->next = pool->searches;
+	pool->searches = s;
+	/* a frontier with nothing left is a search that already finished */
+	if (len == 0){
+		search_finish_locked(s);
+	}
+	else{
+		pthread_cond_broadcast(&(pool->cond));
+	}
+	pthread_mutex_unlock(&(pool->mutex));
+
+	if (items != &root){
+		free(items);
+	}
+	return s;
+}
+
+struct ffind_search* ffind_search_start(struct ffind_pool* pool, const char* base_dir, const struct parsed_data* pd, struct stats_set* stats, ffind_callback cb, void* data){
+	return search_start(pool, base_dir, pd, stats, cb, data, NULL);
+}
+
+struct ffind_search* ffind_search_resume(struct ffind_pool* pool, const char* base_dir, const struct parsed_data* pd, struct stats_set* stats, ffind_callback cb, void* data, const struct ffind_frontier* frontier){
+	return search_start(pool, base_dir, pd, stats, cb, data, frontier);
+}
+
+int ffind_search_checkpoint(struct ffind_search* search, int stop, struct ffind_frontier* out){
+	struct ffind_pool* pool = search->pool;
+	struct dir_item* items = NULL;
+	size_t len = 0;
+	int ret = 0;
+
+	out->dirs = NULL;
+	out->len = 0;
+	out->results = 0;
+
+	pthread_mutex_lock(&(pool->mutex));
+	search->paused = 1;
+	while (search->active > 0){
+		pthread_cond_wait(&(search->cond), &(pool->mutex));
+	}
+
+	/* a cancelled search threw its queue away, so there is nothing to copy that would be true */
+	if (search_cancelled(search)){
+		ret = 1;
+	}
+	else if (search->stack_len > 0 && !(items = malloc(search->stack_len * sizeof(*items)))){
+		log_enomem();
+		ret = -1;
+	}
+	else{
+		/* the nodes are only referenced here, and their paths written out once the threads are let go */
+		for (; len < search->stack_len; ++len){
+			const struct dir_item* item = &(search->stack[len]);
+
+			items[len] = *item;
+			if (item->names){
+				items[len].names = malloc(item->names_len);
+				if (!items[len].names){
+					log_enomem();
+					ret = -1;
+					break;
+				}
+				memcpy(items[len].names, item->names, item->names_len);
+			}
+			dir_node_ref(item->node);
+		}
+		out->results = ffind_search_count(search);
+	}
+
+	if (stop && ret == 0){
+		if (search->status == 0){
+			search->status = FFIND_INTERRUPTED;
+		}
+		search_cancel_locked(search);
+	}
+	search->paused = 0;
+	if (search->stack_len > 0){
+		pthread_cond_broadcast(&(pool->cond));
+	}
+	pthread_mutex_unlock(&(pool->mutex));
+
+	if (ret == 0 && len > 0){
+		out->dirs = calloc(len, sizeof(*(out->dirs)));
+		if (!out->dirs){
+			log_enomem();
+			ret = -1;
+		}
+	}
+	for (size_t i = 0; ret == 0 && i < len; ++i){
+		struct ffind_pending* p = &(out->dirs[i]);
+
+		p->path = malloc(items[i].node->path_len + 1);
+		if (!p->path){
+			log_enomem();
+			ret = -1;
+			break;
+		}
+		dir_node_path(items[i].node, p->path);
+		p->path_len = items[i].node->path_len;
+		p->depth = items[i].node->depth;
+		p->flat = items[i].flat;
+		p->names = items[i].names;
+		p->names_len = items[i].names_len;
+		items[i].names = NULL;
+		out->len++;
+	}
+
+	pthread_mutex_lock(&(pool->mutex));
+	for (size_t i = 0; i < len; ++i){
+		search_release_locked(search, &(items[i]));
+	}
+	pthread_mutex_unlock(&(pool->mutex));
+	free(items);
+	return ret;
+}
+
+void ffind_frontier_free(struct ffind_frontier* frontier){
+	for (size_t i = 0; i < frontier->len; ++i){
+		free(frontier->dirs[i].path);
+		free(frontier->dirs[i].names);
+	}
+	free(frontier->dirs);
+	frontier->dirs = NULL;
+	frontier->len = 0;
+}
+
+int ffind_search_next(struct ffind_search* search, const struct ffind_result** results, size_t* len){
+	struct ffind_pool* pool = search->pool;
+
+	pthread_mutex_lock(&(pool->mutex));
+	if (search->current){
+		search->current->next = search->free_batches;
+		search->free_batches = search->current;
+		search->current = NULL;
+	}
+
+	while (!search->queue_head && !search->done){
+		pthread_cond_wait(&(search->cond), &(pool->mutex));
+	}
+	if (!search->queue_head){
+		pthread_mutex_unlock(&(pool->mutex));
+		return 0;
+	}
+
+	search->current = search->queue_head;
+	search->queue_head = search->current->next;
+	if (!search->queue_head){
+		search->queue_tail = NULL;
+	}
+	search->queue_len--;
+	pthread_cond_broadcast(&(search->cond));
+	pthread_mutex_unlock(&(pool->mutex));
+
+	*results = search->current->results;
+	*len = search->current->len;
+	return 1;
+}
+
+void ffind_search_cancel(struct ffind_search* search){
+	pthread_mutex_lock(&(search->pool->mutex));
+	search_cancel_locked(search);
+	pthread_mutex_unlock(&(search->pool->mutex));
+}
+
+int ffind_search_wait(struct ffind_search* search){
+	int ret;
+
+	pthread_mutex_lock(&(search->pool->mutex));
+	while (!search->done){
+		pthread_cond_wait(&(search->cond), &(search->pool->mutex));
+	}
+	ret = search->status;
+	pthread_mutex_unlock(&(search->pool->mutex));
+	return ret;
+}
+
+size_t ffind_search_count(const struct ffind_search* search){
+	size_t n = __atomic_load_n(&(search->n_results), __ATOMIC_RELAXED);
+	/* a batch past the limit holds its reservation until it gives it back */
+	return search->max_results && n > search->max_results ? search->max_results : n;
+}
+
+void ffind_search_free(struct ffind_search* search){
+	if (!search){
+		return;
+	}
+
+	pthread_mutex_lock(&(search->pool->mutex));
+	if (!search->done){
+		search_cancel_locked(search);
+		while (!search->done){
+			pthread_cond_wait(&(search->cond), &(search->pool->mutex));
+		}
+	}
+	pthread_mutex_unlock(&(search->pool->mutex));
+
+	batch_free_list(search->queue_head);
+	batch_free_list(search->free_batches);
+	batch_free(search->current);
+	free(search->stack);
+	dir_arena_free(&(search->arena));
+	pthread_cond_destroy(&(search->cond));
+	free(search);
 }
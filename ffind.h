@@ -1,6 +1,10 @@
 /** @file ffind.h
- * @brief The finding backend.
- * Copyright (c) 2018 Jonathan Lemos
+ * @brief The finding backend.<br>
+ * This is the public interface of libffind.
+ * Searches run on a shared pool of worker threads and deliver their matches in batches,
+ * either to a callback or through a pull iterator.
+ * Any number of searches may run on the same pool at the same time.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
  *
  * This software may be modified and distributed under the terms
  * of the MIT license.  See the LICENSE file for details.
@@ -11,40 +15,411 @@
 
 #include "options.h"
 #include "match.h"
-#include <pthread.h>
+#include "stats.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
 
 /**
- * @brief Creates the ffind threads.
+ * @brief The maximum number of results in a single batch.
+ */
+#define FFIND_BATCH_LEN 256
+
+/**
+ * @brief A batch is delivered early once its paths take up this many bytes.
+ */
+#define FFIND_BATCH_BYTES (64 * 1024)
+
+/**
+ * @brief The maximum number of undelivered batches an iterator search holds before its workers wait for the consumer.
+ */
+#define FFIND_QUEUE_MAX 64
+
+/**
+ * @brief Workers check whether their search was cancelled or ran out of time after reading this many entries of a directory.<br>
+ * This bounds how long a cancelled search keeps running.
+ */
+#define FFIND_CHECK_INTERVAL 32
+
+/**
+ * @brief Once a directory has more entries than this, the worker reading it hands the rest of its names to other workers to stat and match.
+ */
+#define FFIND_SPLIT_THRESHOLD 4096
+
+/**
+ * @brief The number of names in each chunk of a large directory handed to other workers.
+ */
+#define FFIND_SPLIT_CHUNK 1024
+
+/**
+ * @brief With --inode-order, the most entries of a directory that are read and sorted by inode at once.<br>
+ * Larger directories are handled in windows of this size, so memory use stays bounded.
+ */
+#define FFIND_INODE_WINDOW 65536
+
+/**
+ * @brief How often an adaptive pool reconsiders its number of active threads, in milliseconds.
+ */
+#define FFIND_ADAPT_PERIOD_MS 25
+
+/**
+ * @brief The starting number of threads per CPU on network and FUSE filesystems.
+ */
+#define FFIND_REMOTE_THREADS_PER_CPU 4
+
+/**
+ * @brief The most bytes of a thread's current directory that ffind_pool_progress_dir() can report.<br>
+ * Longer paths are cut from the front, since the end says more about where the thread is.
+ */
+#define FFIND_PROGRESS_PATH 256
+
+/**
+ * @brief Returned by ffind_search_wait() when a search stopped because it ran out of time.
+ */
+#define FFIND_TIMED_OUT 1
+
+/**
+ * @brief Returned by ffind_search_wait() when a search was stopped by ffind_search_checkpoint().
+ */
+#define FFIND_INTERRUPTED 2
+
+/**
+ * @brief A worker pool that runs searches.
+ */
+struct ffind_pool;
+
+/**
+ * @brief A single search of a directory tree.
+ */
+struct ffind_search;
+
+/**
+ * @brief A single matching entry.
+ */
+struct ffind_result{
+	const char* path; /**< The full path of the entry. */
+	size_t path_len;  /**< strlen(path) */
+	struct stat st;   /**< The entry's metadata, as fetched during the search. */
+	int depth;        /**< The depth of the entry. Entries directly inside the base directory have a depth of 1. */
+	int score;        /**< With --fuzzy, how well the entry's path matched the query. Higher is better. Otherwise 0. */
+};
+
+/**
+ * @brief Receives a batch of results.<br>
+ * Callbacks for the same search may run at the same time on different pool threads.
+ *
+ * @param results The results.<br>
+ * These are only valid until the callback returns.
+ *
+ * @param len The number of results.
+ *
+ * @param data The data pointer given to ffind_search_start().
+ *
+ * @return 0 to continue the search, nonzero to cancel it.
+ */
+typedef int (*ffind_callback)(const struct ffind_result* results, size_t len, void* data);
+
+/**
+ * @brief Creates a worker pool.
+ *
+ * @param n_threads The number of worker threads.<br>
+ * This cannot be 0.
+ *
+ * @return A new pool, or NULL on failure.<br>
+ * This must be freed with ffind_pool_destroy().
+ * @see ffind_pool_destroy()
+ */
+struct ffind_pool* ffind_pool_create(size_t n_threads);
+
+/**
+ * @brief Creates a worker pool that changes its number of active threads to match the workload.<br>
+ * Every thread is created up front, but only some of them take work at a time.
+ * Threads are activated when the active ones spend most of their time blocked with directories waiting, and parked when they are mostly using the CPU.
+ *
+ * @param min_threads The minimum number of active threads.<br>
+ * This cannot be 0.
+ *
+ * @param max_threads The number of threads in the pool.<br>
+ * This cannot be less than min_threads.
+ *
+ * @param initial The number of threads that are active at first.<br>
+ * ffind_default_threads() gives a reasonable value.
+ *
+ * @return A new pool, or NULL on failure.<br>
+ * This must be freed with ffind_pool_destroy().
+ * @see ffind_pool_destroy()
+ */
+struct ffind_pool* ffind_pool_create_adaptive(size_t min_threads, size_t max_threads, size_t initial);
+
+/**
+ * @brief Picks a starting number of threads for searching a directory.<br>
+ * This is the number of online CPUs, multiplied by FFIND_REMOTE_THREADS_PER_CPU if the directory is on a network or FUSE filesystem.
+ *
+ * @param path The directory that will be searched.
+ *
+ * @return The suggested number of threads.
+ */
+size_t ffind_default_threads(const char* path);
+
+/**
+ * @brief Stops a pool's threads and releases it.<br>
+ * Every search started on the pool must be freed before this is called.
+ *
+ * @param pool The pool to destroy.
+ */
+void ffind_pool_destroy(struct ffind_pool* pool);
+
+/**
+ * @brief Gets the number of threads in a pool.
+ *
+ * @param pool The pool.
+ *
+ * @return The number of threads.<br>
+ * For an adaptive pool, this is the maximum number of threads.
+ */
+size_t ffind_pool_threads(const struct ffind_pool* pool);
+
+/**
+ * @brief Called for every directory a search is about to read.<br>
+ * Calls may run at the same time on different pool threads.
+ *
+ * @param path The directory's path.
+ *
+ * @param path_len strlen(path)
+ *
+ * @param depth The depth of the directory. The base directory has a depth of 0.
+ *
+ * @param data The data pointer given to the search's callback.
+ */
+typedef void (*ffind_dir_hook)(const char* path, size_t path_len, int depth, void* data);
+
+/**
+ * @brief Sets a function for the pool's threads to call with every directory right before they open it, so anything it arranges is in place before the directory is read.<br>
+ * Chunks of directories that were already read, like the entries of a frontier, are not passed to it.<br>
+ * This must be called before any search is started on the pool.
+ *
+ * @param pool The pool.
+ *
+ * @param hook The function, or NULL for none.
+ */
+void ffind_pool_set_dir_hook(struct ffind_pool* pool, ffind_dir_hook hook);
+
+/**
+ * @brief A task run by ffind_pool_run().
+ *
+ * @param index The index of this run of the task.
+ *
+ * @param thread The index of the pool thread running it, which is less than ffind_pool_threads().<br>
+ * Runs on the same thread never overlap, so this can select per-thread buffers.
+ *
+ * @param data The data passed to ffind_pool_run().
+ */
+typedef void (*ffind_task)(size_t index, size_t thread, void* data);
+
+/**
+ * @brief Runs a task once for every index from 0 to n - 1 on a pool's active threads, and waits for every run to finish.<br>
+ * The runs share the pool with any searches on it. Only one call runs at a time; others wait for it to finish.<br>
+ * This function is thread-safe, but it cannot be called from a pool thread.
+ *
+ * @param pool The pool.
+ *
+ * @param n The number of runs.
+ *
+ * @param fn The task.
+ *
+ * @param data Passed to every run.
+ */
+void ffind_pool_run(struct ffind_pool* pool, size_t n, ffind_task fn, void* data);
+
+/**
+ * @brief A snapshot of a pool's progress, totalled over every search it has run.
+ */
+struct ffind_progress{
+	uint64_t dirs;    /**< Directories opened. */
+	uint64_t entries; /**< Directory entries read. */
+	uint64_t matches; /**< Entries that matched. */
+	size_t queued;    /**< Directories waiting for a thread. */
+	size_t busy;      /**< Threads working on a directory. */
+};
+
+/**
+ * @brief Takes a snapshot of a pool's progress.<br>
+ * Each worker keeps its own counters and updates them with relaxed atomic stores, so reading them never slows the workers down or takes a lock.
+ * The totals are not taken at a single instant, but each is at most a few entries behind.<br>
+ * This function is thread-safe.
+ *
+ * @param pool The pool.
+ *
+ * @param out Filled with the snapshot.
+ */
+void ffind_pool_progress(const struct ffind_pool* pool, struct ffind_progress* out);
+
+/**
+ * @brief Gets the directory a pool thread is working on.<br>
+ * This function is thread-safe.
+ *
+ * @param pool The pool.
+ *
+ * @param thread The index of the thread, which must be less than ffind_pool_threads().
+ *
+ * @param buf Filled with the end of the path, up to FFIND_PROGRESS_PATH bytes.<br>
+ * This is not NUL-terminated.
+ *
+ * @return The full length of the path, which is larger than FFIND_PROGRESS_PATH if only its end was written.<br>
+ * 0 if the thread is idle, or if the thread moved on too quickly to get a consistent copy.
+ */
+size_t ffind_pool_progress_dir(const struct ffind_pool* pool, size_t thread, char buf[FFIND_PROGRESS_PATH]);
+
+/**
+ * @brief Starts a search.<br>
+ * This function is thread-safe.
+ *
+ * @param pool The pool to run the search on.
  *
  * @param base_dir The directory to start iterating through.
  *
  * @param pd A pointer to a flags structure filled by parse_options().<br>
- * This cannot be NULL.
+ * The search uses its patterns and flags, so it must stay valid until the search is freed.<br>
+ * If pd->max_results is nonzero, the search delivers at most that many results and then cancels itself.<br>
+ * If pd->timeout_ns is nonzero, the search cancels itself once that much time has passed.
  * @see parse_options()
  *
- * @param out A pointer to a pointer of pthreads that will be filled by this function.<br>
- * This must be freed with ffind_join_threads()
- * @see ffind_join_threads()
+ * @param stats Counters to record into, or NULL to not record statistics.<br>
+ * This must have been created for at least ffind_pool_threads() threads.
  *
+ * @param cb The callback to deliver results to, or NULL to retrieve results with ffind_search_next().
  *
- * @return 0 on success, negative on failure.
- * On failure, out is set to NULL and does not have to be freed.
+ * @param data A pointer passed to every call of cb.
+ *
+ * @return A new search, or NULL on failure.<br>
+ * This must be freed with ffind_search_free().
+ * @see ffind_search_free()
+ */
+struct ffind_search* ffind_search_start(struct ffind_pool* pool, const char* base_dir, const struct parsed_data* pd, struct stats_set* stats, ffind_callback cb, void* data);
+
+/**
+ * @brief A directory a search has yet to finish.
+ */
+struct ffind_pending{
+	char* path;       /**< The directory's path. */
+	size_t path_len;  /**< strlen(path) */
+	int depth;        /**< The depth of the directory. The base directory has a depth of 0. */
+	char* names;      /**< If not NULL, the directory was already read and only these of its entries are left.<br>
+	                       Each is a byte holding the entry's d_type, or 0 if it is not known, followed by its NUL-terminated name. */
+	size_t names_len; /**< The length of names. */
+	int flat;         /**< If true, subdirectories among the directory's entries are matched but not searched, since they are listed separately or belong to another shard. */
+};
+
+/**
+ * @brief Everything a search has left to do.<br>
+ * Every directory that is not listed, and not under one that is, is finished.
  */
-int ffind_create_threads(const char* base_dir, const struct parsed_data* pd, pthread_t** out);
+struct ffind_frontier{
+	struct ffind_pending* dirs; /**< The unfinished directories. */
+	size_t len;                 /**< The number of unfinished directories. */
+	size_t results;             /**< The number of results delivered before the frontier was taken. */
+};
 
 /**
- * @brief Waits for ffind threads to finish and releases all memory associated with them.<br>
- * These threads should be created by ffind_create_threads()
- * @see ffind_create_threads()
+ * @brief Starts a search from where an earlier one left off.<br>
+ * This function is thread-safe.
  *
- * @param threads The ffind threads to wait for.
+ * @param pool The pool to run the search on.
  *
- * @param threads_len The number of threads created.<br>
- * This is equal to the parsed_data structure's "n_threads" member at the time of the threads' creation.
+ * @param base_dir The base directory of the earlier search.
+ *
+ * @param pd The options, like ffind_search_start().
+ *
+ * @param stats Counters to record into, or NULL to not record statistics.
+ *
+ * @param cb The callback to deliver results to, or NULL to retrieve results with ffind_search_next().
+ *
+ * @param data A pointer passed to every call of cb.
+ *
+ * @param frontier What the earlier search had left, as taken by ffind_search_checkpoint().<br>
+ * The search makes its own copy.
+ * @see ffind_search_checkpoint()
+ *
+ * @return A new search, or NULL on failure.<br>
+ * This must be freed with ffind_search_free().
+ * @see ffind_search_free()
+ */
+struct ffind_search* ffind_search_resume(struct ffind_pool* pool, const char* base_dir, const struct parsed_data* pd, struct stats_set* stats, ffind_callback cb, void* data, const struct ffind_frontier* frontier);
+
+/**
+ * @brief Takes a copy of what a search started with a callback has left to do.<br>
+ * Threads stop taking the search's directories until the ones in progress are finished and their results delivered, so every directory is either done or listed, never half done.
+ * Only that wait and copying the queue happen with the threads held back; the paths are written out after they carry on.<br>
+ * This function is thread-safe.
+ *
+ * @param search The search.
+ *
+ * @param stop If true, the search is cancelled once the copy is taken, and ffind_search_wait() returns FFIND_INTERRUPTED.
+ *
+ * @param out Filled with the frontier.<br>
+ * This must be freed with ffind_frontier_free(), even if this function fails.
+ * @see ffind_frontier_free()
+ *
+ * @return 0 on success, positive if the search was already cancelled so what it had left is unknown, negative on failure.
+ */
+int ffind_search_checkpoint(struct ffind_search* search, int stop, struct ffind_frontier* out);
+
+/**
+ * @brief Frees the contents of a frontier.
+ *
+ * @param frontier The frontier.
+ */
+void ffind_frontier_free(struct ffind_frontier* frontier);
+
+/**
+ * @brief Retrieves the next batch of results from a search started without a callback.<br>
+ * This blocks until a batch is available or the search is finished.
+ *
+ * @param search The search.
+ *
+ * @param results Set to the results.<br>
+ * These stay valid until the next call to ffind_search_next() or ffind_search_free().
+ *
+ * @param len Set to the number of results.
+ *
+ * @return 1 if a batch was retrieved, 0 if the search is finished.
+ */
+int ffind_search_next(struct ffind_search* search, const struct ffind_result** results, size_t* len);
+
+/**
+ * @brief Cancels a search.<br>
+ * Directories that have not been started are discarded, and directories in progress stop at the next batch.
+ * This function is thread-safe and may be called from a callback.
+ *
+ * @param search The search to cancel.
+ */
+void ffind_search_cancel(struct ffind_search* search);
+
+/**
+ * @brief Waits for a search to finish.
+ *
+ * @param search The search.
+ *
+ * @return 0 on success, FFIND_TIMED_OUT if the search ran out of time, FFIND_INTERRUPTED if ffind_search_checkpoint() stopped it, negative if the base directory could not be read or memory ran out.
+ */
+int ffind_search_wait(struct ffind_search* search);
+
+/**
+ * @brief Gets the number of results a search has delivered so far.<br>
+ * This function is thread-safe.
+ *
+ * @param search The search.
+ *
+ * @return The number of results.
+ */
+size_t ffind_search_count(const struct ffind_search* search);
+
+/**
+ * @brief Releases a search.<br>
+ * If the search is still running, it is cancelled and waited for first.
  *
- * @return 0 on success, negative on failure.
- * On failure, the memory is still released and the threads should not be reused.
+ * @param search The search to free.
  */
-int ffind_join_threads(pthread_t* threads, size_t threads_len);
+void ffind_search_free(struct ffind_search* search);
 
 #endif
@@ -0,0 +1,463 @@
+/** @file format.c
+ * @brief Output formats for matching entries.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "format.h"
+#include "log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+void format_init(struct format* fmt){
+	fmt->mode = FORMAT_PATH;
+	fmt->sep = '\n';
+	fmt->ops = NULL;
+	fmt->ops_len = 0;
+	fmt->text = NULL;
+}
+
+void format_free(struct format* fmt){
+	free(fmt->ops);
+	free(fmt->text);
+	format_init(fmt);
+}
+
+/* Appends len bytes of literal text, merging it with the previous operation if that is also literal. */
+static void add_literal(struct format* fmt, size_t* text_len, const char* s, size_t len){
+	struct format_op* last = fmt->ops_len ? &(fmt->ops[fmt->ops_len - 1]) : NULL;
+
+	memcpy(fmt->text + *text_len, s, len);
+	if (last && last->type == FOP_LITERAL && last->off + last->len == *text_len){
+		last->len += len;
+	}
+	else{
+		fmt->ops[fmt->ops_len].type = FOP_LITERAL;
+		fmt->ops[fmt->ops_len].off = *text_len;
+		fmt->ops[fmt->ops_len].len = len;
+		fmt->ops_len++;
+	}
+	*text_len += len;
+}
+
+static void add_op(struct format* fmt, enum format_op_type type){
+	fmt->ops[fmt->ops_len].type = type;
+	fmt->ops[fmt->ops_len].off = 0;
+	fmt->ops[fmt->ops_len].len = 0;
+	fmt->ops_len++;
+}
+
+/* Parses the escape sequence after a backslash.
+ * Returns the number of characters consumed, or 0 if the escape is invalid. */
+static size_t parse_escape(const char* s, char* out){
+	size_t i;
+	int val = 0;
+
+	switch (*s){
+	case 'a':
+		*out = '\a';
+		return 1;
+	case 'b':
+		*out = '\b';
+		return 1;
+	case 'f':
+		*out = '\f';
+		return 1;
+	case 'n':
+		*out = '\n';
+		return 1;
+	case 'r':
+		*out = '\r';
+		return 1;
+	case 't':
+		*out = '\t';
+		return 1;
+	case 'v':
+		*out = '\v';
+		return 1;
+	case '\\':
+		*out = '\\';
+		return 1;
+	}
+
+	/* \NNN is an octal character code */
+	for (i = 0; i < 3 && s[i] >= '0' && s[i] <= '7'; ++i){
+		val = val * 8 + (s[i] - '0');
+	}
+	*out = (char)val;
+	return i;
+}
+
+int format_compile(const char* spec, struct format* fmt){
+	size_t spec_len = strlen(spec);
+	size_t text_len = 0;
+
+	format_free(fmt);
+	fmt->mode = FORMAT_PRINTF;
+
+	/* every character of the spec produces at most one operation and one byte of text */
+	fmt->ops = malloc((spec_len + 1) * sizeof(*(fmt->ops)));
+	fmt->text = malloc(spec_len + 1);
+	if (!fmt->ops || !fmt->text){
+		log_enomem();
+		format_free(fmt);
+		return -1;
+	}
+
+	for (const char* s = spec; *s; ){
+		if (*s == '\\'){
+			char c;
+			size_t n = parse_escape(s + 1, &c);
+			if (n == 0){
+				eprintf_mt("ffind: -printf escape \\%c is not supported.\n", s[1]);
+				format_free(fmt);
+				return -1;
+			}
+			add_literal(fmt, &text_len, &c, 1);
+			s += n + 1;
+			continue;
+		}
+
+		if (*s != '%'){
+			add_literal(fmt, &text_len, s, 1);
+			s++;
+			continue;
+		}
+
+		s++;
+		switch (*s){
+		case '%':
+			add_literal(fmt, &text_len, "%", 1);
+			break;
+		case 'p':
+			add_op(fmt, FOP_PATH);
+			break;
+		case 'P':
+			add_op(fmt, FOP_REL_PATH);
+			break;
+		case 'f':
+			add_op(fmt, FOP_NAME);
+			break;
+		case 'h':
+			add_op(fmt, FOP_DIR);
+			break;
+		case 'd':
+			add_op(fmt, FOP_DEPTH);
+			break;
+		case 's':
+			add_op(fmt, FOP_SIZE);
+			break;
+		case 'k':
+			add_op(fmt, FOP_BLOCKS_KB);
+			break;
+		case 'm':
+			add_op(fmt, FOP_MODE);
+			break;
+		case 'y':
+			add_op(fmt, FOP_TYPE);
+			break;
+		case 'i':
+			add_op(fmt, FOP_INODE);
+			break;
+		case 'n':
+			add_op(fmt, FOP_LINKS);
+			break;
+		case 'U':
+			add_op(fmt, FOP_UID);
+			break;
+		case 'G':
+			add_op(fmt, FOP_GID);
+			break;
+		case 'A':
+		case 'C':
+		case 'T':
+			if (s[1] != '@'){
+				eprintf_mt("ffind: -printf only supports %%%c@ for times.\n", *s);
+				format_free(fmt);
+				return -1;
+			}
+			add_op(fmt, *s == 'A' ? FOP_ATIME : *s == 'C' ? FOP_CTIME : FOP_MTIME);
+			s++;
+			break;
+		case '\0':
+			eprintf_mt("ffind: -printf format ends with a lone %%.\n");
+			format_free(fmt);
+			return -1;
+		default:
+			eprintf_mt("ffind: -printf directive %%%c is not supported.\n", *s);
+			format_free(fmt);
+			return -1;
+		}
+		s++;
+	}
+	return 0;
+}
+
+/* Makes room for len more bytes. */
+static int fb_reserve(struct format_buf* fb, size_t len){
+	char* tmp;
+	size_t cap;
+
+	if (fb->len + len <= fb->cap){
+		return 0;
+	}
+	cap = fb->cap ? fb->cap : 4096;
+	while (cap < fb->len + len){
+		cap *= 2;
+	}
+	tmp = realloc(fb->data, cap);
+	if (!tmp){
+		log_enomem();
+		return -1;
+	}
+	fb->data = tmp;
+	fb->cap = cap;
+	return 0;
+}
+
+/* The put_* functions assume the space was already reserved. */
+
+static void put_bytes(struct format_buf* fb, const char* s, size_t len){
+	memcpy(fb->data + fb->len, s, len);
+	fb->len += len;
+}
+
+/* Writes an unsigned number in decimal. At most 20 bytes are written. */
+static void put_u64(struct format_buf* fb, uint64_t val){
+	char tmp[20];
+	size_t i = sizeof(tmp);
+
+	do{
+		tmp[--i] = '0' + val % 10;
+		val /= 10;
+	}while (val);
+	put_bytes(fb, tmp + i, sizeof(tmp) - i);
+}
+
+/* Writes a signed number in decimal. At most 21 bytes are written. */
+static void put_i64(struct format_buf* fb, int64_t val){
+	if (val < 0){
+		fb->data[fb->len++] = '-';
+		put_u64(fb, -(uint64_t)val);
+		return;
+	}
+	put_u64(fb, val);
+}
+
+/* Writes permission bits in octal. At most 4 bytes are written. */
+static void put_mode(struct format_buf* fb, mode_t mode){
+	char tmp[4];
+	size_t i = sizeof(tmp);
+
+	mode &= 07777;
+	do{
+		tmp[--i] = '0' + (mode & 7);
+		mode >>= 3;
+	}while (mode);
+	put_bytes(fb, tmp + i, sizeof(tmp) - i);
+}
+
+/* Writes a JSON string. At most 6 * len + 2 bytes are written. */
+static void put_json_string(struct format_buf* fb, const char* s, size_t len){
+	static const char hex[] = "0123456789abcdef";
+
+	fb->data[fb->len++] = '"';
+	for (size_t i = 0; i < len; ++i){
+		unsigned char c = s[i];
+		switch (c){
+		case '"':
+		case '\\':
+			fb->data[fb->len++] = '\\';
+			fb->data[fb->len++] = c;
+			break;
+		case '\n':
+			put_bytes(fb, "\\n", 2);
+			break;
+		case '\t':
+			put_bytes(fb, "\\t", 2);
+			break;
+		default:
+			if (c < 0x20){
+				put_bytes(fb, "\\u00", 4);
+				fb->data[fb->len++] = hex[c >> 4];
+				fb->data[fb->len++] = hex[c & 0xF];
+			}
+			else{
+				/* paths are not necessarily UTF-8, so other bytes are passed through as-is */
+				fb->data[fb->len++] = c;
+			}
+		}
+	}
+	fb->data[fb->len++] = '"';
+}
+
+static void put_le(struct format_buf* fb, uint64_t val, size_t n_bytes){
+	for (size_t i = 0; i < n_bytes; ++i){
+		fb->data[fb->len++] = (char)(val >> (8 * i));
+	}
+}
+
+static char type_letter(mode_t mode){
+	if (S_ISREG(mode)){
+		return 'f';
+	}
+	if (S_ISDIR(mode)){
+		return 'd';
+	}
+	if (S_ISLNK(mode)){
+		return 'l';
+	}
+	if (S_ISFIFO(mode)){
+		return 'p';
+	}
+	if (S_ISSOCK(mode)){
+		return 's';
+	}
+	if (S_ISCHR(mode)){
+		return 'c';
+	}
+	if (S_ISBLK(mode)){
+		return 'b';
+	}
+	return 'U';
+}
+
+/* Executes the operations of a -printf format. */
+static int format_printf(const struct format* fmt, const char* path, size_t path_len, const struct stat* st, int depth, size_t base_len, struct format_buf* fb){
+	for (size_t i = 0; i < fmt->ops_len; ++i){
+		const struct format_op* op = &(fmt->ops[i]);
+		const char* slash;
+
+		/* enough for the path and any number */
+		if (fb_reserve(fb, path_len + op->len + 24) != 0){
+			return -1;
+		}
+
+		switch (op->type){
+		case FOP_LITERAL:
+			put_bytes(fb, fmt->text + op->off, op->len);
+			break;
+		case FOP_PATH:
+			put_bytes(fb, path, path_len);
+			break;
+		case FOP_REL_PATH:
+			if (base_len < path_len){
+				size_t off = path[base_len] == '/' ? base_len + 1 : base_len;
+				put_bytes(fb, path + off, path_len - off);
+			}
+			break;
+		case FOP_NAME:
+			slash = strrchr(path, '/');
+			slash = slash ? slash + 1 : path;
+			put_bytes(fb, slash, path_len - (slash - path));
+			break;
+		case FOP_DIR:
+			slash = strrchr(path, '/');
+			if (slash){
+				put_bytes(fb, path, slash - path);
+			}
+			else{
+				put_bytes(fb, ".", 1);
+			}
+			break;
+		case FOP_DEPTH:
+			put_i64(fb, depth);
+			break;
+		case FOP_SIZE:
+			put_i64(fb, st->st_size);
+			break;
+		case FOP_BLOCKS_KB:
+			put_i64(fb, ((int64_t)st->st_blocks + 1) / 2);
+			break;
+		case FOP_MODE:
+			put_mode(fb, st->st_mode);
+			break;
+		case FOP_TYPE:
+			fb->data[fb->len++] = type_letter(st->st_mode);
+			break;
+		case FOP_INODE:
+			put_u64(fb, st->st_ino);
+			break;
+		case FOP_LINKS:
+			put_u64(fb, st->st_nlink);
+			break;
+		case FOP_UID:
+			put_u64(fb, st->st_uid);
+			break;
+		case FOP_GID:
+			put_u64(fb, st->st_gid);
+			break;
+		case FOP_ATIME:
+			put_i64(fb, st->st_atime);
+			break;
+		case FOP_CTIME:
+			put_i64(fb, st->st_ctime);
+			break;
+		case FOP_MTIME:
+			put_i64(fb, st->st_mtime);
+			break;
+		}
+	}
+	return 0;
+}
+
+int format_entry(const struct format* fmt, const char* path, size_t path_len, const struct stat* st, int depth, size_t base_len, struct format_buf* fb){
+	switch (fmt->mode){
+	case FORMAT_PATH:
+		if (fb_reserve(fb, path_len + 1) != 0){
+			return -1;
+		}
+		put_bytes(fb, path, path_len);
+		fb->data[fb->len++] = fmt->sep;
+		return 0;
+
+	case FORMAT_PRINTF:
+		return format_printf(fmt, path, path_len, st, depth, base_len, fb);
+
+	case FORMAT_JSON:
+		/* the keys, the escaped path, and five numbers */
+		if (fb_reserve(fb, 6 * path_len + 192) != 0){
+			return -1;
+		}
+		put_bytes(fb, "{\"path\":", 8);
+		put_json_string(fb, path, path_len);
+		put_bytes(fb, ",\"type\":\"", 9);
+		fb->data[fb->len++] = type_letter(st->st_mode);
+		put_bytes(fb, "\",\"size\":", 9);
+		put_i64(fb, st->st_size);
+		put_bytes(fb, ",\"mtime\":", 9);
+		put_i64(fb, st->st_mtime);
+		put_bytes(fb, ",\"inode\":", 9);
+		put_u64(fb, st->st_ino);
+		put_bytes(fb, ",\"depth\":", 9);
+		put_i64(fb, depth);
+		put_bytes(fb, "}\n", 2);
+		return 0;
+
+	case FORMAT_BINARY:
+		if (fb_reserve(fb, FORMAT_BINARY_HEADER + path_len) != 0){
+			return -1;
+		}
+		put_le(fb, FORMAT_BINARY_HEADER - 4 + path_len, 4);
+		fb->data[fb->len++] = type_letter(st->st_mode);
+		put_le(fb, 0, 3);
+		put_le(fb, st->st_size, 8);
+		put_le(fb, (uint64_t)(int64_t)st->st_mtime, 8);
+		put_le(fb, st->st_ino, 8);
+		put_le(fb, depth, 4);
+		put_le(fb, path_len, 4);
+		put_bytes(fb, path, path_len);
+		return 0;
+	}
+	return 0;
+}
+
+void format_buf_free(struct format_buf* fb){
+	free(fb->data);
+	fb->data = NULL;
+	fb->len = 0;
+	fb->cap = 0;
+}
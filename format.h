@@ -0,0 +1,145 @@
+/** @file format.h
+ * @brief Output formats for matching entries.<br>
+ * Formats are compiled once when options are parsed, and every entry is formatted from the metadata fetched during the search.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __FORMAT_H
+#define __FORMAT_H
+
+#include "attribute.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/**
+ * @brief The size of the fixed part of a binary record, including its length prefix.
+ */
+#define FORMAT_BINARY_HEADER 40
+
+/**
+ * @brief The ways entries can be written.
+ */
+enum format_mode{
+	FORMAT_PATH = 0, /**< The path followed by a separator. */
+	FORMAT_PRINTF,   /**< A compiled -printf format. */
+	FORMAT_JSON,     /**< One JSON object per line. */
+	/**
+	 * Length-prefixed records with every integer in little-endian order:
+	 * u32 length of the rest of the record, u8 type, u8[3] zero, u64 size, i64 mtime, u64 inode, u32 depth, u32 path length, and the path without a NUL terminator.
+	 */
+	FORMAT_BINARY
+};
+
+/**
+ * @brief The kinds of -printf operations.
+ */
+enum format_op_type{
+	FOP_LITERAL = 0, /**< Text copied as-is. */
+	FOP_PATH,        /**< %p: The full path. */
+	FOP_REL_PATH,    /**< %P: The path relative to the starting directory. */
+	FOP_NAME,        /**< %f: The last component of the path. */
+	FOP_DIR,         /**< %h: Everything before the last component of the path. */
+	FOP_DEPTH,       /**< %d: The depth. */
+	FOP_SIZE,        /**< %s: The size in bytes. */
+	FOP_BLOCKS_KB,   /**< %k: The space used in 1K blocks. */
+	FOP_MODE,        /**< %m: The permission bits in octal. */
+	FOP_TYPE,        /**< %y: The type as a single letter. */
+	FOP_INODE,       /**< %i: The inode number. */
+	FOP_LINKS,       /**< %n: The number of hard links. */
+	FOP_UID,         /**< %U: The owner's user id. */
+	FOP_GID,         /**< %G: The owner's group id. */
+	FOP_ATIME,       /**< %A@: The access time in seconds since the epoch. */
+	FOP_CTIME,       /**< %C@: The status change time in seconds since the epoch. */
+	FOP_MTIME        /**< %T@: The modification time in seconds since the epoch. */
+};
+
+/**
+ * @brief A single -printf operation.
+ */
+struct format_op{
+	enum format_op_type type; /**< What to write. */
+	size_t off;               /**< For FOP_LITERAL, the offset of the text within format::text. */
+	size_t len;               /**< For FOP_LITERAL, the length of the text. */
+};
+
+/**
+ * @brief A compiled output format.
+ */
+struct format{
+	enum format_mode mode;  /**< How entries are written. */
+	char sep;               /**< For FORMAT_PATH, the character written after each path. */
+	struct format_op* ops;  /**< For FORMAT_PRINTF, the operations to perform in order. */
+	size_t ops_len;         /**< The number of operations. */
+	char* text;             /**< The literal text of every FOP_LITERAL with escapes already expanded. */
+};
+
+/**
+ * @brief A growable output buffer.<br>
+ * Each thread should own one of these so entries can be formatted without locking.
+ */
+struct format_buf{
+	char* data; /**< The formatted output. */
+	size_t len; /**< The number of bytes in data. */
+	size_t cap; /**< The allocated size of data. */
+};
+
+/**
+ * @brief Initializes a format that writes paths separated by newlines.
+ *
+ * @param fmt The format to initialize.
+ */
+void format_init(struct format* fmt);
+
+/**
+ * @brief Compiles a -printf format string.<br>
+ * The directives are a subset of find(1)'s: %p %P %f %h %d %s %k %m %y %i %n %U %G %A@ %C@ %T@ %%, and the escapes \\n \\t \\0 \\\\.
+ *
+ * @param spec The format string.
+ *
+ * @param fmt The format to fill.<br>
+ * Anything it previously held is released.
+ *
+ * @return 0 on success, negative if the format string is invalid or memory could not be allocated.
+ */
+int format_compile(const char* spec, struct format* fmt);
+
+/**
+ * @brief Releases the memory held by a format and resets it with format_init().
+ *
+ * @param fmt The format to free.
+ */
+void format_free(struct format* fmt);
+
+/**
+ * @brief Appends a formatted entry to a buffer.
+ *
+ * @param fmt The format.
+ *
+ * @param path The full path of the entry.
+ *
+ * @param path_len strlen(path)
+ *
+ * @param st The entry's metadata.
+ *
+ * @param depth The entry's depth.
+ *
+ * @param base_len The length of the starting directory at the front of path, used for %P.
+ *
+ * @param fb The buffer to append to.
+ *
+ * @return 0 on success, negative if memory could not be allocated.
+ */
+int format_entry(const struct format* fmt, const char* path, size_t path_len, const struct stat* st, int depth, size_t base_len, struct format_buf* fb) FF_HOT;
+
+/**
+ * @brief Releases the memory held by an output buffer.
+ *
+ * @param fb The buffer to free.
+ */
+void format_buf_free(struct format_buf* fb);
+
+#endif
@@ -0,0 +1,161 @@
+/** @file fuzzy.c
+ * @brief Fuzzy subsequence scoring of paths.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "fuzzy.h"
+#include "log.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Every matched character is worth this much. */
+#define SCORE_MATCH 16
+/* Bonuses for a character that starts a path component, a word after '_', '-', '.' or ' ', or a camelCase hump. */
+#define BONUS_COMPONENT 10
+#define BONUS_WORD 8
+#define BONUS_CAMEL 6
+/* A bonus for a character that directly follows the previous match. */
+#define BONUS_CONSECUTIVE 6
+/* A bonus for a character in the entry's own name rather than its parent directories. */
+#define BONUS_NAME 4
+/* Penalties for skipping characters between two matches: once for the gap and again for each character skipped. */
+#define PENALTY_GAP_START 3
+#define PENALTY_GAP 1
+
+/* Case conversions for ASCII only, so the result does not depend on the locale. */
+static char ascii_lower(char c){
+	return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+static char ascii_upper(char c){
+	return c >= 'a' && c <= 'z' ? c - 'a' + 'A' : c;
+}
+
+int fuzzy_compile(const char* query, struct fuzzy_query* out){
+	size_t len = strlen(query);
+
+	out->text = NULL;
+	out->len = 0;
+	out->icase = 1;
+
+	if (len == 0){
+		eprintf_mt("ffind: The fuzzy query cannot be empty.\n");
+		return -1;
+	}
+
+	out->text = malloc(len + 1);
+	if (!out->text){
+		log_enomem();
+		return -1;
+	}
+	memcpy(out->text, query, len + 1);
+	out->len = len;
+
+	/* smart case: an uppercase letter makes the whole query case-sensitive */
+	for (size_t i = 0; i < len; ++i){
+		if (query[i] >= 'A' && query[i] <= 'Z'){
+			out->icase = 0;
+			break;
+		}
+	}
+	return 0;
+}
+
+void fuzzy_free(struct fuzzy_query* q){
+	free(q->text);
+	q->text = NULL;
+	q->len = 0;
+}
+
+/* Finds the first occurrence of c in s.
+ * memchr() is vectorized by the C library, so this skips over the characters between matches far faster than a byte loop. */
+FF_INLINE static inline const char* find_char(const char* s, size_t len, char c, int icase){
+	const char* lo = memchr(s, c, len);
+	const char* hi;
+	char upper;
+
+	if (!icase || (upper = ascii_upper(c)) == c){
+		return lo;
+	}
+	hi = memchr(s, upper, lo ? (size_t)(lo - s) : len);
+	return hi ? hi : lo;
+}
+
+/* Finds the leftmost occurrence of the query as a subsequence of s.
+ * Returns the offset just past its last character, or 0 if s does not contain the query. */
+static size_t match_forward(const struct fuzzy_query* q, const char* s, size_t len){
+	const char* ptr = s;
+	const char* end = s + len;
+
+	for (size_t i = 0; i < q->len; ++i){
+		ptr = find_char(ptr, end - ptr, q->text[i], q->icase);
+		if (!ptr){
+			return 0;
+		}
+		ptr++;
+	}
+	return ptr - s;
+}
+
+/* The bonus for matching the character at path[i]. */
+static int position_bonus(const char* path, size_t i){
+	char prev;
+
+	if (i == 0 || path[i - 1] == '/'){
+		return BONUS_COMPONENT;
+	}
+	prev = path[i - 1];
+	if (prev == '_' || prev == '-' || prev == '.' || prev == ' '){
+		return BONUS_WORD;
+	}
+	if (prev >= 'a' && prev <= 'z' && path[i] >= 'A' && path[i] <= 'Z'){
+		return BONUS_CAMEL;
+	}
+	return 0;
+}
+
+int fuzzy_score(const struct fuzzy_query* q, const char* path, size_t path_len, size_t name_off){
+	size_t end;
+	size_t next = 0;
+	size_t j = q->len;
+	int score = 0;
+
+	/* a match within the name beats one spread over the directories */
+	end = match_forward(q, path + name_off, path_len - name_off);
+	if (end){
+		end += name_off;
+	}
+	else{
+		end = match_forward(q, path, path_len);
+		if (!end){
+			return FUZZY_NO_MATCH;
+		}
+	}
+
+	/* walking back from the end of the leftmost match finds the shortest window that ends there */
+	for (size_t i = end; i-- > 0 && j > 0;){
+		char c = q->icase ? ascii_lower(path[i]) : path[i];
+
+		if (c != q->text[j - 1]){
+			continue;
+		}
+		score += SCORE_MATCH + position_bonus(path, i);
+		if (i >= name_off){
+			score += BONUS_NAME;
+		}
+		if (j < q->len){
+			if (next == i + 1){
+				score += BONUS_CONSECUTIVE;
+			}
+			else{
+				score -= PENALTY_GAP_START + (int)(next - i - 1) * PENALTY_GAP;
+			}
+		}
+		next = i;
+		j--;
+	}
+	return score;
+}
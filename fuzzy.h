@@ -0,0 +1,74 @@
+/** @file fuzzy.h
+ * @brief Fuzzy subsequence scoring of paths.<br>
+ * A path matches a query if it contains every character of the query in order.
+ * Matches are scored so that characters at the start of words, in runs, and in the entry's own name rank higher.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __FUZZY_H
+#define __FUZZY_H
+
+#include "attribute.h"
+#include <stddef.h>
+
+/**
+ * @brief The score of a path that does not contain the query.
+ */
+#define FUZZY_NO_MATCH (-1)
+
+/**
+ * @brief The number of results --fuzzy prints if --top is not given.
+ */
+#define FUZZY_DEFAULT_TOP 100
+
+/**
+ * @brief A compiled query.
+ */
+struct fuzzy_query{
+	char* text;         /**< The query, lowercased if icase is set. */
+	size_t len;         /**< The length of text. */
+	unsigned icase:1;   /**< True if case is ignored, which is the case unless the query contains an uppercase letter. */
+};
+
+/**
+ * @brief Compiles a query.
+ *
+ * @param query The characters to look for.
+ *
+ * @param out The query to fill.<br>
+ * This must be freed with fuzzy_free() when no longer in use.
+ * @see fuzzy_free()
+ *
+ * @return 0 on success, negative if the query is empty or memory could not be allocated.
+ */
+int fuzzy_compile(const char* query, struct fuzzy_query* out);
+
+/**
+ * @brief Releases the memory held by a query.
+ *
+ * @param q The query to free.<br>
+ * If this was never compiled, its text should be NULL.
+ */
+void fuzzy_free(struct fuzzy_query* q);
+
+/**
+ * @brief Scores a path against a query.<br>
+ * If the whole query can be found in the last component of the path, only that component is scored.
+ *
+ * @param q The query.
+ *
+ * @param path The path.<br>
+ * This does not need to be NUL-terminated.
+ *
+ * @param path_len The length of path.
+ *
+ * @param name_off The offset of the last component of the path.
+ *
+ * @return A score where higher is better, or FUZZY_NO_MATCH if the path does not contain the query.
+ */
+int fuzzy_score(const struct fuzzy_query* q, const char* path, size_t path_len, size_t name_off) FF_HOT;
+
+#endif
@@ -14,6 +14,9 @@
 
 #define log_enomem()      eprintf_mt("ffind: failed to allocate requested memory\n")
 #define log_eopendir(dir) eprintf_mt("ffind: failed to open %s (%s)\n", dir, strerror(errno))
+#define log_eopen(file)   eprintf_mt("ffind: failed to open %s (%s)\n", file, strerror(errno))
+#define log_eread(file)   eprintf_mt("ffind: failed to read %s (%s)\n", file, strerror(errno))
+#define log_ewrite(file)  eprintf_mt("ffind: failed to write %s (%s)\n", file, strerror(errno))
 #define log_ethread()     eprintf_mt("ffind: failed to start thread (%s)\n", strerror(errno))
 #define log_ejoin()       eprintf_mt("ffind: failed to join thread (%s)\n", strerror(errno))
 
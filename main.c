@@ -8,16 +8,437 @@
 
 #include "ffind.h"
 #include "options.h"
+#include "stats.h"
+#include "trace.h"
+#include "format.h"
+#include "topk.h"
+#include "dupes.h"
+#include "extsort.h"
+#include "aggregate.h"
+#include "progress.h"
+#include "shard.h"
+#include "throttle.h"
+#include "checkpoint.h"
+#include "watch.h"
 #include "log.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* The most threads -j auto uses by default. */
+#define AUTO_THREADS_CAP 256
+
+/* Creates the worker pool that -j asked for. */
+static struct ffind_pool* create_pool(const struct parsed_data* pd){
+	size_t min_threads;
+	size_t max_threads;
+	long n_cpus;
+
+	if (pd->n_threads != 0){
+		return ffind_pool_create(pd->n_threads);
+	}
+
+	n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n_cpus < 1){
+		n_cpus = 1;
+	}
+
+	min_threads = pd->min_threads ? pd->min_threads : 1;
+	max_threads = pd->max_threads;
+	if (!max_threads){
+		max_threads = (size_t)n_cpus * 8 > 32 ? (size_t)n_cpus * 8 : 32;
+		max_threads = max_threads < AUTO_THREADS_CAP ? max_threads : AUTO_THREADS_CAP;
+		max_threads = max_threads > min_threads ? max_threads : min_threads;
+	}
+
+	return ffind_pool_create_adaptive(min_threads, max_threads, ffind_default_threads(pd->directories[0]));
+}
+
+/* With --fuzzy, each pool thread ranks results into its own heap, and the heaps are merged once every search is finished. */
+struct rank_heap{
+	struct topk heap;
+	struct rank_heap* next;
+};
+
+struct ranking{
+	struct rank_heap* heaps;
+	size_t k;
+	pthread_mutex_t mutex;
+};
+
+/* What the output callbacks need to know about the search they are handling. */
+struct output{
+	const struct format* fmt;
+	size_t base_len;
+	struct ranking* rank;
+	struct dupes* dupes;
+	struct agg* agg;
+	struct extsort* sorted;
+	enum sort_key sort;
+	struct watch* watch;
+	size_t index;
+	int failed;
+};
+
+/* Each pool thread formats into its own buffer. */
+static pthread_key_t key_buf;
+/* and ranks into its own heap */
+static pthread_key_t key_heap;
+/* and collects --duplicates candidates into its own set */
+static pthread_key_t key_dupes;
+/* and sums --count, --du, and --extensions into its own accumulators */
+static pthread_key_t key_agg;
+/* and buffers --sort results into its own set */
+static pthread_key_t key_sort;
+
+/* With --watch, every directory is watched right before it is read. */
+static void watch_dir(const char* path, size_t path_len, int depth, void* data){
+	struct output* out = data;
+	watch_add(out->watch, path, path_len, depth, out->index);
+}
+
+static void free_buf(void* fb){
+	format_buf_free(fb);
+	free(fb);
+}
+
+/* Prints a batch of results.
+ * The batch is formatted into the calling thread's buffer and written with a single fwrite(), so batches from different threads do not interleave. */
+static int print_results(const struct ffind_result* results, size_t len, void* data){
+	struct output* out = data;
+	struct format_buf* fb = pthread_getspecific(key_buf);
+
+	if (!fb){
+		fb = calloc(1, sizeof(*fb));
+		if (!fb || pthread_setspecific(key_buf, fb) != 0){
+			log_enomem();
+			free(fb);
+			__atomic_store_n(&(out->failed), 1, __ATOMIC_RELAXED);
+			return 1;
+		}
+	}
+
+	fb->len = 0;
+	for (size_t i = 0; i < len; ++i){
+		if (format_entry(out->fmt, results[i].path, results[i].path_len, &(results[i].st), results[i].depth, out->base_len, fb) != 0){
+			__atomic_store_n(&(out->failed), 1, __ATOMIC_RELAXED);
+			return 1;
+		}
+	}
+	fwrite(fb->data, 1, fb->len, stdout);
+	return 0;
+}
+
+/* Prints a batch of results as bare paths, the default output.
+ * This skips format_entry()'s switch on the output mode for every entry. */
+static int print_paths(const struct ffind_result* results, size_t len, void* data){
+	struct output* out = data;
+	struct format_buf* fb = pthread_getspecific(key_buf);
+	size_t total = 0;
+	char sep = out->fmt->sep;
+	char* ptr;
+
+	for (size_t i = 0; i < len; ++i){
+		total += results[i].path_len + 1;
+	}
+	if (!fb || fb->cap < total){
+		if (!fb){
+			fb = calloc(1, sizeof(*fb));
+			if (!fb || pthread_setspecific(key_buf, fb) != 0){
+				log_enomem();
+				free(fb);
+				__atomic_store_n(&(out->failed), 1, __ATOMIC_RELAXED);
+				return 1;
+			}
+		}
+		ptr = realloc(fb->data, total);
+		if (!ptr){
+			log_enomem();
+			__atomic_store_n(&(out->failed), 1, __ATOMIC_RELAXED);
+			return 1;
+		}
+		fb->data = ptr;
+		fb->cap = total;
+	}
+
+	ptr = fb->data;
+	for (size_t i = 0; i < len; ++i){
+		memcpy(ptr, results[i].path, results[i].path_len);
+		ptr += results[i].path_len;
+		*(ptr++) = sep;
+	}
+	fwrite(fb->data, 1, total, stdout);
+	return 0;
+}
+
+/* Returns the key --sort orders a result by. */
+static int64_t sort_key(enum sort_key sort, const struct ffind_result* r){
+	switch (sort){
+	case SORT_MTIME:
+		return (int64_t)r->st.st_mtime;
+	case SORT_SIZE:
+		return (int64_t)r->st.st_size;
+	default:
+		return r->depth;
+	}
+}
+
+/* Ranks a batch of results into the calling thread's heap, by their --fuzzy score or, with --sort --limit, their sort key. */
+static int rank_results(const struct ffind_result* results, size_t len, void* data){
+	struct output* out = data;
+	struct rank_heap* rh = pthread_getspecific(key_heap);
+
+	if (!rh){
+		rh = malloc(sizeof(*rh));
+		if (!rh || pthread_setspecific(key_heap, rh) != 0){
+			log_enomem();
+			free(rh);
+			__atomic_store_n(&(out->failed), 1, __ATOMIC_RELAXED);
+			return 1;
+		}
+		topk_init(&(rh->heap), out->rank->k);
+		pthread_mutex_lock(&(out->rank->mutex));
+		rh->next = out->rank->heaps;
+		out->rank->heaps = rh;
+		pthread_mutex_unlock(&(out->rank->mutex));
+	}
+
+	for (size_t i = 0; i < len; ++i){
+		int64_t score = out->sort != SORT_NONE ? sort_key(out->sort, &(results[i])) : results[i].score;
+
+		if (topk_offer(&(rh->heap), score, results[i].path, results[i].path_len, &(results[i].st), results[i].depth) != 0){
+			__atomic_store_n(&(out->failed), 1, __ATOMIC_RELAXED);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Adds a batch of results to the calling thread's set for --sort without --limit. */
+static int collect_sorted(const struct ffind_result* results, size_t len, void* data){
+	struct output* out = data;
+	struct extsort_set* set = pthread_getspecific(key_sort);
+
+	if (!set){
+		set = extsort_set_new(out->sorted);
+		if (!set || pthread_setspecific(key_sort, set) != 0){
+			__atomic_store_n(&(out->failed), 1, __ATOMIC_RELAXED);
+			return 1;
+		}
+	}
+
+	for (size_t i = 0; i < len; ++i){
+		if (extsort_add(set, sort_key(out->sort, &(results[i])), results[i].path, results[i].path_len, &(results[i].st), results[i].depth) != 0){
+			__atomic_store_n(&(out->failed), 1, __ATOMIC_RELAXED);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Adds a batch of results to the calling thread's set of --duplicates candidates. */
+static int collect_dupes(const struct ffind_result* results, size_t len, void* data){
+	struct output* out = data;
+	struct dupes_set* set = pthread_getspecific(key_dupes);
+
+	if (!set){
+		set = dupes_set_new(out->dupes);
+		if (!set || pthread_setspecific(key_dupes, set) != 0){
+			__atomic_store_n(&(out->failed), 1, __ATOMIC_RELAXED);
+			return 1;
+		}
+	}
+
+	for (size_t i = 0; i < len; ++i){
+		if (dupes_add(set, results[i].path, results[i].path_len, &(results[i].st)) != 0){
+			__atomic_store_n(&(out->failed), 1, __ATOMIC_RELAXED);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Returns the calling thread's accumulators, creating them if needed. */
+static struct agg_set* thread_agg(struct agg* agg){
+	struct agg_set* set = pthread_getspecific(key_agg);
+
+	if (!set){
+		set = agg_set_new(agg);
+		if (set && pthread_setspecific(key_agg, set) != 0){
+			log_enomem();
+			return NULL;
+		}
+	}
+	return set;
+}
+
+/* Adds a batch of results to the calling thread's accumulators. */
+static int collect_agg(const struct ffind_result* results, size_t len, void* data){
+	struct output* out = data;
+	struct agg_set* set = thread_agg(out->agg);
+
+	if (!set){
+		__atomic_store_n(&(out->failed), 1, __ATOMIC_RELAXED);
+		return 1;
+	}
+	for (size_t i = 0; i < len; ++i){
+		if (agg_add(out->agg, set, results[i].path, results[i].path_len, out->base_len, &(results[i].st), results[i].depth) != 0){
+			__atomic_store_n(&(out->failed), 1, __ATOMIC_RELAXED);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Adds a base directory's own blocks for --du, if it would have matched the search's filters.
+ * Returns 0 on success, negative on failure. */
+static int add_du_base(struct agg* agg, const struct parsed_data* pd, const char* dir){
+	struct agg_set* set;
+	struct stat st;
+
+	if (!pat_matches_all(&(pd->pat)) || pd->flags.type == 'f' || pd->flags.contains){
+		return 0;
+	}
+	if (stat(dir, &st) != 0){
+		/* the search reports this itself */
+		return 0;
+	}
+	set = thread_agg(agg);
+	if (!set){
+		return -1;
+	}
+	return agg_add_base(agg, set, dir, &st);
+}
+
+/* Prints a group of duplicates one path per line, with a blank line after the group like fdupes(1). */
+static int print_group(const char* const* paths, size_t n, off_t size, void* data){
+	const struct format* fmt = data;
+	(void)size;
+
+	for (size_t i = 0; i < n; ++i){
+		fwrite(paths[i], 1, strlen(paths[i]), stdout);
+		putchar(fmt->sep);
+	}
+	putchar(fmt->sep);
+	return 0;
+}
+
+/* Finds the length of the base directory at the front of a result's path by going up depth components.
+ * Ranked results can come from different base directories, so this is not known ahead of time. */
+static size_t base_dir_len(const char* path, size_t path_len, int depth){
+	size_t len = path_len;
+
+	for (int i = 0; i < depth && len > 0; ++i){
+		do{
+			len--;
+		}while (len > 0 && path[len] != '/');
+	}
+	return len;
+}
+
+/* Merges every thread's heap and prints the results from best to worst.
+ * Returns 0 on success, negative on failure. */
+static int print_ranking(struct ranking* rank, const struct format* fmt){
+	struct topk best;
+	struct format_buf fb = { NULL, 0, 0 };
+	int ret = 0;
+
+	topk_init(&best, rank->k);
+	for (struct rank_heap* rh = rank->heaps; rh; rh = rh->next){
+		if (topk_merge(&best, &(rh->heap)) != 0){
+			ret = -1;
+			goto cleanup;
+		}
+	}
+	topk_sort(&best);
+
+	for (size_t i = 0; i < best.len; ++i){
+		const struct topk_entry* e = &(best.entries[i]);
+
+		if (format_entry(fmt, e->path, e->path_len, &(e->st), e->depth, base_dir_len(e->path, e->path_len, e->depth), &fb) != 0){
+			ret = -1;
+			goto cleanup;
+		}
+	}
+	fwrite(fb.data, 1, fb.len, stdout);
+
+cleanup:
+	format_buf_free(&fb);
+	topk_free(&best);
+	return ret;
+}
+
+/* The size print_sorted() lets its buffer reach before writing it out. */
+#define SORTED_FLUSH_SIZE 65536
+
+struct sorted_print{
+	const struct format* fmt;
+	struct format_buf fb;
+};
+
+/* Prints one --sort result. */
+static int print_sorted(const char* path, size_t path_len, const struct stat* st, int depth, void* data){
+	struct sorted_print* sp = data;
+
+	if (format_entry(sp->fmt, path, path_len, st, depth, base_dir_len(path, path_len, depth), &(sp->fb)) != 0){
+		return -1;
+	}
+	if (sp->fb.len >= SORTED_FLUSH_SIZE){
+		fwrite(sp->fb.data, 1, sp->fb.len, stdout);
+		sp->fb.len = 0;
+	}
+	return 0;
+}
+
+/* Merges every thread's --sort results and prints them in order.
+ * Returns 0 on success, negative on failure. */
+static int print_sorted_all(struct extsort* sorted, const struct format* fmt){
+	struct sorted_print sp = { fmt, { NULL, 0, 0 } };
+	int ret;
+
+	ret = extsort_finish(sorted, print_sorted, &sp);
+	fwrite(sp.fb.data, 1, sp.fb.len, stdout);
+	format_buf_free(&(sp.fb));
+	return ret;
+}
+
+static void ranking_free(struct ranking* rank){
+	while (rank->heaps){
+		struct rank_heap* next = rank->heaps->next;
+		topk_free(&(rank->heaps->heap));
+		free(rank->heaps);
+		rank->heaps = next;
+	}
+	pthread_mutex_destroy(&(rank->mutex));
+}
 
 int main(int argc, char** argv){
-	pthread_t* threads;
+	struct ffind_pool* pool;
+	struct stats_set* stats = NULL;
 	struct parsed_data pd;
+	struct ranking rank;
+	struct dupes dupes;
+	struct agg agg;
+	struct extsort sorted;
+	struct progress progress;
+	int has_progress = 0;
+	struct checkpoint cp;
+	int has_checkpoint = 0;
+	struct watch watch;
+	int has_watch = 0;
+	struct output* outs = NULL;
+	void** out_data = NULL;
+	struct checkpoint_state resume;
+	size_t first = 0;
+	unsigned agg_modes;
+	ffind_callback cb;
+	uint64_t deadline;
+	size_t found = 0;
 	int res;
+	int ret = 0;
 
 	res = parse_options(argc, argv, &pd);
 	if (res > 0){
@@ -27,16 +448,314 @@ int main(int argc, char** argv){
 		return 1;
 	}
 
+	if (pthread_key_create(&key_buf, free_buf) != 0){
+		log_enomem();
+		free_options(&pd);
+		return 1;
+	}
+	/* the heaps belong to the ranking, so they outlive the threads that filled them */
+	if (pthread_key_create(&key_heap, NULL) != 0){
+		log_enomem();
+		pthread_key_delete(key_buf);
+		free_options(&pd);
+		return 1;
+	}
+	/* like the heaps, the sets belong to the dupes and agg structures */
+	if (pthread_key_create(&key_dupes, NULL) != 0){
+		log_enomem();
+		pthread_key_delete(key_heap);
+		pthread_key_delete(key_buf);
+		free_options(&pd);
+		return 1;
+	}
+	if (pthread_key_create(&key_agg, NULL) != 0){
+		log_enomem();
+		pthread_key_delete(key_dupes);
+		pthread_key_delete(key_heap);
+		pthread_key_delete(key_buf);
+		free_options(&pd);
+		return 1;
+	}
+	if (pthread_key_create(&key_sort, NULL) != 0){
+		log_enomem();
+		pthread_key_delete(key_agg);
+		pthread_key_delete(key_dupes);
+		pthread_key_delete(key_heap);
+		pthread_key_delete(key_buf);
+		free_options(&pd);
+		return 1;
+	}
+	rank.heaps = NULL;
+	/* --sort --limit ranks by the sort key into the same heaps --fuzzy uses */
+	rank.k = pd.flags.fuzzy ? pd.top : pd.limit;
+	pthread_mutex_init(&(rank.mutex), NULL);
+	dupes_init(&dupes);
+	agg_modes = (pd.flags.count ? AGG_COUNT : 0) | (pd.flags.du ? AGG_DU : 0) | (pd.flags.extensions ? AGG_EXTENSIONS : 0);
+	agg_init(&agg, agg_modes, pd.du_depth);
+
+	if (pd.trace_file){
+		trace_init();
+	}
+
+	resume.frontier.dirs = NULL;
+	resume.frontier.len = 0;
+
+	/* the pool's threads inherit the blocked signals and the I/O priority */
+	if ((pd.resume_file && checkpoint_load(pd.resume_file, pd.directories, pd.directories_len, &resume) != 0) || (pd.progress_ns && progress_block_signal() != 0) || (pd.checkpoint_file && checkpoint_block_signals() != 0) ||
+			(pd.flags.watch && watch_block_signals() != 0) ||
+			(pd.flags.idle_io && throttle_idle_io() != 0)){
+		pool = NULL;
+	}
+	else{
+		pool = create_pool(&pd);
+	}
+	if (!pool){
+		checkpoint_state_free(&resume);
+		trace_free();
+		agg_free(&agg);
+		dupes_free(&dupes);
+		ranking_free(&rank);
+		pthread_key_delete(key_sort);
+		pthread_key_delete(key_agg);
+		pthread_key_delete(key_dupes);
+		pthread_key_delete(key_heap);
+		pthread_key_delete(key_buf);
+		free_options(&pd);
+		return 1;
+	}
+
+	/* the threads that fill the sort's sets share its memory */
+	extsort_init(&sorted, ffind_pool_threads(pool));
+	if (pd.resume_file){
+		first = resume.index;
+		found = resume.found;
+	}
+	/* --shard-plan only reads the top levels of each directory, and searches nothing */
+	if (pd.shard_plan){
+		for (size_t i = 0; i < pd.directories_len; ++i){
+			if (shard_plan(pool, pd.directories[i], &pd, stdout) != 0){
+				ret = 1;
+				break;
+			}
+		}
+		goto cleanup;
+	}
+	if (pd.flags.stats){
+		stats = stats_create(ffind_pool_threads(pool));
+		if (!stats){
+			ret = 1;
+			goto cleanup;
+		}
+	}
+	if (pd.progress_ns){
+		if (progress_start(&progress, pool, pd.progress_ns) != 0){
+			ret = 1;
+			goto cleanup;
+		}
+		has_progress = 1;
+	}
+	if (pd.checkpoint_file){
+		if (checkpoint_start(&cp, pd.checkpoint_file, pd.checkpoint_ns, pd.directories, pd.directories_len) != 0){
+			ret = 1;
+			goto cleanup;
+		}
+		has_checkpoint = 1;
+	}
+	/* each search's output outlives it when --watch searches the changes under the same base directory later */
+	outs = malloc(pd.directories_len * sizeof(*outs));
+	out_data = malloc(pd.directories_len * sizeof(*out_data));
+	if (!outs || !out_data){
+		log_enomem();
+		ret = 1;
+		goto cleanup;
+	}
 	for (size_t i = 0; i < pd.directories_len; ++i){
-		if (ffind_create_threads(pd.directories[i], &pd, &threads) != 0){
-			free_options(&pd);
-			return 1;
+		outs[i].fmt = &(pd.format);
+		outs[i].base_len = strlen(pd.directories[i]);
+		outs[i].rank = &rank;
+		outs[i].dupes = &dupes;
+		outs[i].agg = &agg;
+		outs[i].sorted = &sorted;
+		outs[i].sort = pd.sort;
+		outs[i].watch = &watch;
+		outs[i].index = i;
+		outs[i].failed = 0;
+		out_data[i] = &(outs[i]);
+	}
+
+	/* the output callback is picked once instead of checking the mode for every entry */
+	if (pd.flags.fuzzy || pd.limit){
+		cb = rank_results;
+	}
+	else if (pd.sort != SORT_NONE){
+		cb = collect_sorted;
+	}
+	else if (pd.flags.duplicates){
+		cb = collect_dupes;
+	}
+	else if (agg_modes){
+		cb = collect_agg;
+	}
+	else if (pd.format.mode == FORMAT_PATH){
+		cb = print_paths;
+	}
+	else{
+		cb = print_results;
+	}
+
+	if (pd.flags.watch){
+		ffind_pool_set_dir_hook(pool, watch_dir);
+		if (watch_start(&watch, pool, &pd, cb, out_data) != 0){
+			ret = 1;
+			goto cleanup;
 		}
-		if (ffind_join_threads(threads, pd.n_threads) != 0){
-			free_options(&pd);
-			return 1;
+		has_watch = 1;
+	}
+
+	deadline = pd.timeout_ns ? stats_now() + pd.timeout_ns : 0;
+	for (size_t i = first; i < pd.directories_len; ++i){
+		/* the limits apply to all of the directories together, so each search gets what is left of them */
+		struct parsed_data spd = pd;
+		struct ffind_search* search;
+		struct output* out = &(outs[i]);
+
+		if (pd.max_results){
+			if (found >= pd.max_results){
+				break;
+			}
+			spd.max_results = pd.max_results - found;
+		}
+		if (deadline){
+			uint64_t now = stats_now();
+			if (now >= deadline){
+				ret = 2;
+				break;
+			}
+			spd.timeout_ns = deadline - now;
+		}
+
+		if ((agg_modes & AGG_DU) && add_du_base(&agg, &pd, pd.directories[i]) != 0){
+			ret = 1;
+			goto cleanup;
+		}
+		if (pd.resume_file && i == first){
+			search = ffind_search_resume(pool, pd.directories[i], &spd, stats, cb, out, &(resume.frontier));
 		}
+		else if (pd.shard_count){
+			struct ffind_frontier part;
+
+			search = NULL;
+			if (shard_frontier(pool, pd.directories[i], &spd, &part) == 0){
+				search = ffind_search_resume(pool, pd.directories[i], &spd, stats, cb, out, &part);
+			}
+			ffind_frontier_free(&part);
+		}
+		else{
+			search = ffind_search_start(pool, pd.directories[i], &spd, stats, cb, out);
+		}
+		if (!search){
+			ret = 1;
+			goto cleanup;
+		}
+		if (has_checkpoint){
+			checkpoint_set(&cp, search, i, found);
+		}
+		res = ffind_search_wait(search);
+		if (has_checkpoint){
+			checkpoint_set(&cp, NULL, i + 1, found + ffind_search_count(search));
+		}
+		found += ffind_search_count(search);
+		ffind_search_free(search);
+		if (out->failed){
+			ret = 1;
+			goto cleanup;
+		}
+		if (res == FFIND_TIMED_OUT){
+			ret = 2;
+			break;
+		}
+		if (res == FFIND_INTERRUPTED){
+			eprintf_mt("ffind: Stopped. Run again with --resume %s to carry on.\n", pd.checkpoint_file);
+			ret = 128 + checkpoint_signal(&cp);
+			break;
+		}
+		if (res != 0){
+			ret = 1;
+			goto cleanup;
+		}
+	}
+	if ((pd.flags.fuzzy || pd.limit) && print_ranking(&rank, &(pd.format)) != 0){
+		ret = 1;
+		goto cleanup;
+	}
+	if (pd.sort != SORT_NONE && !pd.limit && print_sorted_all(&sorted, &(pd.format)) != 0){
+		ret = 1;
+		goto cleanup;
+	}
+	/* the hashing runs on the pool's threads, now that they are done searching */
+	if (pd.flags.duplicates && dupes_find(&dupes, pool, print_group, &(pd.format)) < 0){
+		ret = 1;
+		goto cleanup;
+	}
+	if (agg_modes && agg_print(&agg, pd.format.sep) != 0){
+		ret = 1;
+		goto cleanup;
+	}
+	if (ret == 2){
+		eprintf_mt("ffind: Time limit reached. The results are incomplete.\n");
+	}
+	/* --watch carries on until it is stopped, which is how it is meant to end */
+	if (has_watch){
+		fflush(stdout);
+		if (watch_wait(&watch) < 0){
+			ret = 1;
+		}
+		watch_stop(&watch);
+		has_watch = 0;
+		for (size_t i = 0; i < pd.directories_len; ++i){
+			if (outs[i].failed){
+				ret = 1;
+			}
+		}
+	}
+
+cleanup:
+	if (has_watch){
+		watch_stop(&watch);
+	}
+	if (has_checkpoint){
+		/* the checkpoint is only kept while there is something left to resume */
+		checkpoint_stop(&cp, ret == 0);
+	}
+	if (has_progress){
+		progress_stop(&progress);
+	}
+	/* the pool's threads free their output buffers as they exit */
+	ffind_pool_destroy(pool);
+	free(outs);
+	free(out_data);
+	ranking_free(&rank);
+	pthread_key_delete(key_sort);
+	pthread_key_delete(key_agg);
+	pthread_key_delete(key_dupes);
+	pthread_key_delete(key_heap);
+	pthread_key_delete(key_buf);
+	fflush(stdout);
+	stats_print(stats);
+	stats_free(stats);
+	if (pd.flags.duplicates && pd.flags.stats){
+		dupes_print_stats(&dupes);
+	}
+	dupes_free(&dupes);
+	extsort_free(&sorted);
+	agg_free(&agg);
+	checkpoint_state_free(&resume);
+	if (pd.trace_file){
+		if (trace_write(pd.trace_file) != 0){
+			ret = 1;
+		}
+		trace_free();
 	}
 	free_options(&pd);
-	return 0;
+	return ret;
 }
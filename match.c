@@ -12,6 +12,9 @@
 #include <string.h>
 #include <regex.h>
 #include <fnmatch.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 int match_fnmatch(const char* haystack, const char* needle){
 	return fnmatch(needle, haystack, 0) == 0;
@@ -99,6 +102,495 @@ int match(const char* haystack, const struct pattern* needle){
 	return 0;
 }
 
+int pat_matches_all(const struct pattern* pat){
+	const char* s;
+
+	switch (pat->p_type){
+	case TYPE_FNMATCH:
+		/* without FNM_PATHNAME or FNM_PERIOD, '*' matches '/' and leading dots too */
+		s = pat->p.fnmatch;
+		if (!s || !*s){
+			return 0;
+		}
+		for (; *s; ++s){
+			if (*s != '*'){
+				return 0;
+			}
+		}
+		return 1;
+	case TYPE_FNMATCH_LITERAL:
+		return pat->p.fnmatch && !*(pat->p.fnmatch);
+	default:
+		return 0;
+	}
+}
+
+/* Finds a needle in a haystack that is not NUL-terminated. */
+static int mem_contains(const char* haystack, size_t haystack_len, const char* needle, size_t needle_len){
+	const char* end = haystack + haystack_len;
+	const char* p = haystack;
+
+	while (needle_len <= (size_t)(end - p) && (p = memchr(p, needle[0], end - p - needle_len + 1)) != NULL){
+		if (!memcmp(p, needle, needle_len)){
+			return 1;
+		}
+		p++;
+	}
+	return 0;
+}
+
+/* Collects the runs of characters every match of a pattern must contain, as the pattern is parsed.
+ * The parsers only ever have to be conservative: ending a run early or forgetting a character just makes the filter weaker. */
+struct filter_builder{
+	char* text;         /* the literal characters seen so far */
+	size_t len;
+	size_t run_start;   /* where the current run starts in text */
+	size_t best_start;  /* the longest piece of a finished run without a '/' */
+	size_t best_len;
+	int slash;          /* whether any run had a '/' */
+};
+
+/* Adds a character that every match must contain right after the previous one. */
+static void fb_char(struct filter_builder* fb, char c){
+	fb->text[fb->len++] = c;
+	if (c == '/'){
+		fb->slash = 1;
+	}
+}
+
+/* Ends the current run, since whatever comes next is not a fixed character.
+ * Names never contain a '/', so a literal has to fit inside a name or be in the directory's path, and only the pieces between slashes are candidates. */
+static void fb_break(struct filter_builder* fb){
+	size_t start = fb->run_start;
+
+	for (size_t i = fb->run_start; i <= fb->len; ++i){
+		if (i == fb->len || fb->text[i] == '/'){
+			if (i - start > fb->best_len){
+				fb->best_start = start;
+				fb->best_len = i - start;
+			}
+			start = i + 1;
+		}
+	}
+	fb->run_start = fb->len;
+}
+
+/* Takes back the last character, which a quantifier made optional, and ends the run. */
+static void fb_drop(struct filter_builder* fb){
+	if (fb->len > fb->run_start){
+		fb->len--;
+	}
+	fb_break(fb);
+}
+
+/* Fills in a filter from the runs.
+ * suffix_run is the length of the run the pattern ends with, if it is anchored to the end of the path.
+ * exact is true if the pattern is nothing but that suffix or, without one, the longest run, with only "match anything" around it. */
+static void fb_finish(struct filter_builder* fb, struct pat_filter* f, size_t suffix_run, int exact){
+	const char* suffix = fb->text + fb->len - suffix_run;
+	const char* lit;
+	size_t lit_len;
+	const char* slash;
+
+	fb_break(fb);
+	lit = fb->text + fb->best_start;
+	lit_len = fb->best_len;
+
+	/* names never contain a '/', so only the part of the suffix after the last one can be checked against them */
+	for (slash = suffix + suffix_run; slash > suffix && slash[-1] != '/'; --slash);
+	if (slash != suffix){
+		exact = 0;
+		suffix_run -= slash - suffix;
+		suffix = slash;
+	}
+	if (suffix_run > PAT_FILTER_LEN){
+		exact = 0;
+		suffix += suffix_run - PAT_FILTER_LEN;
+		suffix_run = PAT_FILTER_LEN;
+	}
+	memcpy(f->suffix, suffix, suffix_run);
+	f->suffix_len = suffix_run;
+
+	if (fb->slash){
+		exact = 0;
+	}
+	if (lit_len > PAT_FILTER_LEN){
+		exact = 0;
+		lit_len = PAT_FILTER_LEN;
+	}
+	/* a path that ends with the suffix already contains anything in it */
+	if (f->suffix_len && mem_contains(f->suffix, f->suffix_len, lit, lit_len)){
+		lit_len = 0;
+	}
+	memcpy(f->literal, lit, lit_len);
+	f->literal_len = lit_len;
+
+	f->exact = exact && (f->suffix_len || f->literal_len);
+}
+
+/* Checks whether a string has none of the given special characters. */
+static int is_plain(const char* s, size_t len, const char* specials){
+	for (size_t i = 0; i < len; ++i){
+		if (strchr(specials, s[i])){
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Finds the ']' that closes the bracket expression starting at pattern[start].
+ * Returns its index, or 0 if the expression is not closed. */
+static size_t bracket_end(const char* pattern, size_t start){
+	size_t j = start + 1;
+
+	if (pattern[j] == '!' || pattern[j] == '^'){
+		j++;
+	}
+	if (pattern[j] == ']'){
+		j++;
+	}
+	while (pattern[j] && pattern[j] != ']'){
+		/* "[:alpha:]" and the like can contain a ']' */
+		if (pattern[j] == '[' && (pattern[j + 1] == ':' || pattern[j + 1] == '.' || pattern[j + 1] == '=')){
+			const char* close = strchr(pattern + j + 2, pattern[j + 1]);
+			if (!close || close[1] != ']'){
+				return 0;
+			}
+			j = close + 2 - pattern;
+			continue;
+		}
+		j++;
+	}
+	return pattern[j] ? j : 0;
+}
+
+/* Works out a filter for a fnmatch(3) pattern.
+ * Without FNM_PATHNAME, the pattern has to match the whole path, and '*' matches anything including '/'. */
+static void filter_fnmatch(struct filter_builder* fb, const char* pattern, struct pat_filter* f){
+	size_t len = strlen(pattern);
+	size_t stars = strspn(pattern, "*");
+	size_t trail = 0;
+	size_t suffix_run;
+	int exact = 0;
+
+	for (size_t i = 0; i < len; ++i){
+		switch (pattern[i]){
+		case '*':
+		case '?':
+			fb_break(fb);
+			break;
+		case '[':{
+			size_t j = bracket_end(pattern, i);
+
+			if (!j){
+				/* an unterminated '[' is an ordinary character */
+				fb_char(fb, '[');
+				break;
+			}
+			fb_break(fb);
+			i = j;
+			break;
+		}
+		case '\\':
+			if (pattern[i + 1]){
+				i++;
+			}
+			fb_char(fb, pattern[i]);
+			break;
+		default:
+			fb_char(fb, pattern[i]);
+		}
+	}
+	suffix_run = fb->len - fb->run_start;
+
+	/* "*suffix" and "*literal*" are decided by the filter alone */
+	while (trail < len - stars && pattern[len - 1 - trail] == '*'){
+		trail++;
+	}
+	if (stars > 0 && is_plain(pattern + stars, len - stars - trail, "*?[\\")){
+		exact = 1;
+		if (trail > 0){
+			suffix_run = 0;
+		}
+	}
+	fb_finish(fb, f, suffix_run, exact);
+}
+
+/* Works out a filter for a POSIX basic or extended regular expression.
+ * Anything inside a group may be optional or an alternative, so only characters outside of groups count.
+ * Gives up on alternation at the top level, since then no single character is needed. */
+static void filter_regex(struct filter_builder* fb, const char* pattern, int extended, struct pat_filter* f){
+	size_t len = strlen(pattern);
+	size_t suffix_run = 0;
+	int depth = 0;
+	/* whether everything so far was a literal character */
+	int plain = 1;
+
+	for (size_t i = 0; i < len; ++i){
+		char c = pattern[i];
+
+		if (c == '\\'){
+			char n = pattern[++i];
+
+			if (!n){
+				return;
+			}
+			if (!extended && n == '|' && depth == 0){
+				return;
+			}
+			plain &= depth == 0 && !(!extended && strchr("(){}+?", n)) &&
+				!((n >= '0' && n <= '9') || (n >= 'a' && n <= 'z') || (n >= 'A' && n <= 'Z') || n == '<' || n == '>' || n == '`' || n == '\'');
+			if (!extended && (n == '(' || n == ')')){
+				depth += n == '(' ? 1 : -1;
+				fb_break(fb);
+			}
+			else if (!extended && (n == '{' || n == '+' || n == '?')){
+				fb_drop(fb);
+				/* skip the interval's bounds up to its "\}" */
+				if (n == '{'){
+					const char* close = strstr(pattern + i, "\\}");
+					if (!close){
+						return;
+					}
+					i = close + 1 - pattern;
+				}
+			}
+			else if ((n >= '0' && n <= '9') || (n >= 'a' && n <= 'z') || (n >= 'A' && n <= 'Z') || n == '<' || n == '>' || n == '`' || n == '\''){
+				/* back-references, word boundaries, and GNU's classes */
+				fb_break(fb);
+			}
+			else if (depth == 0){
+				fb_char(fb, n);
+			}
+			continue;
+		}
+
+		if (!(c == '$' && i == len - 1) && (depth != 0 || strchr(extended ? ".[]()*+?{}|^$" : ".[*^$", c))){
+			plain = 0;
+		}
+		switch (c){
+		case '[':{
+			size_t j = bracket_end(pattern, i);
+
+			if (!j){
+				return;
+			}
+			fb_break(fb);
+			i = j;
+			break;
+		}
+		case '.':
+		case '^':
+			fb_break(fb);
+			break;
+		case '*':
+			fb_drop(fb);
+			break;
+		case '$':
+			if (i == len - 1 && depth == 0){
+				suffix_run = fb->len - fb->run_start;
+			}
+			fb_break(fb);
+			break;
+		default:
+			if (extended && c == '|' && depth == 0){
+				return;
+			}
+			if (extended && (c == '(' || c == ')')){
+				depth += c == '(' ? 1 : -1;
+				fb_break(fb);
+			}
+			else if (extended && (c == '?' || c == '{')){
+				fb_drop(fb);
+			}
+			else if (extended && c == '+'){
+				fb_break(fb);
+			}
+			else if (depth == 0){
+				fb_char(fb, c);
+			}
+			else{
+				fb_break(fb);
+			}
+		}
+		/* skip the interval's bounds up to its '}' */
+		if (c == '{' && extended){
+			while (i < len && pattern[i] != '}'){
+				i++;
+			}
+		}
+	}
+	if (depth != 0){
+		return;
+	}
+
+	/* a pattern of nothing but literal characters, optionally ending with '$', is only a literal or a suffix */
+	fb_finish(fb, f, suffix_run, plain);
+}
+
+/* Works out what every path matching a pattern must contain.
+ * Only the types whose syntax is simple enough to be sure of get a filter. */
+static void filter_init(const char* pattern, struct pattern* pat, unsigned flags){
+	struct filter_builder fb;
+	struct pat_filter* f = &(pat->filter);
+
+	memset(f, 0, sizeof(*f));
+	if (!pattern){
+		return;
+	}
+	fb.text = malloc(strlen(pattern) + 1);
+	if (!fb.text){
+		/* the full matcher still works without a filter */
+		return;
+	}
+	fb.len = 0;
+	fb.run_start = 0;
+	fb.best_start = 0;
+	fb.best_len = 0;
+	fb.slash = 0;
+
+	switch (pat->p_type){
+	case TYPE_FNMATCH:
+		filter_fnmatch(&fb, pattern, f);
+		break;
+	case TYPE_FNMATCH_LITERAL:
+		for (const char* p = pattern; *p; ++p){
+			fb_char(&fb, *p);
+		}
+		fb_finish(&fb, f, 0, 1);
+		break;
+	case TYPE_REGEX_POSIX:
+	case TYPE_REGEX_POSIX_EX:
+		if (!(flags & PFLAG_ICASE)){
+			filter_regex(&fb, pattern, pat->p_type == TYPE_REGEX_POSIX_EX, f);
+		}
+		break;
+	default:
+		break;
+	}
+	free(fb.text);
+}
+
+int pat_has_filter(const struct pattern* pat){
+	return pat->filter.suffix_len || pat->filter.literal_len;
+}
+
+/* Clears pass[i] for every name that does not end with the filter's suffix.
+ * With SSE2, the 16 bytes before each name's NUL are compared with the suffix in one go. */
+static void batch_suffix(const struct pat_filter* f, const char* names, const size_t* offs, size_t n, unsigned char* pass){
+	size_t m = f->suffix_len;
+	size_t i = 0;
+
+#ifdef __SSE2__
+	if (m <= 16){
+		char want[16] = { 0 };
+		__m128i w;
+		unsigned mask = (0xFFFFu << (16 - m)) & 0xFFFFu;
+
+		memcpy(want + 16 - m, f->suffix, m);
+		w = _mm_loadu_si128((const __m128i*)want);
+		for (; i < n; ++i){
+			size_t end = offs[i + 1] - 1;
+
+			if (!pass[i]){
+				continue;
+			}
+			if (end - offs[i] < m){
+				pass[i] = 0;
+			}
+			else if (end >= 16){
+				__m128i v = _mm_loadu_si128((const __m128i*)(names + end - 16));
+				unsigned eq = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, w));
+				pass[i] = (eq & mask) == mask;
+			}
+			else{
+				pass[i] = !memcmp(names + end - m, f->suffix, m);
+			}
+		}
+		return;
+	}
+#endif
+	for (; i < n; ++i){
+		size_t end = offs[i + 1] - 1;
+
+		if (pass[i]){
+			pass[i] = end - offs[i] >= m && !memcmp(names + end - m, f->suffix, m);
+		}
+	}
+}
+
+/* Sets found[i] for every name that contains the filter's literal, and clears it for the rest.
+ * The packed names are scanned as one buffer. With SSE2, 16 starting positions are checked at once against the literal's first and last characters, and only positions where both match are compared in full.
+ * A match can never span two names, since the literal has no NUL. */
+static void batch_literal(const struct pat_filter* f, const char* names, const size_t* offs, size_t n, unsigned char* found){
+	const char* lit = f->literal;
+	size_t k = f->literal_len;
+	size_t total = offs[n];
+	size_t pos = offs[0];
+	size_t j = 0;
+
+	memset(found, 0, n);
+	if (total - pos < k){
+		return;
+	}
+
+#ifdef __SSE2__
+	{
+		__m128i first = _mm_set1_epi8(lit[0]);
+		__m128i last = _mm_set1_epi8(lit[k - 1]);
+
+		for (; pos + 16 + k - 1 <= total; pos += 16){
+			__m128i a = _mm_loadu_si128((const __m128i*)(names + pos));
+			__m128i b = _mm_loadu_si128((const __m128i*)(names + pos + k - 1));
+			unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+
+			while (mask){
+				size_t p = pos + __builtin_ctz(mask);
+
+				mask &= mask - 1;
+				if (k <= 2 || !memcmp(names + p + 1, lit + 1, k - 2)){
+					while (offs[j + 1] <= p){
+						j++;
+					}
+					found[j] = 1;
+				}
+			}
+		}
+	}
+#endif
+	for (; pos + k <= total; ++pos){
+		if (names[pos] == lit[0] && !memcmp(names + pos, lit, k)){
+			while (offs[j + 1] <= pos){
+				j++;
+			}
+			found[j] = 1;
+		}
+	}
+}
+
+size_t match_batch(const struct pattern* pat, char* path, size_t dir_len, const char* names, const size_t* offs, size_t n, unsigned char* hits){
+	const struct pat_filter* f = &(pat->filter);
+	size_t count = 0;
+
+	memset(hits, 1, n);
+	/* a literal in the directory's path is in every path under it */
+	if (f->literal_len && !mem_contains(path, dir_len, f->literal, f->literal_len)){
+		batch_literal(f, names, offs, n, hits);
+	}
+	if (f->suffix_len){
+		batch_suffix(f, names, offs, n, hits);
+	}
+
+	for (size_t i = 0; i < n; ++i){
+		if (hits[i] && !f->exact){
+			memcpy(path + dir_len, names + offs[i], offs[i + 1] - offs[i]);
+			hits[i] = match(path, pat) == 1;
+		}
+		count += hits[i];
+	}
+	return count;
+}
+
 unsigned flags_convert(enum pattern_type p_type, unsigned f){
 	int flags_new = 0;
 
@@ -137,6 +629,7 @@ int pat_init(const char* pattern, struct pattern* in_out, unsigned flags){
 	int ret = 0;
 	int flags_new = flags_convert(in_out->p_type, flags);
 
+	filter_init(pattern, in_out, flags);
 	switch (in_out->p_type){
 	case TYPE_FNMATCH:
 	case TYPE_FNMATCH_ESCAPE:
@@ -146,11 +639,20 @@ int pat_init(const char* pattern, struct pattern* in_out, unsigned flags){
 
 	case TYPE_REGEX_POSIX:
 	case TYPE_REGEX_POSIX_EX:
+		in_out->p.regex = malloc(sizeof(*(in_out->p.regex)));
+		if (!in_out->p.regex){
+			log_enomem();
+			ret = -1;
+			break;
+		}
+
 		res = regcomp(in_out->p.regex, pattern, flags_new);
 		if (res != 0){
 			char errbuf[256];
 			regerror(res, in_out->p.regex, errbuf, sizeof(errbuf));
 			eprintf_mt("ffind: Failed to create posix regex (%s)\n", errbuf);
+			free(in_out->p.regex);
+			in_out->p.regex = NULL;
 			ret = -1;
 			break;
 		}
@@ -194,6 +696,8 @@ void pat_free(struct pattern* pat){
 	case TYPE_REGEX_POSIX_EX:
 		if (pat->p.regex){
 			regfree(pat->p.regex);
+			free(pat->p.regex);
+			pat->p.regex = NULL;
 		}
 		return;
 	case TYPE_REGEX_PCRE:
@@ -12,6 +12,7 @@
 #include "attribute.h"
 #include <regex.h>
 #include <pcre.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /**
@@ -30,6 +31,29 @@ enum pattern_type{
 #define PFLAG_NORMAL (0)      /**< No special flags. Only valid by itself. */
 #define PFLAG_ICASE  (1 << 0) /**< Ignore case when searching. */
 
+/**
+ * @brief The longest suffix or literal a pat_filter keeps.<br>
+ * Longer ones are cut down, which still rules out most names but leaves the rest to the full matcher.
+ */
+#define PAT_FILTER_LEN 32
+
+/**
+ * @brief The most names match_batch() takes at once.
+ */
+#define MATCH_BATCH_MAX 256
+
+/**
+ * @brief Conditions every path matching a pattern meets, worked out from the pattern's text.<br>
+ * Neither the suffix nor the literal contains a '/', so for a path made of a directory and a name, both can be checked against the name alone.
+ */
+struct pat_filter{
+	char suffix[PAT_FILTER_LEN];  /**< Every matching path ends with this. */
+	char literal[PAT_FILTER_LEN]; /**< Every matching path contains this. */
+	unsigned char suffix_len;     /**< The length of suffix, or 0 if there is none. */
+	unsigned char literal_len;    /**< The length of literal, or 0 if there is none. */
+	unsigned exact:1;             /**< True if a path matches exactly when it meets both conditions, so the full matcher is never needed. */
+};
+
 /**
  * @brief A pattern to match.
  */
@@ -41,6 +65,7 @@ struct pattern{
 		pcre*       pcre;
 		pcre*       javascript;
 	}p;
+	struct pat_filter filter;   /**< Filled in by pat_init(). Empty if nothing could be worked out. */
 };
 
 /**
@@ -53,7 +78,65 @@ struct pattern{
  *
  * @return True for a match, false for no match.
  */
-int match(const char* haystack, const struct pattern* needle) FF_HOT FF_INLINE;
+int match(const char* haystack, const struct pattern* needle) FF_HOT;
+
+/**
+ * @brief Matches a haystack against a fnmatch(3) pattern.<br>
+ * This is what match() does for TYPE_FNMATCH, for callers that already know the pattern's type.
+ * @param haystack A string to search within.
+ * @param needle The pattern.
+ * @return True for a match, false for no match.
+ */
+int match_fnmatch(const char* haystack, const char* needle) FF_HOT;
+
+/**
+ * @brief Checks whether a haystack contains a literal string.<br>
+ * This is what match() does for TYPE_FNMATCH_LITERAL.
+ * @param haystack A string to search within.
+ * @param needle The string to look for.
+ * @return True for a match, false for no match.
+ */
+int match_fnmatch_literal(const char* haystack, const char* needle) FF_HOT;
+
+/**
+ * @brief Matches a haystack against a compiled POSIX regular expression.<br>
+ * This is what match() does for TYPE_REGEX_POSIX and TYPE_REGEX_POSIX_EX.
+ * @param haystack A string to search within.
+ * @param regex The regular expression.
+ * @return True for a match, false for no match.
+ */
+int match_regex_posix(const char* haystack, const regex_t* regex) FF_HOT;
+
+/**
+ * @brief Checks whether match_batch() can rule names out without the full matcher.
+ * @param pat The pattern.
+ * @return True if the pattern has a suffix or a literal to filter by.
+ */
+int pat_has_filter(const struct pattern* pat);
+
+/**
+ * @brief Matches every name in a batch from the same directory at once.<br>
+ * The pattern's suffix and literal are checked over the packed names with vector compares, and only the names that pass both go to match(), one at a time.
+ * If the filter is exact, match() is not called at all.
+ * @param pat The pattern. This should have a filter.
+ * @see pat_has_filter()
+ * @param path A buffer holding the directory's path followed by a slash.<br>
+ * Each name that passes the filter is copied after it to make the path given to match(), so it must have room for the longest name and its NUL.
+ * @param dir_len The length of the directory's path and the slash.
+ * @param names The names, each followed by a NUL, packed one after another.
+ * @param offs The offsets of the names within names. offs[n] is the length of names.
+ * @param n The number of names. This must be at most MATCH_BATCH_MAX.
+ * @param hits Set to 1 for every name whose path matches, and 0 for the rest.
+ * @return The number of matches.
+ */
+size_t match_batch(const struct pattern* pat, char* path, size_t dir_len, const char* names, const size_t* offs, size_t n, unsigned char* hits) FF_HOT;
+
+/**
+ * @brief Checks whether a pattern matches every string, like the default pattern "*".
+ * @param pat The pattern.
+ * @return True if match() would return true for any haystack.
+ */
+int pat_matches_all(const struct pattern* pat);
 
 /**
  * @brief Initializes a pattern structure.
@@ -7,8 +7,13 @@
  */
 
 #include "options.h"
+#include "contents.h"
 #include "log.h"
 #include "match.h"
+#include "progress.h"
+#include "checkpoint.h"
+#include "shard.h"
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -45,32 +50,182 @@ static int add_string(const char* s, char*** array_ptr, size_t* array_len){
 	return 0;
 }
 
+/* Parses a size such as "512", "64k", "10M", or "2G". */
+static int parse_size(const char* s, off_t* out){
+	char* end;
+	unsigned long long val;
+
+	val = strtoull(s, &end, 10);
+	if (end == s){
+		return -1;
+	}
+
+	switch (*end){
+	case 'G':
+	case 'g':
+		val *= 1024;
+		//fall through
+	case 'M':
+	case 'm':
+		val *= 1024;
+		//fall through
+	case 'K':
+	case 'k':
+		val *= 1024;
+		end++;
+		break;
+	}
+
+	if (*end != '\0'){
+		return -1;
+	}
+	*out = val;
+	return 0;
+}
+
+/* Parses a thread count, which must be a positive number. */
+static int parse_count(const char* s, size_t* out){
+	char* end;
+	unsigned long val;
+
+	val = strtoul(s, &end, 10);
+	if (end == s || *end != '\0' || val == 0){
+		return -1;
+	}
+	*out = val;
+	return 0;
+}
+
+/* Parses a duration such as "1.5", "500ms", "2s", "10m", or "1h" into nanoseconds.
+ * A number without a suffix is in seconds. */
+static int parse_duration(const char* s, uint64_t* out){
+	char* end;
+	double val;
+
+	val = strtod(s, &end);
+	if (end == s || val <= 0){
+		return -1;
+	}
+
+	if (!strcmp(end, "ms")){
+		val /= 1e3;
+	}
+	else if (!strcmp(end, "m")){
+		val *= 60;
+	}
+	else if (!strcmp(end, "h")){
+		val *= 3600;
+	}
+	else if (strcmp(end, "") && strcmp(end, "s")){
+		return -1;
+	}
+
+	*out = val * 1e9;
+	return *out > 0 ? 0 : -1;
+}
+
 static void pd_init(struct parsed_data* pd){
 	pd->flags.type = '\0';
 	pd->flags.follow_symlink = 0;
 	pd->flags.print0 = 0;
+	pd->flags.contains = 0;
+	pd->flags.stats = 0;
+	pd->flags.inode_order = 0;
+	pd->flags.restore_order = 0;
+	pd->flags.fuzzy = 0;
+	pd->flags.duplicates = 0;
+	pd->flags.count = 0;
+	pd->flags.du = 0;
+	pd->flags.extensions = 0;
+	pd->flags.idle_io = 0;
+	pd->flags.watch = 0;
 	pd->directories = NULL;
 	pd->directories_len = 0;
 	pd->pat.p_type = TYPE_REGEX_POSIX;
 	pd->pat.p.fnmatch = NULL;
+	pd->contains.p_type = TYPE_FNMATCH_LITERAL;
+	pd->contains.p.fnmatch = NULL;
+	format_init(&(pd->format));
+	pd->fuzzy.text = NULL;
+	pd->fuzzy.len = 0;
+	pd->contains_maxsize = CONTENTS_DEFAULT_MAX_SIZE;
+	pd->trace_file = NULL;
 	pd->maxdepth = -1;
-	pd->n_threads = 4;
+	pd->du_depth = -1;
+	pd->n_threads = 0;
+	pd->min_threads = 0;
+	pd->max_threads = 0;
+	pd->max_results = 0;
+	pd->timeout_ns = 0;
+	pd->progress_ns = 0;
+	pd->max_iops = 0;
+	pd->max_dirs_per_sec = 0;
+	pd->top = 0;
+	pd->checkpoint_file = NULL;
+	pd->checkpoint_ns = CHECKPOINT_DEFAULT_INTERVAL;
+	pd->resume_file = NULL;
+	pd->shard_index = 0;
+	pd->shard_count = 0;
+	pd->shard_depth = SHARD_DEFAULT_DEPTH;
+	pd->shard_split = SHARD_DEFAULT_SPLIT;
+	pd->shard_plan = 0;
+	pd->sort = SORT_NONE;
+	pd->limit = 0;
 }
 
 static void display_help(const char* prog_name){
 	printf_mt("Usage: %s [options] [directory...] [pattern]\n", prog_name);
 	printf_mt("Options\n");
+	printf_mt("\t--binary: Write length-prefixed binary records with the path, type, size, mtime, inode, and depth.\n");
+	printf_mt("\t--checkpoint FILE: Save the directories left to search to FILE every minute and on SIGINT or SIGTERM, which then stop the search.\n");
+	printf_mt("\t--checkpoint-interval DURATION: Save a checkpoint every DURATION (such as 30s or 5m) instead of every minute.\n");
+	printf_mt("\t-contains TEXT: Match only regular files that contain TEXT.\n");
+	printf_mt("\t--count: Print the number of matches instead of the matches themselves.\n");
+	printf_mt("\t-containsmax SIZE: Do not search the contents of files larger than SIZE (default 64M).\n");
+	printf_mt("\t-containsregex PATTERN: Match only regular files with a line matching this regular expression.\n");
+	printf_mt("\t--duplicates: Print groups of matching regular files with identical contents, separated by blank lines.\n");
+	printf_mt("\t--du: Print the disk usage of the matches under each directory in KiB, like du(1).\n");
+	printf_mt("\t--du=DEPTH: Like --du, but only print directories up to DEPTH levels below each starting directory.\n");
 	printf_mt("\t-e: Allow escape characters with -name argument\n");
+	printf_mt("\t--extensions: Print the number of matching files and their total size for each file extension.\n");
+	printf_mt("\t--fuzzy QUERY: Print the entries that best match QUERY as a fuzzy subsequence, best first.\n");
 	printf_mt("\t-H: Follow symbolic links.\n");
 	printf_mt("\t-I: Ignore case when searching.\n");
+	printf_mt("\t--idle-io: Only use the disk when nothing else wants it (Linux only).\n");
+	printf_mt("\t--inode-order: Read each directory, then stat its entries in inode order. Faster on spinning disks with a cold cache.\n");
+	printf_mt("\t--inode-order=restore: Like --inode-order, but print each directory's entries in the order they were read.\n");
+	printf_mt("\t--json: Write one JSON object per line with the path, type, size, mtime, inode, and depth.\n");
 	printf_mt("\t-l: Treat the -name argument literally and match if it is a substring.\n");
 	printf_mt("\t-jNUMBER: Use a specified number of threads.\n");
+	printf_mt("\t-j auto: Adjust the number of threads to the workload (default).\n");
 	printf_mt("\t-L: Follow symbolic links (same as -H).\n");
+	printf_mt("\t--limit NUMBER: With --sort, print only the first NUMBER entries.\n");
 	printf_mt("\t-P: Do not follow symbolic links.\n");
+	printf_mt("\t-print0: Separate entries with '\\0' instead of '\\n'.\n");
+	printf_mt("\t--progress: Print the directories and entries read per second, the queue depth, and a directory being searched to stderr every second.\n");
+	printf_mt("\t--progress=INTERVAL: Like --progress, but report every INTERVAL (such as 500ms or 10s). Either way, SIGUSR1 prints a snapshot of every thread.\n");
+	printf_mt("\t-printf FORMAT: Write each entry using a find(1)-style FORMAT, such as \"%%s %%p\\n\".\n");
 	printf_mt("\t-maxdepth NUMBER: Set the maximum recursion depth\n");
+	printf_mt("\t--max-dirs-per-sec NUMBER: Open at most NUMBER directories per second.\n");
+	printf_mt("\t--max-iops NUMBER: Make at most NUMBER opendir(), stat(), and -contains reads per second.\n");
+	printf_mt("\t--max-results NUMBER: Stop after printing NUMBER entries.\n");
+	printf_mt("\t--max-threads NUMBER: The most threads -j auto may use.\n");
+	printf_mt("\t--min-threads NUMBER: The fewest threads -j auto may use.\n");
 	printf_mt("\t-name PATTERN: Find files matching this pattern.\n");
+	printf_mt("\t-quit: Stop after printing the first match (same as --max-results 1).\n");
+	printf_mt("\t--resume FILE: Carry on from a checkpoint saved by --checkpoint, without printing anything it already printed.\n");
 	printf_mt("\t-regex PATTERN: Find files matching this regular expression.\n");
 	printf_mt("\t-regextype TYPE: Use a different regex dialect. Use \"-regextype help\" to see available dialects.\n");
+	printf_mt("\t--shard I/N: Search only the I-th of N parts of the tree, such that N processes run with 1/N through N/N together print every entry once.\n");
+	printf_mt("\t--shard-depth DEPTH: Divide the tree between shards at directories DEPTH levels below each starting directory (default %d).\n", SHARD_DEFAULT_DEPTH);
+	printf_mt("\t--shard-plan N: Print how evenly N shards would divide each starting directory, estimated from its top levels, instead of searching.\n");
+	printf_mt("\t--shard-split NUMBER: Divide directories with more than NUMBER entries at or below the shard depth entry by entry (default %d, 0 for never).\n", SHARD_DEFAULT_SPLIT);
+	printf_mt("\t--sort KEY: Print the entries sorted by KEY, which is mtime (newest first), size (largest first), or depth (deepest first).\n");
+	printf_mt("\t--stats: Print traversal statistics to stderr when finished.\n");
+	printf_mt("\t--timeout DURATION: Stop after DURATION (such as 500ms, 2s, or 1m) and exit with status 2.\n");
+	printf_mt("\t--top NUMBER: With --fuzzy, print the best NUMBER entries (default %d).\n", FUZZY_DEFAULT_TOP);
+	printf_mt("\t--trace FILE: Write a Chrome trace of every thread's activity to FILE.\n");
+	printf_mt("\t--watch: After searching, keep running and print new and changed entries that match until interrupted (Linux only).\n");
 	printf_mt("\t-type df:\n"
 			"\t\t-type d: Match directories only.\n"
 			"\t\t-type f: Match files only.\n");
@@ -88,6 +243,8 @@ static void display_version(void){
 
 int parse_options(int argc, char** argv, struct parsed_data* in_out){
 	char* pat_text = NULL;
+	char* contains_text = NULL;
+	enum pattern_type regex_type = TYPE_REGEX_POSIX;
 	int p_flags = 0;
 	int ret = 0;
 
@@ -100,6 +257,27 @@ int parse_options(int argc, char** argv, struct parsed_data* in_out){
 			goto cleanup;
 		}
 
+		else if (!strcmp(argv[i], "-contains") || !strcmp(argv[i], "-containsregex")){
+			if (i + 1 >= argc){
+				eprintf_mt("ffind: %s requires an argument.\n", argv[i]);
+				ret = -1;
+				goto cleanup;
+			}
+			in_out->flags.contains = 1;
+			in_out->contains.p_type = !strcmp(argv[i], "-contains") ? TYPE_FNMATCH_LITERAL : TYPE_REGEX_POSIX;
+			i++;
+			contains_text = argv[i];
+		}
+
+		else if (!strcmp(argv[i], "-containsmax")){
+			i++;
+			if (i >= argc || parse_size(argv[i], &(in_out->contains_maxsize)) != 0){
+				eprintf_mt("ffind: -containsmax must be a size such as 512, 64k, 10M, or 1G.\n");
+				ret = -1;
+				goto cleanup;
+			}
+		}
+
 		else if (!strcmp(argv[i], "-maxdepth")){
 			char* tmp;
 			i++;
@@ -124,10 +302,267 @@ int parse_options(int argc, char** argv, struct parsed_data* in_out){
 			}
 		}
 
+		else if (!strcmp(argv[i], "--min-threads") || !strcmp(argv[i], "--max-threads")){
+			size_t* count = !strcmp(argv[i], "--min-threads") ? &(in_out->min_threads) : &(in_out->max_threads);
+			if (i + 1 >= argc || parse_count(argv[i + 1], count) != 0){
+				eprintf_mt("ffind: %s requires a positive number.\n", argv[i]);
+				ret = -1;
+				goto cleanup;
+			}
+			i++;
+		}
+
+		else if (!strcmp(argv[i], "--max-results")){
+			if (i + 1 >= argc || parse_count(argv[i + 1], &(in_out->max_results)) != 0){
+				eprintf_mt("ffind: --max-results requires a positive number.\n");
+				ret = -1;
+				goto cleanup;
+			}
+			i++;
+		}
+
+		else if (!strcmp(argv[i], "--max-iops")){
+			if (i + 1 >= argc || parse_count(argv[i + 1], &(in_out->max_iops)) != 0){
+				eprintf_mt("ffind: --max-iops requires a positive number.\n");
+				ret = -1;
+				goto cleanup;
+			}
+			i++;
+		}
+
+		else if (!strcmp(argv[i], "--max-dirs-per-sec")){
+			if (i + 1 >= argc || parse_count(argv[i + 1], &(in_out->max_dirs_per_sec)) != 0){
+				eprintf_mt("ffind: --max-dirs-per-sec requires a positive number.\n");
+				ret = -1;
+				goto cleanup;
+			}
+			i++;
+		}
+
+		else if (!strcmp(argv[i], "--idle-io")){
+			in_out->flags.idle_io = 1;
+		}
+
+		else if (!strcmp(argv[i], "--watch")){
+			in_out->flags.watch = 1;
+		}
+
+		else if (!strcmp(argv[i], "--duplicates")){
+			in_out->flags.duplicates = 1;
+		}
+
+		else if (!strcmp(argv[i], "--count")){
+			in_out->flags.count = 1;
+		}
+
+		else if (!strcmp(argv[i], "--du")){
+			in_out->flags.du = 1;
+			in_out->du_depth = -1;
+		}
+
+		else if (!strncmp(argv[i], "--du=", strlen("--du="))){
+			const char* arg = argv[i] + strlen("--du=");
+			char* tmp;
+			long depth = strtol(arg, &tmp, 10);
+
+			if (tmp == arg || *tmp != '\0' || depth < 0 || depth > INT_MAX){
+				eprintf_mt("ffind: --du=DEPTH requires a non-negative number.\n");
+				ret = -1;
+				goto cleanup;
+			}
+			in_out->flags.du = 1;
+			in_out->du_depth = depth;
+		}
+
+		else if (!strcmp(argv[i], "--extensions")){
+			in_out->flags.extensions = 1;
+		}
+
+		else if (!strcmp(argv[i], "--fuzzy")){
+			if (i + 1 >= argc){
+				eprintf_mt("ffind: --fuzzy requires a query.\n");
+				ret = -1;
+				goto cleanup;
+			}
+			i++;
+			fuzzy_free(&(in_out->fuzzy));
+			if (fuzzy_compile(argv[i], &(in_out->fuzzy)) != 0){
+				ret = -1;
+				goto cleanup;
+			}
+			in_out->flags.fuzzy = 1;
+		}
+
+		else if (!strcmp(argv[i], "--top")){
+			if (i + 1 >= argc || parse_count(argv[i + 1], &(in_out->top)) != 0){
+				eprintf_mt("ffind: --top requires a positive number.\n");
+				ret = -1;
+				goto cleanup;
+			}
+			i++;
+		}
+
+		else if (!strcmp(argv[i], "--sort")){
+			if (i + 1 >= argc){
+				eprintf_mt("ffind: --sort requires mtime, size, or depth.\n");
+				ret = -1;
+				goto cleanup;
+			}
+			i++;
+			if (!strcmp(argv[i], "mtime")){
+				in_out->sort = SORT_MTIME;
+			}
+			else if (!strcmp(argv[i], "size")){
+				in_out->sort = SORT_SIZE;
+			}
+			else if (!strcmp(argv[i], "depth")){
+				in_out->sort = SORT_DEPTH;
+			}
+			else{
+				eprintf_mt("ffind: --sort requires mtime, size, or depth, not \"%s\".\n", argv[i]);
+				ret = -1;
+				goto cleanup;
+			}
+		}
+
+		else if (!strcmp(argv[i], "--limit")){
+			if (i + 1 >= argc || parse_count(argv[i + 1], &(in_out->limit)) != 0){
+				eprintf_mt("ffind: --limit requires a positive number.\n");
+				ret = -1;
+				goto cleanup;
+			}
+			i++;
+		}
+
+		else if (!strcmp(argv[i], "-quit")){
+			in_out->max_results = 1;
+		}
+
+		else if (!strcmp(argv[i], "--timeout")){
+			if (i + 1 >= argc || parse_duration(argv[i + 1], &(in_out->timeout_ns)) != 0){
+				eprintf_mt("ffind: --timeout must be a duration such as 500ms, 2s, or 1m.\n");
+				ret = -1;
+				goto cleanup;
+			}
+			i++;
+		}
+
+		else if (!strcmp(argv[i], "--progress")){
+			in_out->progress_ns = PROGRESS_DEFAULT_INTERVAL;
+		}
+
+		else if (!strncmp(argv[i], "--progress=", strlen("--progress="))){
+			if (parse_duration(argv[i] + strlen("--progress="), &(in_out->progress_ns)) != 0){
+				eprintf_mt("ffind: --progress=INTERVAL must be a duration such as 500ms, 2s, or 1m.\n");
+				ret = -1;
+				goto cleanup;
+			}
+		}
+
+		else if (!strcmp(argv[i], "--checkpoint") || !strcmp(argv[i], "--resume")){
+			if (i + 1 >= argc){
+				eprintf_mt("ffind: %s requires a file name.\n", argv[i]);
+				ret = -1;
+				goto cleanup;
+			}
+			if (!strcmp(argv[i], "--checkpoint")){
+				in_out->checkpoint_file = argv[i + 1];
+			}
+			else{
+				in_out->resume_file = argv[i + 1];
+			}
+			i++;
+		}
+
+		else if (!strcmp(argv[i], "--checkpoint-interval")){
+			if (i + 1 >= argc || parse_duration(argv[i + 1], &(in_out->checkpoint_ns)) != 0){
+				eprintf_mt("ffind: --checkpoint-interval must be a duration such as 30s or 5m.\n");
+				ret = -1;
+				goto cleanup;
+			}
+			i++;
+		}
+
+		else if (!strcmp(argv[i], "--shard")){
+			char* tmp;
+			unsigned long index = 0;
+			unsigned long count = 0;
+
+			if (i + 1 < argc){
+				index = strtoul(argv[i + 1], &tmp, 10);
+				if (tmp != argv[i + 1] && *tmp == '/'){
+					char* end;
+					count = strtoul(tmp + 1, &end, 10);
+					if (end == tmp + 1 || *end != '\0'){
+						count = 0;
+					}
+				}
+			}
+			if (index == 0 || index > count){
+				eprintf_mt("ffind: --shard must be I/N with I from 1 to N, such as 2/8.\n");
+				ret = -1;
+				goto cleanup;
+			}
+			in_out->shard_index = index - 1;
+			in_out->shard_count = count;
+			i++;
+		}
+
+		else if (!strcmp(argv[i], "--shard-depth")){
+			size_t depth;
+			if (i + 1 >= argc || parse_count(argv[i + 1], &depth) != 0 || depth > INT_MAX){
+				eprintf_mt("ffind: --shard-depth requires a positive number.\n");
+				ret = -1;
+				goto cleanup;
+			}
+			in_out->shard_depth = depth;
+			i++;
+		}
+
+		else if (!strcmp(argv[i], "--shard-split")){
+			char* tmp = NULL;
+			if (i + 1 < argc){
+				in_out->shard_split = strtoul(argv[i + 1], &tmp, 10);
+			}
+			if (!tmp || tmp == argv[i + 1] || *tmp != '\0'){
+				eprintf_mt("ffind: --shard-split requires a number.\n");
+				ret = -1;
+				goto cleanup;
+			}
+			i++;
+		}
+
+		else if (!strcmp(argv[i], "--shard-plan")){
+			if (i + 1 >= argc || parse_count(argv[i + 1], &(in_out->shard_plan)) != 0){
+				eprintf_mt("ffind: --shard-plan requires a positive number.\n");
+				ret = -1;
+				goto cleanup;
+			}
+			i++;
+		}
+
 		else if (!strcmp(argv[i], "-print0")){
 			in_out->flags.print0 = 1;
 		}
 
+		else if (!strcmp(argv[i], "-printf")){
+			if (i + 1 >= argc){
+				eprintf_mt("ffind: -printf requires a format.\n");
+				ret = -1;
+				goto cleanup;
+			}
+			i++;
+			if (format_compile(argv[i], &(in_out->format)) != 0){
+				ret = -1;
+				goto cleanup;
+			}
+		}
+
+		else if (!strcmp(argv[i], "--json") || !strcmp(argv[i], "--binary")){
+			format_free(&(in_out->format));
+			in_out->format.mode = !strcmp(argv[i], "--json") ? FORMAT_JSON : FORMAT_BINARY;
+		}
+
 		else if (!strcmp(argv[i], "-regex")){
 			i++;
 			pat_text = argv[i];
@@ -155,20 +590,24 @@ int parse_options(int argc, char** argv, struct parsed_data* in_out){
 					!strcmp(argv[i], "posix-basic") ||
 					!strcmp(argv[i], "grep")){
 				in_out->pat.p_type = TYPE_REGEX_POSIX;
+				regex_type = TYPE_REGEX_POSIX;
 			}
 
 			else if (!strcmp(argv[i], "posix-extended") ||
 					!strcmp(argv[i], "egrep")){
 				in_out->pat.p_type = TYPE_REGEX_POSIX_EX;
+				regex_type = TYPE_REGEX_POSIX_EX;
 			}
 
 			else if (!strcmp(argv[i], "pcre") ||
 					!strcmp(argv[i], "python")){
 				in_out->pat.p_type = TYPE_REGEX_PCRE;
+				regex_type = TYPE_REGEX_PCRE;
 			}
 
 			else if (!strcmp(argv[i], "javascript")){
 				in_out->pat.p_type = TYPE_REGEX_JAVASCRIPT;
+				regex_type = TYPE_REGEX_JAVASCRIPT;
 			}
 
 			else{
@@ -179,6 +618,25 @@ int parse_options(int argc, char** argv, struct parsed_data* in_out){
 			}
 		}
 
+		else if (!strcmp(argv[i], "--inode-order") || !strcmp(argv[i], "--inode-order=restore")){
+			in_out->flags.inode_order = 1;
+			in_out->flags.restore_order = !strcmp(argv[i], "--inode-order=restore");
+		}
+
+		else if (!strcmp(argv[i], "--stats")){
+			in_out->flags.stats = 1;
+		}
+
+		else if (!strcmp(argv[i], "--trace")){
+			i++;
+			if (i >= argc){
+				eprintf_mt("ffind: --trace requires a file name.\n");
+				ret = -1;
+				goto cleanup;
+			}
+			in_out->trace_file = argv[i];
+		}
+
 		else if (!strcmp(argv[i], "-type")){
 			i++;
 			if (strlen(argv[i]) != 1){
@@ -214,6 +672,25 @@ int parse_options(int argc, char** argv, struct parsed_data* in_out){
 					p_flags |= PFLAG_ICASE;
 					break;
 				case 'j':
+					/* "-j 8" and "-j auto" */
+					if (argv[i][j + 1] == '\0' && i + 1 < argc){
+						i++;
+						if (!strcmp(argv[i], "auto")){
+							in_out->n_threads = 0;
+						}
+						else if (parse_count(argv[i], &(in_out->n_threads)) != 0){
+							eprintf_mt("ffind: -j must be followed by a positive number or \"auto\".\n");
+							ret = -1;
+							goto cleanup;
+						}
+						j = strlen(argv[i]);
+						break;
+					}
+					if (!strcmp(argv[i] + j + 1, "auto")){
+						in_out->n_threads = 0;
+						j = strlen(argv[i]);
+						break;
+					}
 					j++;
 					for (; argv[i][j] >= '0' && argv[i][j] <= '9' && buf_ptr <= sizeof(buf) - 1; ++j, ++buf_ptr){
 						buf[buf_ptr] = argv[i][j];
@@ -221,11 +698,13 @@ int parse_options(int argc, char** argv, struct parsed_data* in_out){
 					if (buf_ptr == sizeof(buf)){
 						eprintf_mt("ffind: Too many threads specified. Lower the number passed to the -j argument.\n");
 					}
-					if (sscanf(buf, "%zu", &(in_out->n_threads)) != 1){
-						eprintf_mt("ffind: Character(s) directly after -j must make up a number.\n");
+					if (sscanf(buf, "%zu", &(in_out->n_threads)) != 1 || in_out->n_threads == 0){
+						eprintf_mt("ffind: Character(s) directly after -j must make up a positive number or \"auto\".\n");
 						ret = -1;
 						goto cleanup;
 					}
+					/* the loop increment moves past the last digit */
+					j--;
 					break;
 				case 'l':
 					in_out->pat.p_type = TYPE_FNMATCH_LITERAL;
@@ -253,6 +732,78 @@ int parse_options(int argc, char** argv, struct parsed_data* in_out){
 		}
 	}
 
+	in_out->format.sep = in_out->flags.print0 ? '\0' : '\n';
+
+	if (in_out->top && !in_out->flags.fuzzy){
+		eprintf_mt("ffind: --top can only be used with --fuzzy.\n");
+		ret = -1;
+		goto cleanup;
+	}
+	/* the limit applies before ranking, so it would rank whichever matches came first */
+	if (in_out->flags.fuzzy && in_out->max_results){
+		eprintf_mt("ffind: --fuzzy cannot be used with --max-results or -quit. Use --top to limit the results.\n");
+		ret = -1;
+		goto cleanup;
+	}
+	if (in_out->flags.duplicates && (in_out->flags.fuzzy || in_out->format.mode != FORMAT_PATH)){
+		eprintf_mt("ffind: --duplicates cannot be used with --fuzzy, -printf, --json, or --binary.\n");
+		ret = -1;
+		goto cleanup;
+	}
+	/* only the files found before the cut would be compared, so groups would be missed without a word */
+	if (in_out->flags.duplicates && (in_out->max_results || in_out->timeout_ns)){
+		eprintf_mt("ffind: --duplicates cannot be used with --max-results, -quit, or --timeout.\n");
+		ret = -1;
+		goto cleanup;
+	}
+	if ((in_out->flags.count || in_out->flags.du || in_out->flags.extensions) && (in_out->flags.fuzzy || in_out->flags.duplicates || in_out->format.mode != FORMAT_PATH)){
+		eprintf_mt("ffind: --count, --du, and --extensions cannot be used with --fuzzy, --duplicates, -printf, --json, or --binary.\n");
+		ret = -1;
+		goto cleanup;
+	}
+	/* these only print once every directory is searched, so there is nothing a checkpoint could save them from repeating */
+	if ((in_out->checkpoint_file || in_out->resume_file) &&
+			(in_out->flags.fuzzy || in_out->flags.duplicates || in_out->flags.count || in_out->flags.du || in_out->flags.extensions)){
+		eprintf_mt("ffind: --checkpoint and --resume cannot be used with --fuzzy, --duplicates, --count, --du, or --extensions.\n");
+		ret = -1;
+		goto cleanup;
+	}
+	if (in_out->limit && in_out->sort == SORT_NONE){
+		eprintf_mt("ffind: --limit can only be used with --sort.\n");
+		ret = -1;
+		goto cleanup;
+	}
+	/* sorted output is only printed once every directory is searched, and --max-results would stop at whichever entries came first */
+	if (in_out->sort != SORT_NONE &&
+			(in_out->flags.fuzzy || in_out->flags.duplicates || in_out->flags.count || in_out->flags.du || in_out->flags.extensions ||
+			 in_out->checkpoint_file || in_out->resume_file || in_out->flags.watch || in_out->max_results)){
+		eprintf_mt("ffind: --sort cannot be used with --fuzzy, --duplicates, --count, --du, --extensions, --checkpoint, --resume, --watch, --max-results, or -quit.\n");
+		ret = -1;
+		goto cleanup;
+	}
+	/* each shard would only compare the files it found */
+	if ((in_out->shard_count || in_out->shard_plan) && in_out->flags.duplicates){
+		eprintf_mt("ffind: --shard and --shard-plan cannot be used with --duplicates.\n");
+		ret = -1;
+		goto cleanup;
+	}
+	if (in_out->shard_count && in_out->shard_plan){
+		eprintf_mt("ffind: --shard and --shard-plan cannot be used together.\n");
+		ret = -1;
+		goto cleanup;
+	}
+	/* a search that never finishes has no end to print a summary at, or to stop a limit at */
+	if (in_out->flags.watch &&
+			(in_out->flags.fuzzy || in_out->flags.duplicates || in_out->flags.count || in_out->flags.du || in_out->flags.extensions ||
+			 in_out->checkpoint_file || in_out->resume_file || in_out->shard_count || in_out->shard_plan || in_out->max_results || in_out->timeout_ns)){
+		eprintf_mt("ffind: --watch cannot be used with --fuzzy, --duplicates, --count, --du, --extensions, --checkpoint, --resume, --shard, --shard-plan, --max-results, -quit, or --timeout.\n");
+		ret = -1;
+		goto cleanup;
+	}
+	if (in_out->flags.fuzzy && !in_out->top){
+		in_out->top = FUZZY_DEFAULT_TOP;
+	}
+
 	if (!pat_text){
 		pat_text = "*";
 		in_out->pat.p_type = TYPE_FNMATCH;
@@ -270,6 +821,16 @@ int parse_options(int argc, char** argv, struct parsed_data* in_out){
 		goto cleanup;
 	}
 
+	if (contains_text){
+		if (in_out->contains.p_type != TYPE_FNMATCH_LITERAL){
+			in_out->contains.p_type = regex_type;
+		}
+		if (pat_init(contains_text, &(in_out->contains), p_flags) != 0){
+			ret = -1;
+			goto cleanup;
+		}
+	}
+
 cleanup:
 	if (ret != 0){
 		free_options(in_out);
@@ -286,4 +847,7 @@ void free_options(struct parsed_data* pd){
 	}
 	free(pd->directories);
 	pat_free(&(pd->pat));
+	pat_free(&(pd->contains));
+	format_free(&(pd->format));
+	fuzzy_free(&(pd->fuzzy));
 }
@@ -10,12 +10,34 @@
 #define __OPTIONS_H
 
 #include "match.h"
+#include "format.h"
+#include "fuzzy.h"
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+enum sort_key{
+	SORT_NONE = 0,
+	SORT_MTIME,
+	SORT_SIZE,
+	SORT_DEPTH
+};
 
 struct ffind_flags{
 	char type;
 	unsigned follow_symlink:1;
 	unsigned print0:1;
+	unsigned contains:1;
+	unsigned stats:1;
+	unsigned inode_order:1;
+	unsigned restore_order:1;
+	unsigned fuzzy:1;
+	unsigned duplicates:1;
+	unsigned count:1;
+	unsigned du:1;
+	unsigned extensions:1;
+	unsigned idle_io:1;
+	unsigned watch:1;
 };
 
 struct parsed_data{
@@ -23,8 +45,32 @@ struct parsed_data{
 	char** directories;
 	size_t directories_len;
 	struct pattern pat;
+	struct pattern contains;
+	struct format format;
+	struct fuzzy_query fuzzy;
+	off_t contains_maxsize;
+	const char* trace_file;
 	int maxdepth;
-	size_t n_threads;
+	int du_depth;       /* with --du, the deepest directories to report, -1 for all */
+	size_t n_threads;   /* 0 to adjust the thread count automatically */
+	size_t min_threads; /* bounds for automatic thread counts, 0 for the default */
+	size_t max_threads;
+	size_t max_results; /* 0 for no limit */
+	uint64_t timeout_ns; /* 0 for no limit */
+	uint64_t progress_ns; /* the time between --progress reports, 0 for none */
+	size_t max_iops;    /* 0 for no limit */
+	size_t max_dirs_per_sec; /* 0 for no limit */
+	size_t top;         /* with --fuzzy, the number of results to print */
+	const char* checkpoint_file; /* --checkpoint, or NULL */
+	uint64_t checkpoint_ns; /* the time between checkpoints */
+	const char* resume_file; /* --resume, or NULL */
+	size_t shard_index; /* with --shard, the shard to search, counting from 0 */
+	size_t shard_count; /* with --shard, the number of shards, 0 without it */
+	int shard_depth;    /* the depth directories are divided between shards at */
+	size_t shard_split; /* directories at or below shard_depth with more entries than this are divided further, 0 for never */
+	size_t shard_plan;  /* --shard-plan, the number of shards to estimate, 0 for none */
+	enum sort_key sort; /* --sort, SORT_NONE without it */
+	size_t limit;       /* with --sort, the number of results to print, 0 for all */
 };
 
 /**
@@ -0,0 +1,181 @@
+/** @file progress.c
+ * @brief Live progress reports for --progress.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "progress.h"
+#include "stats.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Prints a line to stderr.
+ * This writes the line in one call instead of going through eprintf_mt(), since a worker holding the stdio mutex while it waits on a full pipe is exactly when a report is wanted. */
+static void report(const char* format, ...){
+	char line[FFIND_PROGRESS_PATH + 256];
+	va_list ap;
+	int len;
+
+	va_start(ap, format);
+	len = vsnprintf(line, sizeof(line), format, ap);
+	va_end(ap);
+	if (len < 0){
+		return;
+	}
+	if ((size_t)len >= sizeof(line)){
+		len = sizeof(line) - 1;
+		line[len - 1] = '\n';
+	}
+	/* a report that does not make it out is not worth failing over */
+	if (write(STDERR_FILENO, line, len) < 0){
+		return;
+	}
+}
+
+static double per_sec(uint64_t n, uint64_t ns){
+	return ns ? n * 1e9 / ns : 0.0;
+}
+
+/* Finds a busy thread, starting at *thread and moving on from there so that successive reports show different threads.
+ * Returns the length of its directory, or 0 if no thread is busy. */
+static size_t busy_dir(const struct ffind_pool* pool, size_t* thread, char buf[FFIND_PROGRESS_PATH]){
+	size_t n_threads = ffind_pool_threads(pool);
+
+	for (size_t i = 0; i < n_threads; ++i){
+		size_t t = (*thread + i) % n_threads;
+		size_t len = ffind_pool_progress_dir(pool, t, buf);
+
+		if (len){
+			*thread = t + 1;
+			return len;
+		}
+	}
+	return 0;
+}
+
+/* Prints one line with the rates since the last report. */
+static void print_line(struct progress* p){
+	struct ffind_progress cur;
+	char dir[FFIND_PROGRESS_PATH];
+	uint64_t now = stats_now();
+	uint64_t elapsed = now - p->last_time;
+	size_t len;
+	size_t n;
+
+	ffind_pool_progress(p->pool, &cur);
+	len = busy_dir(p->pool, &(p->next_thread), dir);
+	n = len < FFIND_PROGRESS_PATH ? len : FFIND_PROGRESS_PATH;
+
+	report("ffind: %.1fs: %llu dirs (%.0f/s), %llu entries (%.0f/s), %llu matches, %zu queued, %zu/%zu busy%s%s%.*s\n",
+			(now - p->start) / 1e9,
+			(unsigned long long)cur.dirs, per_sec(cur.dirs - p->last.dirs, elapsed),
+			(unsigned long long)cur.entries, per_sec(cur.entries - p->last.entries, elapsed),
+			(unsigned long long)cur.matches,
+			cur.queued, cur.busy, ffind_pool_threads(p->pool),
+			len ? ", in " : "", len > FFIND_PROGRESS_PATH ? "..." : "", (int)n, dir);
+
+	p->last = cur;
+	p->last_time = now;
+}
+
+/* Prints the totals and what every busy thread is working on, for SIGUSR1. */
+static void print_snapshot(struct progress* p){
+	struct ffind_progress cur;
+	uint64_t elapsed = stats_now() - p->start;
+	size_t n_threads = ffind_pool_threads(p->pool);
+
+	ffind_pool_progress(p->pool, &cur);
+	report("ffind: snapshot at %.1fs\n", elapsed / 1e9);
+	report("\tdirectories: %llu (%.0f/s)\n", (unsigned long long)cur.dirs, per_sec(cur.dirs, elapsed));
+	report("\tentries: %llu (%.0f/s)\n", (unsigned long long)cur.entries, per_sec(cur.entries, elapsed));
+	report("\tmatches: %llu\n", (unsigned long long)cur.matches);
+	report("\tqueued: %zu\n", cur.queued);
+	report("\tbusy: %zu/%zu\n", cur.busy, n_threads);
+	for (size_t i = 0; i < n_threads; ++i){
+		char dir[FFIND_PROGRESS_PATH];
+		size_t len = ffind_pool_progress_dir(p->pool, i, dir);
+		size_t n = len < FFIND_PROGRESS_PATH ? len : FFIND_PROGRESS_PATH;
+
+		if (len){
+			report("\tthread %zu: %s%.*s\n", i, len > FFIND_PROGRESS_PATH ? "..." : "", (int)n, dir);
+		}
+	}
+}
+
+/* Waits for SIGUSR1 or the next report, whichever comes first.
+ * SIGUSR1 is blocked in every thread, so it stays pending until this picks it up. */
+static void* progress_thread(void* param){
+	struct progress* p = param;
+	uint64_t next = p->start + p->interval_ns;
+	sigset_t set;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+
+	while (!__atomic_load_n(&(p->stop), __ATOMIC_ACQUIRE)){
+		uint64_t now = stats_now();
+		struct timespec ts;
+		int sig;
+
+		if (now >= next){
+			print_line(p);
+			/* skip any reports that were missed instead of printing them back to back */
+			while (next <= now){
+				next += p->interval_ns;
+			}
+			continue;
+		}
+
+		ts.tv_sec = (next - now) / 1000000000;
+		ts.tv_nsec = (next - now) % 1000000000;
+		sig = sigtimedwait(&set, NULL, &ts);
+		if (sig == SIGUSR1 && !__atomic_load_n(&(p->stop), __ATOMIC_ACQUIRE)){
+			print_snapshot(p);
+		}
+	}
+	return NULL;
+}
+
+int progress_block_signal(void){
+	sigset_t set;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	if ((errno = pthread_sigmask(SIG_BLOCK, &set, NULL)) != 0){
+		eprintf_mt("ffind: failed to block SIGUSR1 (%s)\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+int progress_start(struct progress* p, struct ffind_pool* pool, uint64_t interval_ns){
+	p->pool = pool;
+	p->interval_ns = interval_ns;
+	p->start = stats_now();
+	p->last_time = p->start;
+	ffind_pool_progress(pool, &(p->last));
+	p->next_thread = 0;
+	p->stop = 0;
+
+	if ((errno = pthread_create(&(p->thread), NULL, progress_thread, p)) != 0){
+		log_ethread();
+		return -1;
+	}
+	return 0;
+}
+
+void progress_stop(struct progress* p){
+	__atomic_store_n(&(p->stop), 1, __ATOMIC_RELEASE);
+	/* wakes the thread up, and since it checks stop first, it does not print a snapshot */
+	if (pthread_kill(p->thread, SIGUSR1) != 0 || pthread_join(p->thread, NULL) != 0){
+		log_ejoin();
+	}
+}
@@ -0,0 +1,68 @@
+/** @file progress.h
+ * @brief Live progress reports for --progress.<br>
+ * A reporter thread samples the pool's counters on a timer and prints the rates to stderr.
+ * Sending the process SIGUSR1 makes it print a fuller snapshot, including what every thread is working on.
+ * The workers are never asked for anything; the reporter only reads counters they already publish.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __PROGRESS_H
+#define __PROGRESS_H
+
+#include "ffind.h"
+#include <pthread.h>
+#include <stdint.h>
+
+/**
+ * @brief The default time between reports, in nanoseconds.
+ */
+#define PROGRESS_DEFAULT_INTERVAL 1000000000ULL
+
+/**
+ * @brief A running reporter.
+ */
+struct progress{
+	struct ffind_pool* pool;     /**< The pool being reported on. */
+	uint64_t interval_ns;        /**< The time between reports. */
+	uint64_t start;              /**< When the reporter started, as returned by stats_now(). */
+	uint64_t last_time;          /**< When the last report was printed. */
+	struct ffind_progress last;  /**< The counters at the last report, to work out the rates. */
+	size_t next_thread;          /**< The thread whose directory the next report starts looking at. */
+	pthread_t thread;            /**< The reporter thread. */
+	int stop;                    /**< Set when the reporter should exit. */
+};
+
+/**
+ * @brief Blocks SIGUSR1 in the calling thread, so that it and every thread it creates afterwards leave the signal to the reporter.<br>
+ * This must be called before the pool is created.
+ *
+ * @return 0 on success, negative on failure.
+ */
+int progress_block_signal(void);
+
+/**
+ * @brief Starts reporting on a pool.
+ *
+ * @param p The reporter.<br>
+ * This must be stopped with progress_stop() once the pool is done.
+ * @see progress_stop()
+ *
+ * @param pool The pool to report on.
+ *
+ * @param interval_ns The time between reports.
+ *
+ * @return 0 on success, negative on failure.
+ */
+int progress_start(struct progress* p, struct ffind_pool* pool, uint64_t interval_ns);
+
+/**
+ * @brief Stops a reporter and waits for its thread to exit.
+ *
+ * @param p The reporter.
+ */
+void progress_stop(struct progress* p);
+
+#endif
@@ -0,0 +1,651 @@
+/** @file shard.c
+ * @brief Dividing a search between processes for --shard and --shard-plan.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+/* d_type */
+#define _DEFAULT_SOURCE
+
+#include "shard.h"
+#include "log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#ifndef DT_UNKNOWN
+#define DT_UNKNOWN 0
+#endif
+
+/* A directory read while working out the shards. */
+struct shard_dir{
+	char* path;
+	size_t path_len;
+	int depth;
+	/* set above the split depth, where a directory is divided no matter how few entries it has */
+	int above;
+	/* 0 once read, positive if it could not be opened, negative if memory ran out */
+	int status;
+	int err;
+	/* its entries, each a d_type byte followed by a NUL-terminated name */
+	char* names;
+	size_t names_len;
+	size_t n_names;
+	/* the NUL-terminated names of the entries that are directories to search */
+	char* subdirs;
+	size_t subdirs_len;
+};
+
+/* A directory searched whole by the shard its path hashes to. */
+struct shard_unit{
+	char* path;
+	size_t path_len;
+	int depth;
+	size_t owner;
+	/* with --shard-plan, the entries in its top SHARD_SAMPLE_DEPTH levels */
+	uint64_t sampled;
+};
+
+/* What every shard works out the same way for a base directory. */
+struct shard_walk{
+	const struct parsed_data* pd;
+	size_t count;
+	size_t root_len;
+	/* the directories being read, one level at a time */
+	struct shard_dir* level;
+	size_t level_len;
+	/* the directories whose entries are divided between the shards */
+	struct shard_dir* divided;
+	size_t divided_len;
+	size_t divided_cap;
+	struct shard_unit* units;
+	size_t units_len;
+	size_t units_cap;
+	/* set by the sampling tasks if memory ran out */
+	int failed;
+};
+
+/* 64-bit FNV-1a, which is simple enough to give the same result on every host. */
+#define FNV_OFFSET UINT64_C(0xCBF29CE484222325)
+#define FNV_PRIME  UINT64_C(0x100000001B3)
+
+static uint64_t hash_update(uint64_t h, const char* data, size_t len){
+	for (size_t i = 0; i < len; ++i){
+		h ^= (unsigned char)data[i];
+		h *= FNV_PRIME;
+	}
+	return h;
+}
+
+/* Appends bytes to a growing buffer.
+ * Returns 0 on success, negative on failure. */
+static int buf_append(char** buf, size_t* len, size_t* cap, const char* data, size_t n){
+	if (*len + n > *cap){
+		size_t new_cap = *cap ? *cap : 4096;
+		char* tmp;
+		while (new_cap < *len + n){
+			new_cap *= 2;
+		}
+		tmp = realloc(*buf, new_cap);
+		if (!tmp){
+			return -1;
+		}
+		*buf = tmp;
+		*cap = new_cap;
+	}
+	memcpy(*buf + *len, data, n);
+	*len += n;
+	return 0;
+}
+
+/* Makes room for one more element in a growing array.
+ * Returns the array, which may have moved, or NULL if memory ran out, in which case the old array is still valid. */
+static void* array_reserve(void* arr, size_t len, size_t* cap, size_t size){
+	void* tmp;
+	size_t new_cap;
+
+	if (len < *cap){
+		return arr;
+	}
+	new_cap = *cap ? *cap * 2 : 64;
+	tmp = realloc(arr, new_cap * size);
+	if (tmp){
+		*cap = new_cap;
+	}
+	return tmp;
+}
+
+/* Joins a directory's path and the name of one of its entries the way the search does.
+ * Only a base directory can end with a slash, and then no other one is added.
+ * Returns the new path, or NULL if memory ran out. */
+static char* path_join(const char* dir, size_t dir_len, const char* name, size_t name_len, size_t* out_len){
+	int slash = !(dir_len > 0 && dir[dir_len - 1] == '/');
+	char* path = malloc(dir_len + slash + name_len + 1);
+
+	if (!path){
+		return NULL;
+	}
+	memcpy(path, dir, dir_len);
+	if (slash){
+		path[dir_len] = '/';
+	}
+	memcpy(path + dir_len + slash, name, name_len + 1);
+	*out_len = dir_len + slash + name_len;
+	return path;
+}
+
+/* Checks whether an entry is a directory the search would descend into, stat'ing it if readdir() did not say. */
+static int entry_is_dir(const char* path, unsigned char type, int follow_symlink){
+	struct stat st;
+
+#ifdef DT_DIR
+	if (type == DT_DIR){
+		return 1;
+	}
+	if (type != DT_UNKNOWN && !(follow_symlink && type == DT_LNK)){
+		return 0;
+	}
+#else
+	(void)type;
+#endif
+	if ((follow_symlink ? stat(path, &st) : lstat(path, &st)) != 0){
+		return 0;
+	}
+	return S_ISDIR(st.st_mode);
+}
+
+/* Whether the search descends into the subdirectories of a directory at this depth. */
+static int walk_descends(const struct shard_walk* w, int depth){
+	return w->pd->maxdepth < 0 || depth + 1 < w->pd->maxdepth;
+}
+
+/* Reads one directory of the current level, run on the pool's threads. */
+static void read_task(size_t index, size_t thread, void* data){
+	struct shard_walk* w = data;
+	struct shard_dir* d = &(w->level[index]);
+	int descend = walk_descends(w, d->depth);
+	size_t names_cap = 0;
+	size_t subdirs_cap = 0;
+	struct dirent* dnt;
+	DIR* dp;
+
+	(void)thread;
+
+	dp = opendir(d->path);
+	if (!dp){
+		d->status = 1;
+		d->err = errno;
+		return;
+	}
+	while ((dnt = readdir(dp)) != NULL){
+		size_t name_len;
+		unsigned char type = DT_UNKNOWN;
+
+		if (!strcmp(dnt->d_name, ".") || !strcmp(dnt->d_name, "..")){
+			continue;
+		}
+#ifdef DT_DIR
+		type = dnt->d_type;
+#endif
+		name_len = strlen(dnt->d_name);
+		if (buf_append(&(d->names), &(d->names_len), &names_cap, (const char*)&type, 1) != 0 ||
+				buf_append(&(d->names), &(d->names_len), &names_cap, dnt->d_name, name_len + 1) != 0){
+			d->status = -1;
+			break;
+		}
+		d->n_names++;
+
+		if (descend){
+			size_t path_len;
+			char* path = path_join(d->path, d->path_len, dnt->d_name, name_len, &path_len);
+			int is_dir;
+
+			if (!path){
+				d->status = -1;
+				break;
+			}
+			is_dir = entry_is_dir(path, type, w->pd->flags.follow_symlink);
+			free(path);
+			if (is_dir && buf_append(&(d->subdirs), &(d->subdirs_len), &subdirs_cap, dnt->d_name, name_len + 1) != 0){
+				d->status = -1;
+				break;
+			}
+		}
+	}
+	closedir(dp);
+}
+
+static void shard_dir_free(struct shard_dir* d){
+	free(d->path);
+	free(d->names);
+	free(d->subdirs);
+}
+
+/* The shard a path below the base directory belongs to. */
+static size_t path_owner(const struct shard_walk* w, const char* path, size_t path_len){
+	return hash_update(FNV_OFFSET, path + w->root_len, path_len - w->root_len) % w->count;
+}
+
+/* Adds a directory to search whole.
+ * Returns 0 on success, negative on failure. */
+static int add_unit(struct shard_walk* w, char* path, size_t path_len, int depth){
+	struct shard_unit* tmp = array_reserve(w->units, w->units_len, &(w->units_cap), sizeof(*tmp));
+	struct shard_unit* u;
+
+	if (!tmp){
+		log_enomem();
+		free(path);
+		return -1;
+	}
+	w->units = tmp;
+	u = &(w->units[w->units_len++]);
+	u->path = path;
+	u->path_len = path_len;
+	u->depth = depth;
+	u->owner = path_owner(w, path, path_len);
+	u->sampled = 0;
+	return 0;
+}
+
+/* Queues a directory to be read in the next level. */
+static int add_next(struct shard_dir** next, size_t* next_len, size_t* next_cap, char* path, size_t path_len, int depth, int above){
+	struct shard_dir* tmp = array_reserve(*next, *next_len, next_cap, sizeof(*tmp));
+	struct shard_dir* d;
+
+	if (!tmp){
+		log_enomem();
+		free(path);
+		return -1;
+	}
+	*next = tmp;
+	d = &((*next)[(*next_len)++]);
+	memset(d, 0, sizeof(*d));
+	d->path = path;
+	d->path_len = path_len;
+	d->depth = depth;
+	d->above = above;
+	return 0;
+}
+
+/* Decides what happens to a directory that was just read: it is either divided, with its subdirectories queued for the next level, or searched whole.
+ * Returns 0 on success, negative on failure. */
+static int walk_classify(struct shard_walk* w, struct shard_dir* d, struct shard_dir** next, size_t* next_len, size_t* next_cap){
+	const struct parsed_data* pd = w->pd;
+	struct shard_dir* divided;
+	const char* name;
+
+	/* a directory that cannot be read is left whole to one shard, so only that shard reports it */
+	if (d->status > 0 || (!d->above && d->n_names <= pd->shard_split)){
+		int ret = add_unit(w, d->path, d->path_len, d->depth);
+		d->path = NULL;
+		shard_dir_free(d);
+		memset(d, 0, sizeof(*d));
+		return ret;
+	}
+
+	for (name = d->subdirs; name < d->subdirs + d->subdirs_len; name += strlen(name) + 1){
+		size_t name_len = strlen(name);
+		size_t path_len;
+		char* path = path_join(d->path, d->path_len, name, name_len, &path_len);
+		int depth = d->depth + 1;
+		int res;
+
+		if (!path){
+			log_enomem();
+			return -1;
+		}
+		if (depth < pd->shard_depth){
+			res = add_next(next, next_len, next_cap, path, path_len, depth, 1);
+		}
+		/* only directories at the split depth or below with more entries than shard_split are divided, so the others need not be read */
+		else if (pd->shard_split){
+			res = add_next(next, next_len, next_cap, path, path_len, depth, 0);
+		}
+		else{
+			res = add_unit(w, path, path_len, depth);
+		}
+		if (res != 0){
+			return -1;
+		}
+	}
+	free(d->subdirs);
+	d->subdirs = NULL;
+	d->subdirs_len = 0;
+
+	divided = array_reserve(w->divided, w->divided_len, &(w->divided_cap), sizeof(*divided));
+	if (!divided){
+		log_enomem();
+		return -1;
+	}
+	w->divided = divided;
+	w->divided[w->divided_len++] = *d;
+	memset(d, 0, sizeof(*d));
+	return 0;
+}
+
+static void walk_free(struct shard_walk* w){
+	for (size_t i = 0; i < w->level_len; ++i){
+		shard_dir_free(&(w->level[i]));
+	}
+	free(w->level);
+	for (size_t i = 0; i < w->divided_len; ++i){
+		shard_dir_free(&(w->divided[i]));
+	}
+	free(w->divided);
+	for (size_t i = 0; i < w->units_len; ++i){
+		free(w->units[i].path);
+	}
+	free(w->units);
+}
+
+/* Reads the divided directories of a base directory a level at a time, each level on the pool's threads, and finds the directories to search whole.
+ * The walk must be freed with walk_free(), even if this function fails.
+ * Returns 0 on success, negative on failure. */
+static int walk(struct shard_walk* w, struct ffind_pool* pool, const char* base_dir, const struct parsed_data* pd, size_t count){
+	size_t base_len = strlen(base_dir);
+	size_t level_cap = 0;
+	char* path;
+
+	memset(w, 0, sizeof(*w));
+	w->pd = pd;
+	w->count = count;
+	w->root_len = base_len > 0 && base_dir[base_len - 1] == '/' ? base_len : base_len + 1;
+
+	path = malloc(base_len + 1);
+	if (!path){
+		log_enomem();
+		return -1;
+	}
+	memcpy(path, base_dir, base_len + 1);
+	if (add_next(&(w->level), &(w->level_len), &level_cap, path, base_len, 0, 1) != 0){
+		return -1;
+	}
+
+	while (w->level_len > 0){
+		struct shard_dir* next = NULL;
+		size_t next_len = 0;
+		size_t next_cap = 0;
+		int ret = 0;
+
+		ffind_pool_run(pool, w->level_len, read_task, w);
+
+		for (size_t i = 0; i < w->level_len && ret == 0; ++i){
+			struct shard_dir* d = &(w->level[i]);
+
+			if (d->status < 0){
+				log_enomem();
+				ret = -1;
+			}
+			else if (d->status > 0 && d->depth == 0){
+				errno = d->err;
+				log_eopendir(d->path);
+				ret = -1;
+			}
+			else{
+				ret = walk_classify(w, d, &next, &next_len, &next_cap);
+			}
+		}
+
+		for (size_t i = 0; i < w->level_len; ++i){
+			shard_dir_free(&(w->level[i]));
+		}
+		free(w->level);
+		w->level = next;
+		w->level_len = next_len;
+		if (ret != 0){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Adds a directory to a frontier.
+ * Takes ownership of names, even on failure.
+ * Returns 0 on success, negative on failure. */
+static int frontier_add(struct ffind_frontier* f, size_t* cap, const char* path, size_t path_len, int depth, char* names, size_t names_len, int flat){
+	struct ffind_pending* tmp = array_reserve(f->dirs, f->len, cap, sizeof(*tmp));
+	struct ffind_pending* p;
+
+	if (!tmp){
+		log_enomem();
+		free(names);
+		return -1;
+	}
+	f->dirs = tmp;
+	p = &(f->dirs[f->len]);
+	p->path = malloc(path_len + 1);
+	if (!p->path){
+		log_enomem();
+		free(names);
+		return -1;
+	}
+	memcpy(p->path, path, path_len + 1);
+	p->path_len = path_len;
+	p->depth = depth;
+	p->names = names;
+	p->names_len = names_len;
+	p->flat = flat;
+	f->len++;
+	return 0;
+}
+
+/* Adds the entries of a divided directory that belong to a shard to a frontier, in chunks of up to FFIND_SPLIT_CHUNK names so the pool can share them out.
+ * Returns 0 on success, negative on failure. */
+static int frontier_add_divided(struct ffind_frontier* f, size_t* cap, const struct shard_walk* w, const struct shard_dir* d, size_t shard){
+	uint64_t prefix = FNV_OFFSET;
+	const char* name;
+	char* chunk = NULL;
+	size_t chunk_len = 0;
+	size_t chunk_cap = 0;
+	size_t chunk_count = 0;
+
+	/* every entry's path is the directory's path, a slash, and its name, so the directory's part of the hash is only worked out once */
+	if (d->depth > 0){
+		prefix = hash_update(prefix, d->path + w->root_len, d->path_len - w->root_len);
+		prefix = hash_update(prefix, "/", 1);
+	}
+
+	for (name = d->names; name < d->names + d->names_len; name += strlen(name + 1) + 2){
+		size_t len = strlen(name + 1) + 2;
+
+		if (hash_update(prefix, name + 1, len - 2) % w->count != shard){
+			continue;
+		}
+		if (buf_append(&chunk, &chunk_len, &chunk_cap, name, len) != 0){
+			log_enomem();
+			free(chunk);
+			return -1;
+		}
+		if (++chunk_count == FFIND_SPLIT_CHUNK){
+			if (frontier_add(f, cap, d->path, d->path_len, d->depth, chunk, chunk_len, 1) != 0){
+				return -1;
+			}
+			chunk = NULL;
+			chunk_len = 0;
+			chunk_cap = 0;
+			chunk_count = 0;
+		}
+	}
+	if (chunk_count == 0){
+		free(chunk);
+		return 0;
+	}
+	return frontier_add(f, cap, d->path, d->path_len, d->depth, chunk, chunk_len, 1);
+}
+
+int shard_frontier(struct ffind_pool* pool, const char* base_dir, const struct parsed_data* pd, struct ffind_frontier* out){
+	struct shard_walk w;
+	size_t cap = 0;
+	int ret = 0;
+
+	out->dirs = NULL;
+	out->len = 0;
+	out->results = 0;
+
+	if (walk(&w, pool, base_dir, pd, pd->shard_count) != 0){
+		ret = -1;
+		goto cleanup;
+	}
+	for (size_t i = 0; i < w.divided_len; ++i){
+		if (frontier_add_divided(out, &cap, &w, &(w.divided[i]), pd->shard_index) != 0){
+			ret = -1;
+			goto cleanup;
+		}
+	}
+	for (size_t i = 0; i < w.units_len; ++i){
+		const struct shard_unit* u = &(w.units[i]);
+
+		if (u->owner == pd->shard_index && frontier_add(out, &cap, u->path, u->path_len, u->depth, NULL, 0, 0) != 0){
+			ret = -1;
+			goto cleanup;
+		}
+	}
+
+cleanup:
+	walk_free(&w);
+	return ret;
+}
+
+/* Counts the entries in a directory and, levels_left deep, the directories under it.
+ * Directories that cannot be read count as empty. */
+static uint64_t sample_dir(const struct shard_walk* w, const char* path, size_t path_len, int depth, int levels_left, int* failed){
+	struct dirent* dnt;
+	uint64_t n = 0;
+	int descend = levels_left > 1 && walk_descends(w, depth);
+	DIR* dp;
+
+	dp = opendir(path);
+	if (!dp){
+		return 0;
+	}
+	while ((dnt = readdir(dp)) != NULL && !*failed){
+		unsigned char type = DT_UNKNOWN;
+		size_t name_len;
+		size_t sub_len;
+		char* sub;
+
+		if (!strcmp(dnt->d_name, ".") || !strcmp(dnt->d_name, "..")){
+			continue;
+		}
+		n++;
+		if (!descend){
+			continue;
+		}
+#ifdef DT_DIR
+		type = dnt->d_type;
+#endif
+		name_len = strlen(dnt->d_name);
+		sub = path_join(path, path_len, dnt->d_name, name_len, &sub_len);
+		if (!sub){
+			*failed = 1;
+			break;
+		}
+		if (entry_is_dir(sub, type, w->pd->flags.follow_symlink)){
+			n += sample_dir(w, sub, sub_len, depth + 1, levels_left - 1, failed);
+		}
+		free(sub);
+	}
+	closedir(dp);
+	return n;
+}
+
+/* Samples one directory searched whole, run on the pool's threads. */
+static void sample_task(size_t index, size_t thread, void* data){
+	struct shard_walk* w = data;
+	struct shard_unit* u = &(w->units[index]);
+	int failed = 0;
+
+	(void)thread;
+
+	u->sampled = sample_dir(w, u->path, u->path_len, u->depth, SHARD_SAMPLE_DEPTH, &failed);
+	if (failed){
+		__atomic_store_n(&(w->failed), 1, __ATOMIC_RELAXED);
+	}
+}
+
+/* Sorts units by their sampled size, largest first. */
+static int unit_cmp(const void* a, const void* b){
+	const struct shard_unit* x = a;
+	const struct shard_unit* y = b;
+
+	if (x->sampled != y->sampled){
+		return x->sampled > y->sampled ? -1 : 1;
+	}
+	return strcmp(x->path, y->path);
+}
+
+int shard_plan(struct ffind_pool* pool, const char* base_dir, const struct parsed_data* pd, FILE* fp){
+	struct shard_walk w;
+	size_t count = pd->shard_plan;
+	uint64_t* entries = NULL;
+	size_t* units = NULL;
+	uint64_t total = 0;
+	uint64_t largest = 0;
+	int ret = 0;
+
+	if (walk(&w, pool, base_dir, pd, count) != 0){
+		ret = -1;
+		goto cleanup;
+	}
+	ffind_pool_run(pool, w.units_len, sample_task, &w);
+	entries = calloc(count, sizeof(*entries));
+	units = calloc(count, sizeof(*units));
+	if (w.failed || !entries || !units){
+		log_enomem();
+		ret = -1;
+		goto cleanup;
+	}
+
+	/* every entry of a divided directory is a unit of work for the shard it hashes to */
+	for (size_t i = 0; i < w.divided_len; ++i){
+		const struct shard_dir* d = &(w.divided[i]);
+		uint64_t prefix = FNV_OFFSET;
+		const char* name;
+
+		if (d->depth > 0){
+			prefix = hash_update(prefix, d->path + w.root_len, d->path_len - w.root_len);
+			prefix = hash_update(prefix, "/", 1);
+		}
+		for (name = d->names; name < d->names + d->names_len; name += strlen(name + 1) + 2){
+			entries[hash_update(prefix, name + 1, strlen(name + 1)) % count]++;
+		}
+	}
+	for (size_t i = 0; i < w.units_len; ++i){
+		entries[w.units[i].owner] += w.units[i].sampled;
+		units[w.units[i].owner]++;
+	}
+	for (size_t i = 0; i < count; ++i){
+		total += entries[i];
+		if (entries[i] > largest){
+			largest = entries[i];
+		}
+	}
+
+	fprintf(fp, "%s: %zu shards split at depth %d, %zu directories divided entry by entry, %zu subtrees\n",
+			base_dir, count, pd->shard_depth, w.divided_len, w.units_len);
+	fprintf(fp, "shard\tsubtrees\tentries\tshare\n");
+	for (size_t i = 0; i < count; ++i){
+		fprintf(fp, "%zu/%zu\t%zu\t%llu\t%.1f%%\n", i + 1, count, units[i], (unsigned long long)entries[i], total ? 100.0 * entries[i] / total : 0.0);
+	}
+	/* 1.00 is a perfect split; the search takes as long as its largest shard */
+	fprintf(fp, "largest/mean: %.2f\n", total ? (double)largest * count / total : 1.0);
+
+	if (w.units_len > 0){
+		qsort(w.units, w.units_len, sizeof(*(w.units)), unit_cmp);
+		fprintf(fp, "largest subtrees:\n");
+		for (size_t i = 0; i < w.units_len && i < SHARD_PLAN_TOP; ++i){
+			fprintf(fp, "%llu\t%zu/%zu\t%s\n", (unsigned long long)w.units[i].sampled, w.units[i].owner + 1, count, w.units[i].path);
+		}
+	}
+
+cleanup:
+	free(units);
+	free(entries);
+	walk_free(&w);
+	return ret;
+}
@@ -0,0 +1,73 @@
+/** @file shard.h
+ * @brief Dividing a search between processes for --shard and --shard-plan.<br>
+ * Every shard reads the directories above the split depth, and each of their entries belongs to the shard its path hashes to.
+ * A directory at the split depth belongs, along with everything under it, to the shard its path hashes to,
+ * unless it has so many entries that it is divided entry by entry like the directories above it.
+ * Since every shard works this out from the same paths, the shards need no coordination, and together print every entry exactly once.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __SHARD_H
+#define __SHARD_H
+
+#include "ffind.h"
+#include "options.h"
+#include <stdio.h>
+
+/**
+ * @brief The default --shard-depth.
+ */
+#define SHARD_DEFAULT_DEPTH 1
+
+/**
+ * @brief The default --shard-split.
+ */
+#define SHARD_DEFAULT_SPLIT 10000
+
+/**
+ * @brief The number of levels below each subtree that --shard-plan reads to estimate its size.
+ */
+#define SHARD_SAMPLE_DEPTH 2
+
+/**
+ * @brief The number of the largest subtrees --shard-plan lists.
+ */
+#define SHARD_PLAN_TOP 5
+
+/**
+ * @brief Works out what one shard has to search in a base directory.
+ *
+ * @param pool The pool whose threads read the divided directories.
+ *
+ * @param base_dir The base directory.
+ *
+ * @param pd The options. This uses the shard, the split depth and size, -maxdepth, and whether symlinks are followed.
+ *
+ * @param out Filled with the shard's part of the search, to pass to ffind_search_resume().<br>
+ * This must be freed with ffind_frontier_free(), even if this function fails.
+ * @see ffind_frontier_free()
+ *
+ * @return 0 on success, negative on failure.
+ */
+int shard_frontier(struct ffind_pool* pool, const char* base_dir, const struct parsed_data* pd, struct ffind_frontier* out);
+
+/**
+ * @brief Estimates how much of a base directory each of pd->shard_plan shards would search, and prints a table of it.<br>
+ * Each subtree is estimated by the entries in its top SHARD_SAMPLE_DEPTH levels.
+ *
+ * @param pool The pool whose threads read the directories.
+ *
+ * @param base_dir The base directory.
+ *
+ * @param pd The options, like shard_frontier().
+ *
+ * @param fp Where to print the table.
+ *
+ * @return 0 on success, negative on failure.
+ */
+int shard_plan(struct ffind_pool* pool, const char* base_dir, const struct parsed_data* pd, FILE* fp);
+
+#endif
@@ -0,0 +1,201 @@
+/** @file stats.c
+ * @brief Traversal statistics for --stats.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "stats.h"
+#include "log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+uint64_t stats_now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void stats_hist_add(uint64_t* hist, uint64_t value){
+	size_t bucket = 0;
+
+	while (value > 0 && bucket < STATS_HIST_BUCKETS - 1){
+		value >>= 1;
+		bucket++;
+	}
+	hist[bucket]++;
+}
+
+struct stats_set* stats_create(size_t n_threads){
+	struct stats_set* ss;
+
+	ss = malloc(sizeof(*ss));
+	if (!ss){
+		log_enomem();
+		return NULL;
+	}
+	ss->slots = calloc(n_threads, sizeof(*(ss->slots)));
+	if (!ss->slots){
+		log_enomem();
+		free(ss);
+		return NULL;
+	}
+	ss->len = n_threads;
+	ss->wall_ns = 0;
+	ss->scan_start = 0;
+	ss->stop_ns = 0;
+	ss->stops = 0;
+	ss->peak_pending = 0;
+	ss->peak_node_bytes = 0;
+	ss->peak_path_bytes = 0;
+	return ss;
+}
+
+void stats_scan_begin(struct stats_set* ss){
+	if (!ss){
+		return;
+	}
+	ss->scan_start = stats_now();
+}
+
+void stats_scan_end(struct stats_set* ss){
+	if (!ss){
+		return;
+	}
+	ss->wall_ns += stats_now() - ss->scan_start;
+}
+
+void stats_scan_stopped(struct stats_set* ss, uint64_t cancel_time){
+	if (!ss){
+		return;
+	}
+	ss->stop_ns += stats_now() - cancel_time;
+	ss->stops++;
+}
+
+void stats_scan_pending(struct stats_set* ss, uint64_t pending, uint64_t node_bytes, uint64_t path_bytes){
+	if (!ss){
+		return;
+	}
+	if (pending > ss->peak_pending){
+		ss->peak_pending = pending;
+	}
+	if (node_bytes > ss->peak_node_bytes){
+		ss->peak_node_bytes = node_bytes;
+	}
+	if (path_bytes > ss->peak_path_bytes){
+		ss->peak_path_bytes = path_bytes;
+	}
+}
+
+struct ffind_stats* stats_slot(struct stats_set* ss, size_t thread){
+	if (!ss){
+		return NULL;
+	}
+	return &(ss->slots[thread]);
+}
+
+static double ms(uint64_t ns){
+	return ns / 1e6;
+}
+
+static void print_hist(const char* title, const uint64_t* hist){
+	size_t first = STATS_HIST_BUCKETS;
+	size_t last = 0;
+
+	for (size_t i = 0; i < STATS_HIST_BUCKETS; ++i){
+		if (hist[i]){
+			first = i < first ? i : first;
+			last = i;
+		}
+	}
+
+	eprintf_mt("%s\n", title);
+	for (size_t i = first; i <= last; ++i){
+		uint64_t lo = i == 0 ? 0 : (uint64_t)1 << (i - 1);
+		uint64_t hi = (uint64_t)1 << i;
+		eprintf_mt("  [%10llu, %10llu) %llu\n", (unsigned long long)lo, (unsigned long long)hi, (unsigned long long)hist[i]);
+	}
+}
+
+void stats_print(const struct stats_set* ss){
+	struct ffind_stats total;
+	size_t unused = 0;
+
+	if (!ss){
+		return;
+	}
+
+	memset(&total, 0, sizeof(total));
+	for (size_t i = 0; i < ss->len; ++i){
+		const struct ffind_stats* s = &(ss->slots[i]);
+
+		total.dirs_opened += s->dirs_opened;
+		total.entries_read += s->entries_read;
+		total.stat_calls += s->stat_calls;
+		total.matches += s->matches;
+		total.lock_wait_ns += s->lock_wait_ns;
+		total.throttled_ns += s->throttled_ns;
+		for (size_t j = 0; j < STATS_ERRNO_MAX; ++j){
+			total.errors[j] += s->errors[j];
+		}
+		for (size_t j = 0; j < STATS_HIST_BUCKETS; ++j){
+			total.dir_size_hist[j] += s->dir_size_hist[j];
+			total.match_ns_hist[j] += s->match_ns_hist[j];
+		}
+	}
+
+	eprintf_mt("ffind: statistics\n");
+	eprintf_mt("directories opened:   %llu\n", (unsigned long long)total.dirs_opened);
+	eprintf_mt("entries read:         %llu\n", (unsigned long long)total.entries_read);
+	eprintf_mt("stat calls:           %llu\n", (unsigned long long)total.stat_calls);
+	eprintf_mt("matches:              %llu\n", (unsigned long long)total.matches);
+	eprintf_mt("dir_stack lock wait:  %.3f ms\n", ms(total.lock_wait_ns));
+	if (total.throttled_ns){
+		eprintf_mt("throttled:            %.3f ms\n", ms(total.throttled_ns));
+	}
+	if (ss->stops){
+		eprintf_mt("cancel to stop:       %.3f ms\n", ms(ss->stop_ns / ss->stops));
+	}
+	eprintf_mt("pending dirs peak:    %llu (%.1f KiB as nodes, %.1f KiB as full paths)\n", (unsigned long long)ss->peak_pending, ss->peak_node_bytes / 1024.0, ss->peak_path_bytes / 1024.0);
+
+	eprintf_mt("errors:\n");
+	for (size_t i = 0; i < STATS_ERRNO_MAX; ++i){
+		if (total.errors[i]){
+			eprintf_mt("  %-36s %llu\n", strerror(i), (unsigned long long)total.errors[i]);
+		}
+	}
+
+	eprintf_mt("threads (ms):      busy    blocked  lock wait       idle\n");
+	for (size_t i = 0; i < ss->len; ++i){
+		const struct ffind_stats* s = &(ss->slots[i]);
+		uint64_t waiting = s->blocked_ns + s->lock_wait_ns + s->throttled_ns;
+		uint64_t busy = s->active_ns > waiting ? s->active_ns - waiting : 0;
+		uint64_t idle = ss->wall_ns > s->active_ns ? ss->wall_ns - s->active_ns : 0;
+
+		/* threads an adaptive pool never activated */
+		if (!s->active_ns){
+			unused++;
+			continue;
+		}
+		eprintf_mt("  worker %3zu %10.3f %10.3f %10.3f %10.3f\n", i,
+				ms(busy), ms(s->blocked_ns), ms(s->lock_wait_ns), ms(idle));
+	}
+	if (unused){
+		eprintf_mt("  %zu of %zu workers did no work\n", unused, ss->len);
+	}
+
+	print_hist("directory size (entries):", total.dir_size_hist);
+	print_hist("match latency (ns, sampled):", total.match_ns_hist);
+}
+
+void stats_free(struct stats_set* ss){
+	if (!ss){
+		return;
+	}
+	free(ss->slots);
+	free(ss);
+}
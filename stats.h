@@ -0,0 +1,180 @@
+/** @file stats.h
+ * @brief Traversal statistics for --stats.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __STATS_H
+#define __STATS_H
+
+#include "attribute.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Errors with an errno at or above this value are counted together.
+ */
+#define STATS_ERRNO_MAX 160
+
+/**
+ * @brief The number of power-of-two buckets in each histogram.
+ */
+#define STATS_HIST_BUCKETS 32
+
+/**
+ * @brief Only one in this many entries has its stat() and match() calls timed.<br>
+ * Reading the clock around every entry would cost more than the 2% budget for --stats.
+ */
+#define STATS_SAMPLE_INTERVAL 16
+
+/**
+ * @brief Counters for a single thread.<br>
+ * Each thread only writes to its own structure, so no locking or atomics are needed until they are merged at exit.
+ */
+struct ffind_stats{
+	uint64_t dirs_opened;                        /**< Directories successfully opened. */
+	uint64_t entries_read;                       /**< Directory entries read, not counting "." and "..". */
+	uint64_t stat_calls;                         /**< Calls to stat() or lstat(). */
+	uint64_t matches;                            /**< Entries printed. */
+	uint64_t errors[STATS_ERRNO_MAX];            /**< Failed calls, indexed by errno. */
+	uint64_t lock_wait_ns;                       /**< Time spent waiting for the directory stack lock. */
+	uint64_t active_ns;                          /**< Time spent with a directory to work on. */
+	uint64_t blocked_ns;                         /**< Estimated time spent in opendir() and stat() calls. */
+	uint64_t throttled_ns;                       /**< Time spent waiting for --max-iops or --max-dirs-per-sec. */
+	uint64_t dir_size_hist[STATS_HIST_BUCKETS];  /**< Entries per directory, bucketed by power of two. */
+	uint64_t match_ns_hist[STATS_HIST_BUCKETS];  /**< Sampled match() latency in nanoseconds, bucketed by power of two. */
+};
+
+/**
+ * @brief A set of per-thread counters, one for each thread in a worker pool.
+ */
+struct stats_set{
+	struct ffind_stats* slots; /**< One set of counters per thread. */
+	size_t len;                /**< The number of slots. */
+	uint64_t wall_ns;          /**< Wall time of every scan this set was used for. */
+	uint64_t scan_start;       /**< The start of the current scan. */
+	uint64_t stop_ns;          /**< Time from cancelling a scan to its last worker finishing, summed over cancelled scans. */
+	uint64_t stops;            /**< The number of cancelled scans. */
+	uint64_t peak_pending;     /**< The most directories waiting to be searched at once. */
+	uint64_t peak_node_bytes;  /**< The most memory used to store the waiting directories. */
+	uint64_t peak_path_bytes;  /**< The most memory the waiting directories' full paths would have used as separate strings. */
+};
+
+/**
+ * @brief Creates a set of counters.
+ *
+ * @param n_threads The number of threads that will record into the set.
+ *
+ * @return A new set of counters, or NULL on failure.<br>
+ * This must be freed with stats_free() when no longer in use.
+ * @see stats_free()
+ */
+struct stats_set* stats_create(size_t n_threads);
+
+/**
+ * @brief Marks the beginning of a scan.<br>
+ * A set of counters should only be used by one scan at a time.
+ *
+ * @param ss The set of counters.<br>
+ * If this is NULL, nothing happens.
+ */
+void stats_scan_begin(struct stats_set* ss);
+
+/**
+ * @brief Marks the end of a scan.
+ *
+ * @param ss The set of counters.<br>
+ * If this is NULL, nothing happens.
+ */
+void stats_scan_end(struct stats_set* ss);
+
+/**
+ * @brief Records how long a cancelled scan took to stop.
+ *
+ * @param ss The set of counters.<br>
+ * If this is NULL, nothing happens.
+ *
+ * @param cancel_time When the scan was cancelled, as returned by stats_now().
+ */
+void stats_scan_stopped(struct stats_set* ss, uint64_t cancel_time);
+
+/**
+ * @brief Records the peak size of a scan's queue of waiting directories.<br>
+ * Over several scans, the largest of each value is kept.
+ *
+ * @param ss The set of counters.<br>
+ * If this is NULL, nothing happens.
+ *
+ * @param pending The most directories waiting at once.
+ *
+ * @param node_bytes The most memory used to store them.
+ *
+ * @param path_bytes The most memory their full paths would have used.
+ */
+void stats_scan_pending(struct stats_set* ss, uint64_t pending, uint64_t node_bytes, uint64_t path_bytes);
+
+/**
+ * @brief Gets the counters for a thread.
+ *
+ * @param ss The set of counters.
+ *
+ * @param thread The index of the thread within its pool.
+ *
+ * @return The thread's counters, or NULL if ss is NULL.
+ */
+struct ffind_stats* stats_slot(struct stats_set* ss, size_t thread);
+
+/**
+ * @brief Merges every thread's counters and prints a summary to stderr.
+ *
+ * @param ss The set of counters.<br>
+ * If this is NULL, nothing happens.
+ */
+void stats_print(const struct stats_set* ss) FF_COLD;
+
+/**
+ * @brief Releases a set of counters.
+ *
+ * @param ss The set of counters to free.
+ */
+void stats_free(struct stats_set* ss);
+
+/**
+ * @brief Gets the current time in nanoseconds from a monotonic clock.
+ *
+ * @return The current time.
+ */
+uint64_t stats_now(void) FF_HOT;
+
+/**
+ * @brief Adds a value to a power-of-two histogram.
+ *
+ * @param hist The histogram to add to.
+ *
+ * @param value The value to add.
+ */
+void stats_hist_add(uint64_t* hist, uint64_t value) FF_HOT;
+
+/**
+ * @brief Counts a failed call.
+ *
+ * @param stats The calling thread's counters.<br>
+ * If this is NULL, nothing happens.
+ *
+ * @param err The errno of the failure.
+ */
+#define stats_error(stats, err) do { if (stats){ (stats)->errors[(unsigned)(err) < STATS_ERRNO_MAX ? (unsigned)(err) : STATS_ERRNO_MAX - 1]++; } } while (0)
+
+/**
+ * @brief Increments a counter.
+ *
+ * @param stats The calling thread's counters.<br>
+ * If this is NULL, nothing happens.
+ *
+ * @param field The name of the counter to increment.
+ */
+#define stats_inc(stats, field) do { if (stats){ (stats)->field++; } } while (0)
+
+#endif
@@ -0,0 +1,57 @@
+/** @file throttle.c
+ * @brief Rate limits for --max-iops and --max-dirs-per-sec.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+/* syscall() */
+#define _DEFAULT_SOURCE
+
+#include "throttle.h"
+#include "log.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+/* from linux/ioprio.h, which older systems do not have */
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_IDLE  3
+#define IOPRIO_WHO_PROCESS 1
+
+void throttle_init(struct throttle* t, uint64_t per_sec){
+	t->interval_ns = 0;
+	if (per_sec){
+		t->interval_ns = per_sec < 1000000000 ? 1000000000 / per_sec : 1;
+	}
+	t->next = 0;
+}
+
+uint64_t throttle_take(struct throttle* t, uint64_t now){
+	uint64_t next = __atomic_load_n(&(t->next), __ATOMIC_RELAXED);
+	uint64_t start;
+
+	/* the schedule never lags more than THROTTLE_BURST_NS behind now, so slots left unused while nobody was calling are not saved up */
+	do{
+		start = next + THROTTLE_BURST_NS < now ? now - THROTTLE_BURST_NS : next;
+	} while (!__atomic_compare_exchange_n(&(t->next), &next, start + t->interval_ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	return start;
+}
+
+int throttle_idle_io(void){
+#if defined(__linux__) && defined(SYS_ioprio_set)
+	if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0){
+		eprintf_mt("ffind: failed to set the I/O priority (%s)\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+#else
+	eprintf_mt("ffind: Setting the I/O priority is not supported on this system.\n");
+	return -1;
+#endif
+}
@@ -0,0 +1,65 @@
+/** @file throttle.h
+ * @brief Rate limits for --max-iops and --max-dirs-per-sec.<br>
+ * A throttle hands out start times instead of counting tokens: each caller claims the next slot on a shared schedule with a single compare-and-swap and sleeps until it comes up.
+ * The calls are spaced evenly, so the rate stays smooth no matter how many threads share the throttle.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __THROTTLE_H
+#define __THROTTLE_H
+
+#include <stdint.h>
+
+/**
+ * @brief How far a throttle may fall behind its schedule, in nanoseconds.<br>
+ * A thread that oversleeps or pauses to do other work can catch up on this much of its share of the rate, but no more, so the calls never come in bursts longer than this.
+ */
+#define THROTTLE_BURST_NS 10000000ULL
+
+/**
+ * @brief The longest a thread sleeps at once while waiting for its slot, in nanoseconds.<br>
+ * Many threads sharing a slow throttle can be handed slots well in the future, so they wake up this often to check whether to stop.
+ */
+#define THROTTLE_SLICE_NS 50000000ULL
+
+/**
+ * @brief A rate limit shared by several threads.
+ */
+struct throttle{
+	uint64_t interval_ns; /**< The time between calls, or 0 for no limit. */
+	uint64_t next;        /**< When the next slot starts, as returned by stats_now(). */
+};
+
+/**
+ * @brief Initializes a throttle.
+ *
+ * @param t The throttle.
+ *
+ * @param per_sec The most calls per second, or 0 for no limit.
+ */
+void throttle_init(struct throttle* t, uint64_t per_sec);
+
+/**
+ * @brief Claims the next slot of a throttle.<br>
+ * This function is thread-safe and takes no lock.
+ *
+ * @param t The throttle. This must have a limit.
+ *
+ * @param now The current time, as returned by stats_now().
+ *
+ * @return When the slot starts. The caller should not make its call before then.
+ */
+uint64_t throttle_take(struct throttle* t, uint64_t now);
+
+/**
+ * @brief Lowers the I/O priority of the calling thread, and of the threads it creates afterwards, to idle.<br>
+ * Idle I/O is only served when no other process wants the disk. This only has an effect on Linux with an I/O scheduler that supports priorities.
+ *
+ * @return 0 on success, negative on failure.
+ */
+int throttle_idle_io(void);
+
+#endif
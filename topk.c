@@ -0,0 +1,197 @@
+/** @file topk.c
+ * @brief Keeps the best-scoring results in a bounded heap.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "topk.h"
+#include "log.h"
+#include <stdlib.h>
+#include <string.h>
+
+void topk_init(struct topk* t, size_t k){
+	t->entries = NULL;
+	t->len = 0;
+	t->cap = 0;
+	t->k = k;
+}
+
+/* Returns negative if a ranks below b, positive if it ranks above, and 0 if they are the same. */
+static int rank_cmp(int64_t a_score, const char* a_path, size_t a_len, const struct topk_entry* b){
+	if (a_score != b->score){
+		return a_score < b->score ? -1 : 1;
+	}
+	if (a_len != b->path_len){
+		return a_len > b->path_len ? -1 : 1;
+	}
+	return -memcmp(a_path, b->path, a_len);
+}
+
+static int entry_cmp(const struct topk_entry* a, const struct topk_entry* b){
+	return rank_cmp(a->score, a->path, a->path_len, b);
+}
+
+static void entry_swap(struct topk_entry* a, struct topk_entry* b){
+	struct topk_entry tmp = *a;
+	*a = *b;
+	*b = tmp;
+}
+
+/* Restores the heap after the entry at i got worse, moving it toward the root. */
+static void sift_up(struct topk* t, size_t i){
+	while (i > 0){
+		size_t parent = (i - 1) / 2;
+		if (entry_cmp(&(t->entries[i]), &(t->entries[parent])) >= 0){
+			break;
+		}
+		entry_swap(&(t->entries[i]), &(t->entries[parent]));
+		i = parent;
+	}
+}
+
+/* Restores the heap after the entry at i got better, moving it away from the root. */
+static void sift_down(struct topk* t, size_t i){
+	for (;;){
+		size_t worst = i;
+		size_t l = 2 * i + 1;
+		size_t r = l + 1;
+
+		if (l < t->len && entry_cmp(&(t->entries[l]), &(t->entries[worst])) < 0){
+			worst = l;
+		}
+		if (r < t->len && entry_cmp(&(t->entries[r]), &(t->entries[worst])) < 0){
+			worst = r;
+		}
+		if (worst == i){
+			break;
+		}
+		entry_swap(&(t->entries[i]), &(t->entries[worst]));
+		i = worst;
+	}
+}
+
+/* Makes room for one more entry, growing the array up to k entries.
+ * Returns 0 on success, negative on failure. */
+static int topk_reserve(struct topk* t){
+	size_t cap;
+	void* tmp;
+
+	if (t->len < t->cap){
+		return 0;
+	}
+	cap = t->cap ? t->cap * 2 : 16;
+	cap = cap < t->k ? cap : t->k;
+	tmp = realloc(t->entries, cap * sizeof(*(t->entries)));
+	if (!tmp){
+		log_enomem();
+		return -1;
+	}
+	t->entries = tmp;
+	t->cap = cap;
+	return 0;
+}
+
+int topk_offer(struct topk* t, int64_t score, const char* path, size_t path_len, const struct stat* st, int depth){
+	struct topk_entry* e;
+	int grow = t->len < t->k;
+
+	if (t->k == 0){
+		return 0;
+	}
+
+	if (grow){
+		if (topk_reserve(t) != 0){
+			return -1;
+		}
+		e = &(t->entries[t->len]);
+		e->path = malloc(path_len + 1);
+		if (!e->path){
+			log_enomem();
+			return -1;
+		}
+		e->path_cap = path_len + 1;
+	}
+	else{
+		/* the new result has to beat the worst one kept */
+		e = &(t->entries[0]);
+		if (rank_cmp(score, path, path_len, e) <= 0){
+			return 0;
+		}
+		if (e->path_cap < path_len + 1){
+			char* tmp = realloc(e->path, path_len + 1);
+			if (!tmp){
+				log_enomem();
+				return -1;
+			}
+			e->path = tmp;
+			e->path_cap = path_len + 1;
+		}
+	}
+
+	memcpy(e->path, path, path_len);
+	e->path[path_len] = '\0';
+	e->path_len = path_len;
+	e->score = score;
+	e->st = *st;
+	e->depth = depth;
+
+	if (grow){
+		t->len++;
+		sift_up(t, t->len - 1);
+	}
+	else{
+		sift_down(t, 0);
+	}
+	return 0;
+}
+
+int topk_merge(struct topk* dst, struct topk* src){
+	int ret = 0;
+
+	for (size_t i = 0; i < src->len; ++i){
+		struct topk_entry* e = &(src->entries[i]);
+
+		if (dst->len < dst->k){
+			if (topk_reserve(dst) != 0){
+				ret = -1;
+				break;
+			}
+			/* the path moves over instead of being copied */
+			dst->entries[dst->len] = *e;
+			e->path = NULL;
+			dst->len++;
+			sift_up(dst, dst->len - 1);
+		}
+		else if (dst->k > 0 && entry_cmp(e, &(dst->entries[0])) > 0){
+			/* the replaced entry's path is freed with the rest of src */
+			entry_swap(e, &(dst->entries[0]));
+			sift_down(dst, 0);
+		}
+	}
+
+	for (size_t i = 0; i < src->len; ++i){
+		free(src->entries[i].path);
+	}
+	src->len = 0;
+	return ret;
+}
+
+static int sort_cmp(const void* a, const void* b){
+	return entry_cmp(b, a);
+}
+
+void topk_sort(struct topk* t){
+	if (t->len > 1){
+		qsort(t->entries, t->len, sizeof(*(t->entries)), sort_cmp);
+	}
+}
+
+void topk_free(struct topk* t){
+	for (size_t i = 0; i < t->len; ++i){
+		free(t->entries[i].path);
+	}
+	free(t->entries);
+	topk_init(t, t->k);
+}
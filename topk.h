@@ -0,0 +1,98 @@
+/** @file topk.h
+ * @brief Keeps the best-scoring results in a bounded heap.<br>
+ * Each thread can rank into its own heap without locking, and the heaps are merged once the search is finished.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __TOPK_H
+#define __TOPK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/**
+ * @brief A ranked result.
+ */
+struct topk_entry{
+	int64_t score;   /**< The result's score. Higher is better. */
+	char* path;      /**< A copy of the result's path. */
+	size_t path_len; /**< strlen(path) */
+	size_t path_cap; /**< The allocated size of path. */
+	struct stat st;  /**< The result's metadata. */
+	int depth;       /**< The result's depth. */
+};
+
+/**
+ * @brief A heap holding at most k results, with the worst of them at the root.
+ */
+struct topk{
+	struct topk_entry* entries; /**< The heap. */
+	size_t len;                 /**< The number of results in the heap. */
+	size_t cap;                 /**< The allocated size of entries. It grows up to k as results arrive. */
+	size_t k;                   /**< The most results the heap holds. */
+};
+
+/**
+ * @brief Initializes an empty heap.
+ *
+ * @param t The heap to initialize.<br>
+ * This must be freed with topk_free() when no longer in use.
+ * @see topk_free()
+ *
+ * @param k The most results to keep.
+ */
+void topk_init(struct topk* t, size_t k);
+
+/**
+ * @brief Offers a result to a heap.<br>
+ * If the heap is full, the result replaces the worst one if it is better, and is dropped otherwise without allocating anything.<br>
+ * Ties are broken in favor of the shorter path, then the path that sorts first.
+ *
+ * @param t The heap.
+ *
+ * @param score The result's score.
+ *
+ * @param path The result's path.
+ *
+ * @param path_len strlen(path)
+ *
+ * @param st The result's metadata.
+ *
+ * @param depth The result's depth.
+ *
+ * @return 0 on success, negative if memory could not be allocated.
+ */
+int topk_offer(struct topk* t, int64_t score, const char* path, size_t path_len, const struct stat* st, int depth);
+
+/**
+ * @brief Moves every result in one heap into another, keeping only the best k.
+ *
+ * @param dst The heap to merge into.
+ *
+ * @param src The heap to merge from.<br>
+ * This is left empty.
+ *
+ * @return 0 on success, negative if memory could not be allocated.
+ */
+int topk_merge(struct topk* dst, struct topk* src);
+
+/**
+ * @brief Sorts a heap's results from best to worst.<br>
+ * Afterwards, t->entries is no longer a heap, so nothing more can be offered or merged into it.
+ *
+ * @param t The heap.
+ */
+void topk_sort(struct topk* t);
+
+/**
+ * @brief Releases the memory held by a heap.
+ *
+ * @param t The heap to free.
+ */
+void topk_free(struct topk* t);
+
+#endif
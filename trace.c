@@ -0,0 +1,131 @@
+/** @file trace.c
+ * @brief Per-thread event tracing for --trace.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "trace.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+static pthread_mutex_t mutex_trace = PTHREAD_MUTEX_INITIALIZER;
+
+static int trace_on = 0;
+static uint64_t trace_epoch = 0;
+static struct trace_buf* trace_bufs = NULL;
+static int trace_next_tid = 1;
+
+static const char* const trace_names[] = {
+	"opendir",
+	"readdir",
+	"stat",
+	"match",
+	"push",
+	"pop",
+	"output",
+	"chunk"
+};
+
+void trace_init(void){
+	trace_on = 1;
+	trace_epoch = stats_now();
+}
+
+struct trace_buf* trace_thread(const char* name){
+	struct trace_buf* tb;
+
+	if (!trace_on){
+		return NULL;
+	}
+
+	tb = malloc(sizeof(*tb));
+	if (!tb){
+		log_enomem();
+		return NULL;
+	}
+	tb->records = malloc(TRACE_BUF_LEN * sizeof(*(tb->records)));
+	if (!tb->records){
+		log_enomem();
+		free(tb);
+		return NULL;
+	}
+	tb->head = 0;
+	tb->name = name;
+
+	/* only registration takes the lock; recording never does */
+	pthread_mutex_lock(&mutex_trace);
+	tb->tid = trace_next_tid++;
+	tb->next = trace_bufs;
+	trace_bufs = tb;
+	pthread_mutex_unlock(&mutex_trace);
+
+	return tb;
+}
+
+void trace_record(struct trace_buf* tb, enum trace_event type, uint64_t start, uint64_t arg){
+	struct trace_record* r = &(tb->records[tb->head & (TRACE_BUF_LEN - 1)]);
+
+	r->start = start;
+	r->dur = stats_now() - start;
+	r->arg = arg;
+	r->type = type;
+	tb->head++;
+}
+
+int trace_write(const char* path){
+	FILE* fp;
+	const char* sep = "";
+	int ret = 0;
+
+	fp = fopen(path, "w");
+	if (!fp){
+		log_eopen(path);
+		return -1;
+	}
+
+	fprintf(fp, "{\"traceEvents\":[\n");
+	for (const struct trace_buf* tb = trace_bufs; tb; tb = tb->next){
+		uint64_t first = tb->head > TRACE_BUF_LEN ? tb->head - TRACE_BUF_LEN : 0;
+
+		fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+				sep, tb->tid, tb->name, tb->tid);
+		sep = ",\n";
+
+		for (uint64_t i = first; i < tb->head; ++i){
+			const struct trace_record* r = &(tb->records[i & (TRACE_BUF_LEN - 1)]);
+			uint64_t start = r->start > trace_epoch ? r->start - trace_epoch : 0;
+
+			fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"n\":%llu}}",
+					trace_names[r->type], tb->tid, start / 1e3, r->dur / 1e3, (unsigned long long)r->arg);
+		}
+	}
+	fprintf(fp, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+	if (ferror(fp)){
+		log_ewrite(path);
+		ret = -1;
+	}
+	if (fclose(fp) != 0){
+		ret = -1;
+	}
+	return ret;
+}
+
+void trace_free(void){
+	struct trace_buf* tb = trace_bufs;
+
+	while (tb){
+		struct trace_buf* next = tb->next;
+		free(tb->records);
+		free(tb);
+		tb = next;
+	}
+	trace_bufs = NULL;
+	trace_on = 0;
+}
@@ -0,0 +1,124 @@
+/** @file trace.h
+ * @brief Per-thread event tracing for --trace.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include "attribute.h"
+#include "stats.h"
+#include <stdint.h>
+
+/**
+ * @brief The number of events each thread keeps.<br>
+ * This must be a power of 2. Once a thread's buffer is full, its oldest events are overwritten.
+ */
+#define TRACE_BUF_LEN (1 << 16)
+
+/**
+ * @brief The kinds of spans that can be traced.
+ */
+enum trace_event{
+	TRACE_OPENDIR = 0, /**< opendir() */
+	TRACE_READDIR,     /**< Reading and processing a whole directory. */
+	TRACE_STAT,        /**< stat() or lstat() */
+	TRACE_MATCH,       /**< match() and, if enabled, the content search. */
+	TRACE_PUSH,        /**< Pushing a directory on to the shared stack. */
+	TRACE_POP,         /**< Popping a directory off the shared stack. */
+	TRACE_OUTPUT,      /**< Writing a match to stdout. */
+	TRACE_CHUNK        /**< Processing a chunk of a large directory's entries read by another thread. */
+};
+
+/**
+ * @brief A single traced span.
+ */
+struct trace_record{
+	uint64_t start; /**< The start of the span in nanoseconds. */
+	uint64_t dur;   /**< The length of the span in nanoseconds. */
+	uint64_t arg;   /**< An event-specific value, such as the number of entries in a directory. */
+	uint32_t type;  /**< The enum trace_event of this span. */
+};
+
+/**
+ * @brief A ring buffer of spans that is only written by the thread that owns it.
+ */
+struct trace_buf{
+	struct trace_record* records; /**< TRACE_BUF_LEN records. */
+	uint64_t head;                /**< The total number of records written. */
+	const char* name;             /**< The name of the owning thread. */
+	int tid;                      /**< A unique id for the owning thread. */
+	struct trace_buf* next;       /**< The next buffer in the global list. */
+};
+
+/**
+ * @brief Enables tracing.<br>
+ * Until this is called, trace_thread() returns NULL and nothing is recorded.
+ */
+void trace_init(void);
+
+/**
+ * @brief Creates a trace buffer for the calling thread.<br>
+ * This function is thread-safe.
+ *
+ * @param name The name the thread will be shown with.
+ *
+ * @return A trace buffer, or NULL if tracing is disabled or memory could not be allocated.
+ */
+struct trace_buf* trace_thread(const char* name);
+
+/**
+ * @brief Appends a span to a trace buffer.
+ *
+ * @param tb The calling thread's trace buffer.
+ *
+ * @param type The kind of span.
+ *
+ * @param start The start of the span, as returned by trace_begin().<br>
+ * The span ends now.
+ *
+ * @param arg An event-specific value.
+ */
+void trace_record(struct trace_buf* tb, enum trace_event type, uint64_t start, uint64_t arg) FF_HOT;
+
+/**
+ * @brief Writes every thread's spans to a file in Chrome trace event JSON format.<br>
+ * All traced threads must have finished before this is called.
+ *
+ * @param path The file to write.
+ *
+ * @return 0 on success, negative on failure.
+ */
+int trace_write(const char* path);
+
+/**
+ * @brief Releases every trace buffer.
+ */
+void trace_free(void);
+
+/**
+ * @brief Starts a span.
+ *
+ * @param tb The calling thread's trace buffer, or NULL if tracing is disabled.
+ *
+ * @return The start time to pass to trace_end().
+ */
+#define trace_begin(tb) (FF_UNLIKELY((tb) != NULL) ? stats_now() : 0)
+
+/**
+ * @brief Ends a span started with trace_begin().
+ *
+ * @param tb The calling thread's trace buffer, or NULL if tracing is disabled.
+ *
+ * @param type The kind of span.
+ *
+ * @param start The value returned by trace_begin().
+ *
+ * @param arg An event-specific value.
+ */
+#define trace_end(tb, type, start, arg) do { if (FF_UNLIKELY((tb) != NULL)){ trace_record(tb, type, start, arg); } } while (0)
+
+#endif
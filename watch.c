@@ -0,0 +1,522 @@
+/** @file watch.c
+ * @brief Following changes to the searched directories for --watch.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+/* d_type constants */
+#define _DEFAULT_SOURCE
+
+#include "watch.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+/* How often watch_wait() checks whether a search of changes failed, in nanoseconds. */
+#define WATCH_POLL_NS 200000000
+
+int watch_block_signals(void){
+	sigset_t set;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	if ((errno = pthread_sigmask(SIG_BLOCK, &set, NULL)) != 0){
+		eprintf_mt("ffind: failed to block SIGINT and SIGTERM (%s)\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+int watch_wait(struct watch* w){
+	struct timespec ts;
+	sigset_t set;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	ts.tv_sec = 0;
+	ts.tv_nsec = WATCH_POLL_NS;
+
+	while (!__atomic_load_n(&(w->failed), __ATOMIC_RELAXED)){
+		int sig = sigtimedwait(&set, NULL, &ts);
+		if (sig > 0){
+			return sig;
+		}
+	}
+	return -1;
+}
+
+#ifdef __linux__
+
+/* The events that can make an entry new or changed, and the ones that tell a watched directory moved. */
+#define WATCH_MASK (IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_ONLYDIR)
+
+/* The entries of one watched directory that changed, gathered from a buffer of events.
+ * p.names is packed like a chunk of a large directory, so the whole lot can be searched as a frontier. */
+struct change{
+	int wd;
+	size_t base;
+	struct ffind_pending p;
+	size_t names_cap;
+};
+
+struct changes{
+	struct change* list;
+	size_t len;
+	size_t cap;
+};
+
+/* Finds the change for a watch descriptor, creating it with a copy of the directory's path if there is none yet.
+ * Events for the same directory tend to come together, so the search starts from the last one.
+ * Returns the change, or NULL if memory ran out. */
+static struct change* changes_get(struct changes* ch, int wd, const struct watch_dir* d){
+	struct change* c;
+
+	for (size_t i = ch->len; i > 0; --i){
+		if (ch->list[i - 1].wd == wd){
+			return &(ch->list[i - 1]);
+		}
+	}
+
+	if (ch->len == ch->cap){
+		size_t cap = ch->cap ? ch->cap * 2 : 16;
+		struct change* tmp = realloc(ch->list, cap * sizeof(*tmp));
+		if (!tmp){
+			return NULL;
+		}
+		ch->list = tmp;
+		ch->cap = cap;
+	}
+	c = &(ch->list[ch->len]);
+	memset(c, 0, sizeof(*c));
+	c->p.path = malloc(d->path_len + 1);
+	if (!c->p.path){
+		return NULL;
+	}
+	memcpy(c->p.path, d->path, d->path_len + 1);
+	c->p.path_len = d->path_len;
+	c->p.depth = d->depth;
+	c->wd = wd;
+	c->base = d->base;
+	ch->len++;
+	return c;
+}
+
+/* Adds a changed entry to its directory's change, unless it is already there.
+ * Returns 0 on success, negative if memory ran out. */
+static int change_add(struct change* c, const char* name, unsigned char type){
+	size_t name_len = strlen(name);
+	const char* pos;
+
+	for (pos = c->p.names; pos && pos < c->p.names + c->p.names_len; pos += strlen(pos + 1) + 2){
+		if (!strcmp(pos + 1, name)){
+			return 0;
+		}
+	}
+
+	if (c->p.names_len + name_len + 2 > c->names_cap){
+		size_t cap = c->names_cap ? c->names_cap : 256;
+		char* tmp;
+		while (cap < c->p.names_len + name_len + 2){
+			cap *= 2;
+		}
+		tmp = realloc(c->p.names, cap);
+		if (!tmp){
+			return -1;
+		}
+		c->p.names = tmp;
+		c->names_cap = cap;
+	}
+	c->p.names[c->p.names_len] = type;
+	memcpy(c->p.names + c->p.names_len + 1, name, name_len + 1);
+	c->p.names_len += name_len + 2;
+	return 0;
+}
+
+/* Checks whether a regular file that was just created should wait for IN_CLOSE_WRITE.
+ * A new hard link gets no IN_CLOSE_WRITE, so it is reported when it is created. */
+static int wait_for_close(const struct change* c, const char* name){
+	int slash = !(c->p.path_len > 0 && c->p.path[c->p.path_len - 1] == '/');
+	char* path = malloc(c->p.path_len + slash + strlen(name) + 1);
+	struct stat st;
+	int ret = 0;
+
+	if (!path){
+		return 0;
+	}
+	memcpy(path, c->p.path, c->p.path_len);
+	path[c->p.path_len] = '/';
+	strcpy(path + c->p.path_len + slash, name);
+	if (lstat(path, &st) == 0 && S_ISREG(st.st_mode) && st.st_nlink < 2){
+		ret = 1;
+	}
+	free(path);
+	return ret;
+}
+
+/* Turns an event into a changed entry.
+ * Returns 0 on success, negative if memory ran out. */
+static int handle_event(struct watch_instance* wi, const struct inotify_event* ev, struct changes* ch){
+	struct watch_dir* d;
+	struct change* c;
+	unsigned char type;
+
+	if (ev->mask & IN_Q_OVERFLOW){
+		eprintf_mt("ffind: Too many changes arrived at once, so some of them were missed.\n");
+		return 0;
+	}
+
+	pthread_mutex_lock(&(wi->mutex));
+	d = ev->wd >= 0 && (size_t)ev->wd < wi->dirs_len ? &(wi->dirs[ev->wd]) : NULL;
+	if (!d || !d->path){
+		pthread_mutex_unlock(&(wi->mutex));
+		return 0;
+	}
+	if (ev->mask & IN_IGNORED){
+		free(d->path);
+		d->path = NULL;
+		pthread_mutex_unlock(&(wi->mutex));
+		return 0;
+	}
+	if (ev->mask & IN_MOVE_SELF){
+		struct stat st;
+
+		/* a directory moved within the tree is watched again at its new path as soon as it is searched there, which finds the same watch and updates its path.
+		 * otherwise the path is stale, and the watch would report entries somewhere they are not */
+		if (stat(d->path, &st) != 0 || st.st_dev != d->dev || st.st_ino != d->ino){
+			inotify_rm_watch(wi->fd, ev->wd);
+		}
+		pthread_mutex_unlock(&(wi->mutex));
+		return 0;
+	}
+	if (ev->len == 0 || !(ev->mask & (IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE))){
+		pthread_mutex_unlock(&(wi->mutex));
+		return 0;
+	}
+	c = changes_get(ch, ev->wd, d);
+	pthread_mutex_unlock(&(wi->mutex));
+	if (!c){
+		return -1;
+	}
+
+	/* a new subdirectory's chunk is searched like any other, so it is descended into and watched */
+	if (ev->mask & IN_ISDIR){
+		type = DT_DIR;
+	}
+	else if (ev->mask & IN_CLOSE_WRITE){
+		type = DT_REG;
+	}
+	else if ((ev->mask & IN_CREATE) && wait_for_close(c, ev->name)){
+		return 0;
+	}
+	else{
+		type = DT_UNKNOWN;
+	}
+	return change_add(c, ev->name, type);
+}
+
+/* Searches the changed entries, once for each base directory they are under, and frees them.
+ * Returns 0 on success, negative on failure. */
+static int changes_search(struct watch* w, struct changes* ch){
+	struct ffind_pending* dirs;
+	int ret = 0;
+
+	if (ch->len == 0){
+		return 0;
+	}
+	dirs = malloc(ch->len * sizeof(*dirs));
+	if (!dirs){
+		log_enomem();
+		ret = -1;
+	}
+
+	for (size_t i = 0; i < ch->len && ret == 0; ++i){
+		size_t base = ch->list[i].base;
+		struct ffind_frontier f;
+		struct ffind_search* search;
+
+		/* a change with no names left is one whose base directory was already searched */
+		if (!ch->list[i].p.names){
+			continue;
+		}
+		f.dirs = dirs;
+		f.len = 0;
+		f.results = 0;
+		for (size_t j = i; j < ch->len; ++j){
+			if (ch->list[j].base == base && ch->list[j].p.names){
+				dirs[f.len++] = ch->list[j].p;
+			}
+		}
+
+		search = ffind_search_resume(w->pool, w->pd->directories[base], w->pd, NULL, w->cb, w->data[base], &f);
+		if (!search){
+			ret = -1;
+			break;
+		}
+		if (ffind_search_wait(search) < 0){
+			ret = -1;
+		}
+		ffind_search_free(search);
+
+		for (size_t j = i; j < ch->len; ++j){
+			if (ch->list[j].base == base){
+				free(ch->list[j].p.names);
+				ch->list[j].p.names = NULL;
+			}
+		}
+	}
+	/* whoever is reading wants each change as soon as it happens */
+	fflush(stdout);
+
+	for (size_t i = 0; i < ch->len; ++i){
+		free(ch->list[i].p.path);
+		free(ch->list[i].p.names);
+	}
+	ch->len = 0;
+	free(dirs);
+	return ret;
+}
+
+/* Reads events from one inotify instance and searches what they changed, until the stop pipe is written to. */
+static void* watch_thread(void* param){
+	struct watch_instance* wi = param;
+	struct watch* w = wi->w;
+	struct changes ch;
+	struct pollfd fds[2];
+	/* malloc() aligns the buffer for the events in it */
+	char* buf = malloc(WATCH_BUF_SIZE);
+
+	memset(&ch, 0, sizeof(ch));
+	fds[0].fd = wi->fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = w->stop_pipe[0];
+	fds[1].events = POLLIN;
+	if (!buf){
+		log_enomem();
+		__atomic_store_n(&(w->failed), 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	for (;;){
+		const char* pos;
+		ssize_t len;
+
+		if (poll(fds, 2, -1) < 0){
+			if (errno == EINTR){
+				continue;
+			}
+			eprintf_mt("ffind: failed to wait for changes (%s)\n", strerror(errno));
+			break;
+		}
+		if (fds[1].revents){
+			break;
+		}
+		len = read(wi->fd, buf, WATCH_BUF_SIZE);
+		if (len < 0){
+			if (errno == EINTR || errno == EAGAIN){
+				continue;
+			}
+			eprintf_mt("ffind: failed to read changes (%s)\n", strerror(errno));
+			break;
+		}
+
+		for (pos = buf; pos < buf + len; ){
+			const struct inotify_event* ev = (const struct inotify_event*)pos;
+
+			pos += sizeof(*ev) + ev->len;
+			if (handle_event(wi, ev, &ch) != 0){
+				log_enomem();
+				break;
+			}
+		}
+		if (changes_search(w, &ch) != 0){
+			break;
+		}
+	}
+
+	/* the loop only ends early on failure */
+	if (!fds[1].revents){
+		__atomic_store_n(&(w->failed), 1, __ATOMIC_RELAXED);
+	}
+	for (size_t i = 0; i < ch.len; ++i){
+		free(ch.list[i].p.path);
+		free(ch.list[i].p.names);
+	}
+	free(ch.list);
+	free(buf);
+	return NULL;
+}
+
+void watch_add(struct watch* w, const char* path, size_t path_len, int depth, size_t base){
+	struct watch_instance* wi;
+	struct watch_dir* d;
+	struct stat st;
+	int wd;
+
+	/* if the directory is gone, the search reports it when it fails to open it */
+	if (stat(path, &st) != 0){
+		return;
+	}
+	/* the same directory always goes to the same instance, so watching it again finds the watch it already has */
+	wi = &(w->instances[st.st_ino % w->n_instances]);
+
+	pthread_mutex_lock(&(wi->mutex));
+	wd = inotify_add_watch(wi->fd, path, WATCH_MASK);
+	if (wd < 0){
+		if (errno == ENOSPC && !__atomic_exchange_n(&(w->full), 1, __ATOMIC_RELAXED)){
+			eprintf_mt("ffind: Reached the limit on inotify watches (fs.inotify.max_user_watches), so changes in some directories will be missed.\n");
+		}
+		pthread_mutex_unlock(&(wi->mutex));
+		return;
+	}
+	if ((size_t)wd >= wi->dirs_len){
+		size_t len = wi->dirs_len ? wi->dirs_len : 256;
+		struct watch_dir* tmp;
+		while (len <= (size_t)wd){
+			len *= 2;
+		}
+		tmp = realloc(wi->dirs, len * sizeof(*tmp));
+		if (!tmp){
+			log_enomem();
+			inotify_rm_watch(wi->fd, wd);
+			pthread_mutex_unlock(&(wi->mutex));
+			return;
+		}
+		memset(tmp + wi->dirs_len, 0, (len - wi->dirs_len) * sizeof(*tmp));
+		wi->dirs = tmp;
+		wi->dirs_len = len;
+	}
+
+	d = &(wi->dirs[wd]);
+	free(d->path);
+	d->path = malloc(path_len + 1);
+	if (!d->path){
+		log_enomem();
+		inotify_rm_watch(wi->fd, wd);
+		pthread_mutex_unlock(&(wi->mutex));
+		return;
+	}
+	memcpy(d->path, path, path_len + 1);
+	d->path_len = path_len;
+	d->depth = depth;
+	d->base = base;
+	d->dev = st.st_dev;
+	d->ino = st.st_ino;
+	pthread_mutex_unlock(&(wi->mutex));
+}
+
+/* Closes the first n_fds instances and joins the first n_threads threads. */
+static void watch_free(struct watch* w, size_t n_fds, size_t n_threads){
+	char c = 0;
+
+	if (n_threads > 0 && write(w->stop_pipe[1], &c, 1) != 1){
+		eprintf_mt("ffind: failed to stop watching (%s)\n", strerror(errno));
+	}
+	for (size_t i = 0; i < n_threads; ++i){
+		if ((errno = pthread_join(w->instances[i].thread, NULL)) != 0){
+			log_ejoin();
+		}
+	}
+	for (size_t i = 0; i < n_fds; ++i){
+		struct watch_instance* wi = &(w->instances[i]);
+
+		close(wi->fd);
+		for (size_t j = 0; j < wi->dirs_len; ++j){
+			free(wi->dirs[j].path);
+		}
+		free(wi->dirs);
+		pthread_mutex_destroy(&(wi->mutex));
+	}
+	free(w->instances);
+	close(w->stop_pipe[0]);
+	close(w->stop_pipe[1]);
+}
+
+int watch_start(struct watch* w, struct ffind_pool* pool, const struct parsed_data* pd, ffind_callback cb, void* const* data){
+	size_t n_fds;
+	size_t n_threads;
+
+	w->pool = pool;
+	w->pd = pd;
+	w->cb = cb;
+	w->data = data;
+	w->n_instances = ffind_pool_threads(pool) < WATCH_MAX_INSTANCES ? ffind_pool_threads(pool) : WATCH_MAX_INSTANCES;
+	w->full = 0;
+	w->failed = 0;
+
+	if (pipe(w->stop_pipe) != 0){
+		eprintf_mt("ffind: failed to create a pipe (%s)\n", strerror(errno));
+		return -1;
+	}
+	w->instances = calloc(w->n_instances, sizeof(*(w->instances)));
+	if (!w->instances){
+		log_enomem();
+		watch_free(w, 0, 0);
+		return -1;
+	}
+
+	for (n_fds = 0; n_fds < w->n_instances; ++n_fds){
+		struct watch_instance* wi = &(w->instances[n_fds]);
+
+		wi->w = w;
+		wi->fd = inotify_init1(IN_CLOEXEC);
+		if (wi->fd < 0){
+			eprintf_mt("ffind: failed to start watching for changes (%s)\n", strerror(errno));
+			watch_free(w, n_fds, 0);
+			return -1;
+		}
+		pthread_mutex_init(&(wi->mutex), NULL);
+	}
+	for (n_threads = 0; n_threads < w->n_instances; ++n_threads){
+		if ((errno = pthread_create(&(w->instances[n_threads].thread), NULL, watch_thread, &(w->instances[n_threads]))) != 0){
+			log_ethread();
+			watch_free(w, n_fds, n_threads);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void watch_stop(struct watch* w){
+	watch_free(w, w->n_instances, w->n_instances);
+}
+
+#else
+
+int watch_start(struct watch* w, struct ffind_pool* pool, const struct parsed_data* pd, ffind_callback cb, void* const* data){
+	(void)w;
+	(void)pool;
+	(void)pd;
+	(void)cb;
+	(void)data;
+	eprintf_mt("ffind: --watch is only supported on Linux.\n");
+	return -1;
+}
+
+void watch_add(struct watch* w, const char* path, size_t path_len, int depth, size_t base){
+	(void)w;
+	(void)path;
+	(void)path_len;
+	(void)depth;
+	(void)base;
+}
+
+void watch_stop(struct watch* w){
+	(void)w;
+}
+
+#endif
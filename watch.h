@@ -0,0 +1,131 @@
+/** @file watch.h
+ * @brief Following changes to the searched directories for --watch.<br>
+ * Every directory gets an inotify watch right before the search reads it, so anything created after the read is reported by the watch, and nothing falls between the two.
+ * The watches are spread over several inotify instances by inode, each with a thread that turns the events it reads into a small search of just the changed entries.
+ * New subdirectories are searched, and watched, like any other directory.
+ * @copyright Copyright (c) 2018 Jonathan Lemos
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef __WATCH_H
+#define __WATCH_H
+
+#include "ffind.h"
+#include "options.h"
+#include <pthread.h>
+#include <sys/types.h>
+
+/**
+ * @brief The most inotify instances a watch uses.<br>
+ * Each instance has its own thread, but the kernel limits how many instances a user can have, so this stays small.
+ */
+#define WATCH_MAX_INSTANCES 4
+
+/**
+ * @brief The size of the buffer each thread reads events into.
+ */
+#define WATCH_BUF_SIZE 65536
+
+/**
+ * @brief A watched directory.
+ */
+struct watch_dir{
+	char* path;      /**< The directory's path, or NULL for a slot that is not in use. */
+	size_t path_len; /**< strlen(path) */
+	int depth;       /**< The depth of the directory. */
+	size_t base;     /**< The index of the base directory it is under. */
+	dev_t dev;       /**< The directory's device, to tell whether its path still leads to it. */
+	ino_t ino;       /**< The directory's inode. */
+};
+
+/**
+ * @brief An inotify instance and the thread reading it.
+ */
+struct watch_instance{
+	struct watch* w;         /**< The watch it belongs to. */
+	int fd;                  /**< The inotify instance. */
+	pthread_mutex_t mutex;   /**< Protects dirs. */
+	struct watch_dir* dirs;  /**< The watched directories, indexed by watch descriptor. */
+	size_t dirs_len;         /**< The length of dirs. */
+	pthread_t thread;        /**< The thread reading the instance. */
+};
+
+/**
+ * @brief Watches on every directory searched.
+ */
+struct watch{
+	struct ffind_pool* pool;            /**< The pool that searches the changes. */
+	const struct parsed_data* pd;       /**< The options. */
+	ffind_callback cb;                  /**< Receives the changed entries that match. */
+	void* const* data;                  /**< The data passed to cb for each base directory. */
+	struct watch_instance* instances;   /**< The inotify instances. */
+	size_t n_instances;                 /**< The number of inotify instances. */
+	int stop_pipe[2];                   /**< Written to to stop the threads. */
+	int full;                           /**< Set once the watch limit is reached, so it is only reported once. */
+	int failed;                         /**< Set if a search of changes failed. */
+};
+
+/**
+ * @brief Blocks SIGINT and SIGTERM in the calling thread, so that it and every thread it creates afterwards leave them to watch_wait().<br>
+ * This must be called before the pool is created.
+ *
+ * @return 0 on success, negative on failure.
+ */
+int watch_block_signals(void);
+
+/**
+ * @brief Starts watching for changes.<br>
+ * Nothing is watched until watch_add() is called, which should be set up as the pool's directory hook before the first search.
+ *
+ * @param w The watch.<br>
+ * This must be stopped with watch_stop().
+ * @see watch_stop()
+ *
+ * @param pool The pool to search changes on.
+ *
+ * @param pd The options.
+ *
+ * @param cb Receives the changed entries that match.
+ *
+ * @param data The data passed to cb for each of pd->directories.
+ *
+ * @return 0 on success, negative on failure.
+ */
+int watch_start(struct watch* w, struct ffind_pool* pool, const struct parsed_data* pd, ffind_callback cb, void* const* data);
+
+/**
+ * @brief Watches a directory.<br>
+ * Directories that cannot be watched are skipped; reaching the system's limit on watches is reported once.<br>
+ * This function is thread-safe.
+ *
+ * @param w The watch.
+ *
+ * @param path The directory.
+ *
+ * @param path_len strlen(path)
+ *
+ * @param depth The depth of the directory.
+ *
+ * @param base The index of the base directory it is under.
+ */
+void watch_add(struct watch* w, const char* path, size_t path_len, int depth, size_t base);
+
+/**
+ * @brief Waits until SIGINT or SIGTERM arrives, or searching a change fails.
+ *
+ * @param w The watch.
+ *
+ * @return The signal, or negative on failure.
+ */
+int watch_wait(struct watch* w);
+
+/**
+ * @brief Stops watching and waits for the threads to exit.
+ *
+ * @param w The watch.
+ */
+void watch_stop(struct watch* w);
+
+#endif